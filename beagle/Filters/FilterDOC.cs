@@ -38,6 +38,13 @@ namespace Beagle.Filters {
     
 	public class FilterDOC : FilterOle {
 
+		// Budget for the extractor, which stops cleanly and
+		// hands over what it has got by then.  The time is
+		// kept below the CPU limit, at which it would be
+		// killed instead.
+		private const int MAX_TEXT_BYTES = 10*1024*1024;
+		private const int MAX_SECONDS = 60;
+
 		//////////////////////////////////////////////////////////
 
 		public FilterDOC () 
@@ -98,7 +105,10 @@ namespace Beagle.Filters {
 				exe = "beagle-doc-extractor";
 
 			pc = new SafeProcess ();
-			pc.Arguments = new string [] { exe, FileInfo.FullName };
+			pc.Arguments = new string [] { exe,
+						       "--max-bytes", MAX_TEXT_BYTES.ToString (),
+						       "--max-seconds", MAX_SECONDS.ToString (),
+						       FileInfo.FullName };
 			pc.RedirectStandardOutput = true;
 			pc.RedirectStandardError = true;
 			pc.UseLangC = true;
@@ -138,6 +148,8 @@ namespace Beagle.Filters {
 
 			if (line.StartsWith ("**BREAK**"))
 				AppendStructuralBreak ();
+			else if (line.StartsWith ("**STATS**"))
+				LogStats (line.Substring (9));
 			else if (line.StartsWith ("**HOT**")) {
 				string l = line.Substring (7);
 				AppendText (l, l);
@@ -145,6 +157,21 @@ namespace Beagle.Filters {
 				AppendText (line);
 		}
 
+		// Text bytes, hot bytes, flushes, structural breaks,
+		// milliseconds and whether the budget was hit.  The
+		// extractor warns about the latter itself.
+		private void LogStats (string stats)
+		{
+			string[] fields = stats.Trim ().Split (' ');
+
+			if (fields.Length != 6)
+				return;
+
+			Log.Debug ("doc extractor [{0}]: {1} bytes ({2} hot) in {3} flushes, {4} breaks, {5} ms{6}",
+				   Indexable.Uri, fields [0], fields [1], fields [2], fields [3], fields [4],
+				   fields [5] == "1" ? ", stopped at the budget" : "");
+		}
+
 		override protected void DoClose ()
 		{
 			base.DoClose ();
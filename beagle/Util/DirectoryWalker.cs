@@ -47,9 +47,72 @@ namespace Beagle.Util {
 
 		[DllImport ("libbeagleglue", EntryPoint = "beagled_utils_readdir", SetLastError = true)]
 		private static extern int sys_readdir (IntPtr dir, [Out] byte[] buf, int max_len);
-		
+
+		[DllImport ("libbeagleglue", EntryPoint = "beagled_utils_open_dir", SetLastError = true)]
+		private static extern int sys_open_dir ([MarshalAs (UnmanagedType.CustomMarshaler, MarshalTypeRef=typeof(Mono.Unix.Native.FileNameMarshaler))] string name);
+
+		[DllImport ("libbeagleglue", EntryPoint = "beagled_utils_read_entries", SetLastError = true)]
+		private static extern int sys_read_entries (int fd, [Out] byte[] buf, int buf_len, int flags);
+
+		// Flags for sys_read_entries, see beagled-utils.c
+		private const int STAT_FILES = 1;
+		private const int STAT_ALL = 2;
+
+		// Offsets into the entries filled in by sys_read_entries
+		private const int ENTRY_INODE_OFFSET = 0;
+		private const int ENTRY_MTIME_OFFSET = 8;
+		private const int ENTRY_CTIME_OFFSET = 16;
+		private const int ENTRY_SIZE_OFFSET = 24;
+		private const int ENTRY_RECLEN_OFFSET = 32;
+		private const int ENTRY_TYPE_OFFSET = 34;
+		private const int ENTRY_NAME_OFFSET = 36;
+
+		// How much of a directory we read per call in batches
+		private const int BATCH_BUFFER_SIZE = 32768;
+
+		// Whether the glue can enumerate directories in batches.  If
+		// not, we fall back to readdir, one entry per call.
+		private static bool batched_readdir = true;
+
 		private static Encoding filename_encoding = Encoding.Default;
 
+		// The d_type values from dirent.h
+		public enum EntryType : byte {
+			Unknown = 0,
+			Fifo = 1,
+			CharDevice = 2,
+			Directory = 4,
+			BlockDevice = 6,
+			Regular = 8,
+			SymbolicLink = 10,
+			Socket = 12
+		}
+
+		// Type is Unknown if the filesystem doesn't report it, or
+		// if the directory was read with readdir.
+		public struct Entry {
+			public string Name;
+			public EntryType Type;
+			public ulong Inode;
+
+			// Only filled in if the entry was stat'd, otherwise -1
+			public long Mtime;
+			public long Ctime;
+			public long Size;
+
+			public bool HasStat {
+				get { return Mtime >= 0; }
+			}
+
+			public DateTime MtimeUtc {
+				get { return (Mtime < 0) ? DateTime.MinValue : DateTimeUtil.UnixToDateTimeUtc (Mtime); }
+			}
+
+			public DateTime CtimeUtc {
+				get { return (Ctime < 0) ? DateTime.MinValue : DateTimeUtil.UnixToDateTimeUtc (Ctime); }
+			}
+		}
+
 		private static string readdir (IntPtr dir, ref byte[] buffer)
 		{
 			int r = 0;
@@ -73,10 +136,25 @@ namespace Beagle.Util {
 			FileFilter file_filter;
 			FileObjectifier file_objectifier;
 			IntPtr dir_handle = IntPtr.Zero;
+			int dir_fd = -1;
 			string current;
-			byte[] buffer = new byte [256];
+			Entry current_entry;
+			byte[] buffer;
+			int buffer_len = 0, buffer_pos = 0;
 
 			public bool NamesOnly = false;
+			public bool Entries = false;
+
+			// If set, the entry type which the file filter is
+			// looking for: Directory for directories, or Regular
+			// for anything else, as File.Exists accepts FIFOs,
+			// sockets and devices too.  Entries whose type the
+			// directory tells us are then matched without calling
+			// the filter.
+			public EntryType FilterType = EntryType.Unknown;
+
+			// Flags passed to sys_read_entries
+			public int StatFlags = 0;
 			
 			public FileEnumerator (string          path,
 					       FileFilter      file_filter,
@@ -90,8 +168,7 @@ namespace Beagle.Util {
 			
 			~FileEnumerator ()
 			{
-				if (dir_handle != IntPtr.Zero)
-					closedir (dir_handle);
+				Close ();
 			}
 
 			public object Current {
@@ -100,6 +177,8 @@ namespace Beagle.Util {
 					if (current != null) {
 						if (file_objectifier != null)
 							current_obj = file_objectifier (path, current); 
+						else if (Entries)
+							current_obj = current_entry;
 						else if (NamesOnly)
 							current_obj = current;
 						else
@@ -110,12 +189,75 @@ namespace Beagle.Util {
 				}
 			}
 
+			private void Close ()
+			{
+				if (dir_fd != -1) {
+					Mono.Unix.Native.Syscall.close (dir_fd);
+					dir_fd = -1;
+				}
+
+				if (dir_handle != IntPtr.Zero) {
+					closedir (dir_handle);
+					dir_handle = IntPtr.Zero;
+				}
+			}
+
+			// Fills in current_entry with the next entry in the
+			// directory, returning false at the end.
+			private bool NextEntry ()
+			{
+				if (dir_fd == -1) {
+					if (dir_handle == IntPtr.Zero)
+						return false;
+
+					current_entry.Name = readdir (dir_handle, ref buffer);
+					current_entry.Type = EntryType.Unknown;
+					current_entry.Inode = 0;
+					current_entry.Mtime = -1;
+					current_entry.Ctime = -1;
+					current_entry.Size = -1;
+
+					return current_entry.Name != null;
+				}
+
+				if (buffer_pos >= buffer_len) {
+					buffer_len = sys_read_entries (dir_fd, buffer, buffer.Length, StatFlags);
+					buffer_pos = 0;
+
+					if (buffer_len == -1) {
+						int errno = Marshal.GetLastWin32Error ();
+						Logger.Log.Debug ("Error reading directory {0}: {1}", path, Mono.Unix.UnixMarshal.GetErrorDescription (NativeConvert.ToErrno (errno)));
+					}
+
+					if (buffer_len <= 0)
+						return false;
+				}
+
+				int pos = buffer_pos;
+
+				current_entry.Inode = BitConverter.ToUInt64 (buffer, pos + ENTRY_INODE_OFFSET);
+				current_entry.Mtime = BitConverter.ToInt64 (buffer, pos + ENTRY_MTIME_OFFSET);
+				current_entry.Ctime = BitConverter.ToInt64 (buffer, pos + ENTRY_CTIME_OFFSET);
+				current_entry.Size = BitConverter.ToInt64 (buffer, pos + ENTRY_SIZE_OFFSET);
+				current_entry.Type = (EntryType) buffer [pos + ENTRY_TYPE_OFFSET];
+
+				int name_start = pos + ENTRY_NAME_OFFSET;
+				int n_chars = 0;
+				while (buffer [name_start + n_chars] != 0)
+					++n_chars;
+				current_entry.Name = FileNameMarshaler.LocalToUTF8 (buffer, name_start, n_chars);
+
+				buffer_pos += BitConverter.ToUInt16 (buffer, pos + ENTRY_RECLEN_OFFSET);
+
+				return true;
+			}
+
 			public bool MoveNext ()
 			{
 				bool skip_file = false;
 
 				do {
-					current = readdir (dir_handle, ref buffer);
+					current = NextEntry () ? current_entry.Name : null;
 					if (current == null)
 						break;
 
@@ -124,6 +266,16 @@ namespace Beagle.Util {
 					if (current == "." || current == "..") {
 						skip_file = true;
 
+					} else if (FilterType != EntryType.Unknown
+						   && current_entry.Type != EntryType.Unknown
+						   && current_entry.Type != EntryType.SymbolicLink) {
+						// The directory told us the type, so
+						// there is no need to stat the file.
+						if (FilterType == EntryType.Directory)
+							skip_file = (current_entry.Type != EntryType.Directory);
+						else
+							skip_file = (current_entry.Type == EntryType.Directory);
+
 					} else if (file_filter != null) {
 						try {
 							if (! file_filter (path, current))
@@ -140,10 +292,8 @@ namespace Beagle.Util {
 
 				} while (skip_file);
 
-				if (current == null) {
-					closedir (dir_handle);
-					dir_handle = IntPtr.Zero;
-				}
+				if (current == null)
+					Close ();
 
 				return current != null;
 			}
@@ -151,8 +301,32 @@ namespace Beagle.Util {
 			public void Reset ()
 			{
 				current = null;
-				if (dir_handle != IntPtr.Zero)
-					closedir (dir_handle);
+				buffer_len = buffer_pos = 0;
+				Close ();
+
+				if (batched_readdir) {
+					try {
+						dir_fd = sys_open_dir (path);
+					} catch (EntryPointNotFoundException) {
+						batched_readdir = false;
+					}
+
+					if (dir_fd == -1 && batched_readdir) {
+						Errno errno = NativeConvert.ToErrno (Marshal.GetLastWin32Error ());
+						if (errno != Errno.ENOSYS)
+							throw new DirectoryNotFoundException (path);
+						batched_readdir = false;
+					}
+				}
+
+				if (dir_fd != -1) {
+					if (buffer == null || buffer.Length < BATCH_BUFFER_SIZE)
+						buffer = new byte [BATCH_BUFFER_SIZE];
+					return;
+				}
+
+				if (buffer == null)
+					buffer = new byte [256];
 				dir_handle = opendir (path);
 				if (dir_handle == IntPtr.Zero)
 					throw new DirectoryNotFoundException (path);
@@ -166,6 +340,9 @@ namespace Beagle.Util {
 			FileObjectifier file_objectifier;
 			
 			public bool NamesOnly = false;
+			public bool Entries = false;
+			public EntryType FilterType = EntryType.Unknown;
+			public int StatFlags = 0;
 
 			public FileEnumerable (string          path,
 					       FileFilter      file_filter,
@@ -176,11 +353,23 @@ namespace Beagle.Util {
 				this.file_objectifier = file_objectifier;
 			}
 
+			public FileEnumerable (string          path,
+					       FileFilter      file_filter,
+					       FileObjectifier file_objectifier,
+					       EntryType       filter_type)
+				: this (path, file_filter, file_objectifier)
+			{
+				this.FilterType = filter_type;
+			}
+
 			public IEnumerator GetEnumerator ()
 			{
 				FileEnumerator e;
 				e = new FileEnumerator (path, file_filter, file_objectifier);
 				e.NamesOnly = this.NamesOnly;
+				e.Entries = this.Entries;
+				e.FilterType = this.FilterType;
+				e.StatFlags = this.StatFlags;
 				return e;
 			}
 		}
@@ -211,7 +400,7 @@ namespace Beagle.Util {
 
 		static public IEnumerable GetFiles (string path)
 		{
-			return new FileEnumerable (path, new FileFilter (IsFile), null);
+			return new FileEnumerable (path, new FileFilter (IsFile), null, EntryType.Regular);
 		}
 
 		static public IEnumerable GetFiles (DirectoryInfo dirinfo)
@@ -223,7 +412,8 @@ namespace Beagle.Util {
 		{
 			return new FileEnumerable (path,
 						   new FileFilter (IsFile),
-						   new FileObjectifier (FileInfoObjectifier));
+						   new FileObjectifier (FileInfoObjectifier),
+						   EntryType.Regular);
 		}
 
 		static public IEnumerable GetFileInfos (DirectoryInfo dirinfo)
@@ -243,7 +433,7 @@ namespace Beagle.Util {
 
 		static public IEnumerable GetDirectories (string path)
 		{
-			return new FileEnumerable (path, new FileFilter (IsDirectory), null);
+			return new FileEnumerable (path, new FileFilter (IsDirectory), null, EntryType.Directory);
 		}
 
 		static public IEnumerable GetDirectories (DirectoryInfo dirinfo)
@@ -254,7 +444,7 @@ namespace Beagle.Util {
 		static public IEnumerable GetDirectoryNames (string path)
 		{
 			FileEnumerable fe;
-			fe = new FileEnumerable (path, new FileFilter (IsDirectory), null);
+			fe = new FileEnumerable (path, new FileFilter (IsDirectory), null, EntryType.Directory);
 			fe.NamesOnly = true;
 			return fe;
 		}
@@ -263,7 +453,8 @@ namespace Beagle.Util {
 		{
 			return new FileEnumerable (path,
 						   new FileFilter (IsDirectory),
-						   new FileObjectifier (DirectoryInfoObjectifier));
+						   new FileObjectifier (DirectoryInfoObjectifier),
+						   EntryType.Directory);
 		}
 
 		static public IEnumerable GetDirectoryInfos (DirectoryInfo dirinfo)
@@ -284,6 +475,27 @@ namespace Beagle.Util {
 			return fe;
 		}
 
+		// Returns an Entry for each item in the directory, which is
+		// much cheaper than a FileInfo and, where the filesystem
+		// reports the type, saves stat'ing the item to find it.
+		static public IEnumerable GetEntries (string path)
+		{
+			return GetEntries (path, false);
+		}
+
+		// If stat_files is true, the mtime, ctime and size of the
+		// regular files are filled in, too, and so is the type of
+		// any entry the filesystem doesn't report it for.
+		static public IEnumerable GetEntries (string path, bool stat_files)
+		{
+			FileEnumerable fe;
+			fe = new FileEnumerable (path, null, null);
+			fe.Entries = true;
+			if (stat_files)
+				fe.StatFlags = STAT_FILES;
+			return fe;
+		}
+
 		static public IEnumerable GetFileInfosRecursive (string path)
 		{
 			foreach (FileInfo i in DirectoryWalker.GetFileInfos (path))
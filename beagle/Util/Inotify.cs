@@ -46,6 +46,14 @@ namespace Beagle.Util {
 			void Unsubscribe ();
 			void ChangeSubscription (EventType new_mask);
 		}
+
+		// One directory of a tree subscribed to with SubscribeTree ().
+		public class TreeWatch {
+			public string Path;
+			public int    Parent;	// Index of the parent directory, -1 for the root
+			public Watch  Watch;	// null if the directory could not be watched
+			public Errno  Error;	// Why it could not be watched
+		}
 		/////////////////////////////////////////////////////////////////////////////////////
 
 		[Flags]
@@ -84,35 +92,98 @@ namespace Beagle.Util {
 
 		/////////////////////////////////////////////////////////////////////////////////////
 
+		// An event as handed over by inotify_snarf_coalesced ()
 		[StructLayout (LayoutKind.Sequential)]
-		private struct inotify_event {
+		private struct glue_event {
 			public int       wd;
 			public EventType mask;
 			public uint      cookie;
-			public uint      len;
+			public int       src_wd;	// Source of a move the glue paired up, or -1
+			public uint      name;
+			public uint      src_name;
+			public uint      path;		// Of the watch, when the event happened
+			public uint      src_path;
+			public int       shard;		// Which queue it goes in
 		}
 
+		private const uint NoName = 0xffffffff;
+
 		[DllImport ("libbeagleglue")]
 		static extern int inotify_glue_init ();
 
+		[DllImport ("libbeagleglue")]
+		static extern int inotify_glue_init_fanotify ();
+
+		[DllImport ("libbeagleglue")]
+		static extern int inotify_glue_init_sharded (int n_shards);
+
+		[DllImport ("libbeagleglue")]
+		static extern int inotify_glue_shard_count (int fd);
+
 		[DllImport ("libbeagleglue")]
 		static extern int inotify_glue_watch (int fd, [MarshalAs (UnmanagedType.CustomMarshaler, MarshalTypeRef=typeof(Mono.Unix.Native.FileNameMarshaler))] string filename, EventType mask);
 
 		[DllImport ("libbeagleglue")]
 		static extern int inotify_glue_ignore (int fd, int wd);
 
+		// The glue keeps track of where every watch is, including across
+		// directory renames, so we don't have to.
+		[DllImport ("libbeagleglue")]
+		static extern int inotify_glue_lookup ([MarshalAs (UnmanagedType.CustomMarshaler, MarshalTypeRef=typeof(Mono.Unix.Native.FileNameMarshaler))] string path);
+
 		[DllImport ("libbeagleglue")]
-		static extern unsafe void inotify_snarf_events (int fd,
-								out int nr,
-								out IntPtr buffer);
+		static extern int inotify_glue_get_path (int wd, byte [] buffer, int len);
+
+		[StructLayout (LayoutKind.Sequential)]
+		private struct tree_entry {
+			public int  wd;
+			public int  parent;
+			public uint name;
+		}
+
+		[DllImport ("libbeagleglue")]
+		static extern int inotify_glue_watch_tree (int fd, [MarshalAs (UnmanagedType.CustomMarshaler, MarshalTypeRef=typeof(Mono.Unix.Native.FileNameMarshaler))] string path, EventType mask, int n_threads, out IntPtr entries, out IntPtr names);
+
+		[DllImport ("libbeagleglue")]
+		static extern void inotify_glue_free_tree (IntPtr entries, IntPtr names);
+
+		[DllImport ("libbeagleglue")]
+		static extern void inotify_snarf_coalesced (int fd,
+							    out int nr,
+							    out IntPtr events,
+							    out IntPtr names,
+							    out IntPtr paths,
+							    out int coalesced);
 
 		[DllImport ("libbeagleglue")]
 		static extern void inotify_snarf_cancel ();
 
+		[DllImport ("libbeagleglue")]
+		static extern void inotify_glue_set_batching (int latency_msec, int max_bytes);
+
+		[StructLayout (LayoutKind.Sequential)]
+		public struct Stats {
+			public ulong Batches;
+			public ulong Events;
+			public ulong Bytes;
+			public ulong MaxBatchEvents;
+			public ulong WaitNanoseconds;	// Spent collecting batches after their first event
+			public ulong Overflows;
+			public ulong QueueHighWater;	// Most bytes ever found queued in the kernel
+			public ulong BufferSize;
+			[MarshalAs (UnmanagedType.ByValArray, SizeConst=16)]
+			public ulong [] BatchSizes;	// Number of batches of 2^i to 2^(i+1)-1 events
+		}
+
+		[DllImport ("libbeagleglue")]
+		static extern void inotify_glue_get_stats (out Stats stats);
+
 		/////////////////////////////////////////////////////////////////////////////////////
 
 		public static bool Verbose = false;
 		private static int inotify_fd = -1;
+		private static long coalesced_count = 0;
+		private static bool using_fanotify = false;
 
 		static Inotify ()
 		{
@@ -124,8 +195,36 @@ namespace Beagle.Util {
 			if (Environment.GetEnvironmentVariable ("BEAGLE_INOTIFY_VERBOSE") != null)
 				Inotify.Verbose = true;
 
+			// fanotify doesn't need a watch per directory, and the glue
+			// makes it look just like inotify to us.
+			if (Environment.GetEnvironmentVariable ("BEAGLE_ENABLE_FANOTIFY") != null) {
+				try {
+					inotify_fd = inotify_glue_init_fanotify ();
+				} catch (EntryPointNotFoundException) { }
+
+				if (inotify_fd >= 0) {
+					Logger.Log.Debug ("Using fanotify for file system notification");
+					using_fanotify = true;
+					SetBatching ();
+					return;
+				}
+
+				Logger.Log.Debug ("fanotify not available, falling back to inotify");
+			}
+
+			// Big trees can be spread over several inotify instances,
+			// whose events are dispatched in parallel.  By default the
+			// glue decides how many from the number of CPUs.
+			int shards = 0;
+			string str = Environment.GetEnvironmentVariable ("BEAGLE_INOTIFY_SHARDS");
+			if (str != null) {
+				try {
+					shards = Int32.Parse (str);
+				} catch (FormatException) { }
+			}
+
 			try {
-				inotify_fd = inotify_glue_init ();
+				inotify_fd = inotify_glue_init_sharded (shards);
 			} catch (EntryPointNotFoundException) {
 				Logger.Log.Info ("Inotify not available on system.");
 				return;
@@ -143,6 +242,12 @@ namespace Beagle.Util {
 
 				Logger.Log.Warn ("Could not initialize inotify: {0}", error_message);
 			} else {
+				SetBatching ();
+
+				shards = inotify_glue_shard_count (inotify_fd);
+				if (shards > 1)
+					Logger.Log.Debug ("Spreading inotify watches over {0} instances", shards);
+
 				try {
 					FileStream fs = new FileStream ("/proc/sys/fs/inotify/max_user_watches", FileMode.Open, FileAccess.Read);
 					StreamReader r = new StreamReader (fs);
@@ -162,10 +267,45 @@ namespace Beagle.Util {
 			}
 		}
 
+		// How long events may be held back to be read in one go, and
+		// how big such a batch may get, can be tuned without rebuilding.
+		private static void SetBatching ()
+		{
+			int latency = -1, max_bytes = -1;
+
+			string str = Environment.GetEnvironmentVariable ("BEAGLE_INOTIFY_LATENCY");
+			if (str != null) {
+				try {
+					latency = Int32.Parse (str);
+				} catch (FormatException) { }
+			}
+
+			str = Environment.GetEnvironmentVariable ("BEAGLE_INOTIFY_BATCH_BYTES");
+			if (str != null) {
+				try {
+					max_bytes = Int32.Parse (str);
+				} catch (FormatException) { }
+			}
+
+			if (latency >= 0 || max_bytes > 0)
+				inotify_glue_set_batching (latency, max_bytes);
+		}
+
 		public static bool Enabled {
 			get { return inotify_fd >= 0; }
 		}
 
+		// How many kernel events were merged or cancelled out before
+		// they ever reached the queue
+		public static long CoalescedCount {
+			get { return coalesced_count; }
+		}
+
+		// Whether the notifications come from fanotify rather than inotify
+		public static bool UsingFanotify {
+			get { return using_fanotify; }
+		}
+
 		/////////////////////////////////////////////////////////////////////////////////////
 
 #if ! ENABLE_INOTIFY
@@ -177,6 +317,11 @@ namespace Beagle.Util {
 			return null;
 		}
 
+		public static TreeWatch [] SubscribeTree (string path, InotifyCallback callback, EventType mask)
+		{
+			return null;
+		}
+
 		public static void Start ()
 		{
 			return;
@@ -187,16 +332,43 @@ namespace Beagle.Util {
 			return;
 		}
 
+		public static Stats GetStats ()
+		{
+			return new Stats ();
+		}
+
+		public static void DebugHook ()
+		{
+			return;
+		}
+
 #else // ENABLE_INOTIFY
 
 		/////////////////////////////////////////////////////////////////////////////////////
-		private static ArrayList event_queue = new ArrayList ();
+
+		// The events of each inotify instance the glue reads from go in a
+		// queue of their own, with its own thread to dispatch them.  A
+		// subtree is always watched by the same instance, so its events stay
+		// in order.
+		private class EventQueue {
+			public ArrayList Events = new ArrayList ();
+			public Hashtable PendingMoveCookies = new Hashtable ();
+
+			public void Dispatch ()
+			{
+				DispatchWorker (this);
+			}
+		}
+
+		private static EventQueue [] queues = null;
+		private static object state_lock = new object ();
 
 		private class QueuedEvent {
 			public int       Wd;
 			public EventType Type;
 			public string    Filename;
 			public uint      Cookie;
+			public string    Path;		// Of the watch, when the event happened
 
 			public bool        Analyzed;
 			public bool        Dispatched;
@@ -275,22 +447,32 @@ namespace Beagle.Util {
 
 		private class WatchInfo {
 			public int       Wd = -1;
-			public string    Path;
+			public string    InitialPath;	// Where it was when we set it up
 			public bool      IsDirectory;
 			public EventType Mask;
 
 			public EventType FilterMask;
 			public EventType FilterSeen;
 
-			public ArrayList Children;
-			public WatchInfo Parent;
-
 			public ArrayList Subscribers;
+
+			// Where it is now, as far as the glue knows
+			public string Path {
+				get {
+					string path = null;
+					if (Wd >= 0)
+						path = WatchPath (Wd);
+					return path != null ? path : InitialPath;
+				}
+			}
 		}
 
+		// Also serves as the lock for the WatchInfo objects in it.
 		private static Hashtable watched_by_wd = new Hashtable ();
-		private static Hashtable watched_by_path = new Hashtable ();
-		private static WatchInfo last_watched = null;
+
+		// Held by SubscribeTree () across the native walk, which is too
+		// long to hold the watched_by_wd lock for.
+		private static object tree_lock = new object ();
 
 		private class PendingMove {
 			public WatchInfo Watch;
@@ -310,45 +492,99 @@ namespace Beagle.Util {
 			get { return watched_by_wd.Count; }
 		}
 
+		public static Stats GetStats ()
+		{
+			Stats stats;
+			inotify_glue_get_stats (out stats);
+			return stats;
+		}
+
+		public static void DebugHook ()
+		{
+			if (! Enabled)
+				return;
+
+			Stats stats = GetStats ();
+
+			Log.Debug ("Inotify: {0} watches, {1} events in {2} batches (largest {3}), {4} coalesced, {5} overflows",
+				   WatchCount, stats.Events, stats.Batches, stats.MaxBatchEvents, CoalescedCount, stats.Overflows);
+			Log.Debug ("Inotify: {0:0.0} ms average batching delay, kernel queue high water {1} bytes, buffer {2} bytes",
+				   stats.Batches > 0 ? stats.WaitNanoseconds / 1e6 / stats.Batches : 0,
+				   stats.QueueHighWater, stats.BufferSize);
+
+			StringBuilder sb = new StringBuilder ();
+			for (int i = 0; i < stats.BatchSizes.Length; i++)
+				if (stats.BatchSizes [i] > 0)
+					sb.AppendFormat (" {0}+:{1}", 1 << i, stats.BatchSizes [i]);
+			Log.Debug ("Inotify: batch sizes{0}", sb.ToString ());
+		}
+
 		public static bool IsWatching (string path)
 		{
 			path = Path.GetFullPath (path);
-			return watched_by_path.Contains (path);
+			return inotify_glue_lookup (path) >= 0;
+		}
+
+		// The caller has to handle all locking itself
+		private static WatchInfo LookupPath (string path)
+		{
+			int wd = inotify_glue_lookup (path);
+			return wd >= 0 ? watched_by_wd [wd] as WatchInfo : null;
+		}
+
+		private static string WatchPath (int wd)
+		{
+			byte [] buffer = new byte [256];
+			int len;
+
+			while ((len = inotify_glue_get_path (wd, buffer, buffer.Length)) >= buffer.Length)
+				buffer = new byte [len + 1];
+
+			if (len < 0)
+				return null;
+
+			return FileNameMarshaler.LocalToUTF8 (buffer, 0, len);
 		}
 
 		// Filter WatchInfo items when we do the Lookup.
-		// We do the filtering here to avoid having to acquire
-		// the watched_by_wd lock yet again.
+		// A watch we don't know about yet may have been made by a tree
+		// walk which hasn't recorded it, so wait for the walk and look
+		// again.
 		private static WatchInfo Lookup (int wd, EventType event_type)
 		{
-			lock (watched_by_wd) {
-				WatchInfo watched;
-				if (last_watched != null && last_watched.Wd == wd)
-					watched = last_watched;
-				else {
-					watched = watched_by_wd [wd] as WatchInfo;
-					if (watched != null)
-						last_watched = watched;
-				}
+			bool found;
+			WatchInfo watched;
 
-				if (watched != null && (watched.FilterMask & event_type) != 0) {
-					watched.FilterSeen |= event_type;
-					watched = null;
-				}
+			lock (watched_by_wd)
+				watched = LookupAndFilter_Unlocked (wd, event_type, out found);
 
-				return watched;
+			if (! found) {
+				lock (tree_lock)
+					lock (watched_by_wd)
+						watched = LookupAndFilter_Unlocked (wd, event_type, out found);
 			}
+
+			return watched;
+		}
+
+		// The caller has to handle all locking itself
+		private static WatchInfo LookupAndFilter_Unlocked (int wd, EventType event_type, out bool found)
+		{
+			WatchInfo watched = watched_by_wd [wd] as WatchInfo;
+
+			found = (watched != null);
+			if (watched != null && (watched.FilterMask & event_type) != 0) {
+				watched.FilterSeen |= event_type;
+				watched = null;
+			}
+
+			return watched;
 		}
 
 		// The caller has to handle all locking itself
 		private static void Forget (WatchInfo watched)
 		{
-			if (last_watched == watched)
-				last_watched = null;
-			if (watched.Parent != null)
-				watched.Parent.Children.Remove (watched);
 			watched_by_wd.Remove (watched.Wd);
-			watched_by_path.Remove (watched.Path);
 		}
 
 		public static Watch Subscribe (string path, InotifyCallback callback, EventType mask, EventType initial_filter)
@@ -367,21 +603,14 @@ namespace Beagle.Util {
 				throw new IOException (path);
 
 			lock (watched_by_wd) {
-				watched = watched_by_path [path] as WatchInfo;
+				watched = LookupPath (path);
 
 				if (watched == null) {
 					// We need an entirely new WatchInfo object
 					watched = new WatchInfo ();
-					watched.Path = path;
+					watched.InitialPath = path;
 					watched.IsDirectory = is_directory;
 					watched.Subscribers = new ArrayList ();
-					watched.Children = new ArrayList ();
-					DirectoryInfo dir = new DirectoryInfo (path);
-					if (dir.Parent != null)
-						watched.Parent = watched_by_path [dir.Parent.ToString ()] as WatchInfo;
-					if (watched.Parent != null)
-						watched.Parent.Children.Add (watched);
-					watched_by_path [watched.Path] = watched;
 				}
 
 				watched.FilterMask = initial_filter;
@@ -402,6 +631,113 @@ namespace Beagle.Util {
 			return Subscribe (path, callback, mask, 0);
 		}
 
+		// Subscribe to 'path' and every directory below it.  The tree is
+		// walked and watched natively, by a few threads at once, and the
+		// directories come back with each parent ahead of its children.
+		// Directories which could not be watched are returned too, with a
+		// null Watch.
+		public static TreeWatch [] SubscribeTree (string path, InotifyCallback callback, EventType mask)
+		{
+			if (!Path.IsPathRooted (path))
+				path = Path.GetFullPath (path);
+
+			EventType new_mask = base_mask | mask;
+			int entry_size = Marshal.SizeOf (typeof (tree_entry));
+
+			// We hold tree_lock across the walk: events for directories the
+			// walk has already watched (in particular the creation of new
+			// subdirectories) can't be dispatched until we know about them,
+			// so Lookup () waits for it on a watch it can't find.
+			lock (tree_lock) {
+				IntPtr entries, names;
+				int n;
+
+				n = inotify_glue_watch_tree (inotify_fd, path, new_mask, 0, out entries, out names);
+				if (n < 0) {
+					Mono.Unix.Native.Errno errno = Mono.Unix.Native.NativeConvert.ToErrno (-n);
+					string msg = String.Format ("Attempt to watch {0} failed: {1}", path, Mono.Unix.UnixMarshal.GetErrorDescription (errno));
+					throw new IOException (msg);
+				}
+
+				TreeWatch [] tree = new TreeWatch [n];
+
+				try {
+					lock (watched_by_wd) {
+						for (int i = 0; i < n; i++) {
+							tree_entry entry;
+							entry = (tree_entry) Marshal.PtrToStructure ((IntPtr) ((long) entries + i * entry_size), typeof (tree_entry));
+
+							TreeWatch tw = new TreeWatch ();
+							tw.Parent = entry.parent;
+							if (entry.parent < 0)
+								tw.Path = path;
+							else
+								tw.Path = Path.Combine (tree [entry.parent].Path, ReadName (names, entry.name));
+							tree [i] = tw;
+
+							if (entry.wd < 0) {
+								tw.Error = Mono.Unix.Native.NativeConvert.ToErrno (-entry.wd);
+								if (! watch_limit_error_displayed && tw.Error == Mono.Unix.Native.Errno.ENOSPC) {
+									Log.Error ("Maximum inotify watch limit hit adding watch to {0}.  Try adjusting /proc/sys/fs/inotify/max_user_watches", tw.Path);
+									watch_limit_error_displayed = true;
+								}
+								continue;
+							}
+
+							WatchInfo watched = watched_by_wd [entry.wd] as WatchInfo;
+							if (watched == null) {
+								watched = new WatchInfo ();
+								watched.InitialPath = tw.Path;
+								watched.IsDirectory = true;
+								watched.Subscribers = new ArrayList ();
+							}
+
+							// The walk replaced whatever mask the watch had,
+							// CreateOrModifyWatch () puts back the bits that any
+							// earlier subscribers need.
+							watched.Wd = entry.wd;
+							watched.Mask = new_mask;
+							watched.FilterMask = 0;
+							watched.FilterSeen = 0;
+
+							WatchInternal watch = new WatchInternal (callback, mask, watched);
+							watched.Subscribers.Add (watch);
+
+							try {
+								CreateOrModifyWatch (watched);
+							} catch (IOException) {
+								// We can race and directories can disappear.
+							}
+							watched_by_wd [watched.Wd] = watched;
+
+							tw.Watch = watch;
+						}
+					}
+				} finally {
+					inotify_glue_free_tree (entries, names);
+				}
+
+				return tree;
+			}
+		}
+
+		private static string ReadName (IntPtr names, uint offset)
+		{
+			if (offset == NoName)
+				return String.Empty;
+
+			IntPtr name = (IntPtr) ((long) names + offset);
+
+			int len = 0;
+			while (Marshal.ReadByte (name, len) != 0)
+				++len;
+
+			byte [] bytes = new byte [len];
+			Marshal.Copy (name, bytes, 0, len);
+
+			return FileNameMarshaler.LocalToUTF8 (bytes, 0, len);
+		}
+
 		public static EventType Filter (string path, EventType mask)
 		{
 			EventType seen = 0;
@@ -410,7 +746,7 @@ namespace Beagle.Util {
 
 			lock (watched_by_wd) {
 				WatchInfo watched;
-				watched = watched_by_path [path] as WatchInfo;
+				watched = LookupPath (path);
 
 				seen = watched.FilterSeen;
 				watched.FilterMask = mask;
@@ -493,7 +829,7 @@ namespace Beagle.Util {
 		private static bool shutdown_requested = false;
 
 		public static void ShutdownRequested () {
-			lock (event_queue) {
+			lock (state_lock) {
 			    shutdown_requested = true;
 			}
 		}
@@ -505,14 +841,19 @@ namespace Beagle.Util {
 
 			Logger.Log.Debug("Starting Inotify threads");
 
-			lock (event_queue) {
+			lock (state_lock) {
 				if (shutdown_requested || snarf_thread != null)
 					return;
 
 				running = true;
 
+				queues = new EventQueue [inotify_glue_shard_count (inotify_fd)];
+				for (int i = 0; i < queues.Length; i++)
+					queues [i] = new EventQueue ();
+
 				snarf_thread = ExceptionHandlingThread.Start (new ThreadStart (SnarfWorker));
-				ExceptionHandlingThread.Start (new ThreadStart (DispatchWorker));
+				foreach (EventQueue queue in queues)
+					ExceptionHandlingThread.Start (new ThreadStart (queue.Dispatch));
 			}
 		}
 
@@ -523,14 +864,18 @@ namespace Beagle.Util {
 
 			Log.Debug ("Stopping inotify threads");
 
-			lock (event_queue) {
+			lock (state_lock) {
 				shutdown_requested = true;
 
 				if (! running)
 					return;
 
 				running = false;
-				Monitor.Pulse (event_queue);
+			}
+
+			foreach (EventQueue queue in queues) {
+				lock (queue.Events)
+					Monitor.Pulse (queue.Events);
 			}
 
 			inotify_snarf_cancel ();
@@ -538,22 +883,21 @@ namespace Beagle.Util {
 
 		private static unsafe void SnarfWorker ()
 		{
-			int event_size = Marshal.SizeOf (typeof (inotify_event));
-			
 			while (running) {
 
-				// We get much better performance if we wait a tiny bit
-				// between reads in order to let events build up.
-				// FIXME: We need to be smarter here to avoid queue overflows.
-				Thread.Sleep (15);
-
-				IntPtr buffer;
-				int nr;
+				IntPtr events, names, paths;
+				int nr, coalesced;
 
-				// Will block while waiting for events, but with a 1s timeout.
-				inotify_snarf_events (inotify_fd, 
-						      out nr,
-						      out buffer);
+				// Will block while waiting for events.  Once they start
+				// coming in, the glue holds on to them for a little while
+				// (see SetBatching) so that they are read in batches, and
+				// merges redundant ones before we see them.
+				inotify_snarf_coalesced (inotify_fd,
+							 out nr,
+							 out events,
+							 out names,
+							 out paths,
+							 out coalesced);
 
 				if (!running)
 					break;
@@ -561,106 +905,84 @@ namespace Beagle.Util {
 				if (nr == 0)
 					continue;
 
-				ArrayList new_events = new ArrayList ();
+				coalesced_count += coalesced;
+				if (Verbose && coalesced > 0)
+					Console.WriteLine ("*** inotify: coalesced {0} events into {1}", coalesced + nr, nr);
 
-				bool saw_overflow = false;
-				while (nr > 0) {
+				ArrayList [] new_events = new ArrayList [queues.Length];
 
-					// Read the low-level event struct from the buffer.
-					inotify_event raw_event;
-					raw_event = (inotify_event) Marshal.PtrToStructure (buffer, typeof (inotify_event));
-					buffer = (IntPtr) ((long) buffer + event_size);
+				// Events on the same watch share the same path, and the
+				// same offset into the path table
+				Hashtable batch_paths = new Hashtable ();
 
-					if ((raw_event.mask & EventType.QueueOverflow) != 0)
+				bool saw_overflow = false;
+				glue_event *ev = (glue_event *) events;
+				for (int i = 0; i < nr; i++, ev++) {
+
+					if ((ev->mask & EventType.QueueOverflow) != 0)
 						saw_overflow = true;
 
 					// Now we convert our low-level event struct into a nicer object.
 					QueuedEvent qe = new QueuedEvent ();
-					qe.Wd = raw_event.wd;
-					qe.Type = raw_event.mask;
-					qe.Cookie = raw_event.cookie;
-
-					// Extract the filename payload (if any) from the buffer.
-					byte [] filename_bytes = new byte[raw_event.len];
-					Marshal.Copy (buffer, filename_bytes, 0, (int) raw_event.len);
-					buffer = (IntPtr) ((long) buffer + raw_event.len);
-					int n_chars = 0;
-					while (n_chars < filename_bytes.Length && filename_bytes [n_chars] != 0)
-						++n_chars;
-					qe.Filename = "";
-					if (n_chars > 0)
-						qe.Filename = FileNameMarshaler.LocalToUTF8 (filename_bytes, 0, n_chars);
-
-					new_events.Add (qe);
-					nr -= event_size + (int) raw_event.len;
+					qe.Wd = ev->wd;
+					qe.Type = ev->mask;
+					qe.Cookie = ev->cookie;
+					qe.Filename = ReadName (names, ev->name);
+					qe.Path = ReadPath (batch_paths, paths, ev->path);
+
+					// A move whose halves the glue already paired up.  The
+					// MovedFrom half is never dispatched on its own, just
+					// like one we pair up in AnalyzeQueue_Unlocked.
+					if (ev->src_wd >= 0) {
+						QueuedEvent from = new QueuedEvent ();
+						from.Wd = ev->src_wd;
+						from.Type = EventType.MovedFrom | (ev->mask & EventType.IsDirectory);
+						from.Filename = ReadName (names, ev->src_name);
+						from.Path = ReadPath (batch_paths, paths, ev->src_path);
+						from.Analyzed = true;
+						from.Dispatched = true;
+						qe.PairedMove = from;
+					}
+
+					int shard = ev->shard;
+					if (shard < 0 || shard >= queues.Length)
+						shard = 0;
+					if (new_events [shard] == null)
+						new_events [shard] = new ArrayList ();
+					new_events [shard].Add (qe);
 				}
 
 				if (saw_overflow)
 					Logger.Log.Warn ("Inotify queue overflow!");
 
-				lock (event_queue) {
-					event_queue.AddRange (new_events);
-					Monitor.Pulse (event_queue);
+				for (int i = 0; i < queues.Length; i++) {
+					if (new_events [i] == null)
+						continue;
+
+					lock (queues [i].Events) {
+						queues [i].Events.AddRange (new_events [i]);
+						Monitor.Pulse (queues [i].Events);
+					}
 				}
 			}
 		}
 
 
-		// Update the watched_by_path hash and the path stored inside the watch
-		// in response to a move event.
-		private static void MoveWatch (WatchInfo watch, string name)		
+		private static string ReadPath (Hashtable batch_paths, IntPtr paths, uint offset)
 		{
-			lock (watched_by_wd) {
+			if (offset == NoName)
+				return null;
 
-				watched_by_path.Remove (watch.Path);
-				watch.Path = name;
-				watched_by_path [watch.Path] = watch;
+			string path = batch_paths [offset] as string;
+			if (path == null) {
+				path = ReadName (paths, offset);
+				batch_paths [offset] = path;
 			}
 
-			if (Verbose)
-				Console.WriteLine ("*** inotify: Moved Watch to {0}", watch.Path);
+			return path;
 		}
 
-		// A directory we are watching has moved.  We need to fix up its path, and the path of
-		// all of its subdirectories, their subdirectories, and so on.
-		private static void HandleMove (string srcpath, string dstparent, string dstname)
-		{
-			string dstpath = Path.Combine (dstparent, dstname);
-			lock (watched_by_wd) {
-
-				WatchInfo start = watched_by_path [srcpath] as WatchInfo;	// not the same as src!
-				if (start == null) {
-					Logger.Log.Warn ("Lookup failed for {0}", srcpath);
-					return;
-				}
-
-				// Queue our starting point, then walk its subdirectories, invoking MoveWatch() on
-				// each, repeating for their subdirectories.  The relationship between start, child
-				// and dstpath is fickle and important.
-				Queue queue = new Queue();
-				queue.Enqueue (start);
-				do {
-					WatchInfo target = queue.Dequeue () as WatchInfo;
-					for (int i = 0; i < target.Children.Count; i++) {
-						WatchInfo child = target.Children[i] as WatchInfo;
-						Logger.Log.Debug ("Moving watch on {0} from {1} to {2}", child.Path, srcpath, dstpath);
-						string name = Path.Combine (dstpath, child.Path.Substring (srcpath.Length + 1));
-						MoveWatch (child, name);
-						queue.Enqueue (child);
-					}
-				} while (queue.Count > 0);
-				
-				// Ultimately, fixup the original watch, too
-				MoveWatch (start, dstpath);
-				if (start.Parent != null)
-					start.Parent.Children.Remove (start);
-				start.Parent = watched_by_path [dstparent] as WatchInfo;
-				if (start.Parent != null)
-					start.Parent.Children.Add (start);				
-			}
-		}
-
-		private static void SendEvent (WatchInfo watched, string filename, string srcpath, EventType mask)
+		private static void SendEvent (WatchInfo watched, string path, string filename, string srcpath, EventType mask)
 		{
 			// Does the watch care about this event?
 			if ((watched.Mask & mask) == 0)
@@ -672,7 +994,7 @@ namespace Beagle.Util {
 
 			if (Verbose) {
 				Console.WriteLine ("*** inotify: {0} {1} {2} {3} {4} {5}",
-						   mask, watched.Wd, watched.Path,
+						   mask, watched.Wd, path,
 						   filename != "" ? filename : "\"\"",
 						   isDirectory == true ? "(directory)" : "(file)",
 						   srcpath != null ? "(from " + srcpath + ")" : "");
@@ -684,7 +1006,7 @@ namespace Beagle.Util {
 			foreach (WatchInternal watch in (IEnumerable) watched.Subscribers.Clone ())
 				try {
 					if (watch.Callback != null && (watch.Mask & mask) != 0)
-						watch.Callback (watch, watched.Path, filename, srcpath, mask);
+						watch.Callback (watch, path, filename, srcpath, mask);
 				} catch (Exception e) {
 					Logger.Log.Error (e, "Caught exception executing Inotify callbacks");
 				}
@@ -692,14 +1014,15 @@ namespace Beagle.Util {
 
 		////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		// Dispatch-time operations on the event queue
-	       
-		private static Hashtable pending_move_cookies = new Hashtable ();
+		// Dispatch-time operations on the event queues
 
 		// Clean up the queue, removing dispatched objects.
-		// We assume that the called holds the event_queue lock.
-		private static void CleanQueue_Unlocked ()
+		// We assume that the called holds the queue's lock.
+		private static void CleanQueue_Unlocked (EventQueue queue)
 		{
+			ArrayList event_queue = queue.Events;
+			Hashtable pending_move_cookies = queue.PendingMoveCookies;
+
 			int first_undispatched = 0;
 			while (first_undispatched < event_queue.Count) {
 				QueuedEvent qe = event_queue [first_undispatched] as QueuedEvent;
@@ -718,10 +1041,15 @@ namespace Beagle.Util {
 		}
 
 		// Apply high-level processing to the queue.  Pair moves,
-		// coalesce events, etc.
-		// We assume that the caller holds the event_queue lock.
-		private static void AnalyzeQueue_Unlocked ()
+		// coalesce events, etc.  Only moves within one queue are paired
+		// here; the glue pairs those between queues when both halves
+		// are read in one go.
+		// We assume that the caller holds the queue's lock.
+		private static void AnalyzeQueue_Unlocked (EventQueue queue)
 		{
+			ArrayList event_queue = queue.Events;
+			Hashtable pending_move_cookies = queue.PendingMoveCookies;
+
 			int first_unanalyzed = event_queue.Count;
 			while (first_unanalyzed > 0) {
 				--first_unanalyzed;
@@ -760,8 +1088,10 @@ namespace Beagle.Util {
 			}
 		}
 
-		private static void DispatchWorker ()
+		private static void DispatchWorker (EventQueue queue)
 		{
+			ArrayList event_queue = queue.Events;
+
 			while (running) {
 				QueuedEvent next_event = null;
 
@@ -770,9 +1100,9 @@ namespace Beagle.Util {
 				lock (event_queue) {
 
 					while (running) {
-						CleanQueue_Unlocked ();
+						CleanQueue_Unlocked (queue);
 
-						AnalyzeQueue_Unlocked ();
+						AnalyzeQueue_Unlocked (queue);
 
 						// Now look for an event to dispatch.
 						DateTime min_hold_until = DateTime.MaxValue;
@@ -823,24 +1153,29 @@ namespace Beagle.Util {
 				if (watched == null)
 					continue;
 
+				// The path the watch had when the event happened; the
+				// glue has already moved it if a directory was renamed
+				// since.
+				string path = next_event.Path;
+				if (path == null)
+					path = watched.Path;
+
 				string srcpath = null;
 
-				// If this event is a paired MoveTo, there is extra work to do.
+				// If this event is a paired MoveTo, set the source path accordingly.
 				if ((next_event.Type & EventType.MovedTo) != 0 && next_event.PairedMove != null) {
 					WatchInfo paired_watched;
 					paired_watched = Lookup (next_event.PairedMove.Wd, next_event.PairedMove.Type);
 
 					if (paired_watched != null) {
-						// Set the source path accordingly.
-						srcpath = Path.Combine (paired_watched.Path, next_event.PairedMove.Filename);
-						
-						// Handle the internal rename of the directory.
-						if ((next_event.Type & EventType.IsDirectory) != 0)
-							HandleMove (srcpath, watched.Path, next_event.Filename);
+						string srcdir = next_event.PairedMove.Path;
+						if (srcdir == null)
+							srcdir = paired_watched.Path;
+						srcpath = Path.Combine (srcdir, next_event.PairedMove.Filename);
 					}
 				}
 
-				SendEvent (watched, next_event.Filename, srcpath, next_event.Type);
+				SendEvent (watched, path, next_event.Filename, srcpath, next_event.Type);
 
 				// If a directory we are watching gets ignored, we need
 				// to remove it from the watchedByFoo hashes.
@@ -872,12 +1207,17 @@ namespace Beagle.Util {
 			while (to_watch.Count > 0) {
 				string path = (string) to_watch.Dequeue ();
 
-				Console.WriteLine ("Watching {0}", path);
-				Inotify.Subscribe (path, null, Inotify.EventType.All);
+				if (! recursive) {
+					Console.WriteLine ("Watching {0}", path);
+					Inotify.Subscribe (path, null, Inotify.EventType.All);
+					continue;
+				}
 
-				if (recursive) {
-					foreach (string subdir in DirectoryWalker.GetDirectories (path))
-						to_watch.Enqueue (subdir);
+				foreach (TreeWatch tw in Inotify.SubscribeTree (path, null, Inotify.EventType.All)) {
+					if (tw.Watch != null)
+						Console.WriteLine ("Watching {0}", tw.Path);
+					else
+						Console.WriteLine ("Could not watch {0}: {1}", tw.Path, tw.Error);
 				}
 			}
 
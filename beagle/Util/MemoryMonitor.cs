@@ -0,0 +1,223 @@
+//
+// MemoryMonitor.cs
+//
+// Copyright (C) 2026 the author(s) of beagle.
+//
+
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+
+using System;
+using System.Runtime.InteropServices;
+
+namespace Beagle.Util {
+
+	// Samples our memory use every second in the background and keeps
+	// the last ten minutes of it, so that decisions like restarting to
+	// get memory back can look at how it has been going rather than at
+	// a single reading.  See vmsize-glue.c.
+
+	public static class MemoryMonitor {
+
+		[StructLayout (LayoutKind.Sequential)]
+		public struct Sample {
+			public long   Time;		// Milliseconds, on a monotonic clock
+			public long   Serial;
+			public long   VmSize;		// KB, as are the next five
+			public long   VmRss;
+			public long   RssShared;
+			public long   Pss;		// -1 when the kernel can't tell
+			public long   Anonymous;
+			public long   Swap;
+			public long   HeapArena;	// Bytes, from malloc
+			public long   HeapInUse;
+			public long   HeapFree;
+			public long   HeapMmapped;
+			public double MemorySome;	// Share of the interval the system stalled on memory
+			public double MemoryFull;
+		}
+
+		[DllImport ("libbeagleglue")]
+		static extern int memory_glue_start (int interval_msec);
+
+		[DllImport ("libbeagleglue")]
+		static extern void memory_glue_stop ();
+
+		[DllImport ("libbeagleglue")]
+		static extern int memory_glue_get_latest (out Sample sample);
+
+		[DllImport ("libbeagleglue")]
+		static extern int memory_glue_get_history ([Out] Sample [] samples, int max);
+
+		[DllImport ("libbeagleglue")]
+		static extern int memory_glue_history_size ();
+
+		private static bool available = false;
+
+		public static void Start ()
+		{
+			lock (typeof (MemoryMonitor)) {
+				if (available)
+					return;
+
+				int rc;
+				try {
+					rc = memory_glue_start (0);
+				} catch (EntryPointNotFoundException) {
+					return;
+				}
+
+				if (rc < 0) {
+					Log.Debug ("Unable to sample memory usage, falling back to single readings");
+					return;
+				}
+
+				available = true;
+			}
+		}
+
+		public static void Stop ()
+		{
+			lock (typeof (MemoryMonitor)) {
+				if (! available)
+					return;
+
+				memory_glue_stop ();
+				available = false;
+			}
+		}
+
+		public static bool Available {
+			get { return available; }
+		}
+
+		// Returns false if there is no sample yet.
+		public static bool GetLatest (out Sample sample)
+		{
+			if (! available) {
+				sample = new Sample ();
+				return false;
+			}
+
+			return memory_glue_get_latest (out sample) == 0;
+		}
+
+		// The samples from the last 'span', oldest first.
+		public static Sample [] GetHistory (TimeSpan span)
+		{
+			if (! available)
+				return new Sample [0];
+
+			Sample [] samples = new Sample [memory_glue_history_size ()];
+			int n = memory_glue_get_history (samples, samples.Length);
+
+			int first = 0;
+			if (n > 0) {
+				long since = samples [n - 1].Time - (long) span.TotalMilliseconds;
+				while (first < n && samples [first].Time < since)
+					++first;
+			}
+
+			Sample [] result = new Sample [n - first];
+			Array.Copy (samples, first, result, 0, result.Length);
+			return result;
+		}
+
+		// The lowest resident size over the last 'span', in KB: what we
+		// have held on to throughout, rather than a passing peak.  Falls
+		// back to the current size without a history.
+		public static int SustainedRss (TimeSpan span)
+		{
+			Sample [] samples = GetHistory (span);
+
+			if (samples.Length == 0)
+				return SystemInformation.VmRss;
+
+			long min = Int64.MaxValue;
+			foreach (Sample s in samples)
+				if (s.VmRss >= 0 && s.VmRss < min)
+					min = s.VmRss;
+
+			return min == Int64.MaxValue ? SystemInformation.VmRss : (int) min;
+		}
+
+		// How fast the resident size has been growing over the last
+		// 'span', in KB per second, as the slope of a least squares fit.
+		public static double RssTrend (TimeSpan span)
+		{
+			Sample [] samples = GetHistory (span);
+
+			if (samples.Length < 2)
+				return 0;
+
+			double t0 = samples [0].Time;
+			double sum_t = 0, sum_r = 0, sum_tt = 0, sum_tr = 0;
+			int n = 0;
+
+			foreach (Sample s in samples) {
+				if (s.VmRss < 0)
+					continue;
+				double t = (s.Time - t0) / 1000.0;
+				sum_t += t;
+				sum_r += s.VmRss;
+				sum_tt += t * t;
+				sum_tr += t * s.VmRss;
+				++n;
+			}
+
+			double d = n * sum_tt - sum_t * sum_t;
+			if (n < 2 || d <= 0)
+				return 0;
+
+			return (n * sum_tr - sum_t * sum_r) / d;
+		}
+
+		// Log a summary of the last 'span', a sample every 'step'.
+		public static void LogHistory (TimeSpan span, TimeSpan step)
+		{
+			Sample [] samples = GetHistory (span);
+
+			if (samples.Length == 0)
+				return;
+
+			Log.Debug ("Memory history, last {0}: VmRSS trend {1:0.0} KB/s",
+				   StringFu.TimeSpanToString (span), RssTrend (span));
+
+			long last_time = Int64.MinValue;
+			long now = samples [samples.Length - 1].Time;
+
+			for (int i = 0; i < samples.Length; ++i) {
+				Sample s = samples [i];
+
+				// Always show the newest one
+				if (s.Time - last_time < (long) step.TotalMilliseconds && i < samples.Length - 1)
+					continue;
+				last_time = s.Time;
+
+				Log.Debug ("  -{0,4}s: VmSize={1:0.0} MB VmRSS={2:0.0} MB PSS={3:0.0} MB Anon={4:0.0} MB Swap={5:0.0} MB, heap {6:0.0}/{7:0.0} MB in use, {8:0.0} MB mmapped, stalled {9:0.00}/{10:0.00}",
+					   (now - s.Time) / 1000,
+					   s.VmSize / 1024.0, s.VmRss / 1024.0, s.Pss / 1024.0, s.Anonymous / 1024.0, s.Swap / 1024.0,
+					   s.HeapInUse / 1048576.0, (s.HeapArena + s.HeapMmapped) / 1048576.0, s.HeapMmapped / 1048576.0,
+					   s.MemorySome, s.MemoryFull);
+			}
+		}
+	}
+}
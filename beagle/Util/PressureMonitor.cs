@@ -0,0 +1,158 @@
+//
+// PressureMonitor.cs
+//
+// Copyright (C) 2026 the author(s) of beagle.
+//
+
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+
+using System;
+using System.Runtime.InteropServices;
+
+namespace Beagle.Util {
+
+	// Watches how much the machine is stalling on I/O, CPU and memory
+	// (Linux's pressure stall information) and works out how hard we
+	// should be working: Throttle goes from 1, full speed, down towards
+	// 0 within a tenth of a second of contention, and back up within a
+	// second of it ending.  See pressure-glue.c.
+
+	public static class PressureMonitor {
+
+		[StructLayout (LayoutKind.Sequential)]
+		public struct State {
+			public double Throttle;
+			public double IoSome;		// Share of the last interval stalled on each
+			public double IoFull;
+			public double CpuSome;
+			public double MemorySome;
+			public double MemoryFull;
+			public double ReadRate;		// Bytes/s we read from and wrote to storage
+			public double WriteRate;
+			public double IoShare;		// Our share of the disks' throughput
+			public int    IoClass;		// I/O class we set, 0 if we leave it alone
+			public int    Running;
+			public ulong  Samples;
+			public ulong  Backoffs;
+		}
+
+		[DllImport ("libbeagleglue")]
+		static extern int pressure_glue_start (int interval_msec);
+
+		[DllImport ("libbeagleglue")]
+		static extern void pressure_glue_stop ();
+
+		[DllImport ("libbeagleglue")]
+		static extern void pressure_glue_set_adjust_io_priority (int adjust);
+
+		[DllImport ("libbeagleglue")]
+		static extern double pressure_glue_get_throttle ();
+
+		[DllImport ("libbeagleglue")]
+		static extern void pressure_glue_get_state (out State state);
+
+		private static bool started = false;
+		private static bool available = false;
+
+		// Starts sampling, if it hasn't been started already.  With
+		// adjust_io_priority, the I/O class of the threads in background
+		// roles (see SystemPriorities.SetThreadRole) follows the throttle
+		// factor too: idle while throttled, the lowest best-effort
+		// priority when the machine is quiet.
+		public static void Start (bool adjust_io_priority)
+		{
+			lock (typeof (PressureMonitor)) {
+				if (! started) {
+					started = true;
+
+					if (Environment.GetEnvironmentVariable ("BEAGLE_DISABLE_PRESSURE_MONITOR") != null) {
+						Log.Debug ("BEAGLE_DISABLE_PRESSURE_MONITOR is set");
+						return;
+					}
+
+					int rc;
+					try {
+						rc = pressure_glue_start (0);
+					} catch (EntryPointNotFoundException) {
+						return;
+					}
+
+					if (rc < 0) {
+						Log.Debug ("No pressure stall information available, not throttling by it");
+						return;
+					}
+
+					available = true;
+					Log.Debug ("Monitoring pressure stall information");
+				}
+
+				if (available && adjust_io_priority) {
+					pressure_glue_set_adjust_io_priority (1);
+					Log.Debug ("Adjusting IO priority to system pressure");
+				}
+			}
+		}
+
+		public static void Stop ()
+		{
+			lock (typeof (PressureMonitor)) {
+				if (! available)
+					return;
+
+				pressure_glue_stop ();
+				available = false;
+			}
+		}
+
+		public static bool Available {
+			get { return available; }
+		}
+
+		// How much of our usual pace to keep up, from 1 down to 0.05
+		public static double Throttle {
+			get { return available ? pressure_glue_get_throttle () : 1.0; }
+		}
+
+		public static State GetState ()
+		{
+			State state;
+
+			if (! available)
+				return new State ();
+
+			pressure_glue_get_state (out state);
+			return state;
+		}
+
+		public static void LogState ()
+		{
+			if (! available)
+				return;
+
+			State state = GetState ();
+			Log.Debug ("Pressure: throttle {0:0.00} ({1} backoffs in {2} samples), stalled io {3:0.00}/{4:0.00} cpu {5:0.00} memory {6:0.00}/{7:0.00}, own io {8:0} KB/s read {9:0} KB/s written ({10:0%} of the disks)",
+				   state.Throttle, state.Backoffs, state.Samples,
+				   state.IoSome, state.IoFull, state.CpuSome, state.MemorySome, state.MemoryFull,
+				   state.ReadRate / 1024, state.WriteRate / 1024, state.IoShare);
+		}
+	}
+}
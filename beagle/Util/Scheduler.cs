@@ -84,6 +84,9 @@ namespace Beagle.Util {
 			public ITaskCollector Collector = null;
 			public double Weight = 1.0;
 
+			// The role the worker thread takes on while running this task
+			public ThreadRole Role = ThreadRole.Indexer;
+
 			public bool Reschedule = false;
 
 			private ArrayList task_groups = null;
@@ -689,6 +692,7 @@ namespace Beagle.Util {
 				if (shutdown_requested || thread != null)
 					return;
 				running = true;
+				PressureMonitor.Start (false);
 				thread = ExceptionHandlingThread.Start (new ThreadStart (Worker));
 			}
 		}
@@ -801,14 +805,26 @@ namespace Beagle.Util {
 			}
 
 
-			// FIXME: we should do something more sophisticated than this
-			// with the load average.
-			// Random numbers galore!
-			double load_average = SystemInformation.LoadAverageOneMinute;
-			if (load_average > 3.001)
-				rate_factor *= 5.002;
-			else if (load_average > 1.5003)
-				rate_factor *= 2.004;
+			if (PressureMonitor.Available) {
+				// Pressure stall information tells us how much other
+				// work is actually held up, not just how much there is.
+				// Cut the share of time we spend working by the throttle
+				// factor: we work d out of every d * (1 + rate_factor)
+				// seconds, so this becomes d out of every
+				// d * (1 + rate_factor) / throttle.
+				double throttle = PressureMonitor.Throttle;
+				if (throttle < 1.0)
+					rate_factor = (1 + rate_factor) / throttle - 1;
+			} else {
+				// FIXME: we should do something more sophisticated than this
+				// with the load average.
+				// Random numbers galore!
+				double load_average = SystemInformation.LoadAverageOneMinute;
+				if (load_average > 3.001)
+					rate_factor *= 5.002;
+				else if (load_average > 1.5003)
+					rate_factor *= 2.004;
+			}
 
 			double delay = rate_factor * duration_of_previous_task;
 
@@ -1059,6 +1075,7 @@ namespace Beagle.Util {
 					}
 				}
 				foreach (Task task in to_be_executed) {
+					SystemPriorities.SetThreadRole (task.Role);
 					task.DoTask ();
 					++total_executed_task_count;
 					++executed_task_count;
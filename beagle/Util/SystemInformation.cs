@@ -212,6 +212,12 @@ namespace Beagle.Util {
 
 			Logger.Log.Debug ("Memory usage: VmSize={0:.0} MB, VmRSS={1:.0} MB,  GC.GetTotalMemory={2} ({3} colls)",
 					  vm_size/1024.0, vm_rss/1024.0, GC.GetTotalMemory (false), GC.CollectionCount (2));
+
+			MemoryMonitor.Sample sample;
+			if (MemoryMonitor.GetLatest (out sample))
+				Logger.Log.Debug ("Memory usage: PSS={0:.0} MB, anonymous={1:.0} MB, swapped={2:.0} MB, malloc={3:.0} MB in use, VmRSS trend {4:0.0} KB/s over the last minute",
+						  sample.Pss/1024.0, sample.Anonymous/1024.0, sample.Swap/1024.0,
+						  sample.HeapInUse/1048576.0, MemoryMonitor.RssTrend (TimeSpan.FromMinutes (1)));
 		}
 
 		///////////////////////////////////////////////////////////////
@@ -28,6 +28,16 @@ using System;
 using System.Runtime.InteropServices;
 
 namespace Beagle.Util {
+
+	// What a thread is doing, as far as the kernel's CPU and I/O schedulers
+	// are concerned.  See SystemPriorities.SetThreadRole.
+	public enum ThreadRole {
+		Query,
+		Snippet,
+		Indexer,
+		Filter,
+		Crawler
+	}
 	
 	public static class SystemPriorities {
 
@@ -69,6 +79,9 @@ namespace Beagle.Util {
 				Log.Debug ("Reniced process to {0}", nice);
 			else
 				Log.Debug ("Process was already niced to {0}, not renicing to {1}", prio, nice);
+
+			if (prio >= 0)
+				base_nice = prio;
 		}
 
 		//////////////////////////////////////////////////////////////
@@ -99,5 +112,178 @@ namespace Beagle.Util {
 
 			return rc >= 0;
 		}
+	
+		//////////////////////////////////////////////////////////////
+		// Thread roles
+
+		// Priorities, scheduler policies and nice values are all per
+		// thread on Linux, so instead of lowering the whole process we
+		// can tag each thread with what it is doing.  Queries and
+		// snippets keep the process' priorities while indexing work
+		// around them backs off.  Threads that run work of different
+		// kinds, like the scheduler's worker or a ThreadPond, switch
+		// role as they pick up each piece of work.
+		//
+		// The I/O priority of the background roles belongs to the glue,
+		// where the PressureMonitor can move all of them between classes
+		// as the machine gets busy or quiet.  It leaves the others alone.
+
+		[DllImport ("libbeagleglue")]
+		static extern int get_thread_io_priority (int tid);
+
+		[DllImport ("libbeagleglue")]
+		static extern int set_thread_io_priority (int tid, int ioprio);
+
+		[DllImport ("libbeagleglue")]
+		static extern int set_background_thread_io_priority_idle (int tid);
+
+		[DllImport ("libbeagleglue")]
+		static extern int set_background_thread_io_priority_best_effort (int tid, int ioprio);
+
+		[DllImport ("libbeagleglue")]
+		static extern int set_thread_scheduler_policy_batch (int tid);
+
+		[DllImport ("libbeagleglue")]
+		static extern int set_thread_scheduler_policy_other (int tid);
+
+		[DllImport ("libbeagleglue")]
+		static extern int set_thread_nice (int tid, int nice);
+
+		[DllImport ("libbeagleglue")]
+		static extern int get_thread_nice (int tid, out int nice);
+
+		// For IoPriority: whatever the process has
+		const int ProcessIoPriority = -1;
+
+		private struct RolePriorities {
+			public bool IoIdle;
+			public int IoPriority;	// Within the best effort class
+			public bool Batch;
+			public int NiceIncrement;	// Over the process' nice value
+
+			public RolePriorities (bool io_idle, int io_priority, bool batch, int nice_increment)
+			{
+				this.IoIdle = io_idle;
+				this.IoPriority = io_priority;
+				this.Batch = batch;
+				this.NiceIncrement = nice_increment;
+			}
+		}
+
+		// Indexed by ThreadRole.  The background roles all share a
+		// nice value: an unprivileged thread can't lower its nice value
+		// once it has raised it, so a thread moving between them would
+		// otherwise stay at the highest one it has been at.
+		static RolePriorities [] role_priorities = new RolePriorities [] {
+			new RolePriorities (false, ProcessIoPriority, false, 0),	// Query
+			new RolePriorities (false, ProcessIoPriority, false, 0),	// Snippet
+			new RolePriorities (false, 7, true,  5),	// Indexer
+			new RolePriorities (true,  7, true,  5),	// Filter
+			new RolePriorities (true,  7, true,  5)		// Crawler
+		};
+
+		// The nice value roles are relative to: whatever Renice set, or
+		// else what the first thread to take on a role was running at.
+		static int base_nice = Int32.MinValue;
+
+		// Likewise the I/O priority, as the raw value the kernel uses
+		static int base_ioprio = -1;
+
+		static bool warned_about_roles = false;
+
+		// What the calling thread was last set to, so that switching to
+		// the role it already has costs nothing.
+		[ThreadStatic]
+		static bool has_role;
+
+		[ThreadStatic]
+		static ThreadRole current_role;
+
+		static public ThreadRole CurrentThreadRole {
+			get { return has_role ? current_role : ThreadRole.Query; }
+		}
+
+		// Switch the calling thread to the given role and return the
+		// role it had before, so that callers can put it back.
+		static public ThreadRole SetThreadRole (ThreadRole role)
+		{
+			ThreadRole old_role = CurrentThreadRole;
+
+			if (has_role && role == current_role)
+				return old_role;
+
+			// A thread that never had a role has the process'
+			// priorities, which are not necessarily the query ones,
+			// so set everything the first time.
+			if (! has_role && base_ioprio < 0)
+				base_ioprio = get_thread_io_priority (0);
+
+			ApplyRole (0, role, ! has_role,
+				   role_priorities [(int) old_role],
+				   role_priorities [(int) role]);
+
+			has_role = true;
+			current_role = role;
+
+			return old_role;
+		}
+
+		// Set the role of another thread, by its kernel thread id.
+		static public void SetThreadRole (int tid, ThreadRole role)
+		{
+			RolePriorities prio = role_priorities [(int) role];
+			ApplyRole (tid, role, true, prio, prio);
+		}
+
+		static void ApplyRole (int tid, ThreadRole role, bool set_all,
+				       RolePriorities old_prio, RolePriorities new_prio)
+		{
+			bool ok = true;
+
+			if (set_all
+			    || old_prio.IoIdle != new_prio.IoIdle
+			    || old_prio.IoPriority != new_prio.IoPriority) {
+				int rc = 0;
+				if (new_prio.IoPriority == ProcessIoPriority) {
+					if (base_ioprio >= 0)
+						rc = set_thread_io_priority (tid, base_ioprio);
+				} else if (new_prio.IoIdle)
+					rc = set_background_thread_io_priority_idle (tid);
+				else
+					rc = set_background_thread_io_priority_best_effort (tid, new_prio.IoPriority);
+				ok &= (rc >= 0);
+			}
+
+			if (set_all || old_prio.Batch != new_prio.Batch) {
+				int rc;
+				if (new_prio.Batch)
+					rc = set_thread_scheduler_policy_batch (tid);
+				else
+					rc = set_thread_scheduler_policy_other (tid);
+				ok &= (rc >= 0);
+			}
+
+			if (set_all || old_prio.NiceIncrement != new_prio.NiceIncrement) {
+				if (base_nice == Int32.MinValue) {
+					int nice;
+					if (get_thread_nice (0, out nice) == 0)
+						base_nice = nice;
+				}
+
+				// Failing to lower the nice value is expected
+				// when we aren't privileged; don't complain.
+				if (base_nice != Int32.MinValue) {
+					int nice = Math.Min (base_nice + new_prio.NiceIncrement, 19);
+					int rc = set_thread_nice (tid, nice);
+					if (rc < 0 && (set_all || new_prio.NiceIncrement > old_prio.NiceIncrement))
+						ok = false;
+				}
+			}
+
+			if (! ok && ! warned_about_roles) {
+				Log.Warn ("Unable to set all of the priorities of thread {0} for role {1}", tid, role);
+				warned_about_roles = true;
+			}
+		}
 	}
 }
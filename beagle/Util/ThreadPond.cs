@@ -53,10 +53,26 @@ namespace Beagle.Util {
 			running = false;
 		}
 
+		private class RoleClosure {
+			public ThreadStart Start;
+			public ThreadRole Role;
+		}
+
 		public void Add (ThreadStart start)
 		{
+			Add (start, ThreadRole.Indexer);
+		}
+
+		// The worker that picks this up switches to the given role
+		// while running it.
+		public void Add (ThreadStart start, ThreadRole role)
+		{
+			RoleClosure closure = new RoleClosure ();
+			closure.Start = start;
+			closure.Role = role;
+
 			lock (queue_lock) {
-				queue.Enqueue (start);
+				queue.Enqueue (closure);
 				Monitor.Pulse (queue_lock);
 			}
 		}
@@ -84,7 +100,7 @@ namespace Beagle.Util {
 		{
 			while (running) {
 				
-				ThreadStart start = null;
+				RoleClosure closure = null;
 
 				lock (queue_lock) {
 					if (! running)
@@ -93,14 +109,15 @@ namespace Beagle.Util {
 						Monitor.Wait (queue_lock);
 						continue;
 					}
-					start = queue.Dequeue () as ThreadStart;
+					closure = queue.Dequeue () as RoleClosure;
 				}
 
-				if (start == null)
+				if (closure == null)
 					continue;
 
 				try {
-					start ();
+					SystemPriorities.SetThreadRole (closure.Role);
+					closure.Start ();
 				} catch (Exception ex) {
 					Logger.Log.Warn ("Caught exception in ThreadPond worker");
 					Logger.Log.Warn (ex);
@@ -35,17 +35,152 @@ namespace Beagle.Util {
 	public class XdgMime {
 
 		[DllImport ("libbeagleglue")]
-		static extern IntPtr xdg_mime_get_mime_type_from_file_name (string file_name);
+		static extern IntPtr xdg_mime_context_new ();
 
 		[DllImport ("libbeagleglue")]
-		static extern IntPtr xdg_mime_get_mime_type_for_data ([In] byte[] data, IntPtr len);
+		static extern IntPtr xdg_mime_context_get_snapshot (IntPtr context);
 
 		[DllImport ("libbeagleglue")]
-		static extern bool xdg_mime_mime_type_subclass (string subclass, string superclass);
+		static extern void xdg_mime_snapshot_unref (IntPtr snapshot);
+
+		[DllImport ("libbeagleglue")]
+		static extern IntPtr xdg_mime_snapshot_get_mime_type_from_file_name (IntPtr snapshot, string file_name);
+
+		[DllImport ("libbeagleglue")]
+		static extern IntPtr xdg_mime_snapshot_get_mime_type_for_fd (IntPtr snapshot, int fd, string file_name, out IntPtr data, out IntPtr len);
+
+		// Where the result cache keeps the type we settle on for a file
+		[StructLayout (LayoutKind.Sequential)]
+		private struct FileStamp {
+			public ulong Dev;
+			public ulong Ino;
+			public ulong Size;
+			public long  Mtime;
+			public uint  Key;
+			public int   Valid;
+		}
+
+		[DllImport ("libbeagleglue")]
+		static extern IntPtr xdg_mime_snapshot_get_file_result (IntPtr snapshot, string file_name, out FileStamp stamp);
+
+		[DllImport ("libbeagleglue")]
+		static extern void xdg_mime_snapshot_set_file_result (IntPtr snapshot, ref FileStamp stamp, string mime_type);
+
+		[DllImport ("libbeagleglue")]
+		static extern int xdg_mime_context_set_result_cache (IntPtr context, string file_name, int n_entries);
+
+		[StructLayout (LayoutKind.Sequential)]
+		public struct ResultCacheStats {
+			public ulong Hits;
+			public ulong Misses;
+			public ulong Insertions;
+			public ulong Evictions;		// Entries dropped to make room
+			public ulong Entries;		// In use, including those read back from the file
+			public ulong Capacity;
+			public ulong Persistent;	// Whether they are kept in a file
+		}
+
+		[DllImport ("libbeagleglue")]
+		static extern int xdg_mime_context_get_result_cache_stats (IntPtr context, out ResultCacheStats stats);
+
+		[DllImport ("libbeagleglue")]
+		static extern int xdg_mime_context_watch (IntPtr context);
+
+		[StructLayout (LayoutKind.Sequential)]
+		public struct ReloadStats {
+			public ulong Reloads;		// Times the files were reread after changing
+			public ulong LastReload;	// When they last were, in microseconds since the epoch
+			public ulong Events;		// Changes to the files the watching thread was told of
+			public ulong Watching;		// Whether a thread watches them
+		}
+
+		[DllImport ("libbeagleglue")]
+		static extern void xdg_mime_context_get_reload_stats (IntPtr context, out ReloadStats stats);
+
+		[DllImport ("libbeagleglue")]
+		static extern bool xdg_mime_snapshot_mime_type_subclass (IntPtr snapshot, string subclass, string superclass);
+
+		// One database for all threads.  Each lookup works on a snapshot
+		// of it, which stays valid even if the files change under it, so
+		// any number of threads can look things up at once.
+		private static IntPtr context = xdg_mime_context_new ();
+
+		private static bool result_cache_enabled = false;
+
+		// Remembers what type up to 'size' files turned out to be, by
+		// inode, mtime and size, so that unchanged files aren't opened
+		// again on the next crawl.  With a path, the results are
+		// kept there from one run to the next, unless another process
+		// already has the file.
+		public static bool EnableResultCache (string path, int size)
+		{
+			if (xdg_mime_context_set_result_cache (context, path, size) != 0)
+				return false;
+
+			result_cache_enabled = true;
+			return true;
+		}
+
+		public static ResultCacheStats GetResultCacheStats ()
+		{
+			ResultCacheStats stats;
+			xdg_mime_context_get_result_cache_stats (context, out stats);
+			return stats;
+		}
+
+		public static void LogResultCacheStats ()
+		{
+			if (! result_cache_enabled)
+				return;
+
+			ResultCacheStats stats = GetResultCacheStats ();
+
+			Log.Debug ("MIME result cache: {0} hits, {1} misses, {2} of {3} entries in use, {4} evicted{5}",
+				   stats.Hits, stats.Misses, stats.Entries, stats.Capacity, stats.Evictions,
+				   stats.Persistent != 0 ? "" : " (not persistent)");
+		}
+
+		// Has a thread watch the shared MIME database with inotify
+		// and reload it in the background when it changes, instead
+		// of lookups checking the files every few seconds and
+		// reloading them on whichever thread happens to notice.
+		public static bool Watch ()
+		{
+			return xdg_mime_context_watch (context) == 0;
+		}
+
+		public static ReloadStats GetReloadStats ()
+		{
+			ReloadStats stats;
+			xdg_mime_context_get_reload_stats (context, out stats);
+			return stats;
+		}
+
+		public static void LogReloadStats ()
+		{
+			ReloadStats stats = GetReloadStats ();
+
+			if (stats.Reloads == 0) {
+				Log.Debug ("MIME database: not reloaded{0}", stats.Watching != 0 ? ", watching for changes" : "");
+				return;
+			}
+
+			DateTime last_reload = DateTimeUtil.UnixToDateTimeUtc ((long) (stats.LastReload / 1000000)).ToLocalTime ();
+
+			Log.Debug ("MIME database: reloaded {0} times, last at {1}{2}",
+				   stats.Reloads, last_reload,
+				   stats.Watching != 0 ? String.Format (", {0} changes seen", stats.Events) : "");
+		}
 
 		public static string GetMimeTypeFromFileName (string file_name)
 		{
-			return Marshal.PtrToStringAnsi (xdg_mime_get_mime_type_from_file_name (file_name));
+			IntPtr snapshot = xdg_mime_context_get_snapshot (context);
+
+			try {
+				return Marshal.PtrToStringAnsi (xdg_mime_snapshot_get_mime_type_from_file_name (snapshot, file_name));
+			} finally {
+				xdg_mime_snapshot_unref (snapshot);
+			}
 		}
 
 		private const string UNKNOWN_MIME_TYPE = "application/octet-stream";
@@ -64,6 +199,18 @@ namespace Beagle.Util {
 
 		public static string GetMimeType (string file_path)
 		{
+			byte[] header;
+
+			return GetMimeType (file_path, out header);
+		}
+
+		// Also hands back the start of the file, as read for sniffing
+		// (or null if it wasn't read, which with the result cache it
+		// usually isn't), so that callers don't have to read it again.
+		public static string GetMimeType (string file_path, out byte[] header)
+		{
+			header = null;
+
 			string mime_type = GetMimeTypeFromXattr (file_path);
 			if (mime_type != null)
 				return mime_type;
@@ -72,40 +219,68 @@ namespace Beagle.Util {
 			Console.WriteLine ("From xattr: [{0}]", mime_type);
 #endif
 
-			string content_mime_type, extension_mime_type;
+			IntPtr snapshot = xdg_mime_context_get_snapshot (context);
+
+			try {
+				return GetMimeType (snapshot, file_path, out header);
+			} finally {
+				xdg_mime_snapshot_unref (snapshot);
+			}
+		}
+
+		// Sniffs the contents of the file.  The start of the file is
+		// read once, by xdgmime, into a buffer of this thread's, and
+		// copied out from there.
+		private static byte[] SniffContent (IntPtr snapshot, string file_path, out string content_mime_type)
+		{
+			content_mime_type = UNKNOWN_MIME_TYPE;
 
-			FileStream fs = null;
-			byte[] buf = null;
-			int len = -1;
+			int fd = Mono.Unix.Native.Syscall.open (file_path, Mono.Unix.Native.OpenFlags.O_RDONLY);
+			if (fd == -1)
+				return null;
 
 			try {
-				fs = new FileStream (file_path, FileMode.Open, FileAccess.Read, FileShare.Read, 4096);
-
-				buf = new byte [4096];
-				len = fs.Read (buf, 0, 4096);
-
-				fs.Close ();
-
-				if (len == 0)
-					content_mime_type = UNKNOWN_MIME_TYPE;
-				else
-					content_mime_type = Marshal.PtrToStringAnsi (xdg_mime_get_mime_type_for_data (buf, new IntPtr (len)));
-				
-			} catch (UnauthorizedAccessException) {
-				content_mime_type = UNKNOWN_MIME_TYPE;
-			} catch (System.Security.SecurityException) {
-				content_mime_type = UNKNOWN_MIME_TYPE;
-			} catch (FileNotFoundException) {
-				content_mime_type = UNKNOWN_MIME_TYPE;
-			} catch (IOException) {
-				content_mime_type = UNKNOWN_MIME_TYPE;
+				IntPtr data, len;
+				IntPtr type = xdg_mime_snapshot_get_mime_type_for_fd (snapshot, fd, null, out data, out len);
+
+				if (data == IntPtr.Zero)
+					return null;
+
+				byte[] buf = new byte [(int) len];
+				Marshal.Copy (data, buf, 0, buf.Length);
+
+				if (buf.Length > 0)
+					content_mime_type = Marshal.PtrToStringAnsi (type);
+
+				return buf;
+			} finally {
+				Mono.Unix.Native.Syscall.close (fd);
+			}
+		}
+
+		private static string GetMimeType (IntPtr snapshot, string file_path, out byte[] buf)
+		{
+			string mime_type;
+			string content_mime_type, extension_mime_type;
+
+			buf = null;
+
+			// With the result cache, what we settled on last time for
+			// an unchanged file is found without opening it.
+			FileStamp stamp = new FileStamp ();
+			if (result_cache_enabled) {
+				IntPtr cached = xdg_mime_snapshot_get_file_result (snapshot, file_path, out stamp);
+				if (cached != IntPtr.Zero)
+					return Marshal.PtrToStringAnsi (cached);
 			}
 
+			buf = SniffContent (snapshot, file_path, out content_mime_type);
+
 #if XDGMIME_DEBUG
 			Console.WriteLine ("From content: [{0}]", content_mime_type);
 #endif
 
-			extension_mime_type = Marshal.PtrToStringAnsi (xdg_mime_get_mime_type_from_file_name (file_path));
+			extension_mime_type = Marshal.PtrToStringAnsi (xdg_mime_snapshot_get_mime_type_from_file_name (snapshot, file_path));
 
 #if XDGMIME_DEBUG
 			Console.WriteLine ("From extension: [{0}]", extension_mime_type);
@@ -137,10 +312,10 @@ namespace Beagle.Util {
 				default:
 					
 #if XDGMIME_DEBUG
-					Console.WriteLine ("extension mimetype subclass of content mimetype ? {0}", xdg_mime_mime_type_subclass (extension_mime_type, content_mime_type));
+					Console.WriteLine ("extension mimetype subclass of content mimetype ? {0}", xdg_mime_snapshot_mime_type_subclass (snapshot, extension_mime_type, content_mime_type));
 #endif
 
-					if (xdg_mime_mime_type_subclass (extension_mime_type, content_mime_type))
+					if (xdg_mime_snapshot_mime_type_subclass (snapshot, extension_mime_type, content_mime_type))
 						mime_type = extension_mime_type;
 					else
 						mime_type = content_mime_type;
@@ -153,14 +328,18 @@ namespace Beagle.Util {
 			// text.
 			if (mime_type == UNKNOWN_MIME_TYPE
 			    && buf != null
-			    && len > 0
-			    && ValidateUTF8 (buf, len))
+			    && buf.Length > 0
+			    && ValidateUTF8 (buf, buf.Length))
 				mime_type = "text/plain";
 
 #if XDGMIME_DEBUG
 			Console.WriteLine ("Detected: [{0}]", mime_type);
 #endif
 
+			// A file we couldn't read may well be readable next time
+			if (buf != null && result_cache_enabled)
+				xdg_mime_snapshot_set_file_result (snapshot, ref stamp, mime_type);
+
 			return mime_type;
 		}
 
@@ -131,8 +131,11 @@ namespace Beagle.Daemon {
 				if (arg_heap_shot && arg_heap_shot_snapshots)
 					MaybeSendSigprof (vm_rss, GC.GetTotalMemory (false));
 
-				if (vm_rss > 300 * 1024) {
+				// Only restart if we've stayed that big for a
+				// while; a passing peak will be given back.
+				if (vm_rss > 300 * 1024 && MemoryMonitor.SustainedRss (TimeSpan.FromSeconds (30)) > 300 * 1024) {
 					Logger.Log.Debug ("VmRss too large --- shutting down");
+					MemoryMonitor.LogHistory (TimeSpan.FromMinutes (5), TimeSpan.FromSeconds (15));
 					Shutdown.BeginShutdown ();
 				}
 
@@ -474,6 +477,10 @@ namespace Beagle.Daemon {
 				Environment.Exit (-1);
 			}
 
+			MemoryMonitor.Start ();
+
+			XdgMime.Watch ();
+
 			// Start our memory-logging thread
 			if (arg_debug_memory) {
 				ExceptionHandlingThread.Start (new ThreadStart (LogMemoryUsage));
@@ -616,6 +623,10 @@ namespace Beagle.Daemon {
 				// Debugging hook for beagled
 				QueryDriver.DebugHook ();
 				LuceneCommon.DebugHook ();
+				Inotify.DebugHook ();
+				PressureMonitor.LogState ();
+				MemoryMonitor.LogHistory (TimeSpan.FromMinutes (10), TimeSpan.FromSeconds (30));
+				XdgMime.LogReloadStats ();
 				return;
 			}
 
@@ -49,7 +49,7 @@ namespace Beagle.Daemon.FileSystemQueryable {
 			if (this.directory == null)
 				done = true;
 			else 
-				files = DirectoryWalker.GetFileInfos (this.directory.FullName).GetEnumerator ();
+				files = DirectoryWalker.GetEntries (this.directory.FullName, true).GetEnumerator ();
 		}
 
 		public Indexable GetNextIndexable ()
@@ -58,15 +58,19 @@ namespace Beagle.Daemon.FileSystemQueryable {
 				return null;
 
 			while (files.MoveNext ()) {
-				FileInfo f = files.Current as FileInfo;
+				DirectoryWalker.Entry entry = (DirectoryWalker.Entry) files.Current;
 				Indexable indexable = null;
 				try { 
-					if (f.Exists
-					    && ! FileSystem.IsSpecialFile (f.FullName)
-					    && this.directory.IsAttached)
-						indexable = queryable.GetCrawlingFileIndexable (directory, f.Name);
+					if (! IsRegularFile (entry) || ! this.directory.IsAttached)
+						indexable = null;
+					else if (entry.HasStat)
+						indexable = queryable.GetCrawlingFileIndexable (directory, entry.Name,
+												entry.MtimeUtc, entry.CtimeUtc);
+					else
+						indexable = queryable.GetCrawlingFileIndexable (directory, entry.Name);
 				} catch (Exception ex) {
-					Logger.Log.Debug (ex, "Caught exception calling GetCrawlingFileIndexable on '{0}'", f.FullName);
+					Logger.Log.Debug (ex, "Caught exception calling GetCrawlingFileIndexable on '{0}'",
+							  Path.Combine (directory.FullName, entry.Name));
 				}
 				if (indexable != null)
 					return indexable;
@@ -76,6 +80,24 @@ namespace Beagle.Daemon.FileSystemQueryable {
 			return null;
 		}
 
+		// The entries come stat'd in a batch, which fills in the type
+		// the directory doesn't report, so we only have to stat one
+		// ourselves if that failed.
+		private bool IsRegularFile (DirectoryWalker.Entry entry)
+		{
+			switch (entry.Type) {
+			case DirectoryWalker.EntryType.Regular:
+				return true;
+
+			case DirectoryWalker.EntryType.Unknown:
+				string path = Path.Combine (directory.FullName, entry.Name);
+				return File.Exists (path) && ! FileSystem.IsSpecialFile (path);
+
+			default:
+				return false;
+			}
+		}
+
 		public bool HasNextIndexable ()
 		{
 			return ! done;
@@ -48,6 +48,7 @@ namespace Beagle.Daemon.FileSystemQueryable {
 			this.queryable = queryable;
 			this.Tag = "File Crawler";
 			this.Priority = Scheduler.Priority.Delayed;
+			this.Role = ThreadRole.Crawler;
 
 			this.our_post_hook = new Scheduler.Hook (PostCrawlHook);
 		}
@@ -544,6 +544,10 @@ namespace Beagle.Daemon.FileSystemQueryable {
 			// is actually added.
 			roots_by_path.Add (path);
 
+			// Set up the watches for the whole tree in one go, rather than
+			// one directory at a time as the tree crawler gets to them.
+			event_backend.WatchTree (path);
+
 			AddDirectory (null, path);
 		}
 
@@ -1054,8 +1058,13 @@ namespace Beagle.Daemon.FileSystemQueryable {
 		// During crawling, this is the sole method that finds the right id for a file based on its status, so
 		// it might make sense to make this thread safe so that asynchronos inotify events
 		// cannot cause any race.
+		// If the caller already has the mtime and ctime of the file, it passes them in
+		// last_write_time and last_attr_time; otherwise it passes DateTime.MinValue and
+		// the file is stat'd here.
 		private RequiredAction DetermineRequiredAction (DirectoryModel dir,
 								string         name,
+								DateTime       last_write_time,
+								DateTime       last_attr_time,
 								out Guid       id,
 								out string     last_known_path)
 		{
@@ -1137,17 +1146,18 @@ namespace Beagle.Daemon.FileSystemQueryable {
 				}
 			}
 
-			Mono.Unix.Native.Stat stat;
-			try {
-				Mono.Unix.Native.Syscall.stat (path, out stat);
-			} catch (Exception ex) {
-				Logger.Log.Debug (ex, "Caught exception stat-ing {0}", path);
-				return RequiredAction.None;
-			}
+			if (last_write_time == DateTime.MinValue) {
+				Mono.Unix.Native.Stat stat;
+				try {
+					Mono.Unix.Native.Syscall.stat (path, out stat);
+				} catch (Exception ex) {
+					Logger.Log.Debug (ex, "Caught exception stat-ing {0}", path);
+					return RequiredAction.None;
+				}
 
-			DateTime last_write_time, last_attr_time;
-			last_write_time = DateTimeUtil.UnixToDateTimeUtc (stat.st_mtime);
-			last_attr_time = DateTimeUtil.UnixToDateTimeUtc (stat.st_ctime);
+				last_write_time = DateTimeUtil.UnixToDateTimeUtc (stat.st_mtime);
+				last_attr_time = DateTimeUtil.UnixToDateTimeUtc (stat.st_ctime);
+			}
 
 			if (attr.LastWriteTime != last_write_time) {
 				if (Debug)
@@ -1211,6 +1221,13 @@ namespace Beagle.Daemon.FileSystemQueryable {
 		// Return an indexable that will do the right thing with a file
 		// (or null, if the right thing is to do nothing)
 		public Indexable GetCrawlingFileIndexable (DirectoryModel dir, string name)
+		{
+			return GetCrawlingFileIndexable (dir, name, DateTime.MinValue, DateTime.MinValue);
+		}
+
+		// The same, for a caller which has already stat'd the file
+		public Indexable GetCrawlingFileIndexable (DirectoryModel dir, string name,
+							   DateTime last_write_time, DateTime last_attr_time)
 		{
 			string path;
 			path = Path.Combine (dir.FullName, name);
@@ -1218,7 +1235,8 @@ namespace Beagle.Daemon.FileSystemQueryable {
 			RequiredAction action;
 			string last_known_path;
 			Guid unique_id;
-			action = DetermineRequiredAction (dir, name, out unique_id, out last_known_path);
+			action = DetermineRequiredAction (dir, name, last_write_time, last_attr_time,
+							  out unique_id, out last_known_path);
 
 			if (action == RequiredAction.None)
 				return null;
@@ -1428,6 +1446,12 @@ namespace Beagle.Daemon.FileSystemQueryable {
 
 		//////////////////////////////////////////////////////////////////////////
 
+		// Called by the tree crawler when it has nothing left to do
+		public void DoneCrawlingTree ()
+		{
+			event_backend.ForgetUnclaimedWatches ();
+		}
+
 		public void UpdateIsIndexing (DirectoryModel next_dir)
 		{
 			// If IsIndexing is false, then the indexing had
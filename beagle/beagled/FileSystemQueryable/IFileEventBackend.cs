@@ -30,6 +30,14 @@ namespace Beagle.Daemon.FileSystemQueryable {
 
 		object CreateWatch      (string path);
 		bool   ForgetWatch      (object watch_handle);
+
+		// Called before a root is crawled, so that a backend can set up
+		// the watches for the whole tree at once.  CreateWatch is still
+		// called for each directory that gets registered.
+		void   WatchTree        (string path);
+		// Called when the tree crawl runs dry, to drop any watches set up
+		// by WatchTree that CreateWatch never claimed.
+		void   ForgetUnclaimedWatches ();
 		
 		void Start (FileSystemQueryable queryable);
 	}
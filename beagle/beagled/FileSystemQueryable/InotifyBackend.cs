@@ -38,6 +38,40 @@ namespace Beagle.Daemon.FileSystemQueryable {
 		FileSystemQueryable queryable;
 		Inotify.InotifyCallback inotify_callback;
 
+		// Watches set up by WatchTree that the queryable hasn't asked for yet
+		Hashtable unclaimed_watches = new Hashtable ();
+		bool expiry_scheduled = false;
+
+		// Unclaimed watches older than this are dropped, so that subtrees
+		// the queryable never gets to (or ignores) don't keep theirs.  The
+		// queryable reads a directory when it registers it, so a watch
+		// that expires too soon only costs a fresh inotify_add_watch.
+		const int UNCLAIMED_WATCH_LIFETIME = 10 * 60;	// seconds
+		const uint EXPIRY_INTERVAL = 60 * 1000;		// milliseconds
+
+		private class UnclaimedWatch {
+			public Inotify.Watch Watch;
+			public DateTime      Since;
+
+			public UnclaimedWatch (Inotify.Watch watch, DateTime since)
+			{
+				this.Watch = watch;
+				this.Since = since;
+			}
+		}
+
+		// Events from different inotify instances arrive on different
+		// threads.  Those that change the queryable's directory models
+		// (anything on a directory, and moves) go through one at a time.
+		object directory_lock = new object ();
+
+		const Inotify.EventType mask = Inotify.EventType.Create
+					     | Inotify.EventType.Delete
+					     | Inotify.EventType.CloseWrite
+					     | Inotify.EventType.MovedFrom
+					     | Inotify.EventType.MovedTo
+					     | Inotify.EventType.Attrib;
+
 		public InotifyBackend ()
 		{
 			inotify_callback = new Inotify.InotifyCallback (OnInotifyEvent);
@@ -45,16 +79,17 @@ namespace Beagle.Daemon.FileSystemQueryable {
 
 		public object CreateWatch (string path)
 		{
+			lock (unclaimed_watches) {
+				UnclaimedWatch claimed = unclaimed_watches [path] as UnclaimedWatch;
+				if (claimed != null) {
+					unclaimed_watches.Remove (path);
+					return claimed.Watch;
+				}
+			}
+
 			object watch = null;
 			try {
-				watch = Inotify.Subscribe (path, inotify_callback,
-							   Inotify.EventType.Create
-							   | Inotify.EventType.Delete
-							   | Inotify.EventType.CloseWrite
-							   | Inotify.EventType.MovedFrom
-							   | Inotify.EventType.MovedTo
-							   | Inotify.EventType.Attrib);
-
+				watch = Inotify.Subscribe (path, inotify_callback, mask);
 			}
 			catch (IOException) {
 				// We can race and files can disappear.  No big deal.
@@ -62,6 +97,102 @@ namespace Beagle.Daemon.FileSystemQueryable {
 			return watch;
 		}
 
+		public void WatchTree (string path)
+		{
+			int failed = 0;
+			Inotify.TreeWatch [] tree;
+
+			// The walk can take a long time on a big tree, so do it
+			// without the lock, and only take it to publish the
+			// watches.  Until then, events on them get through to
+			// the queryable, which drops those on directories it
+			// hasn't registered yet.
+			try {
+				tree = Inotify.SubscribeTree (path, inotify_callback, mask);
+			} catch (IOException ex) {
+				Logger.Log.Debug ("Couldn't watch tree '{0}': {1}", path, ex.Message);
+				return;
+			}
+
+			if (tree == null)
+				return;
+
+			ArrayList duplicates = new ArrayList ();
+			DateTime now = DateTime.Now;
+
+			lock (unclaimed_watches) {
+				foreach (Inotify.TreeWatch tw in tree) {
+					if (tw.Watch == null) {
+						++failed;
+						continue;
+					}
+					if (unclaimed_watches.Contains (tw.Path))
+						duplicates.Add (tw.Watch);
+					else
+						unclaimed_watches [tw.Path] = new UnclaimedWatch (tw.Watch, now);
+				}
+
+				if (! expiry_scheduled && unclaimed_watches.Count > 0) {
+					expiry_scheduled = true;
+					GLib.Timeout.Add (EXPIRY_INTERVAL, new GLib.TimeoutHandler (ExpireUnclaimedWatches));
+				}
+			}
+
+			foreach (Inotify.Watch watch in duplicates)
+				ForgetWatch (watch);
+
+			Logger.Log.Debug ("Watched {0} directories under '{1}' ({2} could not be watched)", tree.Length - failed, path, failed);
+		}
+
+		// Drops the unclaimed watches that have been around for too long.
+		// Keeps running for as long as there are any left.
+		private bool ExpireUnclaimedWatches ()
+		{
+			ArrayList expired_paths = new ArrayList ();
+			ArrayList expired = new ArrayList ();
+			DateTime cutoff = DateTime.Now.AddSeconds (- UNCLAIMED_WATCH_LIFETIME);
+			bool keep_going;
+
+			lock (unclaimed_watches) {
+				foreach (DictionaryEntry entry in unclaimed_watches) {
+					UnclaimedWatch unclaimed = (UnclaimedWatch) entry.Value;
+					if (unclaimed.Since < cutoff) {
+						expired_paths.Add (entry.Key);
+						expired.Add (unclaimed.Watch);
+					}
+				}
+
+				foreach (string path in expired_paths)
+					unclaimed_watches.Remove (path);
+
+				keep_going = unclaimed_watches.Count > 0;
+				expiry_scheduled = keep_going;
+			}
+
+			if (expired.Count > 0)
+				Logger.Log.Debug ("Expiring {0} unclaimed watches", expired.Count);
+			foreach (Inotify.Watch watch in expired)
+				ForgetWatch (watch);
+
+			return keep_going;
+		}
+
+		public void ForgetUnclaimedWatches ()
+		{
+			ArrayList watches = new ArrayList ();
+			lock (unclaimed_watches) {
+				if (unclaimed_watches.Count == 0)
+					return;
+				foreach (UnclaimedWatch unclaimed in unclaimed_watches.Values)
+					watches.Add (unclaimed.Watch);
+				unclaimed_watches.Clear ();
+			}
+
+			Logger.Log.Debug ("Forgetting {0} unclaimed watches", watches.Count);
+			foreach (Inotify.Watch watch in watches)
+				ForgetWatch (watch);
+		}
+
 		public bool ForgetWatch (object watch_handle)
 		{
 			try {
@@ -83,10 +214,31 @@ namespace Beagle.Daemon.FileSystemQueryable {
 					     string            subitem,
 					     string            srcpath,
 					     Inotify.EventType type)
+		{
+			if ((type & (Inotify.EventType.IsDirectory | Inotify.EventType.MovedFrom | Inotify.EventType.MovedTo)) != 0) {
+				lock (directory_lock)
+					HandleInotifyEvent (watch, path, subitem, srcpath, type);
+			} else
+				HandleInotifyEvent (watch, path, subitem, srcpath, type);
+		}
+
+		private void HandleInotifyEvent (Inotify.Watch     watch,
+						 string            path,
+						 string            subitem,
+						 string            srcpath,
+						 Inotify.EventType type)
 		{
 			bool is_directory;
 			is_directory = (type & Inotify.EventType.IsDirectory) != 0;
 
+			// The queryable hasn't registered this directory yet, and will
+			// read it when it does.
+			lock (unclaimed_watches) {
+				UnclaimedWatch unclaimed = unclaimed_watches [path] as UnclaimedWatch;
+				if (unclaimed != null && unclaimed.Watch == watch)
+					return;
+			}
+
 			queryable.ReportEventInDirectory (path);
 
 			// The case of matched move events
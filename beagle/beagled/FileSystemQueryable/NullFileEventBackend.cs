@@ -48,6 +48,14 @@ namespace Beagle.Daemon.FileSystemQueryable {
 			return false;
 		}
 
+		public void WatchTree (string path)
+		{
+		}
+
+		public void ForgetUnclaimedWatches ()
+		{
+		}
+
 		public void Start (FileSystemQueryable queryable)
 		{
 		}
@@ -49,6 +49,7 @@ namespace Beagle.Daemon.FileSystemQueryable {
 			this.handler = handler;
 			this.Tag = "Tree Crawler";
 			this.Priority = Scheduler.Priority.Delayed;
+			this.Role = ThreadRole.Crawler;
 		}
 
 		public bool IsActive {
@@ -104,11 +105,18 @@ namespace Beagle.Daemon.FileSystemQueryable {
 					Logger.Log.Debug ("Scanning '{0}' for subdirectories", dir.FullName);
 
 				try {
-					foreach (string name in DirectoryWalker.GetDirectoryNames (dir.FullName)) {
-						string path;
-						path = Path.Combine (dir.FullName, name);
-						if (!FileSystem.IsSpecialFile (path))
-							handler (dir, name);
+					foreach (DirectoryWalker.Entry entry in DirectoryWalker.GetEntries (dir.FullName)) {
+						// Entries the directory says are
+						// directories can't be special files;
+						// the rest we have to stat.
+						if (entry.Type == DirectoryWalker.EntryType.Directory) {
+							handler (dir, entry.Name);
+						} else if (entry.Type == DirectoryWalker.EntryType.Unknown) {
+							string path;
+							path = Path.Combine (dir.FullName, entry.Name);
+							if (Directory.Exists (path) && !FileSystem.IsSpecialFile (path))
+								handler (dir, entry.Name);
+						}
 					}
 				} catch (DirectoryNotFoundException ex) {
 					Logger.Log.Debug ("Couldn't scan '{0}' for subdirectories", dir.FullName);
@@ -127,6 +135,7 @@ namespace Beagle.Daemon.FileSystemQueryable {
 		{
 			Log.Debug ("Done crawling directory tree!!!");
 			SetIsActive (false, null);
+			queryable.DoneCrawlingTree ();
 		}
 
 		internal void DebugHook ()
@@ -119,6 +119,21 @@ namespace Beagle.IndexHelper {
 
 			SystemPriorities.ReduceIoPriority ();
 
+			// When the machine is quiet, there is no reason to stay
+			// in the idle I/O class; go back to it as soon as anything
+			// else has to wait.
+			PressureMonitor.Start (true);
+
+			MemoryMonitor.Start ();
+
+			// Most files seen on a crawl haven't changed since the last
+			// one; remember what they were sniffed as.
+			XdgMime.EnableResultCache (Path.Combine (PathFinder.StorageDir, "MimeResults"), 65536);
+
+			// Reload the MIME database when it changes, off the
+			// threads doing the filtering.
+			XdgMime.Watch ();
+
 			int nice_to_set;
 				
 			// We set different nice values because the
@@ -228,10 +243,19 @@ namespace Beagle.IndexHelper {
 				}
 
 				last_vmrss = vmrss;
+
+				// Go by what we've held on to over the last few
+				// samples rather than a single reading, so that a
+				// large document doesn't get us restarted after
+				// its memory has been given back.
+				if (size > threshold)
+					size = MemoryMonitor.SustainedRss (TimeSpan.FromSeconds (10)) / (double) vmrss_original;
+
 				if (size > threshold
 				    || (max_request_count > 0 && RemoteIndexerExecutor.Count > max_request_count)) {
 					if (RemoteIndexerExecutor.Count > 0) {
 						Logger.Log.Debug ("Process too big, shutting down!");
+						MemoryMonitor.LogHistory (TimeSpan.FromMinutes (5), TimeSpan.FromSeconds (15));
 						Shutdown.BeginShutdown ();
 						return;
 					} else {
@@ -336,6 +360,10 @@ namespace Beagle.IndexHelper {
 				Log.Debug ("Moving from log level {0} to Debug", old_level);
 			}
 
+			MemoryMonitor.LogHistory (TimeSpan.FromMinutes (10), TimeSpan.FromSeconds (30));
+			XdgMime.LogResultCacheStats ();
+			XdgMime.LogReloadStats ();
+
 			string span = StringFu.TimeSpanToString (DateTime.Now - last_activity);
 
 			if (CurrentDisplayUri == null)
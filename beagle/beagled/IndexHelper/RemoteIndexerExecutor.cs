@@ -49,6 +49,8 @@ namespace Beagle.IndexHelper {
 
 			IndexHelperTool.ReportActivity ();
 
+			SystemPriorities.SetThreadRole (ThreadRole.Indexer);
+
 			// Find the appropriate driver for this request.
 			LuceneIndexingDriver indexer;
 			lock (indexer_table) {
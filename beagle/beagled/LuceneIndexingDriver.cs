@@ -536,6 +536,22 @@ namespace Beagle.Daemon {
 								 IndexWriter primary_writer,
 					          		 ref IndexWriter secondary_writer,
 						  		 Hashtable prop_change_docs)
+		{
+			// The filter is pulled from while the document is being
+			// added, so all of this counts as filtering.
+			ThreadRole role = SystemPriorities.SetThreadRole (ThreadRole.Filter);
+
+			try {
+				return FilterAndAddIndexable (indexable, primary_writer, ref secondary_writer, prop_change_docs);
+			} finally {
+				SystemPriorities.SetThreadRole (role);
+			}
+		}
+
+		private IndexerAddedReceipt FilterAndAddIndexable (Indexable indexable,
+								   IndexWriter primary_writer,
+								   ref IndexWriter secondary_writer,
+								   Hashtable prop_change_docs)
 		{
 			Filter filter = null;
 			if (FileFilterNotifier != null)
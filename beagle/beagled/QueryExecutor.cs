@@ -88,6 +88,8 @@ namespace Beagle.Daemon {
 		{
 			this.query = (Query) req;
 
+			SystemPriorities.SetThreadRole (ThreadRole.Query);
+
 			this.result = new QueryResult ();
 			this.result.IsIndexListener = this.query.IsIndexListener;
 			AttachResult ();
@@ -45,6 +45,8 @@ namespace Beagle.Daemon {
 			int ctx_length = request.ContextLength;
 			int snp_length = request.SnippetLength;
 
+			SystemPriorities.SetThreadRole (ThreadRole.Snippet);
+
 			if (queryable == null) {
 				Log.Error ("SnippetExecutor: No queryable object matches '{0}'", request.Hit.Source);
 				snippet_reader = new SnippetReader (null, null, false, -1, -1);
@@ -22,9 +22,18 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <unistd.h>
 #include <dirent.h>
+#include <stddef.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 int
 beagled_utils_readdir (void *dir, char *name, int max_len)
@@ -40,3 +49,181 @@ beagled_utils_readdir (void *dir, char *name, int max_len)
     strncpy (name, entry->d_name, max_len);
     return 0;
 }
+
+/*
+ * Batched directory enumeration.
+ *
+ * beagled_utils_read_entries() fills a caller-provided buffer with as many
+ * entries of a directory as fit, read straight from the kernel with
+ * getdents64, so that walking a directory costs one call per buffer rather
+ * than one per entry.  Each entry is laid out as follows, and padded to a
+ * multiple of eight bytes; 'reclen' is the offset of the next entry:
+ *
+ *	offset  0: uint64_t inode
+ *	offset  8: int64_t  mtime, in seconds (-1 unless stat'd)
+ *	offset 16: int64_t  ctime, in seconds (-1 unless stat'd)
+ *	offset 24: int64_t  size (-1 unless stat'd)
+ *	offset 32: uint16_t reclen
+ *	offset 34: uint8_t  type, a DT_* value, or DT_UNKNOWN
+ *	offset 35: uint8_t  reserved
+ *	offset 36: char     name[], NUL terminated
+ *
+ * "." and ".." are never returned.  With BEAGLED_UTILS_STAT_FILES, regular
+ * files (and entries whose type the filesystem does not report) are stat'd
+ * with fstatat() to fill in the times and size, and the type of untyped
+ * entries is filled in from the stat.  With BEAGLED_UTILS_STAT_ALL, every
+ * entry is.  Without either, nothing is stat'd, and callers fall back to stat
+ * for the entries whose type the filesystem does not report.
+ */
+
+#define BEAGLED_UTILS_STAT_FILES	1
+#define BEAGLED_UTILS_STAT_ALL		2
+
+typedef struct {
+	uint64_t ino;
+	int64_t mtime;
+	int64_t ctime;
+	int64_t size;
+	uint16_t reclen;
+	uint8_t type;
+	uint8_t reserved;
+	char name[];
+} beagled_dirent_t;
+
+#define DIRENT_ALIGN(len)	(((len) + 7) & ~7)
+#define DIRENT_RECLEN(namelen)	\
+	DIRENT_ALIGN (offsetof (beagled_dirent_t, name) + (namelen) + 1)
+
+#ifndef IFTODT
+#define IFTODT(mode)		(((mode) & 0170000) >> 12)
+#endif
+
+#ifdef __NR_getdents64
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static inline int
+sys_getdents64 (int fd, void *buf, size_t len)
+{
+	return syscall (__NR_getdents64, fd, buf, len);
+}
+
+/* The size of the buffer we read kernel entries into. */
+#define KERNEL_BUFFER_SIZE	32768
+
+/*
+ * Open the directory 'path' for beagled_utils_read_entries().  Returns a file
+ * descriptor, to be closed with close(), or -1 with errno set.
+ */
+int
+beagled_utils_open_dir (const char *path)
+{
+	return open (path, O_RDONLY | O_DIRECTORY | O_NONBLOCK | O_CLOEXEC);
+}
+
+/*
+ * Fill 'buf', of 'buf_len' bytes, with the next entries of the directory open
+ * on 'fd', as described above, stat'ing them as 'flags' asks.  Returns the number of bytes used, 0 at the end
+ * of the directory, or -1 with errno set.  A buffer of at least 4096 bytes
+ * always fits at least one entry.
+ */
+int
+beagled_utils_read_entries (int fd, char *buf, int buf_len, int flags)
+{
+	char kbuf [KERNEL_BUFFER_SIZE];
+	off_t resume;
+	int used = 0;
+
+	/* Where to go back to if the first entry read does not fit. */
+	resume = lseek (fd, 0, SEEK_CUR);
+	if (resume == (off_t) -1)
+		return -1;
+
+	for (;;) {
+		int nread, pos;
+
+		nread = sys_getdents64 (fd, kbuf, sizeof (kbuf));
+		if (nread <= 0)
+			return (nread == 0 || used > 0) ? used : -1;
+
+		for (pos = 0; pos < nread; ) {
+			struct linux_dirent64 *d = (struct linux_dirent64 *) (kbuf + pos);
+			beagled_dirent_t *e;
+			size_t namelen;
+			int reclen;
+
+			pos += d->d_reclen;
+
+			if (d->d_name [0] == '.' &&
+			    (d->d_name [1] == '\0' ||
+			     (d->d_name [1] == '.' && d->d_name [2] == '\0'))) {
+				resume = d->d_off;
+				continue;
+			}
+
+			namelen = strlen (d->d_name);
+			reclen = DIRENT_RECLEN (namelen);
+
+			if (used + reclen > buf_len) {
+				/* Rewind so the next call starts with this entry. */
+				lseek (fd, resume, SEEK_SET);
+				if (used == 0) {
+					errno = EINVAL;
+					return -1;
+				}
+				return used;
+			}
+
+			e = (beagled_dirent_t *) (buf + used);
+			e->ino = d->d_ino;
+			e->mtime = -1;
+			e->ctime = -1;
+			e->size = -1;
+			e->reclen = reclen;
+			e->type = d->d_type;
+			e->reserved = 0;
+			memcpy (e->name, d->d_name, namelen + 1);
+
+			if ((flags & BEAGLED_UTILS_STAT_ALL) ||
+			    ((flags & BEAGLED_UTILS_STAT_FILES) &&
+			     (d->d_type == DT_REG || d->d_type == DT_UNKNOWN))) {
+				struct stat st;
+
+				if (fstatat (fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+					e->mtime = st.st_mtime;
+					e->ctime = st.st_ctime;
+					e->size = st.st_size;
+					if (e->type == DT_UNKNOWN)
+						e->type = IFTODT (st.st_mode);
+				}
+			}
+
+			used += reclen;
+			resume = d->d_off;
+		}
+	}
+}
+
+#else /* !__NR_getdents64 */
+
+int
+beagled_utils_open_dir (const char *path)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+beagled_utils_read_entries (int fd, char *buf, int buf_len, int flags)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif /* __NR_getdents64 */
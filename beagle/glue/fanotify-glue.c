@@ -0,0 +1,715 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+ * fanotify-glue.c - fanotify backend for the inotify glue
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ */
+
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * With FAN_REPORT_DFID_NAME, fanotify reports every event as the file handle
+ * of the directory it happened in plus a name, which is all an inotify event
+ * carries once the watch descriptor is swapped for the handle.  So we hand out
+ * our own watch descriptors, remember the handle of each watched directory,
+ * and turn every fanotify event back into a struct inotify_event by looking
+ * its handle up.  The managed side keeps mapping descriptors to paths, which
+ * also keeps working across renames since a handle never changes.
+ *
+ * If we are allowed to, the whole filesystem of each watched directory is
+ * marked once, and events in directories nobody watches are dropped here.
+ * Otherwise (without CAP_SYS_ADMIN) each directory gets an inode mark, which
+ * still does not count against inotify's max_user_watches.
+ *
+ * Where the kernel has FAN_RENAME, both halves of a rename come in one event,
+ * which we turn into a MOVED_FROM and MOVED_TO pair sharing a cookie.  Older
+ * kernels only report the halves separately, with nothing to tie them
+ * together, so we pass those on unpaired, with a zero cookie.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/vfs.h>
+#include <sys/inotify.h>
+
+#include "fanotify-glue.h"
+
+#if defined(__NR_fanotify_init) && defined(__NR_fanotify_mark)
+#include <linux/fanotify.h>
+#endif
+
+#if defined(__NR_fanotify_init) && defined(__NR_fanotify_mark) && defined(FAN_REPORT_DFID_NAME)
+
+static inline int
+sys_fanotify_init (unsigned int flags, unsigned int event_f_flags)
+{
+	return syscall (__NR_fanotify_init, flags, event_f_flags);
+}
+
+static inline int
+sys_fanotify_mark (int fd, unsigned int flags, uint64_t mask, int dirfd, const char *path)
+{
+	return syscall (__NR_fanotify_mark, fd, flags, mask, dirfd, path);
+}
+
+/* fanotify uses the inotify values for all of these, and FAN_ONDIR is IN_ISDIR */
+#define WATCH_EVENTS	IN_ALL_EVENTS
+
+#ifndef FAN_RENAME
+#define FAN_RENAME	0
+#endif
+
+#define MOVE_EVENTS	(IN_MOVED_FROM | IN_MOVED_TO)
+
+typedef struct {
+	struct file_handle fh;
+	unsigned char bytes [MAX_HANDLE_SZ];
+} handle_buf_t;
+
+typedef struct watch watch_t;
+
+struct watch {
+	watch_t *next;			/* hash chain */
+	char *path;
+	int wd;
+	uint32_t mask;			/* the events the caller asked for */
+	uint32_t marked;		/* the inode mark, 0 with a filesystem mark */
+	unsigned int hash;
+	unsigned char fsid [8];
+	int handle_type;
+	unsigned int handle_bytes;
+	unsigned char handle [];
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int fan_fd = -1;
+static int fs_marks = 1;		/* cleared once they are refused */
+static int rename_events;		/* set if FAN_RENAME works */
+
+static watch_t **buckets;
+static unsigned int n_buckets, n_watches;
+
+static watch_t **by_wd;
+static int next_wd = 1, by_wd_alloc;
+
+static uint32_t last_cookie;
+
+static unsigned int
+hash_key (const void *fsid, const struct file_handle *fh)
+{
+	const unsigned char *p;
+	unsigned int h = 2166136261u, i;
+
+	for (p = fsid, i = 0; i < 8; i++)
+		h = (h ^ p [i]) * 16777619u;
+	h = (h ^ (unsigned int) fh->handle_type) * 16777619u;
+	for (p = fh->f_handle, i = 0; i < fh->handle_bytes; i++)
+		h = (h ^ p [i]) * 16777619u;
+
+	return h;
+}
+
+/* lookup - find the watch on a handle.  The caller must hold the lock. */
+static watch_t *
+lookup (const void *fsid, const struct file_handle *fh)
+{
+	unsigned int hash;
+	watch_t *w;
+
+	if (!n_buckets)
+		return NULL;
+
+	hash = hash_key (fsid, fh);
+	for (w = buckets [hash & (n_buckets - 1)]; w; w = w->next) {
+		if (w->hash == hash && w->handle_type == fh->handle_type &&
+		    w->handle_bytes == fh->handle_bytes &&
+		    !memcmp (w->fsid, fsid, 8) &&
+		    !memcmp (w->handle, fh->f_handle, fh->handle_bytes))
+			return w;
+	}
+
+	return NULL;
+}
+
+/* insert - add a new watch on a handle.  The caller must hold the lock. */
+static watch_t *
+insert (const void *fsid, const struct file_handle *fh)
+{
+	watch_t *w;
+
+	if (n_watches >= n_buckets) {
+		unsigned int size = n_buckets ? n_buckets * 2 : 256, i;
+		watch_t **new_buckets;
+
+		new_buckets = calloc (size, sizeof (watch_t *));
+		if (!new_buckets)
+			return NULL;
+		for (i = 0; i < n_buckets; i++) {
+			while ((w = buckets [i]) != NULL) {
+				buckets [i] = w->next;
+				w->next = new_buckets [w->hash & (size - 1)];
+				new_buckets [w->hash & (size - 1)] = w;
+			}
+		}
+		free (buckets);
+		buckets = new_buckets;
+		n_buckets = size;
+	}
+
+	/* Only grow the table once it is half full, so free descriptors stay easy to find */
+	if ((int) (n_watches + 1) * 2 >= by_wd_alloc) {
+		int size = by_wd_alloc ? by_wd_alloc * 2 : 256;
+		watch_t **new_by_wd;
+
+		new_by_wd = realloc (by_wd, size * sizeof (watch_t *));
+		if (!new_by_wd)
+			return NULL;
+		memset (new_by_wd + by_wd_alloc, 0, (size - by_wd_alloc) * sizeof (watch_t *));
+		by_wd = new_by_wd;
+		by_wd_alloc = size;
+	}
+
+	w = calloc (1, sizeof (watch_t) + fh->handle_bytes);
+	if (!w)
+		return NULL;
+
+	/*
+	 * Like inotify, hand descriptors out cyclically, so that a freed one is
+	 * reused as late as possible and events still queued for its old watch
+	 * have long been dispatched.
+	 */
+	while (by_wd [next_wd] != NULL)
+		if (++next_wd >= by_wd_alloc)
+			next_wd = 1;
+	w->wd = next_wd;
+	if (++next_wd >= by_wd_alloc)
+		next_wd = 1;
+	w->hash = hash_key (fsid, fh);
+	memcpy (w->fsid, fsid, 8);
+	w->handle_type = fh->handle_type;
+	w->handle_bytes = fh->handle_bytes;
+	memcpy (w->handle, fh->f_handle, fh->handle_bytes);
+
+	w->next = buckets [w->hash & (n_buckets - 1)];
+	buckets [w->hash & (n_buckets - 1)] = w;
+	by_wd [w->wd] = w;
+	n_watches++;
+
+	return w;
+}
+
+/* forget - unlink and free a watch.  The caller must hold the lock. */
+static void
+forget (watch_t *w)
+{
+	watch_t **p;
+
+	for (p = &buckets [w->hash & (n_buckets - 1)]; *p != w; p = &(*p)->next)
+		;
+	*p = w->next;
+	by_wd [w->wd] = NULL;
+	n_watches--;
+
+	free (w->path);
+	free (w);
+}
+
+/* get_handle - the fsid and file handle of 'path' */
+static int
+get_handle (const char *path, int follow, unsigned char *fsid, handle_buf_t *h)
+{
+	struct statfs sfs;
+	int mount_id;
+
+	h->fh.handle_bytes = MAX_HANDLE_SZ;
+	if (name_to_handle_at (AT_FDCWD, path, &h->fh, &mount_id, follow ? AT_SYMLINK_FOLLOW : 0) == -1)
+		return -errno;
+	if (statfs (path, &sfs) == -1)
+		return -errno;
+	memcpy (fsid, &sfs.f_fsid, 8);
+
+	return 0;
+}
+
+int
+fanotify_glue_open (void)
+{
+	int fd;
+
+	/* Nonblocking: a batch can translate to nothing, and the snarf loop
+	 * must not then sit in read() past its deadline or a cancellation */
+	fd = sys_fanotify_init (FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+				O_RDONLY | O_LARGEFILE);
+	if (fd < 0)
+		return -errno;
+
+	fan_fd = fd;
+
+	/* Kernels before 5.17 refuse the bit */
+	if (FAN_RENAME && sys_fanotify_mark (fd, FAN_MARK_ADD | FAN_MARK_ONLYDIR, FAN_RENAME | FAN_ONDIR, AT_FDCWD, "/") == 0) {
+		sys_fanotify_mark (fd, FAN_MARK_REMOVE | FAN_MARK_ONLYDIR, FAN_RENAME | FAN_ONDIR, AT_FDCWD, "/");
+		rename_events = 1;
+	}
+
+	return fd;
+}
+
+int
+fanotify_glue_owns (int fd)
+{
+	return fd >= 0 && fd == fan_fd;
+}
+
+int
+fanotify_glue_add_watch (int fd, const char *path, uint32_t mask)
+{
+	unsigned int flags = FAN_MARK_ADD;
+	unsigned char fsid [8];
+	uint32_t events, want;
+	handle_buf_t h;
+	struct stat st;
+	watch_t *w;
+	int ret, is_new;
+	char *copy;
+
+	ret = get_handle (path, !(mask & IN_DONT_FOLLOW), fsid, &h);
+	if (ret < 0)
+		return ret;
+
+	if (mask & IN_ONLYDIR) {
+		if (stat (path, &st) == -1)
+			return -errno;
+		if (!S_ISDIR (st.st_mode))
+			return -ENOTDIR;
+		flags |= FAN_MARK_ONLYDIR;
+	}
+	if (mask & IN_DONT_FOLLOW)
+		flags |= FAN_MARK_DONT_FOLLOW;
+
+	copy = strdup (path);
+	if (!copy)
+		return -ENOMEM;
+
+	events = mask & WATCH_EVENTS;
+
+	/* What we ask the kernel for, with moves reported as one event where we can */
+	want = events | IN_DELETE_SELF | FAN_ONDIR;
+	if (rename_events && (want & MOVE_EVENTS))
+		want = (want & ~MOVE_EVENTS) | FAN_RENAME;
+
+	pthread_mutex_lock (&lock);
+
+	w = lookup (fsid, &h.fh);
+	is_new = (w == NULL);
+	if (is_new && (w = insert (fsid, &h.fh)) == NULL) {
+		pthread_mutex_unlock (&lock);
+		free (copy);
+		return -ENOMEM;
+	}
+
+	ret = -1;
+	if (fs_marks) {
+		ret = sys_fanotify_mark (fd, flags | FAN_MARK_FILESYSTEM,
+					 want, AT_FDCWD, path);
+		if (ret == -1 && (errno == EPERM || errno == EINVAL))
+			fs_marks = 0;
+	}
+
+	if (!fs_marks) {
+		want |= FAN_EVENT_ON_CHILD;
+
+		/* Adding to a mark only ever adds bits; take away what's no longer wanted */
+		if (w->marked & ~want)
+			sys_fanotify_mark (fd, FAN_MARK_REMOVE | (flags & ~FAN_MARK_ADD),
+					   w->marked & ~want & (WATCH_EVENTS | FAN_RENAME), AT_FDCWD, path);
+		ret = sys_fanotify_mark (fd, flags, want, AT_FDCWD, path);
+		if (ret == 0)
+			w->marked = want;
+	}
+
+	if (ret == -1) {
+		ret = -errno;
+		if (is_new)
+			forget (w);
+		pthread_mutex_unlock (&lock);
+		free (copy);
+		return ret;
+	}
+
+	w->mask = events;
+	free (w->path);
+	w->path = copy;
+	ret = w->wd;
+
+	pthread_mutex_unlock (&lock);
+
+	return ret;
+}
+
+int
+fanotify_glue_rm_watch (int fd, int wd)
+{
+	unsigned char fsid [8];
+	handle_buf_t h;
+	watch_t *w;
+
+	pthread_mutex_lock (&lock);
+
+	if (wd <= 0 || wd >= by_wd_alloc || (w = by_wd [wd]) == NULL) {
+		pthread_mutex_unlock (&lock);
+		return -EINVAL;
+	}
+
+	/* The directory may have moved since; only unmark it if it is still ours */
+	if (w->marked && get_handle (w->path, 0, fsid, &h) == 0 && lookup (fsid, &h.fh) == w)
+		sys_fanotify_mark (fd, FAN_MARK_REMOVE, w->marked, AT_FDCWD, w->path);
+
+	forget (w);
+
+	pthread_mutex_unlock (&lock);
+
+	return 0;
+}
+
+/* emit - append one inotify event to 'out', if it fits */
+static int
+emit (char **out, char *end, int wd, uint32_t mask, uint32_t cookie, const char *name)
+{
+	struct inotify_event *event = (struct inotify_event *) *out;
+	size_t len = 0;
+
+	if (name) {
+		len = strlen (name) + 1;
+		len = (len + sizeof (struct inotify_event) - 1) & ~(sizeof (struct inotify_event) - 1);
+	}
+
+	if (*out + sizeof (struct inotify_event) + len > end)
+		return -1;
+
+	event->wd = wd;
+	event->mask = mask;
+	event->cookie = cookie;
+	event->len = len;
+	if (name) {
+		memset (event->name, 0, len);
+		strcpy (event->name, name);
+	}
+
+	*out += sizeof (struct inotify_event) + len;
+
+	return 0;
+}
+
+/*
+ * fanotify merges the events queued for one object into a single mask,
+ * where inotify would have queued one event per kind.  We split them back
+ * up, in the order they would have happened in.
+ */
+static const uint32_t event_order [] = {
+	IN_CREATE, IN_MOVED_TO, IN_OPEN, IN_ACCESS, IN_MODIFY, IN_ATTRIB,
+	IN_CLOSE_WRITE, IN_CLOSE_NOWRITE, IN_MOVED_FROM, IN_DELETE,
+	IN_DELETE_SELF, IN_MOVE_SELF
+};
+
+/* The same, for a name which went away and came back, so ends up existing */
+static const uint32_t recreated_order [] = {
+	IN_MOVED_FROM, IN_DELETE, IN_CREATE, IN_MOVED_TO, IN_OPEN, IN_ACCESS,
+	IN_MODIFY, IN_ATTRIB, IN_CLOSE_WRITE, IN_CLOSE_NOWRITE,
+	IN_DELETE_SELF, IN_MOVE_SELF
+};
+
+#define N_EVENT_ORDER	(sizeof (event_order) / sizeof (event_order [0]))
+
+#define ARRIVAL_EVENTS	(IN_CREATE | IN_MOVED_TO)
+#define DEPARTURE_EVENTS	(IN_MOVED_FROM | IN_DELETE)
+
+/* Events read from the kernel which did not fit last time */
+static char *raw = NULL;
+static size_t raw_size, raw_pos, raw_len;
+
+/* info_name - the name in a directory handle record, or NULL if it has none */
+static const char *
+info_name (struct fanotify_event_info_fid *fid)
+{
+	struct file_handle *fh = (struct file_handle *) fid->handle;
+
+	if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID)
+		return NULL;
+
+	return (const char *) fh->f_handle + fh->handle_bytes;
+}
+
+/* exists - whether 'name' is in the directory of 'w' right now */
+static int
+exists (watch_t *w, const char *name)
+{
+	struct stat st;
+	char *path;
+	int ret;
+
+	if (!w->path || asprintf (&path, "%s/%s", w->path, name) < 0)
+		return 0;
+	ret = lstat (path, &st) == 0;
+	free (path);
+
+	return ret;
+}
+
+/*
+ * translate_rename - turn a FAN_RENAME event into a MOVED_FROM on the old
+ * directory and a MOVED_TO on the new one.  The caller must hold the lock.
+ */
+static int
+translate_rename (struct fanotify_event_metadata *meta,
+		  struct fanotify_event_info_fid *from,
+		  struct fanotify_event_info_fid *to,
+		  char **out, char *end)
+{
+	uint32_t isdir = (meta->mask & FAN_ONDIR) ? IN_ISDIR : 0;
+	const char *from_name = NULL, *to_name = NULL;
+	watch_t *from_w = NULL, *to_w = NULL;
+	char *start = *out;
+	uint32_t cookie;
+
+	if (from) {
+		from_name = info_name (from);
+		from_w = lookup (&from->fsid, (struct file_handle *) from->handle);
+	}
+	if (to) {
+		to_name = info_name (to);
+		to_w = lookup (&to->fsid, (struct file_handle *) to->handle);
+	}
+
+	cookie = ++last_cookie;
+
+	if (from_w && from_name && (from_w->mask & IN_MOVED_FROM) &&
+	    emit (out, end, from_w->wd, IN_MOVED_FROM | isdir, cookie, from_name) < 0)
+		goto full;
+	if (to_w && to_name && (to_w->mask & IN_MOVED_TO) &&
+	    emit (out, end, to_w->wd, IN_MOVED_TO | isdir, cookie, to_name) < 0)
+		goto full;
+
+	return 0;
+
+ full:
+	*out = start;
+	--last_cookie;
+	return -1;
+}
+
+/* translate - turn one fanotify event into inotify ones.  The caller must hold the lock. */
+static int
+translate (struct fanotify_event_metadata *meta, char **out, char *end)
+{
+	struct fanotify_event_info_fid *fid = NULL, *from = NULL, *to = NULL;
+	struct fanotify_event_info_header *info;
+	const uint32_t *order = event_order;
+	const char *name;
+	char *start = *out;
+	uint32_t mask;
+	unsigned int i;
+	watch_t *w;
+	int self;
+
+	if (meta->mask & FAN_Q_OVERFLOW)
+		return emit (out, end, -1, IN_Q_OVERFLOW, 0, NULL);
+
+	for (info = (struct fanotify_event_info_header *) (meta + 1);
+	     (char *) info + sizeof (*info) <= (char *) meta + meta->event_len && info->len > 0;
+	     info = (struct fanotify_event_info_header *) ((char *) info + info->len)) {
+		switch (info->info_type) {
+		case FAN_EVENT_INFO_TYPE_DFID_NAME:
+		case FAN_EVENT_INFO_TYPE_DFID:
+			if (!fid)
+				fid = (struct fanotify_event_info_fid *) info;
+			break;
+#if FAN_RENAME
+		case FAN_EVENT_INFO_TYPE_OLD_DFID_NAME:
+			from = (struct fanotify_event_info_fid *) info;
+			break;
+		case FAN_EVENT_INFO_TYPE_NEW_DFID_NAME:
+			to = (struct fanotify_event_info_fid *) info;
+			break;
+#endif
+		}
+	}
+
+	/* The kernel never merges a rename with anything else */
+	if (meta->mask & FAN_RENAME)
+		return translate_rename (meta, from, to, out, end);
+
+	if (!fid)
+		return 0;
+
+	name = info_name (fid);
+	if (!name)
+		name = ".";
+	self = (name [0] == '.' && name [1] == '\0');
+
+	w = lookup (&fid->fsid, (struct file_handle *) fid->handle);
+	if (!w)
+		return 0;
+
+	/*
+	 * A name both created and removed since we last looked may have gone
+	 * either way round; what is there now decides which comes last.
+	 */
+	if (!self && (meta->mask & ARRIVAL_EVENTS) && (meta->mask & DEPARTURE_EVENTS) &&
+	    exists (w, name))
+		order = recreated_order;
+
+	for (i = 0; i < N_EVENT_ORDER; i++) {
+		if (!(meta->mask & order [i]) || !(w->mask & order [i]))
+			continue;
+
+		/* Moves only get here without FAN_RENAME, and go out unpaired */
+		mask = order [i];
+		if (!self && (meta->mask & FAN_ONDIR))
+			mask |= IN_ISDIR;
+		if (emit (out, end, w->wd, mask, 0, self ? NULL : name) < 0)
+			goto full;
+	}
+
+	/* Like inotify, a watch goes away with its directory */
+	if (self && (meta->mask & IN_DELETE_SELF)) {
+		if (emit (out, end, w->wd, IN_IGNORED, 0, NULL) < 0)
+			goto full;
+		forget (w);
+	}
+
+	return 0;
+
+ full:
+	/* All or nothing, so that the event can be retried as a whole */
+	*out = start;
+	return -1;
+}
+
+int
+fanotify_glue_pending (int fd)
+{
+	return fanotify_glue_owns (fd) && raw_pos < raw_len;
+}
+
+ssize_t
+fanotify_glue_read (int fd, void *buffer, size_t len)
+{
+	struct fanotify_event_metadata *meta;
+	char *out = buffer, *end = out + len;
+	ssize_t n;
+
+	if (raw_pos >= raw_len) {
+		if (raw_size < len) {
+			char *tmp = realloc (raw, len);
+			if (!tmp) {
+				errno = ENOMEM;
+				return -1;
+			}
+			raw = tmp;
+			raw_size = len;
+		}
+
+		n = read (fd, raw, len);
+		if (n == -1 && errno == EAGAIN)
+			return 0;	/* drained */
+		if (n <= 0)
+			return n;
+		raw_pos = 0;
+		raw_len = n;
+	}
+
+	pthread_mutex_lock (&lock);
+
+	n = raw_len - raw_pos;
+	for (meta = (struct fanotify_event_metadata *) (raw + raw_pos);
+	     FAN_EVENT_OK (meta, n);
+	     meta = FAN_EVENT_NEXT (meta, n)) {
+		if (meta->vers != FANOTIFY_METADATA_VERSION) {
+			n = 0;
+			break;
+		}
+
+		/* Leave it for next time, unless it can never fit */
+		if (translate (meta, &out, end) < 0 && out != (char *) buffer)
+			break;
+
+		if (meta->fd >= 0)
+			close (meta->fd);
+	}
+	raw_pos = FAN_EVENT_OK (meta, n) ? raw_len - n : raw_len;
+
+	pthread_mutex_unlock (&lock);
+
+	return out - (char *) buffer;
+}
+
+#else /* !FAN_REPORT_DFID_NAME */
+
+int
+fanotify_glue_open (void)
+{
+	return -ENOSYS;
+}
+
+int
+fanotify_glue_owns (int fd)
+{
+	return 0;
+}
+
+int
+fanotify_glue_add_watch (int fd, const char *path, uint32_t mask)
+{
+	return -ENOSYS;
+}
+
+int
+fanotify_glue_rm_watch (int fd, int wd)
+{
+	return -ENOSYS;
+}
+
+int
+fanotify_glue_pending (int fd)
+{
+	return 0;
+}
+
+ssize_t
+fanotify_glue_read (int fd, void *buffer, size_t len)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
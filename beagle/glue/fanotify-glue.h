@@ -0,0 +1,48 @@
+/*
+ * fanotify-glue.h - fanotify backend for the inotify glue
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __FANOTIFY_GLUE_H__
+#define __FANOTIFY_GLUE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * These mirror inotify_init(), inotify_add_watch(), inotify_rm_watch() and
+ * read() on an inotify descriptor, except that errors are returned as -errno
+ * (read returns -1 and sets errno, as read does).  The events read back are
+ * struct inotify_event records, so the rest of the glue need not care which
+ * of the two it is talking to.  fanotify_glue_pending() tells whether
+ * events read earlier are still waiting to be returned, in which case the
+ * next read returns them without waiting for the descriptor.
+ */
+
+int     fanotify_glue_open      (void);
+int     fanotify_glue_owns      (int fd);
+int     fanotify_glue_add_watch (int fd, const char *path, uint32_t mask);
+int     fanotify_glue_rm_watch  (int fd, int wd);
+int     fanotify_glue_pending   (int fd);
+ssize_t fanotify_glue_read      (int fd, void *buffer, size_t len);
+
+#endif /* __FANOTIFY_GLUE_H__ */
@@ -27,23 +27,37 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/inotify.h>
 
+#include "fanotify-glue.h"
+#include "inotify-shards.h"
+#include "inotify-tree.h"
+
 #define PROCFS_PREFIX           "/proc/sys/fs/inotify"
 
 #define PROCFS_MAX_USER_DEVICES  PROCFS_PREFIX "/max_user_instances"
 #define PROCFS_MAX_USER_WATCHES  PROCFS_PREFIX "/max_user_watches"
 #define PROCFS_MAX_QUEUED_EVENTS PROCFS_PREFIX "/max_queued_events"
 
+#define PROCFS_FANOTIFY_MAX_QUEUED_EVENTS "/proc/sys/fs/fanotify/max_queued_events"
+
 /* Inotify sysfs knobs, initialized to their pre-sysfs defaults */
 static int max_user_instances = 8;
 static int max_user_watches = 8192;
@@ -94,11 +108,104 @@ inotify_glue_init (void)
 }
 
 
+/*
+ * Like inotify_glue_init(), but uses fanotify when the kernel supports
+ * FAN_REPORT_DFID_NAME.  Every other inotify_glue_ and inotify_snarf_ call
+ * works on the descriptor returned, and events come back in inotify's
+ * format, so callers can use either backend without knowing which it is.
+ */
 int
-inotify_glue_watch (int fd, const char *filename, uint32_t mask)
+inotify_glue_init_fanotify (void)
+{
+	static int fd = 0;
+
+	if (fd)
+		return fd;
+
+	fd = fanotify_glue_open ();
+	if (fd < 0) {
+		int ret = fd;
+		fd = 0;
+		return ret;
+	}
+
+	if (pipe (snarf_cancellation_pipe) == -1)
+		perror ("Can't create snarf_cancellation_pipe");
+
+	read_int (PROCFS_FANOTIFY_MAX_QUEUED_EVENTS, &max_queued_events);
+
+	return fd;
+}
+
+
+/*
+ * Like inotify_glue_init(), but spreads the watches over up to 'n_shards'
+ * inotify instances (see inotify-shards.c), or as many as the number of CPUs
+ * suggests if 'n_shards' is 0.  No more than half of max_user_instances is
+ * ever taken, to leave some for everybody else.  With only one to use, this
+ * is inotify_glue_init().
+ */
+int
+inotify_glue_init_sharded (int n_shards)
+{
+	static int fd = 0;
+
+	if (fd)
+		return fd;
+
+	read_int (PROCFS_MAX_USER_DEVICES, &max_user_instances);
+
+	if (n_shards <= 0) {
+		long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+		n_shards = cpus > 0 ? cpus / 8 : 1;
+		if (n_shards > 8)
+			n_shards = 8;
+	}
+	if (n_shards > max_user_instances / 2)
+		n_shards = max_user_instances / 2;
+
+	if (n_shards <= 1)
+		return inotify_glue_init ();
+
+	fd = inotify_shards_open (n_shards);
+	if (fd < 0) {
+		fd = 0;
+		return inotify_glue_init ();
+	}
+
+	if (pipe (snarf_cancellation_pipe) == -1)
+		perror ("Can't create snarf_cancellation_pipe");
+
+	read_int (PROCFS_MAX_USER_WATCHES, &max_user_watches);
+	read_int (PROCFS_MAX_QUEUED_EVENTS, &max_queued_events);
+
+	return fd;
+}
+
+
+/* inotify_glue_shard_count - how many queues the events of 'fd' come from */
+int
+inotify_glue_shard_count (int fd)
+{
+	return inotify_shards_count (fd);
+}
+
+/*
+ * add_watch - inotify_add_watch() on any backend, returning -errno on failure.
+ * 'parent' is the watch on the directory above, or -1 if it isn't known.
+ */
+static int
+add_watch (int fd, const char *filename, uint32_t mask, int parent)
 {
 	int wd;
 
+	if (fanotify_glue_owns (fd))
+		return fanotify_glue_add_watch (fd, filename, mask);
+
+	if (inotify_shards_owns (fd))
+		return inotify_shards_add_watch (fd, filename, mask, parent);
+
 	wd = inotify_add_watch (fd, filename, mask);
 	if (wd < 0)
 		return -errno;
@@ -107,11 +214,32 @@ inotify_glue_watch (int fd, const char *filename, uint32_t mask)
 }
 
 
+int
+inotify_glue_watch (int fd, const char *filename, uint32_t mask)
+{
+	int wd;
+
+	wd = add_watch (fd, filename, mask, -1);
+	if (wd >= 0)
+		inotify_tree_add_path (wd, filename);
+
+	return wd;
+}
+
+
 int
 inotify_glue_ignore (int fd, uint32_t wd)
 {
 	int ret;
 
+	inotify_tree_remove (wd);
+
+	if (fanotify_glue_owns (fd))
+		return fanotify_glue_rm_watch (fd, wd);
+
+	if (inotify_shards_owns (fd))
+		return inotify_shards_rm_watch (fd, wd);
+
 	ret = inotify_rm_watch (fd, wd);
 	if (ret < 0)
 		return -errno;
@@ -119,6 +247,319 @@ inotify_glue_ignore (int fd, uint32_t wd)
 	return ret;
 }
 
+
+/* inotify_glue_lookup - the watch on 'path', or -1 */
+int
+inotify_glue_lookup (const char *path)
+{
+	return inotify_tree_lookup (path);
+}
+
+
+/*
+ * inotify_glue_get_path - where the watch 'wd' is now
+ *
+ * Returns the length of the path, which is only written to 'buffer' if that
+ * is less than 'len', or -1 if the watch isn't known.
+ */
+int
+inotify_glue_get_path (int wd, char *buffer, int len)
+{
+	return inotify_tree_get_path (wd, buffer, len);
+}
+
+/*
+ * Recursive watch setup.
+ *
+ * inotify_glue_watch_tree() watches 'path' and every directory below it,
+ * walking the tree with a small pool of threads so that the directory reads
+ * and inotify_add_watch() calls of different subtrees overlap.  It returns
+ * the number of directories found (or -errno if the root itself could not be
+ * watched) and hands back two malloc'd blocks, which the caller releases with
+ * inotify_glue_free_tree(): an array of the records below, and the string
+ * table their names point into.
+ *
+ * A record's 'wd' is negative (-errno) for a directory that could not be
+ * watched; those are not descended into.  Parents always come before their
+ * children, the root is record 0 with a parent of -1, and its name is the full
+ * path.  Every other name is relative to its parent.  Should memory run out
+ * part way through, the directories walked so far are still returned.
+ *
+ * Every watch is entered into the watch tree as it is made.
+ *
+ * Each directory is watched before it is read, so a subdirectory created
+ * while the walk is in progress is either returned here or reported by an
+ * IN_CREATE on its parent, and possibly both; the caller must tolerate
+ * watching the same directory twice.
+ */
+
+#define TREE_DEFAULT_THREADS	4
+#define TREE_MAX_THREADS	16
+
+typedef struct {
+	int32_t wd;
+	int32_t parent;
+	uint32_t name;
+} tree_entry_t;
+
+typedef struct tree_job {
+	struct tree_job *next;
+	int index;
+	int wd;
+	char path[];
+} tree_job_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	tree_job_t *jobs;	/* pending directories, walked depth-first */
+	int busy;		/* jobs taken but not finished yet */
+	int fd;
+	uint32_t mask;
+	int error;		/* set when we run out of memory */
+
+	tree_entry_t *entries;
+	int n_entries, entries_alloc;
+	char *names;
+	size_t names_len, names_alloc;
+} tree_walk_t;
+
+/* tree_add_entry - append a record.  The caller must hold the walk lock. */
+static int
+tree_add_entry (tree_walk_t *walk, int wd, int parent, const char *name, size_t len)
+{
+	if (walk->n_entries == walk->entries_alloc) {
+		int alloc = walk->entries_alloc ? walk->entries_alloc * 2 : 256;
+		tree_entry_t *entries;
+
+		entries = realloc (walk->entries, alloc * sizeof (tree_entry_t));
+		if (!entries)
+			return -1;
+		walk->entries = entries;
+		walk->entries_alloc = alloc;
+	}
+
+	if (walk->names_len + len + 1 > walk->names_alloc) {
+		size_t alloc = walk->names_alloc ? walk->names_alloc * 2 : 4096;
+		char *names;
+
+		while (alloc < walk->names_len + len + 1)
+			alloc *= 2;
+		names = realloc (walk->names, alloc);
+		if (!names)
+			return -1;
+		walk->names = names;
+		walk->names_alloc = alloc;
+	}
+
+	walk->entries [walk->n_entries].wd = wd;
+	walk->entries [walk->n_entries].parent = parent;
+	walk->entries [walk->n_entries].name = walk->names_len;
+	memcpy (walk->names + walk->names_len, name, len);
+	walk->names [walk->names_len + len] = '\0';
+	walk->names_len += len + 1;
+
+	return walk->n_entries++;
+}
+
+/* tree_add_job - queue a directory for reading.  The caller must hold the walk lock. */
+static int
+tree_add_job (tree_walk_t *walk, int index, int wd, const char *path, size_t len)
+{
+	tree_job_t *job;
+
+	job = malloc (sizeof (tree_job_t) + len + 1);
+	if (!job)
+		return -1;
+	job->index = index;
+	job->wd = wd;
+	memcpy (job->path, path, len);
+	job->path [len] = '\0';
+
+	job->next = walk->jobs;
+	walk->jobs = job;
+	pthread_cond_signal (&walk->cond);
+
+	return 0;
+}
+
+/* tree_scan - watch and queue every subdirectory of one directory */
+static void
+tree_scan (tree_walk_t *walk, tree_job_t *job)
+{
+	size_t path_len = strlen (job->path);
+	struct dirent *entry;
+	char *child = NULL;
+	size_t child_alloc = 0;
+	DIR *dir;
+	int dfd;
+
+	dfd = open (job->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (dfd == -1)
+		return;
+	dir = fdopendir (dfd);
+	if (!dir) {
+		close (dfd);
+		return;
+	}
+
+	while ((entry = readdir (dir)) != NULL) {
+		size_t name_len, child_len;
+		int wd, index;
+
+		if (entry->d_name [0] == '.' && (entry->d_name [1] == '\0' ||
+		    (entry->d_name [1] == '.' && entry->d_name [2] == '\0')))
+			continue;
+
+		if (entry->d_type == DT_UNKNOWN) {
+			struct stat st;
+
+			if (fstatat (dfd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1 ||
+			    !S_ISDIR (st.st_mode))
+				continue;
+		} else if (entry->d_type != DT_DIR)
+			continue;
+
+		name_len = strlen (entry->d_name);
+		child_len = path_len + 1 + name_len;
+		if (child_len + 1 > child_alloc) {
+			char *tmp;
+
+			child_alloc = child_len + 64;
+			tmp = realloc (child, child_alloc);
+			if (!tmp)
+				break;
+			child = tmp;
+		}
+		memcpy (child, job->path, path_len);
+		child [path_len] = '/';
+		memcpy (child + path_len + 1, entry->d_name, name_len + 1);
+
+		wd = add_watch (walk->fd, child, walk->mask, job->wd);
+
+		/* It went away, or was replaced by something else */
+		if (wd == -ENOENT || wd == -ENOTDIR)
+			continue;
+		if (wd >= 0)
+			inotify_tree_add (wd, job->wd, entry->d_name);
+
+		pthread_mutex_lock (&walk->lock);
+		index = tree_add_entry (walk, wd, job->index, entry->d_name, name_len);
+		if (index < 0 || (wd >= 0 && tree_add_job (walk, index, wd, child, child_len) < 0))
+			walk->error = ENOMEM;
+		pthread_mutex_unlock (&walk->lock);
+
+		if (walk->error)
+			break;
+	}
+
+	free (child);
+	closedir (dir);
+}
+
+static void *
+tree_worker (void *data)
+{
+	tree_walk_t *walk = data;
+	tree_job_t *job;
+
+	pthread_mutex_lock (&walk->lock);
+	for (;;) {
+		while (!walk->jobs && walk->busy > 0)
+			pthread_cond_wait (&walk->cond, &walk->lock);
+
+		/* Nothing queued and nobody left to queue anything: done */
+		if (!walk->jobs || walk->error)
+			break;
+
+		job = walk->jobs;
+		walk->jobs = job->next;
+		walk->busy++;
+		pthread_mutex_unlock (&walk->lock);
+
+		tree_scan (walk, job);
+		free (job);
+
+		pthread_mutex_lock (&walk->lock);
+		walk->busy--;
+		if (walk->busy == 0 && (!walk->jobs || walk->error))
+			pthread_cond_broadcast (&walk->cond);
+	}
+	pthread_mutex_unlock (&walk->lock);
+
+	return NULL;
+}
+
+int
+inotify_glue_watch_tree (int fd, const char *path, uint32_t mask, int n_threads,
+			 void **entries_out, void **names_out)
+{
+	pthread_t threads [TREE_MAX_THREADS];
+	tree_walk_t walk;
+	tree_job_t *job;
+	int i, wd, started = 0;
+
+	*entries_out = NULL;
+	*names_out = NULL;
+
+	if (n_threads <= 0)
+		n_threads = TREE_DEFAULT_THREADS;
+	if (n_threads > TREE_MAX_THREADS)
+		n_threads = TREE_MAX_THREADS;
+
+	mask |= IN_ONLYDIR | IN_DONT_FOLLOW;
+
+	wd = add_watch (fd, path, mask, -1);
+	if (wd < 0)
+		return wd;
+	inotify_tree_add_path (wd, path);
+
+	memset (&walk, 0, sizeof (walk));
+	pthread_mutex_init (&walk.lock, NULL);
+	pthread_cond_init (&walk.cond, NULL);
+	walk.fd = fd;
+	walk.mask = mask;
+
+	if (tree_add_entry (&walk, wd, -1, path, strlen (path)) < 0 ||
+	    tree_add_job (&walk, 0, wd, path, strlen (path)) < 0)
+		walk.error = ENOMEM;
+
+	/* The calling thread is one of the workers */
+	for (i = 1; i < n_threads && !walk.error; i++) {
+		if (pthread_create (&threads [started], NULL, tree_worker, &walk) != 0)
+			break;
+		started++;
+	}
+	tree_worker (&walk);
+	for (i = 0; i < started; i++)
+		pthread_join (threads [i], NULL);
+
+	while ((job = walk.jobs) != NULL) {
+		walk.jobs = job->next;
+		free (job);
+	}
+	pthread_cond_destroy (&walk.cond);
+	pthread_mutex_destroy (&walk.lock);
+
+	if (walk.n_entries == 0) {
+		inotify_glue_ignore (fd, wd);
+		free (walk.names);
+		return -walk.error;
+	}
+
+	*entries_out = walk.entries;
+	*names_out = walk.names;
+
+	return walk.n_entries;
+}
+
+void
+inotify_glue_free_tree (void *entries, void *names)
+{
+	free (entries);
+	free (names);
+}
+
 void
 inotify_snarf_cancel ()
 {
@@ -127,23 +568,114 @@ inotify_snarf_cancel ()
 }
 
 
-#define MAX_PENDING_COUNT		5
-#define PENDING_PAUSE_NANOSECONDS	2000000
-#define PENDING_THRESHOLD(qsize)	((unsigned int) (qsize) >> 1)
-#define PENDING_MARGINAL_COST(p)	((unsigned int) (1 << (p)))
+/*
+ * Batching.
+ *
+ * Once the first event of a batch is in, we keep collecting for up to
+ * 'batch_latency' milliseconds, draining the kernel queue into a buffer that
+ * grows to fit every few milliseconds, so that the queue can't overflow
+ * while we wait.  The batch is handed over early if a drain finds nothing
+ * new, or once it holds 'batch_max_bytes'.  Both can be changed at run time
+ * with inotify_glue_set_batching().
+ */
+
+#define DEFAULT_BATCH_LATENCY	20		/* milliseconds */
+#define DEFAULT_BATCH_MAX_BYTES	(1024 * 1024)
+#define DRAINS_PER_BATCH	4
+#define MIN_READ_SIZE		(sizeof (struct inotify_event) + NAME_MAX + 1)
+#define BATCH_SIZE_BUCKETS	16
+
+typedef struct {
+	uint64_t batches;
+	uint64_t events;
+	uint64_t bytes;
+	uint64_t max_batch_events;	/* most events in one batch */
+	uint64_t wait_ns;		/* time spent collecting after the first event */
+	uint64_t overflows;		/* IN_Q_OVERFLOW events seen */
+	uint64_t queue_high_water;	/* most bytes ever found queued in the kernel */
+	uint64_t buffer_size;		/* current size of the read buffer */
+	uint64_t batch_sizes [BATCH_SIZE_BUCKETS]; /* batches of 2^i to 2^(i+1)-1 events */
+} inotify_glue_stats_t;
+
+static int batch_latency = DEFAULT_BATCH_LATENCY;
+static size_t batch_max_bytes = DEFAULT_BATCH_MAX_BYTES;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static inotify_glue_stats_t stats;
+
+void
+inotify_glue_set_batching (int latency_msec, int max_bytes)
+{
+	if (latency_msec >= 0)
+		batch_latency = latency_msec;
+	if (max_bytes > 0)
+		batch_max_bytes = max_bytes;
+}
+
+void
+inotify_glue_get_stats (inotify_glue_stats_t *out)
+{
+	pthread_mutex_lock (&stats_lock);
+	*out = stats;
+	pthread_mutex_unlock (&stats_lock);
+}
+
+static int64_t
+now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* account_batch - update the statistics for a batch handed over */
+static void
+account_batch (const char *buffer, size_t len, int64_t wait, unsigned int high_water)
+{
+	const struct inotify_event *event;
+	uint64_t events = 0, overflows = 0;
+	const char *p;
+	int bucket;
+
+	for (p = buffer; p < buffer + len; p += sizeof (struct inotify_event) + event->len) {
+		event = (const struct inotify_event *) p;
+		if (event->mask & IN_Q_OVERFLOW)
+			overflows++;
+		events++;
+	}
+
+	for (bucket = 0; bucket < BATCH_SIZE_BUCKETS - 1 && (events >> (bucket + 1)) != 0; bucket++)
+		;
+
+	pthread_mutex_lock (&stats_lock);
+	stats.batches++;
+	stats.events += events;
+	stats.bytes += len;
+	if (events > stats.max_batch_events)
+		stats.max_batch_events = events;
+	stats.wait_ns += wait;
+	stats.overflows += overflows;
+	if (high_water > stats.queue_high_water)
+		stats.queue_high_water = high_water;
+	stats.batch_sizes [bucket]++;
+	pthread_mutex_unlock (&stats_lock);
+}
 
 void
 inotify_snarf_events (int fd, int *nr, void **buffer_out)
 {
 	struct pollfd pollfd [2]  = { { fd, POLLIN | POLLPRI, 0 }, { snarf_cancellation_pipe [0], POLLIN, 0} };
-	unsigned int prev_pending = 0, pending_count = 0;
-	static struct inotify_event *buffer = NULL;
+	static char *buffer = NULL;
 	static size_t buffer_size;
+	unsigned int high_water = 0;
+	int64_t start, deadline, slice;
+	size_t len = 0;
 	int ret;
 
 	/* Allocate our buffer the first time we try to read events. */
 	if (buffer == NULL) {
-		/* guess the avg len */
+		/* guess the avg len; it grows if that's too little */
 		buffer_size = sizeof (struct inotify_event) + 16;
 		buffer_size *= max_queued_events;
 		buffer = malloc (buffer_size);
@@ -157,6 +689,13 @@ inotify_snarf_events (int fd, int *nr, void **buffer_out)
 	/* Set nr to 0, so it will be sure to contain something
 	   valid if the poll times out. */
 	*nr = 0;
+	*buffer_out = buffer;
+
+	/* Hand over whatever fanotify events didn't fit last time first */
+	if (fanotify_glue_pending (fd)) {
+		*nr = fanotify_glue_read (fd, buffer, buffer_size);
+		return;
+	}
 
 	/* Wait for the file descriptor to be ready to read. */
 	ret = poll (pollfd, 2, -1);
@@ -172,35 +711,475 @@ inotify_snarf_events (int fd, int *nr, void **buffer_out)
 	if (pollfd [1].revents != 0)
 		return;
 
-	/* Reading events in groups significantly helps performance.
-	 * If there are some events (but not too many!) ready, wait a
-	 * bit more to see if more events come in. */
+	start = now_ns ();
+	deadline = start + (int64_t) batch_latency * 1000000;
+	slice = (int64_t) batch_latency * 1000000 / DRAINS_PER_BATCH;
+
+	for (;;) {
+		unsigned int pending = 0;
+		ssize_t n;
 
-	while (pending_count < MAX_PENDING_COUNT) {
-		struct timespec ts = {0, PENDING_PAUSE_NANOSECONDS};
-		unsigned int pending;
+		if (inotify_shards_owns (fd))
+			pending = inotify_shards_queued (fd);
+		else if (ioctl (fd, FIONREAD, &pending) == -1)
+			pending = 0;
+		if (pending > high_water)
+			high_water = pending;
 
-		if (ioctl (fd, FIONREAD, &pending) == -1)
+		/* Nothing new since the last drain: don't hold on to the batch.
+		 * With nothing at all yet, fanotify may have filtered out every
+		 * event it read; go back to poll() rather than read() again. */
+		if (pending == 0)
 			break;
 
-		/* Don't wait if the number of pending events is too close
-		 * to the maximum queue size. */
-		pending /= sizeof (struct inotify_event) + 16;		
-		if (pending > PENDING_THRESHOLD (max_queued_events))
+		if (len + pending + MIN_READ_SIZE > buffer_size) {
+			size_t size = buffer_size * 2;
+			char *tmp;
+
+			while (size < len + pending + MIN_READ_SIZE)
+				size *= 2;
+			tmp = realloc (buffer, size);
+			if (tmp) {
+				buffer = tmp;
+				buffer_size = size;
+				*buffer_out = buffer;
+			}
+		}
+
+		if (fanotify_glue_owns (fd))
+			n = fanotify_glue_read (fd, buffer + len, buffer_size - len);
+		else if (inotify_shards_owns (fd))
+			n = inotify_shards_read (fd, buffer + len, buffer_size - len);
+		else
+			n = read (fd, buffer + len, buffer_size - len);
+		if (n > 0)
+			len += n;
+		else if (n == -1 && errno != EINTR && errno != EAGAIN) {
+			if (len == 0)
+				perror ("read");
 			break;
+		}
 
-		/* With each successive iteration, the minimum rate for
-		 * further sleep doubles. */
-		if (pending-prev_pending < PENDING_MARGINAL_COST(pending_count))
+		if (len >= batch_max_bytes || len + MIN_READ_SIZE > buffer_size ||
+		    fanotify_glue_pending (fd))
 			break;
 
-		prev_pending = pending;
-		++pending_count;
+		/* Sleep until the next drain, or until we're cancelled */
+		if (slice <= 0 || now_ns () + slice > deadline) {
+			break;
+		} else {
+			struct timespec ts = { slice / 1000000000, slice % 1000000000 };
 
-		nanosleep (&ts, NULL);
+			ret = ppoll (&pollfd [1], 1, &ts, NULL);
+			if (ret != 0 && !(ret == -1 && errno == EINTR))
+				break;
+		}
 	}
 
-	*nr = read (fd, buffer, buffer_size);
+	*nr = len;
 
-	*buffer_out = buffer;
+	account_batch (buffer, len, now_ns () - start, high_water);
+	pthread_mutex_lock (&stats_lock);
+	stats.buffer_size = buffer_size;
+	pthread_mutex_unlock (&stats_lock);
+}
+
+
+/*
+ * Event coalescing.
+ *
+ * inotify_snarf_coalesced() reads a batch like inotify_snarf_events() does,
+ * then boils it down before handing it over, as a build or a checkout
+ * produces long runs of events that say the same thing:
+ *
+ *  - Content events (modify, attrib, close, ...) on the same (wd, name) are
+ *    merged into the first of them, by OR-ing the masks, until something
+ *    structural (create, delete, move) happens to that name.
+ *  - A name that is created and deleted again within the batch disappears,
+ *    along with the content events in between.
+ *  - A MOVED_FROM and MOVED_TO with the same cookie become a single
+ *    MOVED_TO record that also carries the source.  Unpaired halves are
+ *    passed through with their cookie, for the caller to pair up.
+ *
+ * The result is an array of the records below.  Names are offsets into the
+ * string table handed back in 'names_out' (really the raw event buffer), or
+ * NO_NAME.  'coalesced' is set to the number of kernel events that were
+ * folded away.  Everything stays valid until the next call.
+ *
+ * Each record also carries the path of the watch it happened on, as it was
+ * when it happened, as an offset into 'paths_out' (NO_NAME if the watch isn't
+ * in the watch tree).  Directory moves are applied to the watch tree as they
+ * go by, even when the two halves arrive in different batches, and a watch is
+ * taken out of it on IN_IGNORED.
+ *
+ * With several inotify instances, each record says which one it came from,
+ * and so which queue it belongs in; moves between them are still paired up
+ * when both halves are in the batch.
+ */
+
+#define NO_NAME		0xffffffffu
+
+#define CONTENT_EVENTS	(IN_ACCESS | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+			 IN_CLOSE_NOWRITE | IN_OPEN)
+
+typedef struct {
+	int32_t wd;
+	uint32_t mask;
+	uint32_t cookie;
+	int32_t src_wd;		/* the MOVED_FROM half of a paired move, or -1 */
+	uint32_t name;
+	uint32_t src_name;
+	uint32_t path;		/* of the watch, or NO_NAME */
+	uint32_t src_path;
+	int32_t shard;		/* the instance the event came from */
+} glue_event_t;
+
+typedef struct {
+	const char *name;	/* NULL if the slot is free */
+	int wd;
+	int merge;		/* record content events are merged into, or -1 */
+	int created;		/* record of a create in this batch, or -1 */
+	uint32_t path;		/* for the watch's own slot: its path ... */
+	unsigned int path_gen;	/* ... as of this generation */
+} name_slot_t;
+
+typedef struct {
+	uint32_t cookie;	/* 0 if the slot is free */
+	int from;		/* record of the MOVED_FROM */
+	const struct inotify_event *dir_to; /* a directory's MOVED_TO, anywhere in the batch */
+} cookie_slot_t;
+
+static glue_event_t *coalesce_events;
+static name_slot_t *name_slots;
+static cookie_slot_t *cookie_slots;
+static int coalesce_alloc, slots_alloc;
+
+static char *paths;
+static size_t paths_len, paths_alloc;
+static unsigned int paths_gen;
+
+/* Directories recently moved away, kept until the MOVED_TO turns up */
+#define PENDING_MOVES	16
+
+static struct {
+	uint32_t cookie;
+	int wd;
+	char *name;
+} pending_moves [PENDING_MOVES];
+static int pending_next;
+
+static name_slot_t *
+find_name_slot (int wd, const char *name)
+{
+	unsigned int h = 2166136261u ^ (unsigned int) wd, i;
+	const char *p;
+
+	for (p = name; *p; p++)
+		h = (h ^ (unsigned char) *p) * 16777619u;
+
+	for (i = h & (slots_alloc - 1); name_slots [i].name; i = (i + 1) & (slots_alloc - 1)) {
+		if (name_slots [i].wd == wd && !strcmp (name_slots [i].name, name))
+			return &name_slots [i];
+	}
+
+	name_slots [i].name = name;
+	name_slots [i].wd = wd;
+	name_slots [i].merge = -1;
+	name_slots [i].created = -1;
+	name_slots [i].path = NO_NAME;
+	name_slots [i].path_gen = 0;
+
+	return &name_slots [i];
+}
+
+/* watch_path - the path of 'wd' in the path table, or NO_NAME */
+static uint32_t
+watch_path (int wd)
+{
+	name_slot_t *slot = find_name_slot (wd, "");
+	int len;
+
+	if (slot->path_gen == paths_gen)
+		return slot->path;
+	slot->path_gen = paths_gen;
+	slot->path = NO_NAME;
+
+	for (;;) {
+		len = inotify_tree_get_path (wd, paths + paths_len, paths_alloc - paths_len);
+		if (len < 0)
+			return NO_NAME;
+		if (paths_len + len < paths_alloc)
+			break;
+
+		{
+			size_t alloc = paths_alloc ? paths_alloc * 2 : 4096;
+			char *tmp;
+
+			while (alloc <= paths_len + len)
+				alloc *= 2;
+			tmp = realloc (paths, alloc);
+			if (!tmp)
+				return NO_NAME;
+			paths = tmp;
+			paths_alloc = alloc;
+		}
+	}
+
+	slot->path = paths_len;
+	paths_len += len + 1;
+
+	return slot->path;
+}
+
+/* move_away - remember a directory's MOVED_FROM */
+static void
+move_away (uint32_t cookie, int wd, const char *name)
+{
+	int i = pending_next;
+
+	free (pending_moves [i].name);
+	pending_moves [i].name = strdup (name);
+	pending_moves [i].cookie = pending_moves [i].name ? cookie : 0;
+	pending_moves [i].wd = wd;
+	pending_next = (i + 1) % PENDING_MOVES;
+}
+
+/* move_here - apply a directory's MOVED_TO to the watch tree */
+static void
+move_here (uint32_t cookie, int wd, const char *name)
+{
+	int i, child;
+
+	for (i = 0; i < PENDING_MOVES; i++) {
+		if (pending_moves [i].cookie != cookie)
+			continue;
+
+		child = inotify_tree_child (pending_moves [i].wd, pending_moves [i].name);
+		if (child >= 0) {
+			inotify_tree_move (child, wd, name);
+			/* Paths worked out so far may be stale now */
+			paths_gen++;
+		}
+
+		pending_moves [i].cookie = 0;
+		free (pending_moves [i].name);
+		pending_moves [i].name = NULL;
+		return;
+	}
+}
+
+static cookie_slot_t *
+find_cookie_slot (uint32_t cookie)
+{
+	unsigned int i;
+
+	for (i = (cookie * 2654435761u) & (slots_alloc - 1);
+	     cookie_slots [i].cookie;
+	     i = (i + 1) & (slots_alloc - 1)) {
+		if (cookie_slots [i].cookie == cookie)
+			return &cookie_slots [i];
+	}
+
+	cookie_slots [i].cookie = cookie;
+	cookie_slots [i].from = -1;
+	cookie_slots [i].dir_to = NULL;
+
+	return &cookie_slots [i];
+}
+
+/* Makes sure there is room for 'n' records, and empties the hash tables. */
+static int
+coalesce_prepare (int n)
+{
+	int slots = 64;
+
+	/* A slot per name, and one per watch for its path */
+	while (slots < 4 * n)
+		slots *= 2;
+
+	if (n > coalesce_alloc) {
+		glue_event_t *events = realloc (coalesce_events, n * sizeof (glue_event_t));
+		if (!events)
+			return -1;
+		coalesce_events = events;
+		coalesce_alloc = n;
+	}
+
+	if (slots > slots_alloc) {
+		name_slot_t *names = realloc (name_slots, slots * sizeof (name_slot_t));
+		cookie_slot_t *cookies;
+
+		if (names)
+			name_slots = names;
+		cookies = realloc (cookie_slots, slots * sizeof (cookie_slot_t));
+		if (cookies)
+			cookie_slots = cookies;
+		if (!names || !cookies)
+			return -1;
+		slots_alloc = slots;
+	}
+
+	memset (name_slots, 0, slots_alloc * sizeof (name_slot_t));
+	memset (cookie_slots, 0, slots_alloc * sizeof (cookie_slot_t));
+
+	paths_len = 0;
+	paths_gen++;
+
+	return 0;
+}
+
+void
+inotify_snarf_coalesced (int fd, int *nr, void **events_out, void **names_out,
+			 void **paths_out, int *coalesced)
+{
+	struct inotify_event *event;
+	glue_event_t *out;
+	char *buffer, *p, *end;
+	int n_raw = 0, n = 0, i, j;
+	int bytes;
+
+	*nr = 0;
+	*coalesced = 0;
+	*events_out = NULL;
+	*names_out = NULL;
+	*paths_out = NULL;
+
+	inotify_snarf_events (fd, &bytes, (void **) &buffer);
+	if (bytes <= 0 || buffer == NULL)
+		return;
+	end = buffer + bytes;
+
+	for (p = buffer; p < end; p += sizeof (struct inotify_event) + event->len) {
+		event = (struct inotify_event *) p;
+		n_raw++;
+	}
+
+	if (coalesce_prepare (n_raw) < 0) {
+		perror ("malloc");
+		return;
+	}
+	out = coalesce_events;
+
+	/* With several instances, the events after a directory's MOVED_FROM
+	 * may come ahead of its MOVED_TO, so the move is applied as soon as
+	 * the MOVED_FROM goes by if the other half is in the batch too. */
+	for (p = buffer; p < end; p += sizeof (struct inotify_event) + event->len) {
+		event = (struct inotify_event *) p;
+		if ((event->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_TO | IN_ISDIR) && event->cookie)
+			find_cookie_slot (event->cookie)->dir_to = event;
+	}
+
+	for (p = buffer; p < end; p += sizeof (struct inotify_event) + event->len) {
+		const char *name;
+		name_slot_t *slot;
+		cookie_slot_t *move;
+		glue_event_t *ev;
+
+		event = (struct inotify_event *) p;
+		name = event->len ? event->name : "";
+
+		ev = &out [n];
+		ev->wd = event->wd;
+		ev->mask = event->mask;
+		ev->cookie = event->cookie;
+		ev->src_wd = -1;
+		ev->name = event->len ? (uint32_t) (event->name - buffer) : NO_NAME;
+		ev->src_name = NO_NAME;
+		ev->path = NO_NAME;
+		ev->src_path = NO_NAME;
+		ev->shard = inotify_shards_shard_of (fd, event->wd);
+
+		if (event->wd < 0 || (event->mask & IN_Q_OVERFLOW)) {
+			n++;
+			continue;
+		}
+
+		ev->path = watch_path (event->wd);
+
+		if (event->mask & IN_IGNORED) {
+			inotify_tree_remove (event->wd);
+			n++;
+			continue;
+		}
+
+		if ((event->mask & (IN_MOVED_FROM | IN_ISDIR)) == (IN_MOVED_FROM | IN_ISDIR) && event->cookie) {
+			const struct inotify_event *to = find_cookie_slot (event->cookie)->dir_to;
+
+			move_away (event->cookie, event->wd, name);
+			if (to)
+				move_here (to->cookie, to->wd, to->name);
+		} else if ((event->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_TO | IN_ISDIR) && event->cookie)
+			move_here (event->cookie, event->wd, name);
+
+		slot = find_name_slot (event->wd, name);
+
+		/* Something happened to the file's contents */
+		if ((event->mask & ~IN_ISDIR & ~CONTENT_EVENTS) == 0) {
+			if (slot->merge >= 0) {
+				out [slot->merge].mask |= event->mask;
+				continue;
+			}
+			slot->merge = n++;
+			continue;
+		}
+
+		if ((event->mask & IN_DELETE) && slot->created >= 0) {
+			/* It never was, as far as the caller needs to know.  Since
+			 * the create, there can only have been one (merged) run of
+			 * content events. */
+			out [slot->created].wd = -1;
+			out [slot->created].mask = 0;
+			if (slot->merge > slot->created) {
+				out [slot->merge].wd = -1;
+				out [slot->merge].mask = 0;
+			}
+			slot->merge = -1;
+			slot->created = -1;
+			continue;
+		}
+
+		/* Anything else ends the run of content events for the name */
+		slot->merge = -1;
+		slot->created = -1;
+
+		if (event->mask & IN_CREATE) {
+			slot->created = n++;
+			continue;
+		}
+
+		if ((event->mask & IN_MOVED_FROM) && event->cookie) {
+			move = find_cookie_slot (event->cookie);
+			move->from = n;
+		} else if ((event->mask & IN_MOVED_TO) && event->cookie) {
+			move = find_cookie_slot (event->cookie);
+			if (move->from >= 0) {
+				glue_event_t *from = &out [move->from];
+
+				ev->cookie = 0;
+				ev->src_wd = from->wd;
+				ev->src_name = from->name;
+				ev->src_path = from->path;
+				from->wd = -1;
+				from->mask = 0;
+				move->from = -1;
+			}
+		}
+
+		n++;
+	}
+
+	/* Squeeze out the records we cancelled */
+	for (i = j = 0; i < n; i++) {
+		if (out [i].wd == -1 && out [i].mask == 0)
+			continue;
+		if (i != j)
+			out [j] = out [i];
+		j++;
+	}
+
+	*nr = j;
+	*coalesced = n_raw - j;
+	*events_out = out;
+	*names_out = buffer;
+	*paths_out = paths;
 }
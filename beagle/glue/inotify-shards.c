@@ -0,0 +1,299 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+ * inotify-shards.c - several inotify instances behind one descriptor
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ */
+
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * One inotify instance means one kernel queue, read by one thread, and on a
+ * machine watching several big trees that is where everything waits.  So
+ * the watches are spread over a few instances, and the reader drains
+ * whichever of them epoll says are ready, taking turns so that a busy one
+ * can't starve the others.
+ *
+ * A watch descriptor handed out is (local wd * number of instances) +
+ * instance, so it is unique across the set; a local wd too big for that to
+ * fit in an int is given back, and the watch fails with ENOSPC.  A new watch
+ * goes on the same instance as its parent, except for the directories right
+ * below a root (and the roots themselves), which go on whichever instance has
+ * the fewest watches.  That splits a big tree by its top level directories,
+ * and keeps the events of any one of those in order.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/inotify.h>
+
+#include "inotify-shards.h"
+#include "inotify-tree.h"
+
+#define MAX_SHARDS	32
+
+typedef struct {
+	int fd;
+	int watches;	/* roughly: watches added less IN_IGNORED seen */
+} shard_t;
+
+static shard_t shards [MAX_SHARDS];
+static int n_shards;
+static int epoll_fd = -1;
+static int next_shard;		/* where the next read starts */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+int
+inotify_shards_open (int n)
+{
+	int i;
+
+	if (epoll_fd != -1)
+		return epoll_fd;
+
+	if (n > MAX_SHARDS)
+		n = MAX_SHARDS;
+	if (n < 1)
+		return -EINVAL;
+
+	epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+	if (epoll_fd == -1)
+		return -errno;
+
+	for (i = 0; i < n; i++) {
+		struct epoll_event ev;
+
+		shards [i].fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+		if (shards [i].fd == -1)
+			break;
+		shards [i].watches = 0;
+
+		memset (&ev, 0, sizeof (ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, shards [i].fd, &ev) == -1) {
+			close (shards [i].fd);
+			break;
+		}
+	}
+
+	/* Out of instances part way: make do with what we got */
+	if (i == 0) {
+		int ret = -errno;
+
+		close (epoll_fd);
+		epoll_fd = -1;
+		return ret;
+	}
+	n_shards = i;
+
+	return epoll_fd;
+}
+
+int
+inotify_shards_owns (int fd)
+{
+	return fd != -1 && fd == epoll_fd;
+}
+
+int
+inotify_shards_count (int fd)
+{
+	return inotify_shards_owns (fd) ? n_shards : 1;
+}
+
+int
+inotify_shards_shard_of (int fd, int wd)
+{
+	if (!inotify_shards_owns (fd) || wd < 0)
+		return 0;
+
+	return wd % n_shards;
+}
+
+/* pick_shard - the instance a new watch on 'path' should go on */
+static int
+pick_shard (const char *path, int parent)
+{
+	int wd, i, best;
+
+	/* Watching something again has to go to the same instance */
+	wd = inotify_tree_lookup (path);
+	if (wd >= 0)
+		return wd % n_shards;
+
+	if (parent < 0) {
+		const char *slash = strrchr (path, '/');
+
+		if (slash && slash != path) {
+			char *dir = strndup (path, slash - path);
+
+			if (dir) {
+				parent = inotify_tree_lookup (dir);
+				free (dir);
+			}
+		}
+	}
+
+	if (parent >= 0 && inotify_tree_depth (parent) > 0)
+		return parent % n_shards;
+
+	pthread_mutex_lock (&lock);
+	for (best = 0, i = 1; i < n_shards; i++) {
+		if (shards [i].watches < shards [best].watches)
+			best = i;
+	}
+	pthread_mutex_unlock (&lock);
+
+	return best;
+}
+
+int
+inotify_shards_add_watch (int fd, const char *path, uint32_t mask, int parent)
+{
+	int shard, wd;
+
+	if (!inotify_shards_owns (fd))
+		return -EBADF;
+
+	shard = pick_shard (path, parent);
+
+	wd = inotify_add_watch (shards [shard].fd, path, mask);
+	if (wd < 0)
+		return -errno;
+
+	if (wd > (INT_MAX - shard) / n_shards) {
+		inotify_rm_watch (shards [shard].fd, wd);
+		return -ENOSPC;
+	}
+
+	pthread_mutex_lock (&lock);
+	shards [shard].watches++;
+	pthread_mutex_unlock (&lock);
+
+	return wd * n_shards + shard;
+}
+
+int
+inotify_shards_rm_watch (int fd, int wd)
+{
+	if (!inotify_shards_owns (fd) || wd < 0)
+		return -EBADF;
+
+	/* The count goes down when the IN_IGNORED comes through */
+	if (inotify_rm_watch (shards [wd % n_shards].fd, wd / n_shards) == -1)
+		return -errno;
+
+	return 0;
+}
+
+int
+inotify_shards_queued (int fd)
+{
+	unsigned int pending, total = 0;
+	int i;
+
+	if (!inotify_shards_owns (fd))
+		return 0;
+
+	for (i = 0; i < n_shards; i++) {
+		if (ioctl (shards [i].fd, FIONREAD, &pending) == 0)
+			total += pending;
+	}
+
+	return total;
+}
+
+ssize_t
+inotify_shards_read (int fd, void *buffer, size_t len)
+{
+	struct epoll_event ready [MAX_SHARDS];
+	size_t total = 0;
+	int n, i, first;
+
+	if (!inotify_shards_owns (fd)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	n = epoll_wait (epoll_fd, ready, MAX_SHARDS, 0);
+	if (n == -1)
+		return -1;
+
+	first = next_shard++;
+
+	for (i = 0; i < n; i++) {
+		int shard = ready [(first + i) % n].data.u32;
+		char *start = (char *) buffer + total, *p;
+		ssize_t got;
+		int ignored = 0;
+
+		/* Too little room left for this one's next event gives EINVAL;
+		 * it is read next time round */
+		got = read (shards [shard].fd, start, len - total);
+		if (got <= 0)
+			continue;
+
+		for (p = start; p < start + got; ) {
+			struct inotify_event *event = (struct inotify_event *) p;
+
+			/* One given back by inotify_shards_add_watch() was never
+			 * handed out, or counted, so nobody is looking for it */
+			if (event->wd > (INT_MAX - shard) / n_shards) {
+				event->wd = -1;
+			} else {
+				if (event->wd >= 0)
+					event->wd = event->wd * n_shards + shard;
+				if (event->mask & IN_IGNORED)
+					ignored++;
+			}
+			p += sizeof (struct inotify_event) + event->len;
+		}
+
+		if (ignored) {
+			pthread_mutex_lock (&lock);
+			shards [shard].watches -= ignored;
+			pthread_mutex_unlock (&lock);
+		}
+
+		total += got;
+	}
+
+	if (total == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return total;
+}
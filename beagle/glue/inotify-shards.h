@@ -0,0 +1,53 @@
+/*
+ * inotify-shards.h - several inotify instances behind one descriptor
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef __INOTIFY_SHARDS_H__
+#define __INOTIFY_SHARDS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A set of inotify instances that looks like one to the rest of the glue.
+ * inotify_shards_open() returns an epoll descriptor over all of them, which
+ * polls readable when any of them is, and the other calls mirror
+ * inotify_add_watch(), inotify_rm_watch(), FIONREAD and read() on it, with
+ * errors returned as -errno (read returns -1 and sets errno, as read does).
+ *
+ * Watch descriptors are made unique across the set, and whole subtrees are
+ * kept on one instance, so that the events of a subtree stay in order.
+ * 'parent' is the watch on the directory above, or -1 if it isn't known.
+ */
+
+int     inotify_shards_open      (int n_shards);
+int     inotify_shards_owns      (int fd);
+int     inotify_shards_count     (int fd);
+int     inotify_shards_shard_of  (int fd, int wd);
+int     inotify_shards_add_watch (int fd, const char *path, uint32_t mask, int parent);
+int     inotify_shards_rm_watch  (int fd, int wd);
+int     inotify_shards_queued    (int fd);
+ssize_t inotify_shards_read      (int fd, void *buffer, size_t len);
+
+#endif /* __INOTIFY_SHARDS_H__ */
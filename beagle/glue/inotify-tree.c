@@ -0,0 +1,579 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+ * inotify-tree.c - where each watch is, as a tree of watch descriptors
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ */
+
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "inotify-tree.h"
+
+typedef struct atom atom_t;
+
+struct atom {
+	atom_t *next;
+	unsigned int hash;
+	unsigned int refs;
+	char str [];
+};
+
+typedef struct node node_t;
+
+struct node {
+	node_t *next;		/* in its parent's hash chain, or the roots list */
+	node_t *wd_next;	/* in the by_wd hash chain */
+	atom_t *name;		/* the full path for a root */
+	int wd;
+	int parent;		/* -1 for a root */
+	int n_children;
+	int watched;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static atom_t **atoms;
+static unsigned int n_atom_buckets, n_atoms;
+
+static node_t **by_wd;
+static unsigned int n_wd_buckets, n_wds;
+
+static node_t **children;
+static unsigned int n_child_buckets, n_children;
+
+static node_t *roots;
+
+static unsigned int
+hash_string (const char *str, size_t len)
+{
+	unsigned int h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char) str [i]) * 16777619u;
+
+	return h;
+}
+
+/* atom_get - find the atom for a string, creating it if 'create' is set */
+static atom_t *
+atom_get (const char *str, size_t len, int create)
+{
+	unsigned int hash = hash_string (str, len);
+	atom_t *a;
+
+	if (n_atom_buckets) {
+		for (a = atoms [hash & (n_atom_buckets - 1)]; a; a = a->next) {
+			if (a->hash == hash && !strncmp (a->str, str, len) && a->str [len] == '\0') {
+				if (create)
+					a->refs++;
+				return a;
+			}
+		}
+	}
+
+	if (!create)
+		return NULL;
+
+	if (n_atoms >= n_atom_buckets) {
+		unsigned int size = n_atom_buckets ? n_atom_buckets * 2 : 1024, i;
+		atom_t **buckets = calloc (size, sizeof (atom_t *));
+
+		if (!buckets)
+			return NULL;
+		for (i = 0; i < n_atom_buckets; i++) {
+			while ((a = atoms [i]) != NULL) {
+				atoms [i] = a->next;
+				a->next = buckets [a->hash & (size - 1)];
+				buckets [a->hash & (size - 1)] = a;
+			}
+		}
+		free (atoms);
+		atoms = buckets;
+		n_atom_buckets = size;
+	}
+
+	a = malloc (sizeof (atom_t) + len + 1);
+	if (!a)
+		return NULL;
+	a->hash = hash;
+	a->refs = 1;
+	memcpy (a->str, str, len);
+	a->str [len] = '\0';
+	a->next = atoms [hash & (n_atom_buckets - 1)];
+	atoms [hash & (n_atom_buckets - 1)] = a;
+	n_atoms++;
+
+	return a;
+}
+
+static void
+atom_unref (atom_t *a)
+{
+	atom_t **p;
+
+	if (--a->refs > 0)
+		return;
+
+	for (p = &atoms [a->hash & (n_atom_buckets - 1)]; *p != a; p = &(*p)->next)
+		;
+	*p = a->next;
+	n_atoms--;
+	free (a);
+}
+
+/*
+ * The nodes are hashed by wd rather than kept in an array indexed by it:
+ * the kernel hands wds out cyclically, and sharding multiplies them, so the
+ * largest one seen says nothing about how many there are.
+ */
+static inline unsigned int
+wd_hash (int wd)
+{
+	return (unsigned int) wd * 2654435761u;
+}
+
+static node_t *
+node_get (int wd)
+{
+	node_t *n;
+
+	if (wd < 0 || !n_wd_buckets)
+		return NULL;
+
+	for (n = by_wd [wd_hash (wd) & (n_wd_buckets - 1)]; n; n = n->wd_next) {
+		if (n->wd == wd)
+			return n;
+	}
+
+	return NULL;
+}
+
+/* node_insert - add a node to by_wd, making room first if need be */
+static int
+node_insert (node_t *n)
+{
+	node_t **bucket;
+
+	if (n_wds >= n_wd_buckets) {
+		unsigned int size = n_wd_buckets ? n_wd_buckets * 2 : 1024, i;
+		node_t **buckets = calloc (size, sizeof (node_t *));
+		node_t *c;
+
+		if (!buckets)
+			return -1;
+		for (i = 0; i < n_wd_buckets; i++) {
+			while ((c = by_wd [i]) != NULL) {
+				by_wd [i] = c->wd_next;
+				c->wd_next = buckets [wd_hash (c->wd) & (size - 1)];
+				buckets [wd_hash (c->wd) & (size - 1)] = c;
+			}
+		}
+		free (by_wd);
+		by_wd = buckets;
+		n_wd_buckets = size;
+	}
+
+	bucket = &by_wd [wd_hash (n->wd) & (n_wd_buckets - 1)];
+	n->wd_next = *bucket;
+	*bucket = n;
+	n_wds++;
+
+	return 0;
+}
+
+static void
+node_remove (node_t *n)
+{
+	node_t **p;
+
+	for (p = &by_wd [wd_hash (n->wd) & (n_wd_buckets - 1)]; *p != n; p = &(*p)->wd_next)
+		;
+	*p = n->wd_next;
+	n_wds--;
+}
+
+static inline unsigned int
+child_hash (int parent, const atom_t *name)
+{
+	return ((unsigned int) parent * 2654435761u) ^ name->hash;
+}
+
+static node_t *
+child_find (int parent, const atom_t *name)
+{
+	node_t *n;
+
+	if (!n_child_buckets)
+		return NULL;
+
+	for (n = children [child_hash (parent, name) & (n_child_buckets - 1)]; n; n = n->next) {
+		if (n->parent == parent && n->name == name)
+			return n;
+	}
+
+	return NULL;
+}
+
+/* link - put a node under its parent, or among the roots */
+static int
+link_node (node_t *n)
+{
+	node_t **bucket;
+
+	if (n->parent < 0) {
+		n->next = roots;
+		roots = n;
+		return 0;
+	}
+
+	if (n_children >= n_child_buckets) {
+		unsigned int size = n_child_buckets ? n_child_buckets * 2 : 1024, i;
+		node_t **buckets = calloc (size, sizeof (node_t *));
+		node_t *c;
+
+		if (!buckets)
+			return -1;
+		for (i = 0; i < n_child_buckets; i++) {
+			while ((c = children [i]) != NULL) {
+				children [i] = c->next;
+				c->next = buckets [child_hash (c->parent, c->name) & (size - 1)];
+				buckets [child_hash (c->parent, c->name) & (size - 1)] = c;
+			}
+		}
+		free (children);
+		children = buckets;
+		n_child_buckets = size;
+	}
+
+	bucket = &children [child_hash (n->parent, n->name) & (n_child_buckets - 1)];
+	n->next = *bucket;
+	*bucket = n;
+	n_children++;
+	node_get (n->parent)->n_children++;
+
+	return 0;
+}
+
+static void
+unlink_node (node_t *n)
+{
+	node_t **p;
+
+	if (n->parent < 0) {
+		p = &roots;
+	} else {
+		p = &children [child_hash (n->parent, n->name) & (n_child_buckets - 1)];
+		n_children--;
+		node_get (n->parent)->n_children--;
+	}
+
+	for (; *p != n; p = &(*p)->next)
+		;
+	*p = n->next;
+}
+
+/* release - free a node, and any ancestors, once nothing needs them */
+static void
+release (node_t *n)
+{
+	while (n && !n->watched && n->n_children == 0) {
+		int parent = n->parent;
+
+		unlink_node (n);
+		node_remove (n);
+		atom_unref (n->name);
+		free (n);
+
+		n = node_get (parent);
+	}
+}
+
+/* find - the node at 'path', watched or not */
+static node_t *
+find (const char *path)
+{
+	node_t *r;
+
+	for (r = roots; r; r = r->next) {
+		size_t len = strlen (r->name->str);
+		const char *p;
+		node_t *n = r;
+
+		if (strncmp (path, r->name->str, len) != 0 || (path [len] != '/' && path [len] != '\0'))
+			continue;
+
+		for (p = path + len; n && *p; ) {
+			const char *slash;
+			atom_t *name;
+
+			while (*p == '/')
+				p++;
+			if (!*p)
+				break;
+			slash = strchr (p, '/');
+			if (!slash)
+				slash = p + strlen (p);
+
+			name = atom_get (p, slash - p, 0);
+			n = name ? child_find (n->wd, name) : NULL;
+			p = slash;
+		}
+
+		if (n)
+			return n;
+	}
+
+	return NULL;
+}
+
+int
+inotify_tree_add (int wd, int parent, const char *name)
+{
+	node_t *n;
+
+	if (wd < 0)
+		return -1;
+
+	pthread_mutex_lock (&lock);
+
+	n = node_get (wd);
+	if (n) {
+		/* Watched again; it is still where it was */
+		n->watched = 1;
+		pthread_mutex_unlock (&lock);
+		return 0;
+	}
+
+	if (parent >= 0 && !node_get (parent))
+		goto fail;
+
+	n = calloc (1, sizeof (node_t));
+	if (!n)
+		goto fail;
+	n->name = atom_get (name, strlen (name), 1);
+	if (!n->name) {
+		free (n);
+		goto fail;
+	}
+	n->wd = wd;
+	n->parent = parent;
+	n->watched = 1;
+
+	if (node_insert (n) < 0) {
+		atom_unref (n->name);
+		free (n);
+		goto fail;
+	}
+	if (link_node (n) < 0) {
+		node_remove (n);
+		atom_unref (n->name);
+		free (n);
+		goto fail;
+	}
+
+	pthread_mutex_unlock (&lock);
+	return 0;
+
+ fail:
+	pthread_mutex_unlock (&lock);
+	return -1;
+}
+
+int
+inotify_tree_add_path (int wd, const char *path)
+{
+	const char *slash = strrchr (path, '/');
+	int parent = -1;
+
+	if (slash && slash != path && slash [1] != '\0') {
+		char *dir = strndup (path, slash - path);
+		node_t *n;
+
+		if (dir) {
+			pthread_mutex_lock (&lock);
+			n = find (dir);
+			if (n)
+				parent = n->wd;
+			pthread_mutex_unlock (&lock);
+			free (dir);
+		}
+	}
+
+	/* We race with the parent going away in between; fall back to a root */
+	if (parent >= 0 && inotify_tree_add (wd, parent, slash + 1) == 0)
+		return 0;
+
+	return inotify_tree_add (wd, -1, path);
+}
+
+void
+inotify_tree_remove (int wd)
+{
+	node_t *n;
+
+	pthread_mutex_lock (&lock);
+	n = node_get (wd);
+	if (n) {
+		n->watched = 0;
+		release (n);
+	}
+	pthread_mutex_unlock (&lock);
+}
+
+int
+inotify_tree_child (int parent, const char *name)
+{
+	node_t *n = NULL;
+	atom_t *a;
+
+	pthread_mutex_lock (&lock);
+	a = atom_get (name, strlen (name), 0);
+	if (a)
+		n = child_find (parent, a);
+	pthread_mutex_unlock (&lock);
+
+	return n ? n->wd : -1;
+}
+
+void
+inotify_tree_move (int wd, int parent, const char *name)
+{
+	node_t *n, *old_parent;
+	atom_t *old_name;
+
+	pthread_mutex_lock (&lock);
+
+	n = node_get (wd);
+	if (!n || !node_get (parent)) {
+		pthread_mutex_unlock (&lock);
+		return;
+	}
+
+	old_parent = node_get (n->parent);
+	old_name = n->name;
+
+	n->name = atom_get (name, strlen (name), 1);
+	if (!n->name) {
+		n->name = old_name;
+		pthread_mutex_unlock (&lock);
+		return;
+	}
+
+	/* A root's name is its full path, so it has to be unlinked under that */
+	{
+		atom_t *new_name = n->name;
+
+		n->name = old_name;
+		unlink_node (n);
+		n->name = new_name;
+	}
+	n->parent = parent;
+	if (link_node (n) < 0) {
+		/* Out of memory: it is lost to path lookups, but not to events */
+		n->parent = -1;
+		n->next = roots;
+		roots = n;
+	}
+	atom_unref (old_name);
+
+	if (old_parent)
+		release (old_parent);
+
+	pthread_mutex_unlock (&lock);
+}
+
+int
+inotify_tree_lookup (const char *path)
+{
+	node_t *n;
+	int wd = -1;
+
+	pthread_mutex_lock (&lock);
+	n = find (path);
+	if (n && n->watched)
+		wd = n->wd;
+	pthread_mutex_unlock (&lock);
+
+	return wd;
+}
+
+/*
+ * inotify_tree_get_path - write the path of 'wd' to 'buffer'
+ *
+ * Returns the length of the path, which is only written if that is less than
+ * 'len', or -1 if the watch isn't known.
+ */
+int
+inotify_tree_get_path (int wd, char *buffer, int len)
+{
+	node_t *n;
+	int total = 0, pos;
+
+	pthread_mutex_lock (&lock);
+
+	n = node_get (wd);
+	if (!n) {
+		pthread_mutex_unlock (&lock);
+		return -1;
+	}
+
+	for (; n; n = node_get (n->parent))
+		total += strlen (n->name->str) + (n->parent >= 0 ? 1 : 0);
+
+	if (total < len) {
+		pos = total;
+		buffer [pos] = '\0';
+		for (n = node_get (wd); n; n = node_get (n->parent)) {
+			size_t l = strlen (n->name->str);
+
+			pos -= l;
+			memcpy (buffer + pos, n->name->str, l);
+			if (n->parent >= 0)
+				buffer [--pos] = '/';
+		}
+	}
+
+	pthread_mutex_unlock (&lock);
+
+	return total;
+}
+
+/* inotify_tree_depth - how far 'wd' is below its root (0 for a root), or -1 */
+int
+inotify_tree_depth (int wd)
+{
+	node_t *n;
+	int depth = -1;
+
+	pthread_mutex_lock (&lock);
+	for (n = node_get (wd); n; n = node_get (n->parent))
+		depth++;
+	pthread_mutex_unlock (&lock);
+
+	return depth;
+}
@@ -0,0 +1,47 @@
+/*
+ * inotify-tree.h - where each watch is, as a tree of watch descriptors
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __INOTIFY_TREE_H__
+#define __INOTIFY_TREE_H__
+
+/*
+ * Every watch is recorded as a (parent wd, name) pair, or as a root with a
+ * full path when its parent isn't watched, and names are interned.  Paths
+ * are put together on demand, so renaming a directory is a single update no
+ * matter how many watches there are below it.  A watch that goes away while
+ * watches below it remain stays in the tree, unwatched, to keep their paths.
+ *
+ * All of these are safe to call from any thread.
+ */
+
+int  inotify_tree_add      (int wd, int parent, const char *name);
+int  inotify_tree_add_path (int wd, const char *path);
+void inotify_tree_remove   (int wd);
+int  inotify_tree_child    (int parent, const char *name);
+void inotify_tree_move     (int wd, int parent, const char *name);
+int  inotify_tree_lookup   (const char *path);
+int  inotify_tree_get_path (int wd, char *buffer, int len);
+int  inotify_tree_depth    (int wd);
+
+#endif /* __INOTIFY_TREE_H__ */
@@ -26,7 +26,11 @@
 
 
 #include <sys/syscall.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #if defined(__i386__)
 #define __NR_ioprio_set		289
@@ -106,3 +110,149 @@ int set_io_priority_best_effort (int ioprio)
 
 	return ioprio_set (IOPRIO_WHO_PROCESS, 0, ioprio | ioclass);
 }
+
+/*
+ * The I/O priority of a single thread, with the given id (0 for the calling
+ * thread).  Threads in one of the background roles (see
+ * SystemPriorities.SetThreadRole) are set with the _background_ variants,
+ * which remember them, so that the pressure monitor can move all of those
+ * between classes at once without touching the threads serving queries.
+ * Until it does, each keeps the priority of its role.
+ */
+
+static pthread_mutex_t background_lock = PTHREAD_MUTEX_INITIALIZER;
+static pid_t *background_tids;
+static int n_background, background_alloc;
+static int background_ioprio = -1;	/* set by the pressure monitor, or -1 */
+
+static pid_t resolve_tid (pid_t tid)
+{
+	return tid ? tid : (pid_t) syscall (SYS_gettid);
+}
+
+/* The caller must hold background_lock */
+static void forget_background (int i)
+{
+	background_tids [i] = background_tids [--n_background];
+}
+
+/* The caller must hold background_lock */
+static int find_background (pid_t tid)
+{
+	int i;
+
+	for (i = 0; i < n_background; i++)
+		if (background_tids [i] == tid)
+			return i;
+
+	return -1;
+}
+
+int get_thread_io_priority (pid_t tid)
+{
+	return ioprio_get (IOPRIO_WHO_PROCESS, tid);
+}
+
+int set_thread_io_priority (pid_t tid, int ioprio)
+{
+	int i, ret;
+
+	tid = resolve_tid (tid);
+
+	pthread_mutex_lock (&background_lock);
+	if ((i = find_background (tid)) >= 0)
+		forget_background (i);
+	ret = ioprio_set (IOPRIO_WHO_PROCESS, tid, ioprio);
+	pthread_mutex_unlock (&background_lock);
+
+	return ret;
+}
+
+static int set_background_thread_io_priority (pid_t tid, int ioprio)
+{
+	int ret;
+
+	tid = resolve_tid (tid);
+
+	pthread_mutex_lock (&background_lock);
+
+	if (find_background (tid) < 0) {
+		if (n_background == background_alloc) {
+			int size = background_alloc ? background_alloc * 2 : 16;
+			pid_t *tids = realloc (background_tids, size * sizeof (pid_t));
+
+			if (tids) {
+				background_tids = tids;
+				background_alloc = size;
+			}
+		}
+
+		/* Without the memory, the thread just won't follow the monitor */
+		if (n_background < background_alloc)
+			background_tids [n_background++] = tid;
+	}
+
+	if (background_ioprio != -1)
+		ioprio = background_ioprio;
+	ret = ioprio_set (IOPRIO_WHO_PROCESS, tid, ioprio);
+
+	pthread_mutex_unlock (&background_lock);
+
+	return ret;
+}
+
+int set_background_thread_io_priority_idle (pid_t tid)
+{
+	return set_background_thread_io_priority (tid, 7 | IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+int set_background_thread_io_priority_best_effort (pid_t tid, int ioprio)
+{
+	return set_background_thread_io_priority (tid, ioprio | IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT);
+}
+
+/*
+ * These change the threads in background roles, and any that take one on
+ * later, until reset_background_io_priority() hands them back to their
+ * roles.  They return the number of threads that could not be changed.
+ */
+
+static int set_io_priority_of_background_threads (int ioprio)
+{
+	char path [64];
+	int i, failed = 0;
+
+	pthread_mutex_lock (&background_lock);
+
+	background_ioprio = ioprio;
+
+	for (i = n_background - 1; i >= 0; i--) {
+		/* Threads which have exited since are forgotten, before their ids are reused */
+		snprintf (path, sizeof (path), "/proc/self/task/%d", (int) background_tids [i]);
+		if (access (path, F_OK) != 0)
+			forget_background (i);
+		else if (ioprio_set (IOPRIO_WHO_PROCESS, background_tids [i], ioprio) < 0)
+			failed++;
+	}
+
+	pthread_mutex_unlock (&background_lock);
+
+	return failed;
+}
+
+int set_background_io_priority_idle (void)
+{
+	return set_io_priority_of_background_threads (7 | IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+int set_background_io_priority_best_effort (int ioprio)
+{
+	return set_io_priority_of_background_threads (ioprio | IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT);
+}
+
+void reset_background_io_priority (void)
+{
+	pthread_mutex_lock (&background_lock);
+	background_ioprio = -1;
+	pthread_mutex_unlock (&background_lock);
+}
@@ -0,0 +1,508 @@
+/*
+ * pressure-glue.c - back indexing off when the machine is under pressure
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A thread samples the kernel's pressure stall information (/proc/pressure)
+ * and our own I/O counters every few tens of milliseconds, and turns them
+ * into a throttle factor between MIN_THROTTLE and 1 for the scheduler to
+ * space indexing work out by.
+ *
+ * PSI's own averages are over ten seconds at the least, far too slow to
+ * react to, so we work from the 'total' stall time counters instead: the
+ * share of each interval that some task spent waiting for I/O, CPU or
+ * memory.  Each share is measured against a threshold, the worst of them is
+ * smoothed a little, and then
+ *
+ *  - above its threshold, the throttle factor is halved on every sample, so
+ *    that contention has us down to a quarter of the speed in about 100 ms;
+ *  - well below it, the factor creeps back up, reaching 1 in about a second.
+ *
+ * The I/O stalls include our own: a crawl on an otherwise quiet machine
+ * keeps the disk busy and stalls on it, and would back itself off for
+ * nothing.  So we also read the throughput of the physical disks, and only
+ * count the part of the I/O stall time that matches the share of it which
+ * isn't ours.
+ *
+ * Optionally the I/O priority of the threads in background roles follows
+ * along: the idle class while we are throttled, the lowest best-effort
+ * priority otherwise, so that a quiet machine's disks get used fully.  The
+ * threads serving queries keep theirs.
+ *
+ * The files are opened once and re-read with pread(), which is all it takes
+ * for /proc to produce fresh contents.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#define DEFAULT_INTERVAL_MSEC	50
+#define MIN_THROTTLE		0.05
+#define THROTTLE_STEP		0.05	/* per sample, on the way back up */
+
+/* Shares of time stalled that count as contention */
+#define IO_THRESHOLD		0.10
+#define CPU_THRESHOLD		0.30
+#define MEMORY_THRESHOLD	0.05
+
+/* Weight of each sample in our share of the disk throughput */
+#define SHARE_WEIGHT		0.25
+
+#define MAX_DISKS		32
+
+/* Throttle factors to switch the I/O class at, with some hysteresis */
+#define IDLE_IOPRIO_BELOW	0.5
+#define BE_IOPRIO_ABOVE		0.9
+
+#define IOPRIO_CLASS_BE		2
+#define IOPRIO_CLASS_IDLE	3
+
+extern int set_background_io_priority_idle (void);
+extern int set_background_io_priority_best_effort (int ioprio);
+extern void reset_background_io_priority (void);
+
+typedef struct {
+	double throttle;	/* 1 is full speed */
+	double io_some;		/* share of the last interval stalled on each */
+	double io_full;
+	double cpu_some;
+	double memory_some;
+	double memory_full;
+	double read_rate;	/* bytes/s we read from and wrote to storage */
+	double write_rate;
+	double io_share;	/* our share of the disks' throughput, smoothed */
+	int io_class;		/* I/O class we set, 0 if we leave it alone */
+	int running;
+	uint64_t samples;
+	uint64_t backoffs;	/* samples on which we cut the throttle factor */
+} pressure_glue_state_t;
+
+enum {
+	RESOURCE_IO,
+	RESOURCE_CPU,
+	RESOURCE_MEMORY,
+	N_RESOURCES
+};
+
+static const char *resource_files [N_RESOURCES] = {
+	"/proc/pressure/io",
+	"/proc/pressure/cpu",
+	"/proc/pressure/memory"
+};
+
+static const double thresholds [N_RESOURCES] = {
+	IO_THRESHOLD,
+	CPU_THRESHOLD,
+	MEMORY_THRESHOLD
+};
+
+static int resource_fds [N_RESOURCES] = { -1, -1, -1 };
+static int self_io_fd = -1;
+static int disk_fds [MAX_DISKS];
+static int n_disks;
+
+/* Only touched by the sampling thread, once it runs */
+static uint64_t last_some [N_RESOURCES], last_full [N_RESOURCES];
+static uint64_t last_read_bytes, last_write_bytes, last_disk_bytes;
+static int64_t last_time;
+static double smoothed, own_bytes, disk_bytes;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pressure_glue_state_t state = { .throttle = 1.0 };
+static int adjust_io_priority;
+static int interval_msec = DEFAULT_INTERVAL_MSEC;
+static volatile int stop_requested;
+static pthread_t thread;
+
+static int64_t
+now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* read_proc - the current contents of a /proc file we keep open */
+static int
+read_proc (int fd, char *buffer, size_t len)
+{
+	ssize_t n;
+
+	n = pread (fd, buffer, len - 1, 0);
+	if (n <= 0)
+		return -1;
+	buffer [n] = '\0';
+
+	return 0;
+}
+
+/* find_value - the number after 'key' on the line starting with 'line' */
+static int
+find_value (const char *buffer, const char *line, const char *key, uint64_t *value)
+{
+	const char *p = buffer;
+	size_t line_len = strlen (line);
+
+	while (p && strncmp (p, line, line_len) != 0) {
+		p = strchr (p, '\n');
+		if (p)
+			p++;
+	}
+	if (!p)
+		return -1;
+
+	p = strstr (p, key);
+	if (!p)
+		return -1;
+
+	*value = strtoull (p + strlen (key), NULL, 10);
+	return 0;
+}
+
+/*
+ * open_disks - open the statistics of every disk backed by a device, which
+ * leaves out partitions, loop, device-mapper and RAID devices, all of whose
+ * I/O ends up on one of those anyway
+ */
+static void
+open_disks (void)
+{
+	struct dirent *d;
+	char path [PATH_MAX];
+	DIR *dir;
+
+	n_disks = 0;
+	dir = opendir ("/sys/block");
+	if (!dir)
+		return;
+
+	while ((d = readdir (dir)) != NULL && n_disks < MAX_DISKS) {
+		int fd;
+
+		if (d->d_name [0] == '.')
+			continue;
+
+		snprintf (path, sizeof (path), "/sys/block/%s/device", d->d_name);
+		if (access (path, F_OK) != 0)
+			continue;
+
+		snprintf (path, sizeof (path), "/sys/block/%s/stat", d->d_name);
+		fd = open (path, O_RDONLY | O_CLOEXEC);
+		if (fd != -1)
+			disk_fds [n_disks++] = fd;
+	}
+
+	closedir (dir);
+}
+
+static void
+close_disks (void)
+{
+	int i;
+
+	for (i = 0; i < n_disks; i++)
+		close (disk_fds [i]);
+	n_disks = 0;
+}
+
+/* read_counters - the stall totals, in microseconds, our I/O and that of the disks in bytes */
+static void
+read_counters (uint64_t *some, uint64_t *full, uint64_t *read_bytes, uint64_t *write_bytes,
+	       uint64_t *disks_bytes)
+{
+	unsigned long long sectors_read, sectors_written;
+	char buffer [512];
+	int i;
+
+	for (i = 0; i < N_RESOURCES; i++) {
+		some [i] = full [i] = 0;
+		if (resource_fds [i] == -1 || read_proc (resource_fds [i], buffer, sizeof (buffer)) < 0)
+			continue;
+		find_value (buffer, "some", "total=", &some [i]);
+		find_value (buffer, "full", "total=", &full [i]);
+	}
+
+	*read_bytes = *write_bytes = 0;
+	if (self_io_fd != -1 && read_proc (self_io_fd, buffer, sizeof (buffer)) == 0) {
+		find_value (buffer, "read_bytes", ": ", read_bytes);
+		find_value (buffer, "write_bytes", ": ", write_bytes);
+	}
+
+	/* The sector counts are in units of 512 bytes whatever the disk's own size */
+	*disks_bytes = 0;
+	for (i = 0; i < n_disks; i++) {
+		if (read_proc (disk_fds [i], buffer, sizeof (buffer)) == 0 &&
+		    sscanf (buffer, "%*u %*u %llu %*u %*u %*u %llu", &sectors_read, &sectors_written) == 2)
+			*disks_bytes += (uint64_t) (sectors_read + sectors_written) * 512;
+	}
+}
+
+static double
+share (uint64_t now, uint64_t then, double interval_usec)
+{
+	double s;
+
+	if (now < then || interval_usec <= 0)
+		return 0;
+
+	s = (now - then) / interval_usec;
+	return s > 1 ? 1 : s;
+}
+
+/* sample - take one sample and run the controller on it */
+static void
+sample (void)
+{
+	uint64_t some [N_RESOURCES], full [N_RESOURCES];
+	uint64_t read_bytes, write_bytes, disks;
+	double stalled [N_RESOURCES], signal = 0, usec, others, io_share = 0;
+	int64_t now;
+	int i, io_class = 0;
+
+	now = now_ns ();
+	read_counters (some, full, &read_bytes, &write_bytes, &disks);
+	usec = (now - last_time) / 1000.0;
+
+	/*
+	 * We account writes when we dirty the pages and the disks when they are
+	 * written back, so both are smoothed over a few samples before taking
+	 * the ratio.
+	 */
+	own_bytes += SHARE_WEIGHT * ((double) (read_bytes - last_read_bytes) + (double) (write_bytes - last_write_bytes) - own_bytes);
+	disk_bytes += SHARE_WEIGHT * ((double) (disks - last_disk_bytes) - disk_bytes);
+	if (disk_bytes > 0)
+		io_share = own_bytes < disk_bytes ? own_bytes / disk_bytes : 1;
+
+	for (i = 0; i < N_RESOURCES; i++) {
+		stalled [i] = share (some [i], last_some [i], usec);
+
+		/* Only what the others are doing on the disks holds us back */
+		others = stalled [i];
+		if (i == RESOURCE_IO)
+			others *= 1 - io_share;
+
+		if (others / thresholds [i] > signal)
+			signal = others / thresholds [i];
+	}
+	smoothed = (smoothed + signal) / 2;
+
+	pthread_mutex_lock (&lock);
+
+	state.io_some = stalled [RESOURCE_IO];
+	state.io_full = share (full [RESOURCE_IO], last_full [RESOURCE_IO], usec);
+	state.cpu_some = stalled [RESOURCE_CPU];
+	state.memory_some = stalled [RESOURCE_MEMORY];
+	state.memory_full = share (full [RESOURCE_MEMORY], last_full [RESOURCE_MEMORY], usec);
+	if (usec > 0) {
+		state.read_rate = read_bytes >= last_read_bytes ? (read_bytes - last_read_bytes) * 1e6 / usec : 0;
+		state.write_rate = write_bytes >= last_write_bytes ? (write_bytes - last_write_bytes) * 1e6 / usec : 0;
+	}
+	state.io_share = io_share;
+	state.samples++;
+
+	if (smoothed > 1) {
+		state.throttle /= 2;
+		if (state.throttle < MIN_THROTTLE)
+			state.throttle = MIN_THROTTLE;
+		state.backoffs++;
+	} else if (smoothed < 0.5 && state.throttle < 1) {
+		state.throttle += THROTTLE_STEP;
+		if (state.throttle > 1)
+			state.throttle = 1;
+	}
+
+	if (adjust_io_priority) {
+		if (state.throttle < IDLE_IOPRIO_BELOW && state.io_class != IOPRIO_CLASS_IDLE)
+			io_class = state.io_class = IOPRIO_CLASS_IDLE;
+		else if (state.throttle >= BE_IOPRIO_ABOVE && state.io_class != IOPRIO_CLASS_BE)
+			io_class = state.io_class = IOPRIO_CLASS_BE;
+	}
+
+	/* Under the lock, so that it can't undo pressure_glue_set_adjust_io_priority (0) */
+	if (io_class == IOPRIO_CLASS_IDLE)
+		set_background_io_priority_idle ();
+	else if (io_class == IOPRIO_CLASS_BE)
+		set_background_io_priority_best_effort (7);
+
+	pthread_mutex_unlock (&lock);
+
+	memcpy (last_some, some, sizeof (some));
+	memcpy (last_full, full, sizeof (full));
+	last_read_bytes = read_bytes;
+	last_write_bytes = write_bytes;
+	last_disk_bytes = disks;
+	last_time = now;
+}
+
+static void *
+sampler (void *data)
+{
+	(void) data;
+
+	while (!stop_requested) {
+		struct timespec ts = { interval_msec / 1000, (interval_msec % 1000) * 1000000 };
+
+		nanosleep (&ts, NULL);
+		sample ();
+	}
+
+	return NULL;
+}
+
+/*
+ * pressure_glue_start - start sampling every 'interval' milliseconds (0 for
+ * the default).  Returns -ENOENT if the kernel has no pressure information
+ * (it needs 4.20 and CONFIG_PSI), in which case the throttle factor stays 1.
+ */
+int
+pressure_glue_start (int interval)
+{
+	char buffer [512];
+	uint64_t some [N_RESOURCES], full [N_RESOURCES];
+	int i, ret;
+
+	pthread_mutex_lock (&lock);
+	if (state.running) {
+		pthread_mutex_unlock (&lock);
+		return 0;
+	}
+
+	for (i = 0; i < N_RESOURCES; i++)
+		resource_fds [i] = open (resource_files [i], O_RDONLY | O_CLOEXEC);
+
+	/* PSI can also be compiled in but switched off, and then reads fail */
+	if (resource_fds [RESOURCE_IO] == -1 ||
+	    read_proc (resource_fds [RESOURCE_IO], buffer, sizeof (buffer)) < 0) {
+		for (i = 0; i < N_RESOURCES; i++) {
+			if (resource_fds [i] != -1)
+				close (resource_fds [i]);
+			resource_fds [i] = -1;
+		}
+		pthread_mutex_unlock (&lock);
+		return -ENOENT;
+	}
+
+	self_io_fd = open ("/proc/self/io", O_RDONLY | O_CLOEXEC);
+	open_disks ();
+
+	if (interval > 0)
+		interval_msec = interval;
+	read_counters (some, full, &last_read_bytes, &last_write_bytes, &last_disk_bytes);
+	memcpy (last_some, some, sizeof (some));
+	memcpy (last_full, full, sizeof (full));
+	last_time = now_ns ();
+	smoothed = own_bytes = disk_bytes = 0;
+	stop_requested = 0;
+
+	ret = pthread_create (&thread, NULL, sampler, NULL);
+	if (ret != 0) {
+		pthread_mutex_unlock (&lock);
+		return -ret;
+	}
+	state.running = 1;
+
+	pthread_mutex_unlock (&lock);
+
+	return 0;
+}
+
+void
+pressure_glue_stop (void)
+{
+	int i;
+
+	pthread_mutex_lock (&lock);
+	if (!state.running) {
+		pthread_mutex_unlock (&lock);
+		return;
+	}
+	stop_requested = 1;
+	pthread_mutex_unlock (&lock);
+
+	pthread_join (thread, NULL);
+
+	pthread_mutex_lock (&lock);
+	for (i = 0; i < N_RESOURCES; i++) {
+		if (resource_fds [i] != -1)
+			close (resource_fds [i]);
+		resource_fds [i] = -1;
+	}
+	if (self_io_fd != -1)
+		close (self_io_fd);
+	self_io_fd = -1;
+	close_disks ();
+	if (state.io_class)
+		reset_background_io_priority ();
+	state.io_class = 0;
+	state.running = 0;
+	state.throttle = 1.0;
+	pthread_mutex_unlock (&lock);
+}
+
+/*
+ * pressure_glue_set_adjust_io_priority - whether to manage the I/O class of
+ * the threads in background roles.  When we stop, they go back to their
+ * roles' priorities as they next take one on.
+ */
+void
+pressure_glue_set_adjust_io_priority (int adjust)
+{
+	pthread_mutex_lock (&lock);
+	adjust_io_priority = adjust;
+	if (!adjust) {
+		if (state.io_class)
+			reset_background_io_priority ();
+		state.io_class = 0;
+	}
+	pthread_mutex_unlock (&lock);
+}
+
+double
+pressure_glue_get_throttle (void)
+{
+	double throttle;
+
+	pthread_mutex_lock (&lock);
+	throttle = state.throttle;
+	pthread_mutex_unlock (&lock);
+
+	return throttle;
+}
+
+void
+pressure_glue_get_state (pressure_glue_state_t *out)
+{
+	pthread_mutex_lock (&lock);
+	*out = state;
+	pthread_mutex_unlock (&lock);
+}
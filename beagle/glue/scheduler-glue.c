@@ -47,3 +47,27 @@ int set_scheduler_policy_other (void)
 
 	return sched_setscheduler (0, SCHED_OTHER, &param);
 }
+
+/*
+ * The policy is per thread as well; these change the thread with the given
+ * id (0 for the calling thread).  Going back from SCHED_BATCH to SCHED_OTHER
+ * needs no privileges.
+ */
+
+int set_thread_scheduler_policy_batch (pid_t tid)
+{
+	struct sched_param param;
+
+	param.sched_priority = 0;
+
+	return sched_setscheduler (tid, SCHED_BATCH, &param);
+}
+
+int set_thread_scheduler_policy_other (pid_t tid)
+{
+	struct sched_param param;
+
+	param.sched_priority = 0;
+
+	return sched_setscheduler (tid, SCHED_OTHER, &param);
+}
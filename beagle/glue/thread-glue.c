@@ -26,6 +26,8 @@
  */
 
 #include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <linux/unistd.h>
 #include <errno.h>
@@ -47,3 +49,30 @@ wrap_gettid (void)
 {
 	return gettid ();
 }
+
+/*
+ * On Linux a nice value belongs to a thread rather than to the whole
+ * process, so these take a thread id (0 for the calling thread).  Without
+ * CAP_SYS_NICE a thread can raise its nice value but not lower it again,
+ * beyond what RLIMIT_NICE allows.  Both return 0, or a negative errno.
+ */
+
+int
+set_thread_nice (pid_t tid, int nice)
+{
+	if (setpriority (PRIO_PROCESS, tid, nice) < 0)
+		return -errno;
+
+	return 0;
+}
+
+int
+get_thread_nice (pid_t tid, int *nice)
+{
+	errno = 0;
+	*nice = getpriority (PRIO_PROCESS, tid);
+	if (*nice == -1 && errno != 0)
+		return -errno;
+
+	return 0;
+}
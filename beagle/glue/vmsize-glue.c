@@ -27,6 +27,28 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+/*
+ * Memory telemetry.  get_vmsize() and get_vmrss() give the current sizes;
+ * the sampler takes a fuller sample on a timer and keeps the last
+ * HISTORY_SIZE of them, so that decisions can be made from how memory use
+ * is trending rather than from a single reading.
+ *
+ * A sample has:
+ *  - sizes from /proc/self/statm, which is a single line of page counts;
+ *  - PSS, anonymous and swapped memory from /proc/self/smaps_rollup (Linux
+ *    4.14 and later).  Producing it walks the page tables, so it is only
+ *    read every SMAPS_EVERY samples;
+ *  - malloc's own view of the heap, from mallinfo2() (or mallinfo() before
+ *    glibc 2.33, which wraps at 4 GB);
+ *  - the share of the interval some and all tasks spent stalled on memory,
+ *    from /proc/pressure/memory when the kernel has it.
+ *
+ * The /proc files are opened once and re-read with pread().  The history is
+ * a ring only the sampler writes to; each slot has a sequence count that is
+ * odd while the slot is being written, so readers never take a lock and
+ * retry the rare slot they catch half written.
+ */
+
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -34,75 +56,386 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <malloc.h>
+#include <pthread.h>
 
-/*
-  FIXME: It is not safe to call this function from multiple threads.
-*/
+#define DEFAULT_INTERVAL_MSEC   1000
+#define HISTORY_SIZE            600     /* ten minutes at the default interval */
+#define SMAPS_EVERY             5
+
+#if defined (__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#define HAVE_MALLINFO2 1
+#endif
+
+typedef struct {
+    int64_t time_msec;          /* CLOCK_MONOTONIC */
+    int64_t serial;             /* counts samples taken since start */
+    int64_t vm_size;            /* kB, as are the next five */
+    int64_t vm_rss;
+    int64_t rss_shared;
+    int64_t pss;                /* -1 if smaps_rollup isn't there */
+    int64_t anonymous;
+    int64_t swap;
+    int64_t heap_arena;         /* bytes, as are the next three */
+    int64_t heap_in_use;
+    int64_t heap_free;
+    int64_t heap_mmapped;
+    double memory_some;         /* share of the interval stalled on memory */
+    double memory_full;
+} memory_glue_sample_t;
+
+typedef struct {
+    uint32_t seq;
+    memory_glue_sample_t sample;
+} slot_t;
+
+static slot_t history [HISTORY_SIZE];
+static uint64_t n_samples;      /* written with release, read with acquire */
+
+static int statm_fd = -1;
+static int smaps_fd = -1;
+static int psi_fd = -1;
+static long page_kb;
+static pthread_once_t statm_once = PTHREAD_ONCE_INIT;
+
+/* Only touched by the sampling thread, once it runs */
+static uint64_t last_some, last_full;
+static int64_t last_time;
+static int64_t last_pss = -1, last_anonymous = -1, last_swap = -1;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int running;
+static int interval_msec = DEFAULT_INTERVAL_MSEC;
+static volatile int stop_requested;
+static pthread_t thread;
+
+static int64_t
+now_usec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* read_proc - the current contents of a /proc file we keep open */
+static int
+read_proc (int fd, char *buffer, size_t len)
+{
+    ssize_t n;
+
+    if (fd == -1)
+        return -1;
+
+    n = pread (fd, buffer, len - 1, 0);
+    if (n <= 0)
+        return -1;
+    buffer [n] = '\0';
+
+    return 0;
+}
+
+/* find_value - the number following 'key' anywhere in the buffer, or -1 */
+static int64_t
+find_value (const char *buffer, const char *key)
+{
+    const char *p = strstr (buffer, key);
+
+    if (p == NULL)
+        return -1;
+
+    return strtoll (p + strlen (key), NULL, 10);
+}
+
+static void
+open_statm (void)
+{
+    statm_fd = open ("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    page_kb = sysconf (_SC_PAGESIZE) / 1024;
+}
+
+/* read_statm - size, resident and shared pages, in kB */
+static int
+read_statm (int64_t *size, int64_t *resident, int64_t *shared)
+{
+    char buffer [128];
+    long long s, r, sh;
+
+    pthread_once (&statm_once, open_statm);
+
+    if (read_proc (statm_fd, buffer, sizeof (buffer)) < 0 ||
+        sscanf (buffer, "%lld %lld %lld", &s, &r, &sh) != 3)
+        return -1;
+
+    *size = s * page_kb;
+    *resident = r * page_kb;
+    *shared = sh * page_kb;
+
+    return 0;
+}
 
 int
 get_vmsize (void)
 {
-    static char proc_filename[64] = {'\0'};
-    static char buffer [1024];
-    int fd;
-    int vmsize = -1;
-
-    if (proc_filename[0] == '\0')
-        snprintf (proc_filename, 64, "/proc/%d/status", getpid ());
-
-    fd = open (proc_filename, O_RDONLY);
-    if (fd >= 0) {
-        if (read (fd, buffer, sizeof (buffer)) > 0) {
-            char *pos = strstr (buffer, "VmSize:");
-            char *endpos = NULL;
-            if (pos != NULL && strlen (pos) > 7) {
-                pos += 7;
-                while (*pos && isspace (*pos))
-                    ++pos;
-                if (*pos != '\0') {
-                    vmsize = (int) strtol (pos, &endpos, 10);
-                    if (pos == endpos || *endpos != ' ')
-                        vmsize = -1;
-                }
-            }
-        }
-        close (fd);
-    }
+    int64_t size, resident, shared;
+
+    if (read_statm (&size, &resident, &shared) < 0)
+        return -1;
 
-    return vmsize;
+    return (int) size;
 }
 
-/* a stupid cut&paste */
 int
 get_vmrss (void)
 {
-    static char proc_filename[64] = {'\0'};
-    static char buffer [1024];
-    int fd;
-    int vmsize = -1;
-
-    if (proc_filename[0] == '\0')
-        snprintf (proc_filename, 64, "/proc/%d/status", getpid ());
-
-    fd = open (proc_filename, O_RDONLY);
-    if (fd >= 0) {
-        if (read (fd, buffer, sizeof (buffer)) > 0) {
-            char *pos = strstr (buffer, "VmRSS:");
-            char *endpos = NULL;
-            if (pos != NULL && strlen (pos) > 7) {
-                pos += 7;
-                while (*pos && isspace (*pos))
-                    ++pos;
-                if (*pos != '\0') {
-                    vmsize = (int) strtol (pos, &endpos, 10);
-                    if (pos == endpos || *endpos != ' ')
-                        vmsize = -1;
-                }
-            }
-        }
-        close (fd);
+    int64_t size, resident, shared;
+
+    if (read_statm (&size, &resident, &shared) < 0)
+        return -1;
+
+    return (int) resident;
+}
+
+static void
+read_heap (memory_glue_sample_t *s)
+{
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2 ();
+#else
+    struct mallinfo mi = mallinfo ();
+#endif
+
+    s->heap_arena = mi.arena;
+    s->heap_in_use = mi.uordblks;
+    s->heap_free = mi.fordblks;
+    s->heap_mmapped = mi.hblkhd;
+}
+
+static double
+share (uint64_t now, uint64_t then, double interval_usec)
+{
+    double s;
+
+    if (now < then || interval_usec <= 0)
+        return 0;
+
+    s = (now - then) / interval_usec;
+    return s > 1 ? 1 : s;
+}
+
+/* take_sample - fill in everything but the serial number */
+static void
+take_sample (memory_glue_sample_t *s, int read_smaps)
+{
+    char buffer [2048];
+    int64_t now = now_usec ();
+
+    memset (s, 0, sizeof (*s));
+    s->time_msec = now / 1000;
+
+    if (read_statm (&s->vm_size, &s->vm_rss, &s->rss_shared) < 0)
+        s->vm_size = s->vm_rss = s->rss_shared = -1;
+
+    if (read_smaps && read_proc (smaps_fd, buffer, sizeof (buffer)) == 0) {
+        last_pss = find_value (buffer, "\nPss:");
+        last_anonymous = find_value (buffer, "\nAnonymous:");
+        last_swap = find_value (buffer, "\nSwap:");
+    }
+    s->pss = last_pss;
+    s->anonymous = last_anonymous;
+    s->swap = last_swap;
+
+    read_heap (s);
+
+    if (read_proc (psi_fd, buffer, sizeof (buffer)) == 0) {
+        const char *full = strstr (buffer, "full");
+        uint64_t some_total = find_value (buffer, "total=");
+        uint64_t full_total = full ? find_value (full, "total=") : 0;
+
+        s->memory_some = share (some_total, last_some, now - last_time);
+        s->memory_full = share (full_total, last_full, now - last_time);
+        last_some = some_total;
+        last_full = full_total;
+    }
+
+    last_time = now;
+}
+
+/* publish - append a sample to the history.  Only the sampler calls this. */
+static void
+publish (memory_glue_sample_t *s)
+{
+    uint64_t n = __atomic_load_n (&n_samples, __ATOMIC_RELAXED);
+    slot_t *slot = &history [n % HISTORY_SIZE];
+
+    s->serial = n;
+
+    __atomic_store_n (&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    slot->sample = *s;
+    __atomic_store_n (&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+
+    __atomic_store_n (&n_samples, n + 1, __ATOMIC_RELEASE);
+}
+
+/* read_slot - copy out sample number 'n', or fail if it has been overwritten */
+static int
+read_slot (uint64_t n, memory_glue_sample_t *out)
+{
+    slot_t *slot = &history [n % HISTORY_SIZE];
+    uint32_t before, after;
+
+    do {
+        before = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+        memcpy (out, &slot->sample, sizeof (*out));
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        after = __atomic_load_n (&slot->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+
+    return out->serial == (int64_t) n ? 0 : -1;
+}
+
+static void *
+sampler (void *data)
+{
+    memory_glue_sample_t s;
+    int count = 0;
+
+    (void) data;
+
+    while (!stop_requested) {
+        struct timespec ts = { interval_msec / 1000, (interval_msec % 1000) * 1000000 };
+
+        take_sample (&s, count++ % SMAPS_EVERY == 0);
+        publish (&s);
+
+        nanosleep (&ts, NULL);
+    }
+
+    return NULL;
+}
+
+/*
+ * memory_glue_start - start sampling every 'interval' milliseconds (0 for
+ * the default).  Returns 0, or a negative errno if /proc/self/statm can't
+ * be read; the other sources are left out of samples when missing.
+ */
+int
+memory_glue_start (int interval)
+{
+    char buffer [512];
+    int ret;
+
+    pthread_mutex_lock (&lock);
+    if (running) {
+        pthread_mutex_unlock (&lock);
+        return 0;
+    }
+
+    pthread_once (&statm_once, open_statm);
+    if (statm_fd == -1) {
+        pthread_mutex_unlock (&lock);
+        return -ENOENT;
     }
 
-    return vmsize;
+    smaps_fd = open ("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+    psi_fd = open ("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+
+    if (interval > 0)
+        interval_msec = interval;
+
+    last_time = now_usec ();
+    last_some = last_full = 0;
+    if (read_proc (psi_fd, buffer, sizeof (buffer)) == 0) {
+        const char *full = strstr (buffer, "full");
+        last_some = find_value (buffer, "total=");
+        last_full = full ? find_value (full, "total=") : 0;
+    }
+    stop_requested = 0;
+
+    ret = pthread_create (&thread, NULL, sampler, NULL);
+    if (ret != 0) {
+        pthread_mutex_unlock (&lock);
+        return -ret;
+    }
+    running = 1;
+
+    pthread_mutex_unlock (&lock);
+
+    return 0;
+}
+
+void
+memory_glue_stop (void)
+{
+    pthread_mutex_lock (&lock);
+    if (!running) {
+        pthread_mutex_unlock (&lock);
+        return;
+    }
+    stop_requested = 1;
+    pthread_mutex_unlock (&lock);
+
+    pthread_join (thread, NULL);
+
+    pthread_mutex_lock (&lock);
+    if (smaps_fd != -1)
+        close (smaps_fd);
+    if (psi_fd != -1)
+        close (psi_fd);
+    smaps_fd = psi_fd = -1;
+    running = 0;
+    pthread_mutex_unlock (&lock);
+}
+
+/* memory_glue_get_latest - the newest sample; -EAGAIN if there is none yet */
+int
+memory_glue_get_latest (memory_glue_sample_t *out)
+{
+    uint64_t n;
+
+    for (;;) {
+        n = __atomic_load_n (&n_samples, __ATOMIC_ACQUIRE);
+        if (n == 0)
+            return -EAGAIN;
+        if (read_slot (n - 1, out) == 0)
+            return 0;
+    }
+}
+
+/*
+ * memory_glue_get_history - copy up to 'max' of the newest samples into
+ * 'out', oldest first, and return how many were copied.  Samples the
+ * sampler overwrites while we copy are left out.
+ */
+int
+memory_glue_get_history (memory_glue_sample_t *out, int max)
+{
+    uint64_t n, first, i;
+    int count = 0;
+
+    if (max <= 0)
+        return 0;
+
+    n = __atomic_load_n (&n_samples, __ATOMIC_ACQUIRE);
+    first = n > (uint64_t) max ? n - max : 0;
+    if (n - first > HISTORY_SIZE)
+        first = n - HISTORY_SIZE;
+
+    for (i = first; i < n; i++) {
+        if (read_slot (i, &out [count]) == 0)
+            count++;
+    }
+
+    return count;
+}
+
+/* memory_glue_history_size - how many samples the history holds at most */
+int
+memory_glue_history_size (void)
+{
+    return HISTORY_SIZE;
 }
@@ -30,6 +30,7 @@
  */
 
 #include <wv.h>
+#include <setjmp.h>
 #include <string.h>
 
 /* Number of structural-break'ed text-chunks to hold
@@ -42,6 +43,23 @@
  */
 #define BUFFERED_STRUCT_BREAK 12
 
+/* Size of the text/hot pools.  The pools are also sent
+ * for indexing when the next word would not fit, so
+ * documents without paragraph ends (huge tables, for
+ * one) never need more than this.
+ */
+#define POOL_SIZE 4096
+
+/* Longest run of characters without a space kept as
+ * one word; longer ones are split.
+ */
+#define MAX_WORD_SIZE 1023
+
+/* How many characters to let through between looking
+ * at the clock.
+ */
+#define CHARS_PER_TIME_CHECK 4096
+
 
 /* Callback to Handle "text" (or words) extracted out of 
  * M$ Word documents 
@@ -56,6 +74,34 @@ typedef void (* wvTextHandlerCallback) (U8* text, int len,
 					U8* hotText, int hotLen, 
 					U8 needStructBrk);
 
+/* What extracting a document took, filled in by
+ * wv1_glue_extract ().
+ *
+ * textBytes/hotBytes: bytes of text sent to the callback.
+ * flushes: number of times the callback was called.
+ * structBrks: structural breaks seen.
+ * msec: time spent extracting, in milliseconds.
+ * stopped: 1 if extraction stopped at the budget.
+ */
+
+typedef struct _Wv1GlueStats {
+  int textBytes;
+  int hotBytes;
+  int flushes;
+  int structBrks;
+  int msec;
+  int stopped;
+} Wv1GlueStats;
+
+/* A run of hot text among the units of a UserData, or,
+ * with a len of 0, a structural break.
+ */
+
+typedef struct _HotSpan {
+  int start;
+  int len;
+} HotSpan;
+
 typedef struct _UserData {
   /* formatting variables */
 
@@ -85,13 +131,29 @@ typedef struct _UserData {
   */
   int bParaEnd:1;
 
-  /* buffer to hold text */
-  GString* txtWord;
-  
-  /* buffer to hold hot-pool-text */
+  /* text since the last update-to-filter, as UTF-16
+   * code units.  Units before wordStart are whole words
+   * and breaks, poolBytes long in UTF-8; the rest is the
+   * word being read, wordBytes long.
+   */
+  U16* units;
+  int nUnits;
+  int wordStart;
+  int poolBytes;
+  int wordBytes;
+
+  /* the hot words among the units, and the breaks */
+  HotSpan* hotSpans;
+  int nHotSpans;
+
+  /* buffer to hold hot-pool-text, filled in from the
+   * hot spans when sending it
+   */
   GString* txtHotPool;
   
-  /* buffer to hold normal-pool-text */
+  /* buffer to hold normal-pool-text, filled in from the
+   * units when sending it
+   */
   GString* txtPool;
   
   /* hold number of "structural breaks" encountered
@@ -100,15 +162,179 @@ typedef struct _UserData {
   short structBrkCount;
 
   wvTextHandlerCallback WordHandler;
+
+  /* budget for the document, 0 for none */
+  int maxBytes;
+  int maxMsec;
+
+  GTimer *timer;
+  int charsSinceTimeCheck;
+
+  /* where to go when the budget is spent */
+  jmp_buf stop;
+
+  Wv1GlueStats stats;
   
 } UserData;
 
+/* Bytes of UTF-8 for a UTF-16 code unit, encoded on its
+ * own the way g_unichar_to_utf8 () does.
+ */
+#define UTF8_LENGTH(ch) ((ch) < 0x80 ? 1 : (ch) < 0x800 ? 2 : 3)
+
+/* Room for the units of a full pool, the word that did
+ * not fit in it, and a break.
+ */
+#define MAX_UNITS (POOL_SIZE + MAX_WORD_SIZE + 2)
+
+/*
+ * encode_utf8: writes 'n' UTF-16 code units to 'out' as
+ * UTF-8, and returns the number of bytes written.  Runs of
+ * ASCII, which is what most documents are mostly made of,
+ * are narrowed eight at a time in loops the compiler can
+ * vectorize.
+ */
+
+static int
+encode_utf8 (const U16 * units, int n, gchar * out)
+{
+  gchar *p = out;
+  int i = 0, j;
+
+  while (i < n) {
+    if (i + 8 <= n) {
+      U16 any = 0;
+
+      for (j = 0; j < 8; j++)
+	any |= units[i + j];
+      if (any < 0x80) {
+	for (j = 0; j < 8; j++)
+	  p[j] = (gchar) units[i + j];
+	p += 8;
+	i += 8;
+	continue;
+      }
+    }
+
+    if (units[i] < 0x80) {
+      *p++ = (gchar) units[i];
+    } else if (units[i] < 0x800) {
+      *p++ = (gchar) (0xc0 | (units[i] >> 6));
+      *p++ = (gchar) (0x80 | (units[i] & 0x3f));
+    } else {
+      *p++ = (gchar) (0xe0 | (units[i] >> 12));
+      *p++ = (gchar) (0x80 | ((units[i] >> 6) & 0x3f));
+      *p++ = (gchar) (0x80 | (units[i] & 0x3f));
+    }
+    i++;
+  }
+
+  return p - out;
+}
 
 /*
- * append_char: fills the txtWord buffer with the character 'ch'
- * converted to UTF8 encoding.  Calls the "WordHandler" for every
- * word/line/end of a paragraph or for every 1023 characters,
- * whichever comes first.
+ * fill_pools: encodes the whole words and breaks into the
+ * text pool, and the hot ones into the hot pool, with a
+ * space for each break.
+ */
+
+static void
+fill_pools (UserData * ud)
+{
+  gchar *p;
+  int i;
+
+  /* g_string_set_size () only reallocates to grow, and
+   * the pools are sized for all they will hold
+   */
+  g_string_set_size (ud->txtPool, ud->poolBytes);
+  encode_utf8 (ud->units, ud->wordStart, ud->txtPool->str);
+
+  /* hot text is never longer than the text it is from */
+  g_string_set_size (ud->txtHotPool, ud->poolBytes);
+  p = ud->txtHotPool->str;
+  for (i = 0; i < ud->nHotSpans; i++) {
+    HotSpan *span = &ud->hotSpans[i];
+
+    if (span->len == 0)
+      *p++ = ' ';
+    else
+      p += encode_utf8 (ud->units + span->start, span->len, p);
+  }
+  g_string_truncate (ud->txtHotPool, p - ud->txtHotPool->str);
+}
+
+/*
+ * flush_pools: sends the whole words and breaks to the
+ * "WordHandler", and keeps only the word being read.  Once
+ * that has taken the document past its byte or time budget,
+ * leaves the parser through ud->stop.
+ */
+
+static void
+flush_pools (UserData * ud, U8 bNeedStructBrk, U8 bEndOfDoc)
+{
+  fill_pools (ud);
+
+  (*(ud->WordHandler))(ud->txtPool->str, ud->txtPool->len, 
+		       ud->txtHotPool->str, ud->txtHotPool->len, bNeedStructBrk);
+
+  ud->stats.textBytes += ud->txtPool->len;
+  ud->stats.hotBytes += ud->txtHotPool->len;
+  ud->stats.flushes++;
+
+  memmove (ud->units, ud->units + ud->wordStart,
+	   (ud->nUnits - ud->wordStart) * sizeof (U16));
+  ud->nUnits -= ud->wordStart;
+  ud->wordStart = 0;
+  ud->poolBytes = 0;
+  ud->nHotSpans = 0;
+  ud->structBrkCount = 0;
+
+  if (bEndOfDoc)
+    return;
+
+  if ((ud->maxBytes > 0 && ud->stats.textBytes >= ud->maxBytes) ||
+      (ud->maxMsec > 0 && g_timer_elapsed (ud->timer, NULL) * 1000 >= ud->maxMsec)) {
+    ud->stats.stopped = 1;
+    longjmp (ud->stop, 1);
+  }
+}
+
+/*
+ * end_word: makes the word being read a whole one, and
+ * notes it as hot if it is.  Hot words next to each other
+ * share a span.
+ */
+
+static void
+end_word (UserData * ud)
+{
+  int len = ud->nUnits - ud->wordStart;
+
+  if (ud->bWasHot && len > 0) {
+    HotSpan *last = ud->nHotSpans ? &ud->hotSpans[ud->nHotSpans - 1] : NULL;
+
+    if (last && last->len > 0 && last->start + last->len == ud->wordStart) {
+      last->len += len;
+    } else {
+      ud->hotSpans[ud->nHotSpans].start = ud->wordStart;
+      ud->hotSpans[ud->nHotSpans].len = len;
+      ud->nHotSpans++;
+    }
+  }
+
+  ud->poolBytes += ud->wordBytes;
+  ud->wordStart = ud->nUnits;
+  ud->wordBytes = 0;
+}
+
+/*
+ * append_char: adds the character 'ch' to the word being
+ * read.  Calls the "WordHandler" at the end of a paragraph,
+ * every BUFFERED_STRUCT_BREAK lines, or when the pools are
+ * full, whichever comes first.  Words are cut at
+ * MAX_WORD_SIZE bytes.
  *
  * ud : carries the UserData filled-in appropriately to hold the 
  *      character (text) attributes.
@@ -120,8 +346,6 @@ typedef struct _UserData {
 void
 append_char (UserData * ud, U16 ch)
 {
-  gchar tmpBuf[64];
-  int len = 0;
   U8 bNeedStructBrk = 0;
 
   if (ud->bIgnore)
@@ -140,75 +364,55 @@ append_char (UserData * ud, U16 ch)
     ch = 0x0A;
     break;
 
-  case 0x20: /* space */
-    g_string_append_c (ud->txtWord, ch);
-    break;
-
   default: 
-    len =  g_unichar_to_utf8 (ch, tmpBuf);
-    /*  FIXME: This is not good, pretty hacky code
-     *  to get rid of unwanted characters, especially
-     *  some graphic symbols used in a document. 
-     *  Ex: a tick mark, a smiley blah blah blah...
-     *  in a much sane way without blocking 
-     *  printable-non-iso characters ;)
+    /*  FIXME: Some graphic symbols used in a document
+     *  (a tick mark, a smiley blah blah blah...) could
+     *  be dropped here, in a much sane way without
+     *  blocking printable-non-iso characters ;)
      */
-    /*
-      int i;
-      for (i = 0; i < len; i++)
-      if (tmpBuf[i] > 0)
-      g_string_append_c (ud->txtWord, tmpBuf[i]);
-    */
-    g_string_append_len (ud->txtWord, tmpBuf, len);
+    ud->units[ud->nUnits++] = ch;
+    ud->wordBytes += UTF8_LENGTH (ch);
     break;
   }
 
-  if (ch == 0x00 || ch == 0x20 || ch == 0x0A) {
-    if (ud->bWasHot)
-      g_string_append_len (ud->txtHotPool, ud->txtWord->str, ud->txtWord->len);
+  if (ch == 0x00 || ch == 0x20 || ch == 0x0A ||
+      ud->wordBytes >= MAX_WORD_SIZE) {
+    /* Make room for the word and the break first */
+    if (ud->poolBytes + ud->wordBytes + 1 >= POOL_SIZE)
+      flush_pools (ud, 0, 0);
 
-    /*    
-    printf ("TxtWord: %s, len: %d\n", ud->txtWord->str, ud->txtWord->len);
-    printf ("TxtPool: %s, len: %d\n", ud->txtPool->str, ud->txtPool->len);       
-    printf ("HotTxtPool: %s, len: %d\n", ud->txtHotPool->str, ud->txtHotPool->len);
-    */
+    end_word (ud);
 
-    g_string_append_len (ud->txtPool, ud->txtWord->str, ud->txtWord->len);
     if (bNeedStructBrk) {
-      g_string_append_c (ud->txtPool, '\n');
-      g_string_append_c (ud->txtHotPool, ' ');
+      /* a space in the hot pool */
+      ud->hotSpans[ud->nHotSpans].start = ud->nUnits;
+      ud->hotSpans[ud->nHotSpans].len = 0;
+      ud->nHotSpans++;
+
+      ud->units[ud->nUnits++] = '\n';
+      ud->wordStart = ud->nUnits;
+      ud->poolBytes++;
       ud->structBrkCount++;
+      ud->stats.structBrks++;
     }
 
+    ud->bWasHot = 0;
+
     if (ud->structBrkCount >= BUFFERED_STRUCT_BREAK ||
-	ud->bParaEnd) {
-      (*(ud->WordHandler))(ud->txtPool->str, ud->txtPool->len, 
-			   ud->txtHotPool->str, ud->txtHotPool->len, bNeedStructBrk);
-      /* 
-	 g_string_erase () can be used here to erase
-	 the previous content, however, using this 
-	 call will free the "erased-content-memory"
-	 and thereby causing memory fragmentation for
-	 every time we transfer data from unmanaged
-	 to managed code.  Setting "len" to 0 results
-	 in the same way g_string_erase () does, but
-	 doesn't do memory-[de/re]allocation
-      */
+	ud->bParaEnd)
+      flush_pools (ud, bNeedStructBrk, ch == 0x00);
+  }
 
-      /*
-	ch == 0x00 refers to EOD.  Do not reset len to
-	zero, we have to free the gstrings.
-       */
-      if (ch != 0x00) {
-	ud->txtPool->len = 0;
-	ud->txtHotPool->len = 0;
-	ud->structBrkCount = 0;
-      }
+  /* Documents with little text can still take long */
+  if (ud->maxMsec > 0 &&
+      ++ud->charsSinceTimeCheck >= CHARS_PER_TIME_CHECK) {
+    ud->charsSinceTimeCheck = 0;
+    if (g_timer_elapsed (ud->timer, NULL) * 1000 >= ud->maxMsec) {
+      ud->bWasHot = 0;
+      end_word (ud);
+      flush_pools (ud, 1, 0);
     }
-    if (ch != 0x00)
-      ud->txtWord->len = 0;
-    ud->bWasHot = 0;
-  }  
+  }
 }
 
 /*
@@ -460,20 +664,37 @@ docProc (wvParseStruct * ps, wvTag tag)
 }
 
 /*
- * wv1_glue_init_doc_parsing: Initiates the document parsing 
- * procedure.  Sets up all the required handlers and the parser.
+ * wv1_glue_extract: Parses the document, sending its text to the
+ * callback as it goes.  Sets up all the required handlers and the
+ * parser.
  * 
  * fname: Name of the file to parse. (essentially a M$ word file)
  *
  * wvTextHandlerCallback: The callback routine that will be called 
- * on extraction of each word.
+ * with the extracted text.
+ *
+ * maxBytes: Bytes of text after which to stop, 0 for no limit.
+ *
+ * maxMsec: Milliseconds after which to stop, 0 for no limit.
+ *
+ * stats: Filled in with what extracting took, if not NULL.
  *
  * Return: 0 -> success
  *        -1 -> failure.
+ *        -2 -> password protected.
+ *        -3 -> the parser could not be started.
+ *        -4 -> stopped at maxBytes or maxMsec; what was
+ *              extracted until then has been sent.
+ *
+ * wv1 has no way to stop wvText () half-way, so stopping
+ * jumps out of it, and whatever it has allocated by then is
+ * left to the process exiting.  Run it in a process of its
+ * own (beagle-doc-extractor) when giving it a budget.
  */
 
 int
-wv1_glue_init_doc_parsing (char* fname, wvTextHandlerCallback callback)
+wv1_glue_extract (char* fname, wvTextHandlerCallback callback,
+		  int maxBytes, int maxMsec, Wv1GlueStats* stats)
 {
   FILE *input;
   int ret = 0;
@@ -483,6 +704,9 @@ wv1_glue_init_doc_parsing (char* fname, wvTextHandlerCallback callback)
 
   UserData ud;
 
+  if (stats)
+    memset (stats, 0, sizeof (Wv1GlueStats));
+
   input = fopen (fname, "rb");
   if (!input)
       return -1;
@@ -505,9 +729,13 @@ wv1_glue_init_doc_parsing (char* fname, wvTextHandlerCallback callback)
   /* set to 0 */
   memset (&ud, 0, sizeof (UserData));
   ud.WordHandler = callback;
-  ud.txtWord = g_string_sized_new (32);
-  ud.txtHotPool = g_string_sized_new (1024);
-  ud.txtPool = g_string_sized_new (1024);
+  ud.units = g_new (U16, MAX_UNITS);
+  ud.hotSpans = g_new (HotSpan, MAX_UNITS);
+  ud.txtHotPool = g_string_sized_new (POOL_SIZE);
+  ud.txtPool = g_string_sized_new (POOL_SIZE);
+  ud.maxBytes = maxBytes;
+  ud.maxMsec = maxMsec;
+  ud.timer = g_timer_new ();
   ps.userData = &ud;
 
   wvSetElementHandler (&ps, eleProc);
@@ -515,10 +743,20 @@ wv1_glue_init_doc_parsing (char* fname, wvTextHandlerCallback callback)
   wvSetCharHandler (&ps, charProc);
   wvSetSpecialCharHandler (&ps, specCharProc);
 
-  wvText (&ps);
-  
+  if (setjmp (ud.stop) == 0)
+    wvText (&ps);
+  else
+    ret = -4;
+
+  ud.stats.msec = (int) (g_timer_elapsed (ud.timer, NULL) * 1000);
+  if (stats)
+    *stats = ud.stats;
+
+  g_timer_destroy (ud.timer);
+
   /* free userdata memory */
-  g_string_free (ud.txtWord, TRUE);
+  g_free (ud.units);
+  g_free (ud.hotSpans);
 
   /* free text pool memory */
   g_string_free (ud.txtPool, TRUE);
@@ -530,10 +768,22 @@ wv1_glue_init_doc_parsing (char* fname, wvTextHandlerCallback callback)
   wvOLEFree (&ps);
 
   ud.txtPool = NULL;
-  ud.txtWord = NULL;
+  ud.units = NULL;
+  ud.hotSpans = NULL;
   ud.txtHotPool = NULL;
 
-  return 0;
+  return ret;
+}
+
+/*
+ * wv1_glue_init_doc_parsing: Like wv1_glue_extract (), without
+ * a budget.
+ */
+
+int
+wv1_glue_init_doc_parsing (char* fname, wvTextHandlerCallback callback)
+{
+  return wv1_glue_extract (fname, callback, 0, 0, NULL);
 }
 
 /*
@@ -0,0 +1,1161 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* bench-mime.c: Times MIME type lookups by file name, by data and by file,
+ * through the globs and magic files and through the mime.cache, and counts
+ * the allocations each lookup makes.
+ *
+ * Build with something like
+ *   gcc -O2 -DHAVE_MMAP -o bench-mime bench-mime.c xdgmime*.c
+ * It only uses the lookups xdgmime has always had, so it can be built
+ * against an older copy of this directory just as well.  Run as
+ *   bench-mime [--record file | --corpus file] [--output file] [dir...]
+ *
+ * There are two corpora.  The synthetic one has a name for every glob in
+ * /usr/share/mime/globs, in upper case as well for the suffixes, some
+ * names no glob matches and names with no extension at all, each with
+ * data that starts the way one of a set of common formats does, or
+ * doesn't.  The real one is the first 4000 files under the given
+ * directories (by default /usr/bin, /usr/share and /etc), of which the
+ * start is kept.  Both are written out as files under a temporary
+ * directory for the lookups by file, so those don't depend on the files
+ * as they are now.
+ *
+ * Two databases are made from /usr/share/mime: one with just the globs,
+ * magic, aliases and subclasses files, and one with just a mime.cache.
+ * The cache is the installed one stamped with the version this code
+ * reads, with its glob lists written anew from the globs file in the
+ * format of that version.
+ *
+ * To compare two builds, record the corpus with one, run both on it with
+ * --corpus and --output, and then
+ *   bench-mime --compare old.out new.out
+ * prints how much faster the second is at each kind of lookup, and
+ * whether they came up with the same answers.
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#define _XOPEN_SOURCE 700
+#include "xdgmime.h"
+#include <arpa/inet.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define MIME_DIR "/usr/share/mime"
+#define MAX_FILES 4000
+#define MAX_SYNTHETIC 8000
+#define MIN_TIME 0.5
+
+#define CORPUS_MAGIC "xdgmime benchmark corpus 1\n"
+
+/* Allocations are counted by standing in for the C library's allocator,
+ * which only glibc makes easy.  Memory checkers bring their own. */
+#if defined (__GLIBC__) && ! defined (__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCATIONS 1
+
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t n_members, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static int counting = 0;
+static unsigned long n_allocations = 0;
+
+void *
+malloc (size_t size)
+{
+  if (counting)
+    n_allocations++;
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members,
+	size_t size)
+{
+  if (counting)
+    n_allocations++;
+  return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void   *ptr,
+	 size_t  size)
+{
+  if (counting)
+    n_allocations++;
+  return __libc_realloc (ptr, size);
+}
+#endif
+
+typedef struct
+{
+  char *name;
+  unsigned char *data;
+  size_t len;
+  char *path;
+} Entry;
+
+typedef struct
+{
+  const char *key;
+  Entry *entries;
+  int n_entries;
+  int n_allocated;
+} Corpus;
+
+static Corpus synthetic = { "synthetic", NULL, 0, 0 };
+static Corpus real = { "real", NULL, 0, 0 };
+static Corpus *corpora[] = { &synthetic, &real };
+#define N_CORPORA 2
+
+static size_t extent;
+
+static FILE *output = NULL;
+
+static void
+add_entry (Corpus              *corpus,
+	   const char          *name,
+	   const unsigned char *data,
+	   size_t               len)
+{
+  Entry *entry;
+
+  if (corpus->n_entries == corpus->n_allocated)
+    {
+      corpus->n_allocated = corpus->n_allocated ? 2 * corpus->n_allocated : 1024;
+      corpus->entries = realloc (corpus->entries, corpus->n_allocated * sizeof (Entry));
+    }
+
+  entry = &corpus->entries[corpus->n_entries++];
+  entry->name = strdup (name);
+  entry->data = malloc (len ? len : 1);
+  if (len > 0)
+    memcpy (entry->data, data, len);
+  entry->len = len;
+  entry->path = NULL;
+}
+
+/* The synthetic corpus */
+
+static const struct
+{
+  const char *bytes;
+  size_t len;
+} samples[] = {
+  { "%PDF-1.4\n", 9 },
+  { "\x89PNG\r\n\x1a\n", 8 },
+  { "GIF89a", 6 },
+  { "\xff\xd8\xff\xe0", 4 },
+  { "\x1f\x8b\x08", 3 },
+  { "BZh91AY&SY", 10 },
+  { "PK\x03\x04", 4 },
+  { "\x7f" "ELF\x02\x01\x01", 7 },
+  { "#!/bin/sh\n", 10 },
+  { "#!/usr/bin/python\n", 18 },
+  { "<?xml version=\"1.0\"?>\n", 22 },
+  { "{\\rtf1", 6 },
+  { "%!PS-Adobe-3.0\n", 15 },
+  /* Markers the magic looks for further in */
+  { "\n\n<!-- generated -->\n\n<html>\n", 29 },
+  { "\n   \n<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01//EN\">\n", 56 },
+  /* And nothing in particular */
+  { "", 0 }
+};
+#define N_SAMPLES ((int) (sizeof (samples) / sizeof (samples[0])))
+
+static void
+make_data (unsigned char *data,
+	   size_t        *len)
+{
+  int sample = rand () % (N_SAMPLES + 2);
+  size_t i, start = 0;
+
+  *len = rand () % (extent + 1);
+
+  if (sample < N_SAMPLES)
+    {
+      start = samples[sample].len < *len ? samples[sample].len : *len;
+      memcpy (data, samples[sample].bytes, start);
+    }
+
+  /* Text after the samples, and either text or binary after nothing */
+  if (sample == N_SAMPLES + 1)
+    {
+      for (i = start; i < *len; i++)
+	data[i] = rand ();
+    }
+  else
+    {
+      static const char text[] = "Lorem ipsum dolor sit amet, consectetur adipisicing elit.\n";
+
+      for (i = start; i < *len; i++)
+	data[i] = text[(i - start) % (sizeof (text) - 1)];
+    }
+}
+
+/* A name the glob matches: stars become some text, question marks and
+ * character classes a character they match */
+static void
+name_for_glob (const char *glob,
+	       char       *name,
+	       size_t      size)
+{
+  size_t n = 0;
+  const char *p;
+
+  for (p = glob; *p && n + 8 < size; p++)
+    {
+      if (*p == '*')
+	{
+	  memcpy (name + n, p == glob ? "file" : "x", p == glob ? 4 : 1);
+	  n += p == glob ? 4 : 1;
+	}
+      else if (*p == '?')
+	name[n++] = 'a';
+      else if (*p == '[')
+	{
+	  const char *end = strchr (p + 1, ']');
+
+	  if (end == NULL)
+	    break;
+	  name[n++] = p[1] == '!' ? '_' : p[1];
+	  p = end;
+	}
+      else if (*p == '\\' && p[1])
+	name[n++] = *++p;
+      else
+	name[n++] = *p;
+    }
+  name[n] = '\0';
+}
+
+static void
+make_synthetic_corpus (void)
+{
+  unsigned char *data = malloc (extent + 1);
+  char line[256], name[256];
+  size_t len;
+  FILE *file;
+  int i;
+
+  file = fopen (MIME_DIR "/globs", "r");
+  while (file != NULL && fgets (line, sizeof (line), file) != NULL &&
+	 synthetic.n_entries < MAX_SYNTHETIC)
+    {
+      char *colon, *glob;
+
+      if (line[0] == '#' || (colon = strchr (line, ':')) == NULL)
+	continue;
+      glob = colon + 1;
+      glob[strcspn (glob, "\n")] = '\0';
+
+      name_for_glob (glob, name, sizeof (name));
+      if (name[0] == '\0')
+	continue;
+      make_data (data, &len);
+      add_entry (&synthetic, name, data, len);
+
+      /* The suffixes are also looked up in lower case */
+      if (glob[0] == '*' && strpbrk (glob + 1, "*?[\\") == NULL)
+	{
+	  char *p;
+
+	  for (p = name; *p; p++)
+	    if (*p >= 'a' && *p <= 'z')
+	      *p -= 'a' - 'A';
+	  make_data (data, &len);
+	  add_entry (&synthetic, name, data, len);
+	}
+    }
+  if (file != NULL)
+    fclose (file);
+
+  /* Names that only the data can tell anything about */
+  for (i = 0; i < synthetic.n_entries / 4; i++)
+    {
+      static const char *names[] = { "data%d", "README.%d", "core.%d.unknownext", "%d" };
+
+      snprintf (name, sizeof (name), names[i % 4], i);
+      make_data (data, &len);
+      add_entry (&synthetic, name, data, len);
+    }
+
+  free (data);
+}
+
+/* The real corpus */
+
+static int
+add_file (const char        *path,
+	  const struct stat *st,
+	  int                flag,
+	  struct FTW        *ftw)
+{
+  unsigned char *data;
+  ssize_t n;
+  int fd;
+
+  if (flag != FTW_F || ! S_ISREG (st->st_mode) || real.n_entries == MAX_FILES)
+    return real.n_entries == MAX_FILES;
+
+  fd = open (path, O_RDONLY);
+  if (fd == -1)
+    return 0;
+
+  data = malloc (extent);
+  n = read (fd, data, extent);
+  close (fd);
+
+  if (n >= 0)
+    add_entry (&real, path + ftw->base, data, n);
+  free (data);
+
+  return 0;
+}
+
+/* Recording and reading back the corpora, so that two builds can be
+ * timed on exactly the same ones */
+
+static int
+write_corpora (const char *file_name)
+{
+  FILE *file = fopen (file_name, "w");
+  int c, i;
+
+  if (file == NULL)
+    return -1;
+
+  fputs (CORPUS_MAGIC, file);
+  for (c = 0; c < N_CORPORA; c++)
+    {
+      Corpus *corpus = corpora[c];
+
+      fwrite (&corpus->n_entries, sizeof (int), 1, file);
+      for (i = 0; i < corpus->n_entries; i++)
+	{
+	  Entry *entry = &corpus->entries[i];
+	  size_t name_len = strlen (entry->name);
+
+	  fwrite (&name_len, sizeof (size_t), 1, file);
+	  fwrite (entry->name, 1, name_len, file);
+	  fwrite (&entry->len, sizeof (size_t), 1, file);
+	  fwrite (entry->data, 1, entry->len, file);
+	}
+    }
+
+  return fclose (file);
+}
+
+static int
+read_corpora (const char *file_name)
+{
+  char magic[sizeof (CORPUS_MAGIC)];
+  FILE *file = fopen (file_name, "r");
+  int c, i, n_entries;
+
+  if (file == NULL)
+    return -1;
+
+  if (fread (magic, 1, strlen (CORPUS_MAGIC), file) != strlen (CORPUS_MAGIC) ||
+      memcmp (magic, CORPUS_MAGIC, strlen (CORPUS_MAGIC)) != 0)
+    {
+      fclose (file);
+      return -1;
+    }
+
+  for (c = 0; c < N_CORPORA; c++)
+    {
+      if (fread (&n_entries, sizeof (int), 1, file) != 1)
+	break;
+
+      for (i = 0; i < n_entries; i++)
+	{
+	  size_t name_len, len;
+	  unsigned char *data;
+	  char *name;
+
+	  if (fread (&name_len, sizeof (size_t), 1, file) != 1 || name_len > 4096)
+	    break;
+	  name = malloc (name_len + 1);
+	  if (fread (name, 1, name_len, file) != name_len ||
+	      fread (&len, sizeof (size_t), 1, file) != 1 || len > (1 << 24))
+	    {
+	      free (name);
+	      break;
+	    }
+	  name[name_len] = '\0';
+	  data = malloc (len ? len : 1);
+	  if (fread (data, 1, len, file) != len)
+	    {
+	      free (name);
+	      free (data);
+	      break;
+	    }
+	  add_entry (corpora[c], name, data, len);
+	  free (name);
+	  free (data);
+	}
+      if (i < n_entries)
+	break;
+    }
+  fclose (file);
+
+  return c == N_CORPORA ? 0 : -1;
+}
+
+/* Each entry gets a directory of its own, so that names can repeat */
+static char *
+write_corpus_files (void)
+{
+  char *dir, path[4096];
+  int c, i, fd;
+
+  dir = strdup ("/tmp/bench-mime-XXXXXX");
+  if (mkdtemp (dir) == NULL)
+    return NULL;
+
+  for (c = 0; c < N_CORPORA; c++)
+    {
+      for (i = 0; i < corpora[c]->n_entries; i++)
+	{
+	  Entry *entry = &corpora[c]->entries[i];
+
+	  snprintf (path, sizeof (path), "%s/%s-%d", dir, corpora[c]->key, i);
+	  mkdir (path, 0700);
+	  snprintf (path, sizeof (path), "%s/%s-%d/%s", dir, corpora[c]->key, i, entry->name);
+	  fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	  if (fd == -1)
+	    continue;
+	  if (write (fd, entry->data, entry->len) == (ssize_t) entry->len)
+	    entry->path = strdup (path);
+	  close (fd);
+	}
+    }
+
+  return dir;
+}
+
+static void
+remove_corpus_files (char *dir)
+{
+  char path[4096];
+  int c, i;
+
+  for (c = 0; c < N_CORPORA; c++)
+    {
+      for (i = 0; i < corpora[c]->n_entries; i++)
+	{
+	  Entry *entry = &corpora[c]->entries[i];
+
+	  if (entry->path)
+	    unlink (entry->path);
+	  snprintf (path, sizeof (path), "%s/%s-%d", dir, corpora[c]->key, i);
+	  rmdir (path);
+	}
+    }
+  rmdir (dir);
+  free (dir);
+}
+
+/* A mime.cache of the version this code reads.  The rest of the installed
+ * one is kept as it is, as its layout hasn't changed since; the glob
+ * lists get written from the globs file, with the suffixes as a tree from
+ * their first characters and the types after the first of a suffix as
+ * '\0' children.
+ */
+typedef struct CacheNode CacheNode;
+
+struct CacheNode
+{
+  unsigned int character;
+  const char *mime_types[16];
+  int n_mime_types;
+  CacheNode *children[128];
+  int n_children;
+};
+
+typedef struct
+{
+  unsigned char *data;
+  size_t size;
+  size_t allocated;
+} CacheBuffer;
+
+static unsigned int
+buffer_add (CacheBuffer *buffer,
+	    const void  *data,
+	    size_t       size)
+{
+  unsigned int offset;
+
+  buffer->size = (buffer->size + 3) & ~3;
+  offset = buffer->size;
+  while (buffer->size + size > buffer->allocated)
+    {
+      buffer->allocated = buffer->allocated ? 2 * buffer->allocated : 65536;
+      buffer->data = realloc (buffer->data, buffer->allocated);
+    }
+  if (size > 0)
+    memcpy (buffer->data + offset, data, size);
+  buffer->size += size;
+
+  return offset;
+}
+
+static unsigned int
+buffer_reserve (CacheBuffer *buffer,
+		size_t       size)
+{
+  unsigned int offset;
+
+  offset = buffer_add (buffer, "", 0);
+  while (size-- > 0)
+    buffer_add (buffer, "", 1);
+
+  return offset;
+}
+
+static unsigned int
+buffer_add_string (CacheBuffer *buffer,
+		   const char  *string)
+{
+  return buffer_add (buffer, string, strlen (string) + 1);
+}
+
+static void
+buffer_set (CacheBuffer  *buffer,
+	    unsigned int  offset,
+	    unsigned int  value)
+{
+  value = htonl (value);
+  memcpy (buffer->data + offset, &value, 4);
+}
+
+static unsigned int
+utf8_next (const char **p)
+{
+  const unsigned char *s = (const unsigned char *) *p;
+  unsigned int c = *s++;
+  int extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+
+  if (extra > 0)
+    c &= 0x3f >> extra;
+  while (extra-- > 0 && (*s & 0xc0) == 0x80)
+    c = (c << 6) | (*s++ & 0x3f);
+  *p = (const char *) s;
+
+  return c;
+}
+
+static CacheNode *
+node_child (CacheNode    *node,
+	    unsigned int  character)
+{
+  CacheNode *child;
+  int i;
+
+  for (i = 0; i < node->n_children; i++)
+    if (node->children[i]->character == character)
+      return node->children[i];
+
+  if (node->n_children == 128)
+    return NULL;
+
+  child = calloc (1, sizeof (CacheNode));
+  child->character = character;
+
+  /* In order */
+  for (i = node->n_children; i > 0 && node->children[i - 1]->character > character; i--)
+    node->children[i] = node->children[i - 1];
+  node->children[i] = child;
+  node->n_children++;
+
+  return child;
+}
+
+static void
+free_nodes (CacheNode *node)
+{
+  int i;
+
+  for (i = 0; i < node->n_mime_types; i++)
+    free ((char *) node->mime_types[i]);
+  for (i = 0; i < node->n_children; i++)
+    {
+      free_nodes (node->children[i]);
+      free (node->children[i]);
+    }
+}
+
+static void
+write_nodes (CacheBuffer  *buffer,
+	     CacheNode    *node,
+	     unsigned int  offset)
+{
+  int i, j, n_extra;
+
+  n_extra = node->n_mime_types > 1 ? node->n_mime_types - 1 : 0;
+  for (i = 0; i < n_extra; i++)
+    {
+      buffer_set (buffer, offset + 16 * i, 0);
+      buffer_set (buffer, offset + 16 * i + 4, buffer_add_string (buffer, node->mime_types[i + 1]));
+      buffer_set (buffer, offset + 16 * i + 8, 0);
+      buffer_set (buffer, offset + 16 * i + 12, 0);
+    }
+
+  for (j = 0; j < node->n_children; j++)
+    {
+      CacheNode *child = node->children[j];
+      unsigned int entry = offset + 16 * (n_extra + j);
+      unsigned int children;
+      int n_child_entries;
+
+      n_child_entries = child->n_children + (child->n_mime_types > 1 ? child->n_mime_types - 1 : 0);
+      children = buffer_reserve (buffer, 16 * n_child_entries);
+
+      buffer_set (buffer, entry, child->character);
+      buffer_set (buffer, entry + 4, child->n_mime_types ? buffer_add_string (buffer, child->mime_types[0]) : 0);
+      buffer_set (buffer, entry + 8, n_child_entries);
+      buffer_set (buffer, entry + 12, children);
+
+      write_nodes (buffer, child, children);
+    }
+}
+
+static int
+compare_pairs (const void *a, const void *b)
+{
+  return strcmp (((char * const *) a)[0], ((char * const *) b)[0]);
+}
+
+static void
+add_glob_list (CacheBuffer  *buffer,
+	       unsigned int  header_offset,
+	       char        *(*pairs)[2],
+	       int           n_pairs)
+{
+  unsigned int list;
+  int i;
+
+  list = buffer_reserve (buffer, 4 + 8 * n_pairs);
+  buffer_set (buffer, header_offset, list);
+  buffer_set (buffer, list, n_pairs);
+  for (i = 0; i < n_pairs; i++)
+    {
+      buffer_set (buffer, list + 4 + 8 * i, buffer_add_string (buffer, pairs[i][0]));
+      buffer_set (buffer, list + 4 + 8 * i + 4, buffer_add_string (buffer, pairs[i][1]));
+    }
+}
+
+static int
+write_cache (const char *path)
+{
+  static const unsigned char version[] = { 0, 1, 0, 0 };
+  static char *literals[4096][2], *globs[4096][2];
+  int n_literals = 0, n_globs = 0;
+  CacheBuffer buffer = { NULL, 0, 0 };
+  unsigned char chunk[65536];
+  unsigned int list;
+  CacheNode root;
+  char line[256];
+  FILE *file;
+  ssize_t n;
+  int fd, i;
+
+  fd = open (MIME_DIR "/mime.cache", O_RDONLY);
+  if (fd == -1)
+    return -1;
+  while ((n = read (fd, chunk, sizeof (chunk))) > 0)
+    buffer_add (&buffer, chunk, n);
+  close (fd);
+  if (buffer.size < 40)
+    {
+      free (buffer.data);
+      return -1;
+    }
+  memcpy (buffer.data, version, sizeof (version));
+
+  memset (&root, 0, sizeof (root));
+
+  file = fopen (MIME_DIR "/globs", "r");
+  while (file != NULL && fgets (line, sizeof (line), file) != NULL)
+    {
+      char *colon, *glob;
+
+      if (line[0] == '#' || (colon = strchr (line, ':')) == NULL)
+	continue;
+      *colon = '\0';
+      glob = colon + 1;
+      glob[strcspn (glob, "\n")] = '\0';
+      if (glob[0] == '\0')
+	continue;
+
+      /* As _xdg_glob_determine_type has it */
+      if (strpbrk (glob + 1, "\\[?*") != NULL || strpbrk (glob, "\\[?") == glob)
+	{
+	  if (n_globs < 4096)
+	    {
+	      globs[n_globs][0] = strdup (glob);
+	      globs[n_globs++][1] = strdup (line);
+	    }
+	}
+      else if (glob[0] != '*')
+	{
+	  if (n_literals < 4096)
+	    {
+	      literals[n_literals][0] = strdup (glob);
+	      literals[n_literals++][1] = strdup (line);
+	    }
+	}
+      else
+	{
+	  CacheNode *node = &root;
+	  const char *p;
+
+	  for (p = glob + 1; *p && node; )
+	    node = node_child (node, utf8_next (&p));
+	  if (node == NULL || node == &root || node->n_mime_types == 16)
+	    continue;
+	  for (i = 0; i < node->n_mime_types; i++)
+	    if (strcmp (node->mime_types[i], line) == 0)
+	      break;
+	  if (i == node->n_mime_types)
+	    node->mime_types[node->n_mime_types++] = strdup (line);
+	}
+    }
+  if (file != NULL)
+    fclose (file);
+
+  qsort (literals, n_literals, sizeof (literals[0]), compare_pairs);
+  add_glob_list (&buffer, 12, literals, n_literals);
+
+  list = buffer_reserve (&buffer, 8);
+  buffer_set (&buffer, 16, list);
+  buffer_set (&buffer, list, root.n_children);
+  buffer_set (&buffer, list + 4, buffer_reserve (&buffer, 16 * root.n_children));
+  write_nodes (&buffer, &root, ntohl (*(unsigned int *) (buffer.data + list + 4)));
+
+  add_glob_list (&buffer, 20, globs, n_globs);
+
+  fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd != -1)
+    {
+      if (write (fd, buffer.data, buffer.size) != (ssize_t) buffer.size)
+	unlink (path);
+      close (fd);
+    }
+
+  free (buffer.data);
+  free_nodes (&root);
+  for (i = 0; i < n_literals; i++)
+    {
+      free (literals[i][0]);
+      free (literals[i][1]);
+    }
+  for (i = 0; i < n_globs; i++)
+    {
+      free (globs[i][0]);
+      free (globs[i][1]);
+    }
+
+  return fd == -1 ? -1 : 0;
+}
+
+/* The databases, each in a directory of its own that xdgmime is pointed
+ * at.  Returns NULL if the files it would be made of aren't there. */
+
+static const char *cache_files[] = { "mime.cache", NULL };
+static const char *plain_files[] = { "magic", "globs", "aliases", "subclasses", NULL };
+
+static char *
+make_database_dir (const char **files)
+{
+  char *dir, path[1024], target[1024];
+  int i;
+
+  dir = strdup ("/tmp/bench-mime-db-XXXXXX");
+  if (mkdtemp (dir) == NULL)
+    return NULL;
+
+  snprintf (path, sizeof (path), "%s/mime", dir);
+  mkdir (path, 0700);
+
+  for (i = 0; files[i]; i++)
+    {
+      int result;
+
+      snprintf (target, sizeof (target), "%s/%s", MIME_DIR, files[i]);
+      snprintf (path, sizeof (path), "%s/mime/%s", dir, files[i]);
+
+      if (strcmp (files[i], "mime.cache") == 0)
+	result = write_cache (path);
+      else
+	result = access (target, R_OK) == 0 ? symlink (target, path) : -1;
+
+      if (result != 0)
+	{
+	  printf ("No %s to make a database from\n", target);
+	  while (i >= 0)
+	    {
+	      snprintf (path, sizeof (path), "%s/mime/%s", dir, files[i--]);
+	      unlink (path);
+	    }
+	  snprintf (path, sizeof (path), "%s/mime", dir);
+	  rmdir (path);
+	  rmdir (dir);
+	  free (dir);
+	  return NULL;
+	}
+    }
+
+  setenv ("XDG_DATA_HOME", dir, 1);
+  setenv ("XDG_DATA_DIRS", dir, 1);
+
+  return dir;
+}
+
+static void
+remove_database_dir (char        *dir,
+		     const char **files)
+{
+  char path[1024];
+  int i;
+
+  for (i = 0; files[i]; i++)
+    {
+      snprintf (path, sizeof (path), "%s/mime/%s", dir, files[i]);
+      unlink (path);
+    }
+  snprintf (path, sizeof (path), "%s/mime", dir);
+  rmdir (path);
+  rmdir (dir);
+  free (dir);
+}
+
+/* The lookups */
+
+typedef enum
+{
+  LOOKUP_NAME,
+  LOOKUP_DATA,
+  LOOKUP_FILE
+} LookupKind;
+
+static const char *lookup_keys[] = { "name", "data", "file" };
+#define N_LOOKUP_KINDS 3
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static const char *
+lookup (LookupKind  kind,
+	Entry      *entry)
+{
+  switch (kind)
+    {
+    case LOOKUP_NAME:
+      return xdg_mime_get_mime_type_from_file_name (entry->name);
+    case LOOKUP_DATA:
+      return xdg_mime_get_mime_type_for_data (entry->data, entry->len);
+    default:
+      return entry->path ? xdg_mime_get_mime_type_for_file (entry->path, NULL) : NULL;
+    }
+}
+
+/* Runs through the corpus once, returning a hash of the answers so that
+ * two builds can tell whether they agree */
+static unsigned int
+lookup_corpus (LookupKind  kind,
+	       Corpus     *corpus)
+{
+  unsigned int hash = 2166136261U;
+  int i;
+
+  for (i = 0; i < corpus->n_entries; i++)
+    {
+      const char *result = lookup (kind, &corpus->entries[i]);
+
+      for (; result && *result; result++)
+	hash = (hash ^ (unsigned char) *result) * 16777619U;
+      hash = (hash ^ '\n') * 16777619U;
+    }
+
+  return hash;
+}
+
+static void
+report (const char *database,
+	const char *corpus,
+	const char *kind,
+	const char *what,
+	double      value)
+{
+  if (output != NULL)
+    fprintf (output, "%s.%s.%s.%s %.10g\n", database, corpus, kind, what, value);
+}
+
+static void
+bench_database (const char *database)
+{
+  int c, k;
+
+  printf ("%-10s %-10s %-5s %14s %14s\n", database, "corpus", "by", "lookups/s", "allocs/lookup");
+
+  for (c = 0; c < N_CORPORA; c++)
+    {
+      Corpus *corpus = corpora[c];
+
+      if (corpus->n_entries == 0)
+	continue;
+
+      for (k = 0; k < N_LOOKUP_KINDS; k++)
+	{
+	  double start, elapsed, allocations = -1;
+	  unsigned int answers;
+	  int passes = 0;
+
+	  /* Once to load things, and to see what the answers are */
+	  answers = lookup_corpus (k, corpus);
+
+#ifdef COUNT_ALLOCATIONS
+	  n_allocations = 0;
+	  counting = 1;
+	  lookup_corpus (k, corpus);
+	  counting = 0;
+	  allocations = (double) n_allocations / corpus->n_entries;
+#endif
+
+	  start = now ();
+	  do
+	    {
+	      lookup_corpus (k, corpus);
+	      passes++;
+	      elapsed = now () - start;
+	    }
+	  while (elapsed < MIN_TIME);
+
+	  printf ("%-10s %-10s %-5s %14.0f ", "", corpus->key, lookup_keys[k],
+		  passes * corpus->n_entries / elapsed);
+	  if (allocations >= 0)
+	    printf ("%14.2f\n", allocations);
+	  else
+	    printf ("%14s\n", "-");
+
+	  report (database, corpus->key, lookup_keys[k], "rate", passes * corpus->n_entries / elapsed);
+	  if (allocations >= 0)
+	    report (database, corpus->key, lookup_keys[k], "allocs", allocations);
+	  report (database, corpus->key, lookup_keys[k], "answers", answers);
+	}
+    }
+}
+
+/* Comparing the output of two runs */
+
+typedef struct
+{
+  char key[256];
+  double value;
+} Result;
+
+static int
+read_results (const char *file_name,
+	      Result     *results,
+	      int         n_results)
+{
+  FILE *file = fopen (file_name, "r");
+  int n = 0;
+
+  if (file == NULL)
+    return -1;
+
+  while (n < n_results && fscanf (file, "%255s %lf", results[n].key, &results[n].value) == 2)
+    n++;
+  fclose (file);
+
+  return n;
+}
+
+static int
+compare_runs (const char *old_file,
+	      const char *new_file)
+{
+  static Result old[256], new[256];
+  int n_old, n_new, i, j, differ = 0;
+
+  n_old = read_results (old_file, old, 256);
+  n_new = read_results (new_file, new, 256);
+  if (n_old < 0 || n_new < 0)
+    {
+      printf ("Can't read %s\n", n_old < 0 ? old_file : new_file);
+      return 1;
+    }
+
+  printf ("%-32s %14s %14s %8s\n", "", "old", "new", "");
+  for (i = 0; i < n_old; i++)
+    {
+      size_t len = strlen (old[i].key);
+
+      for (j = 0; j < n_new; j++)
+	if (strcmp (old[i].key, new[j].key) == 0)
+	  break;
+      if (j == n_new)
+	continue;
+
+      if (len > 8 && strcmp (old[i].key + len - 8, ".answers") == 0)
+	{
+	  if (old[i].value != new[j].value)
+	    {
+	      printf ("%.*s: the answers differ\n", (int) len - 8, old[i].key);
+	      differ = 1;
+	    }
+	}
+      else if (len > 5 && strcmp (old[i].key + len - 5, ".rate") == 0)
+	printf ("%-32s %14.0f %14.0f %7.2fx\n", old[i].key, old[i].value, new[j].value,
+		old[i].value > 0 ? new[j].value / old[i].value : 0.0);
+      else
+	printf ("%-32s %14.2f %14.2f\n", old[i].key, old[i].value, new[j].value);
+    }
+
+  if (! differ)
+    printf ("Both came up with the same answers\n");
+
+  return differ;
+}
+
+static void
+usage (void)
+{
+  printf ("Usage: bench-mime [--record file | --corpus file] [--output file] [dir...]\n"
+	  "       bench-mime --compare old-output new-output\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *record = NULL, *corpus_file = NULL, *output_file = NULL;
+  char *files_dir, *dir;
+  int i, n_dirs = 0;
+
+  if (argc == 4 && strcmp (argv[1], "--compare") == 0)
+    return compare_runs (argv[2], argv[3]);
+
+  for (i = 1; i < argc; i++)
+    {
+      if (i + 1 < argc && strcmp (argv[i], "--record") == 0)
+	record = argv[++i];
+      else if (i + 1 < argc && strcmp (argv[i], "--corpus") == 0)
+	corpus_file = argv[++i];
+      else if (i + 1 < argc && strcmp (argv[i], "--output") == 0)
+	output_file = argv[++i];
+      else if (argv[i][0] == '-')
+	{
+	  usage ();
+	  return 1;
+	}
+      else
+	argv[1 + n_dirs++] = argv[i];
+    }
+
+  srand (1);
+
+  extent = xdg_mime_get_max_buffer_extents ();
+
+  if (corpus_file != NULL)
+    {
+      if (read_corpora (corpus_file) != 0)
+	{
+	  printf ("Can't read the corpus from %s\n", corpus_file);
+	  return 1;
+	}
+    }
+  else
+    {
+      make_synthetic_corpus ();
+      if (n_dirs > 0)
+	{
+	  for (i = 0; i < n_dirs; i++)
+	    nftw (argv[1 + i], add_file, 16, FTW_PHYS);
+	}
+      else
+	{
+	  nftw ("/usr/bin", add_file, 16, FTW_PHYS);
+	  nftw ("/usr/share", add_file, 16, FTW_PHYS);
+	  nftw ("/etc", add_file, 16, FTW_PHYS);
+	}
+    }
+
+  if (record != NULL && write_corpora (record) != 0)
+    {
+      printf ("Can't write the corpus to %s\n", record);
+      return 1;
+    }
+
+  printf ("%d synthetic and %d real files, sniffing up to %d bytes\n",
+	  synthetic.n_entries, real.n_entries, (int) extent);
+
+  if (output_file != NULL && (output = fopen (output_file, "w")) == NULL)
+    {
+      printf ("Can't write to %s\n", output_file);
+      return 1;
+    }
+
+  files_dir = write_corpus_files ();
+  if (files_dir == NULL)
+    {
+      printf ("Can't write out the corpus\n");
+      return 1;
+    }
+
+  dir = make_database_dir (plain_files);
+  if (dir != NULL)
+    {
+      xdg_mime_shutdown ();
+      bench_database ("globs");
+      xdg_mime_shutdown ();
+      remove_database_dir (dir, plain_files);
+    }
+
+  dir = make_database_dir (cache_files);
+  if (dir != NULL)
+    {
+      xdg_mime_shutdown ();
+      bench_database ("cache");
+      xdg_mime_shutdown ();
+      remove_database_dir (dir, cache_files);
+    }
+
+  remove_corpus_files (files_dir);
+
+  if (output != NULL)
+    fclose (output);
+
+  return 0;
+}
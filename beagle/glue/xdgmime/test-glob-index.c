@@ -0,0 +1,573 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* test-glob-index.c: Checks that matching file names through the glob
+ * index gives the same answers as the glob hash and the mime.cache lookups
+ * always have, and times both.
+ *
+ * Build with something like
+ *   gcc -DHAVE_MMAP -pthread -o test-glob-index test-glob-index.c xdgmime*.c
+ * and run as
+ *   test-glob-index [dir...]
+ * to use the names of the files under the given directories (by default
+ * /usr, /etc, /var and /opt), and made up variations of them, as the
+ * corpus.  The glob hash reads /usr/share/mime/globs; the mime.cache
+ * lookups go through two caches built here from the same globs, the first
+ * of them from only half of them.  Random globs are also checked against
+ * fnmatch.
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#define _XOPEN_SOURCE 700
+#include "xdgmime.h"
+#include "xdgmimeint.h"
+#include "xdgmimeglob.h"
+#include "xdgmimecache.h"
+#include "xdgmimeglobindex.h"
+#include <ctype.h>
+#include <fnmatch.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define MAX_NAMES 1000000
+#define N_TYPES 5
+
+static char **names;
+static int n_names = 0;
+
+static int n_checks = 0;
+static int n_failures = 0;
+
+static int
+add_name (const char        *path,
+	  const struct stat *st,
+	  int                flag,
+	  struct FTW        *ftw)
+{
+  if (n_names == MAX_NAMES)
+    return 1;
+
+  names[n_names++] = strdup (path + ftw->base);
+
+  return 0;
+}
+
+/* Variations on the names found, until there are enough of them: other
+ * cases, backup and version suffixes, and names that aren't ASCII or
+ * aren't even UTF-8 */
+static void
+add_variations (void)
+{
+  static const char *decorations[] = { "~", ".bak", ".1", ".gz", ".in", "#", ".orig", "\xc3\xa9", "\xe2\x82\xac.txt", "\xff" };
+  int n_found = n_names;
+  int i = 0;
+
+  while (n_names < MAX_NAMES && n_found > 0)
+    {
+      const char *name = names[i % n_found];
+      char buffer[1024], *p;
+      int kind = (i / n_found) % 4;
+
+      snprintf (buffer, sizeof (buffer), "%s", name);
+      switch (kind)
+	{
+	case 0:
+	  for (p = buffer; *p; p++)
+	    *p = toupper ((unsigned char) *p);
+	  break;
+	case 1:
+	  for (p = buffer; *p; p++)
+	    if (rand () & 1)
+	      *p = toupper ((unsigned char) *p);
+	  break;
+	case 2:
+	  snprintf (buffer, sizeof (buffer), "%s%s", name, decorations[rand () % 10]);
+	  break;
+	case 3:
+	  snprintf (buffer, sizeof (buffer), "%s%s", decorations[rand () % 10], name);
+	  break;
+	}
+
+      names[n_names++] = strdup (buffer);
+      i++;
+    }
+}
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+compare (const char  *what,
+	 const char  *name,
+	 const char **expected,
+	 int          n_expected,
+	 const char **result,
+	 int          n_result)
+{
+  int i;
+
+  n_checks++;
+  for (i = 0; i < n_expected && n_expected == n_result; i++)
+    if (strcmp (expected[i], result[i]) != 0)
+      break;
+
+  if (n_expected != n_result || i < n_expected)
+    {
+      printf ("Test Failed: %s: \"%s\" matches %d types through the index (%s), but %d (%s) are expected\n",
+	      what, name, n_result, n_result ? result[0] : "-",
+	      n_expected, n_expected ? expected[0] : "-");
+      n_failures++;
+    }
+}
+
+typedef int (*LookupFunc) (void *data, const char *name, const char *mime_types[], int n_mime_types);
+
+static void
+check_names (const char *what,
+	     LookupFunc  lookup,
+	     void       *data)
+{
+  const char *expected[N_TYPES], *result[N_TYPES];
+  double start, elapsed[2];
+  int indexed, i, n_expected, n_result;
+
+  for (i = 0; i < n_names; i++)
+    {
+      _xdg_glob_index_enabled = FALSE;
+      n_expected = lookup (data, names[i], expected, N_TYPES);
+      _xdg_glob_index_enabled = TRUE;
+      n_result = lookup (data, names[i], result, N_TYPES);
+      compare (what, names[i], expected, n_expected, result, n_result);
+    }
+
+  for (indexed = 0; indexed < 2; indexed++)
+    {
+      _xdg_glob_index_enabled = indexed;
+      start = now ();
+      for (i = 0; i < n_names; i++)
+	lookup (data, names[i], result, N_TYPES);
+      elapsed[indexed] = now () - start;
+    }
+
+  printf ("%s: %.0f lookups/s through the globs, %.0f lookups/s through the index (%.1fx)\n",
+	  what, n_names / elapsed[0], n_names / elapsed[1], elapsed[0] / elapsed[1]);
+}
+
+static int
+lookup_glob_hash (void       *data,
+		  const char *name,
+		  const char *mime_types[],
+		  int         n_mime_types)
+{
+  return _xdg_glob_hash_lookup_file_name (data, name, mime_types, n_mime_types);
+}
+
+static int
+lookup_cache (void       *data,
+	      const char *name,
+	      const char *mime_types[],
+	      int         n_mime_types)
+{
+  return _xdg_mime_cache_glob_lookup_file_name (name, mime_types, n_mime_types);
+}
+
+/* Globs made up of the characters that mean something to fnmatch, checked
+ * against names made up of the same */
+static void
+check_random_globs (void)
+{
+  static const char glob_chars[] = "ab.*?[]!^-\\c";
+  static const char name_chars[] = "abc.-]![\\^*?";
+  char globs[64][16], name[16];
+  const char *mime_types[64];
+  const char *expected[64];
+  int round, i, j, n, n_expected;
+
+  for (round = 0; round < 2000; round++)
+    {
+      XdgGlobIndex *index = _xdg_glob_index_new ();
+
+      for (i = 0; i < 64; i++)
+	{
+	  int length = rand () % 10;
+
+	  for (j = 0; j < length; j++)
+	    globs[i][j] = glob_chars[rand () % (sizeof (glob_chars) - 1)];
+	  globs[i][length] = '\0';
+	  _xdg_glob_index_add_glob (index, globs[i], globs[i], 0);
+	}
+      _xdg_glob_index_compile (index);
+
+      for (i = 0; i < 200; i++)
+	{
+	  int length = 1 + rand () % 10;
+
+	  for (j = 0; j < length; j++)
+	    name[j] = name_chars[rand () % (sizeof (name_chars) - 1)];
+	  name[length] = '\0';
+
+	  n_expected = 0;
+	  for (j = 0; j < 64; j++)
+	    if (fnmatch (globs[j], name, 0) == 0)
+	      expected[n_expected++] = globs[j];
+
+	  n = _xdg_glob_index_lookup_file_name (index, name, mime_types, 64);
+	  compare ("random globs", name, expected, n_expected, mime_types, n);
+	}
+
+      _xdg_glob_index_free (index);
+    }
+}
+
+/* Writes a mime.cache with just the glob lists (which are what is looked
+ * at here) in the format this code reads, from the first 'n_lines' lines
+ * of the globs file, with the suffixes as a tree from their first
+ * characters and the types after the first of a suffix as '\0' children.
+ */
+typedef struct CacheNode CacheNode;
+
+struct CacheNode
+{
+  xdg_unichar_t character;
+  const char *mime_types[16];
+  int n_mime_types;
+  CacheNode *children[128];
+  int n_children;
+  xdg_uint32_t offset;
+};
+
+typedef struct
+{
+  unsigned char *data;
+  size_t size;
+  size_t allocated;
+} CacheBuffer;
+
+static xdg_uint32_t
+buffer_add (CacheBuffer *buffer,
+	    const void  *data,
+	    size_t       size)
+{
+  xdg_uint32_t offset;
+
+  buffer->size = (buffer->size + 3) & ~3;
+  offset = buffer->size;
+  while (buffer->size + size > buffer->allocated)
+    {
+      buffer->allocated = buffer->allocated ? 2 * buffer->allocated : 65536;
+      buffer->data = realloc (buffer->data, buffer->allocated);
+    }
+  if (size > 0)
+    memcpy (buffer->data + offset, data, size);
+  buffer->size += size;
+
+  return offset;
+}
+
+static xdg_uint32_t
+buffer_reserve (CacheBuffer *buffer,
+		size_t       size)
+{
+  xdg_uint32_t offset;
+
+  offset = buffer_add (buffer, "", 0);
+  while (size-- > 0)
+    buffer_add (buffer, "", 1);
+
+  return offset;
+}
+
+static xdg_uint32_t
+buffer_add_string (CacheBuffer *buffer,
+		   const char  *string)
+{
+  return buffer_add (buffer, string, strlen (string) + 1);
+}
+
+static void
+buffer_set (CacheBuffer  *buffer,
+	    xdg_uint32_t  offset,
+	    xdg_uint32_t  value)
+{
+  value = htonl (value);
+  memcpy (buffer->data + offset, &value, 4);
+}
+
+static CacheNode *
+node_child (CacheNode     *node,
+	    xdg_unichar_t  character)
+{
+  CacheNode *child;
+  int i;
+
+  for (i = 0; i < node->n_children; i++)
+    if (node->children[i]->character == character)
+      return node->children[i];
+
+  if (node->n_children == 128)
+    return NULL;
+
+  child = calloc (1, sizeof (CacheNode));
+  child->character = character;
+
+  /* In order */
+  for (i = node->n_children; i > 0 && node->children[i - 1]->character > character; i--)
+    node->children[i] = node->children[i - 1];
+  node->children[i] = child;
+  node->n_children++;
+
+  return child;
+}
+
+static void
+write_nodes (CacheBuffer *buffer,
+	     CacheNode   *node,
+	     xdg_uint32_t offset)
+{
+  int i, j, n_extra;
+
+  n_extra = node->n_mime_types > 1 ? node->n_mime_types - 1 : 0;
+  for (i = 0; i < n_extra; i++)
+    {
+      buffer_set (buffer, offset + 16 * i, 0);
+      buffer_set (buffer, offset + 16 * i + 4, buffer_add_string (buffer, node->mime_types[i + 1]));
+      buffer_set (buffer, offset + 16 * i + 8, 0);
+      buffer_set (buffer, offset + 16 * i + 12, 0);
+    }
+
+  for (j = 0; j < node->n_children; j++)
+    {
+      CacheNode *child = node->children[j];
+      xdg_uint32_t entry = offset + 16 * (n_extra + j);
+      xdg_uint32_t children;
+      int n_child_entries;
+
+      n_child_entries = child->n_children + (child->n_mime_types > 1 ? child->n_mime_types - 1 : 0);
+      children = buffer_reserve (buffer, 16 * n_child_entries);
+
+      buffer_set (buffer, entry, child->character);
+      buffer_set (buffer, entry + 4, child->n_mime_types ? buffer_add_string (buffer, child->mime_types[0]) : 0);
+      buffer_set (buffer, entry + 8, n_child_entries);
+      buffer_set (buffer, entry + 12, children);
+
+      write_nodes (buffer, child, children);
+    }
+}
+
+static int
+compare_literals (const void *a, const void *b)
+{
+  return strcmp (((char * const *) a)[0], ((char * const *) b)[0]);
+}
+
+static char *
+make_cache (const char *dir,
+	    const char *name,
+	    int         n_lines)
+{
+  static const unsigned char header[] = { 0, 1, 0, 0 };
+  char line[256], path[1024];
+  char *literals[2048][2], *globs[2048][2];
+  int n_literals = 0, n_globs = 0, n_line = 0;
+  CacheNode root;
+  CacheBuffer buffer = { NULL, 0, 0 };
+  xdg_uint32_t list, zero = 0;
+  FILE *file;
+  int fd, i;
+
+  memset (&root, 0, sizeof (root));
+
+  file = fopen ("/usr/share/mime/globs", "r");
+  if (file == NULL)
+    return NULL;
+
+  while (fgets (line, sizeof (line), file) != NULL && n_line++ < n_lines)
+    {
+      char *colon, *glob;
+
+      if (line[0] == '#' || (colon = strchr (line, ':')) == NULL)
+	continue;
+      *colon = '\0';
+      glob = colon + 1;
+      glob[strcspn (glob, "\n")] = '\0';
+
+      switch (_xdg_glob_determine_type (glob))
+	{
+	case XDG_GLOB_LITERAL:
+	  literals[n_literals][0] = strdup (glob);
+	  literals[n_literals++][1] = strdup (line);
+	  break;
+	case XDG_GLOB_SIMPLE:
+	  {
+	    CacheNode *node = &root;
+	    const char *p;
+
+	    for (p = glob + 1; *p && node; p = _xdg_utf8_next_char (p))
+	      node = node_child (node, _xdg_utf8_to_ucs4 (p));
+	    if (node == NULL || node == &root || node->n_mime_types == 16)
+	      break;
+	    for (i = 0; i < node->n_mime_types; i++)
+	      if (strcmp (node->mime_types[i], line) == 0)
+		break;
+	    if (i == node->n_mime_types)
+	      node->mime_types[node->n_mime_types++] = strdup (line);
+	  }
+	  break;
+	case XDG_GLOB_FULL:
+	  globs[n_globs][0] = strdup (glob);
+	  globs[n_globs++][1] = strdup (line);
+	  break;
+	}
+    }
+  fclose (file);
+
+  /* Header: version, then the offsets of the lists, none of the others */
+  buffer_reserve (&buffer, 40);
+  memcpy (buffer.data, header, sizeof (header));
+
+  /* An empty magic section, which the code reads when loading */
+  list = buffer_reserve (&buffer, 12);
+  buffer_set (&buffer, 24, list);
+  for (i = 4; i < 40; i += 4)
+    if (i != 12 && i != 16 && i != 20 && i != 24)
+      buffer_set (&buffer, i, buffer_add (&buffer, &zero, 4));
+
+  qsort (literals, n_literals, sizeof (literals[0]), compare_literals);
+  list = buffer_reserve (&buffer, 4 + 8 * n_literals);
+  buffer_set (&buffer, 12, list);
+  buffer_set (&buffer, list, n_literals);
+  for (i = 0; i < n_literals; i++)
+    {
+      buffer_set (&buffer, list + 4 + 8 * i, buffer_add_string (&buffer, literals[i][0]));
+      buffer_set (&buffer, list + 4 + 8 * i + 4, buffer_add_string (&buffer, literals[i][1]));
+    }
+
+  list = buffer_reserve (&buffer, 8);
+  buffer_set (&buffer, 16, list);
+  buffer_set (&buffer, list, root.n_children);
+  buffer_set (&buffer, list + 4, buffer_reserve (&buffer, 16 * root.n_children));
+  write_nodes (&buffer, &root, ntohl (*(xdg_uint32_t *) (buffer.data + list + 4)));
+
+  list = buffer_reserve (&buffer, 4 + 8 * n_globs);
+  buffer_set (&buffer, 20, list);
+  buffer_set (&buffer, list, n_globs);
+  for (i = 0; i < n_globs; i++)
+    {
+      buffer_set (&buffer, list + 4 + 8 * i, buffer_add_string (&buffer, globs[i][0]));
+      buffer_set (&buffer, list + 4 + 8 * i + 4, buffer_add_string (&buffer, globs[i][1]));
+    }
+
+  snprintf (path, sizeof (path), "%s/%s", dir, name);
+  fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1)
+    return NULL;
+  write (fd, buffer.data, buffer.size);
+  close (fd);
+  free (buffer.data);
+
+  return strdup (path);
+}
+
+int
+main (int argc, char *argv[])
+{
+  XdgGlobHash *glob_hash;
+  XdgMimeCache *caches[3];
+  char dir[] = "/tmp/test-glob-index-XXXXXX";
+  char *paths[2];
+  int i;
+
+  srand (1);
+
+  check_random_globs ();
+
+  names = malloc (MAX_NAMES * sizeof (char *));
+  if (argc > 1)
+    {
+      for (i = 1; i < argc; i++)
+	nftw (argv[i], add_name, 16, FTW_PHYS);
+    }
+  else
+    {
+      nftw ("/usr", add_name, 16, FTW_PHYS);
+      nftw ("/etc", add_name, 16, FTW_PHYS);
+      nftw ("/var", add_name, 16, FTW_PHYS);
+      nftw ("/opt", add_name, 16, FTW_PHYS);
+    }
+  printf ("%d names found", n_names);
+  add_variations ();
+  printf (", %d with variations\n", n_names);
+
+  glob_hash = _xdg_glob_hash_new ();
+  _xdg_mime_glob_read_from_file (glob_hash, "/usr/share/mime/globs");
+  _xdg_glob_hash_build_index (glob_hash);
+  check_names ("globs", lookup_glob_hash, glob_hash);
+  _xdg_glob_hash_free (glob_hash);
+
+  if (mkdtemp (dir) != NULL)
+    {
+      paths[0] = make_cache (dir, "half.cache", 600);
+      paths[1] = make_cache (dir, "whole.cache", 1 << 30);
+
+      if (paths[0] && paths[1])
+	{
+	  caches[0] = _xdg_mime_cache_new_from_file (paths[0]);
+	  caches[1] = _xdg_mime_cache_new_from_file (paths[1]);
+	  caches[2] = NULL;
+
+	  if (caches[0] && caches[1])
+	    {
+	      _caches = caches;
+	      _caches_glob_index = _xdg_mime_cache_build_glob_index (caches);
+	      check_names ("mime.cache", lookup_cache, NULL);
+	      _xdg_glob_index_free (_caches_glob_index);
+	      _caches_glob_index = NULL;
+	      _caches = NULL;
+	      _xdg_mime_cache_unref (caches[0]);
+	      _xdg_mime_cache_unref (caches[1]);
+	    }
+	  else
+	    printf ("The caches could not be read\n");
+	}
+
+      for (i = 0; i < 2; i++)
+	{
+	  if (paths[i])
+	    unlink (paths[i]);
+	}
+      rmdir (dir);
+    }
+
+  printf ("%d checks, %d failures\n", n_checks, n_failures);
+
+  return n_failures != 0;
+}
@@ -0,0 +1,351 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* test-magic-index.c: Checks that sniffing through the magic index gives
+ * the same answers as going through every rule, and times both.
+ *
+ * Build with something like
+ *   gcc -DHAVE_MMAP -o test-magic-index test-magic-index.c xdgmime*.c
+ * and run as
+ *   test-magic-index [dir...]
+ * to use the files under the given directories (by default /usr/bin,
+ * /usr/share and /etc) as the corpus.  Both the mime.cache and the plain
+ * magic file lookups are checked, by pointing XDG_DATA_DIRS at copies of
+ * the shared MIME database with and without the cache.
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#define _XOPEN_SOURCE 700
+#include "xdgmime.h"
+#include "xdgmimeint.h"
+#include "xdgmimemagicindex.h"
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define MAX_FILES 4000
+
+typedef struct
+{
+  char *path;
+  unsigned char *data;
+  size_t len;
+} CorpusFile;
+
+static CorpusFile corpus[MAX_FILES];
+static int n_corpus = 0;
+static size_t extent;
+
+static int n_checks = 0;
+static int n_failures = 0;
+
+static int
+add_file (const char        *path,
+	  const struct stat *st,
+	  int                flag,
+	  struct FTW        *ftw)
+{
+  CorpusFile *file;
+  ssize_t n;
+  int fd;
+
+  if (flag != FTW_F || ! S_ISREG (st->st_mode) || n_corpus == MAX_FILES)
+    return n_corpus == MAX_FILES;
+
+  fd = open (path, O_RDONLY);
+  if (fd == -1)
+    return 0;
+
+  file = &corpus[n_corpus];
+  file->data = malloc (extent);
+  n = read (fd, file->data, extent);
+  close (fd);
+
+  if (n < 0)
+    {
+      free (file->data);
+      return 0;
+    }
+
+  file->path = strdup (path);
+  file->len = n;
+  n_corpus++;
+
+  return 0;
+}
+
+static const char *
+sniff (const void *data,
+       size_t      len,
+       int         indexed)
+{
+  _xdg_mime_magic_index_enabled = indexed;
+  return xdg_mime_get_mime_type_for_data (data, len);
+}
+
+static void
+check_data (const char *path,
+	    const char *what,
+	    const void *data,
+	    size_t      len)
+{
+  const char *result;
+  char expected[256];
+
+  /* Without a mime.cache the database is reread every few seconds, which
+   * frees the strings earlier lookups returned */
+  snprintf (expected, sizeof (expected), "%s", sniff (data, len, FALSE));
+  result = sniff (data, len, TRUE);
+
+  n_checks++;
+  if (strcmp (expected, result) != 0)
+    {
+      printf ("Test Failed: %s (%s, %d bytes) is %s through the index, but %s is expected\n",
+	      path, what, (int) len, result, expected);
+      n_failures++;
+    }
+}
+
+static void
+check_file (const char *path)
+{
+  const char *result;
+  char expected[256];
+  struct stat st;
+
+  if (stat (path, &st) != 0)
+    return;
+
+  _xdg_mime_magic_index_enabled = FALSE;
+  snprintf (expected, sizeof (expected), "%s", xdg_mime_get_mime_type_for_file (path, &st));
+  _xdg_mime_magic_index_enabled = TRUE;
+  result = xdg_mime_get_mime_type_for_file (path, &st);
+
+  n_checks++;
+  if (strcmp (expected, result) != 0)
+    {
+      printf ("Test Failed: file %s is %s through the index, but %s is expected\n",
+	      path, result, expected);
+      n_failures++;
+    }
+}
+
+static void
+check_corpus (void)
+{
+  unsigned char *buffer;
+  size_t len;
+  int i, j, k;
+
+  buffer = malloc (extent);
+
+  for (i = 0; i < n_corpus; i++)
+    {
+      CorpusFile *file = &corpus[i];
+
+      check_file (file->path);
+      check_data (file->path, "whole", file->data, file->len);
+
+      /* Every short prefix, where the range checks end early */
+      for (len = 0; len < file->len && len < 64; len++)
+	check_data (file->path, "truncated", file->data, len);
+      for (len = 64; len < file->len; len *= 2)
+	check_data (file->path, "truncated", file->data, len);
+
+      /* And some damaged copies */
+      for (j = 0; j < 8 && file->len > 0; j++)
+	{
+	  memcpy (buffer, file->data, file->len);
+	  for (k = 0; k < 1 + j; k++)
+	    buffer[rand () % (j < 4 && file->len > 64 ? 64 : file->len)] = rand ();
+	  check_data (file->path, "mutated", buffer, file->len);
+	}
+    }
+
+  free (buffer);
+}
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+time_corpus (const char *what)
+{
+  double start, elapsed[2];
+  int indexed, pass, i;
+
+  for (indexed = 0; indexed < 2; indexed++)
+    {
+      /* Warm up, which also builds the index */
+      for (i = 0; i < n_corpus; i++)
+	sniff (corpus[i].data, corpus[i].len, indexed);
+
+      start = now ();
+      for (pass = 0; pass < 20; pass++)
+	for (i = 0; i < n_corpus; i++)
+	  sniff (corpus[i].data, corpus[i].len, indexed);
+      elapsed[indexed] = now () - start;
+    }
+
+  printf ("%s: %.0f lookups/s through every rule, %.0f lookups/s through the index (%.1fx)\n",
+	  what,
+	  20 * n_corpus / elapsed[0],
+	  20 * n_corpus / elapsed[1],
+	  elapsed[0] / elapsed[1]);
+}
+
+/* Shows xdgmime a copy of the shared MIME database with either just the
+ * mime.cache, or the files it is built from.  The cache is stamped with
+ * the version this code reads, which it may well be newer than.  The magic
+ * part of it hasn't changed since, but the globs have, so its glob lists
+ * are pointed at an empty one added at the end.
+ */
+static const char *cache_files[] = { "mime.cache", NULL };
+static const char *plain_files[] = { "magic", "globs", "aliases", "subclasses", NULL };
+
+static char *
+make_database_dirs (const char **files)
+{
+  char *dir, path[1024], target[1024];
+  int i;
+
+  dir = strdup ("/tmp/test-magic-index-XXXXXX");
+  if (mkdtemp (dir) == NULL)
+    return NULL;
+
+  snprintf (path, sizeof (path), "%s/mime", dir);
+  mkdir (path, 0700);
+
+  for (i = 0; files[i]; i++)
+    {
+      snprintf (target, sizeof (target), "/usr/share/mime/%s", files[i]);
+      snprintf (path, sizeof (path), "%s/mime/%s", dir, files[i]);
+
+      if (strcmp (files[i], "mime.cache") == 0)
+	{
+	  static const unsigned char version[] = { 0, 1, 0, 0 };
+	  static const unsigned char empty[8] = { 0 };
+	  unsigned char buffer[65536], offset[4];
+	  off_t end = 0;
+	  ssize_t n;
+	  int in, out, j;
+
+	  in = open (target, O_RDONLY);
+	  out = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	  while (in != -1 && out != -1 && (n = read (in, buffer, sizeof (buffer))) > 0)
+	    end += write (out, buffer, n);
+	  if (out != -1)
+	    {
+	      end = (end + 3) & ~3;
+	      pwrite (out, empty, sizeof (empty), end);
+	      for (j = 0; j < 4; j++)
+		offset[j] = end >> (24 - 8 * j);
+	      /* Literals, suffixes and other globs */
+	      for (j = 12; j <= 20; j += 4)
+		pwrite (out, offset, sizeof (offset), j);
+	      pwrite (out, version, sizeof (version), 0);
+	    }
+	  close (in);
+	  close (out);
+	}
+      else
+	symlink (target, path);
+    }
+
+  setenv ("XDG_DATA_HOME", dir, 1);
+  setenv ("XDG_DATA_DIRS", dir, 1);
+
+  return dir;
+}
+
+static void
+remove_database_dirs (char        *dir,
+		      const char **files)
+{
+  char path[1024];
+  int i;
+
+  for (i = 0; files[i]; i++)
+    {
+      snprintf (path, sizeof (path), "%s/mime/%s", dir, files[i]);
+      unlink (path);
+    }
+  snprintf (path, sizeof (path), "%s/mime", dir);
+  rmdir (path);
+  rmdir (dir);
+  free (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+  char *dir;
+  int i;
+
+  srand (1);
+
+  extent = xdg_mime_get_max_buffer_extents ();
+
+  if (argc > 1)
+    {
+      for (i = 1; i < argc; i++)
+	nftw (argv[i], add_file, 16, FTW_PHYS);
+    }
+  else
+    {
+      nftw ("/usr/bin", add_file, 16, FTW_PHYS);
+      nftw ("/usr/share", add_file, 16, FTW_PHYS);
+      nftw ("/etc", add_file, 16, FTW_PHYS);
+    }
+
+  printf ("%d files, sniffing %d bytes\n", n_corpus, (int) extent);
+
+  dir = make_database_dirs (cache_files);
+  if (dir != NULL)
+    {
+      check_corpus ();
+      time_corpus ("mime.cache");
+      xdg_mime_shutdown ();
+      remove_database_dirs (dir, cache_files);
+    }
+
+  dir = make_database_dirs (plain_files);
+  if (dir != NULL)
+    {
+      check_corpus ();
+      time_corpus ("magic file");
+      xdg_mime_shutdown ();
+      remove_database_dirs (dir, plain_files);
+    }
+
+  printf ("%d checks, %d failures\n", n_checks, n_failures);
+
+  return n_failures != 0;
+}
@@ -0,0 +1,307 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* test-magic-match.c: Checks that every way of comparing a magic value
+ * against a range of data gives the same answers as the byte by byte
+ * loop the matchlets used to have, and times them.
+ *
+ * Build with something like
+ *   gcc -O2 -o test-magic-match test-magic-match.c xdgmime*.c
+ * The values, masks, offsets and ranges are gone through exhaustively up
+ * to a size, over data made of few enough different bytes that there are
+ * plenty of near misses, and with the value planted at every position.
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#define _XOPEN_SOURCE 700
+#include "xdgmime.h"
+#include "xdgmimeint.h"
+#include "xdgmimematch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define MAX_VALUE 40
+#define MAX_DATA 100
+
+static const char *implementation_names[] = { "scalar", "SSE2", "AVX2" };
+#define N_IMPLEMENTATIONS 3
+
+static int n_checks = 0;
+static int n_failures = 0;
+
+/* The loop from _xdg_mime_magic_matchlet_compare_to_data */
+static int
+reference_match (const unsigned char *value,
+		 const unsigned char *mask,
+		 unsigned int         value_length,
+		 int                  offset,
+		 unsigned int         range_length,
+		 const void          *data,
+		 size_t               len)
+{
+  int i, j;
+  for (i = offset; i < offset + range_length; i++)
+    {
+      int valid_matchlet = TRUE;
+
+      if (i + value_length > len)
+	return FALSE;
+
+      if (mask)
+	{
+	  for (j = 0; j < value_length; j++)
+	    {
+	      if ((value[j] & mask[j]) !=
+		  ((((unsigned char *) data)[j + i]) & mask[j]))
+		{
+		  valid_matchlet = FALSE;
+		  break;
+		}
+	    }
+	}
+      else
+	{
+	  for (j = 0; j <  value_length; j++)
+	    {
+	      if (value[j] != ((unsigned char *) data)[j + i])
+		{
+		  valid_matchlet = FALSE;
+		  break;
+		}
+	    }
+	}
+      if (valid_matchlet)
+	return TRUE;
+    }
+  return FALSE;
+}
+
+static double
+now (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* The data comes from a heap block of exactly its size, so that reading
+ * past it shows up under a memory checker */
+static void
+check_one (const unsigned char *value,
+	   const unsigned char *mask,
+	   unsigned int         value_length,
+	   unsigned int         offset,
+	   unsigned int         range_length,
+	   const unsigned char *data,
+	   size_t               len,
+	   const int           *implementations,
+	   int                  n_implementations)
+{
+  unsigned char *copy = malloc (len ? len : 1);
+  int expected, got, k;
+
+  memcpy (copy, data, len);
+  expected = reference_match (value, mask, value_length, offset, range_length, copy, len);
+  for (k = 0; k < n_implementations; k++)
+    {
+      _xdg_mime_match_set_implementation (implementations[k]);
+      got = _xdg_mime_match_range (value, mask, value_length, offset, range_length, copy, len);
+      n_checks++;
+      if (got != expected)
+	{
+	  n_failures++;
+	  if (n_failures <= 20)
+	    printf ("Test Failed: %s gives %d instead of %d for length %u, offset %u, range %u, %s, data of %zu\n",
+		    implementation_names[implementations[k]], got, expected,
+		    value_length, offset, range_length, mask ? "masked" : "unmasked", len);
+	}
+    }
+  free (copy);
+}
+
+/* Fills 'data' from an alphabet of a few bytes, which the values are also
+ * made of */
+static void
+fill (unsigned char *data,
+      size_t         len,
+      int            n_letters)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    data[i] = 'a' + rand () % n_letters;
+}
+
+static void
+make_mask (unsigned char *mask,
+	   unsigned int   length,
+	   int            kind)
+{
+  unsigned int j;
+
+  for (j = 0; j < length; j++)
+    {
+      switch (kind)
+	{
+	case 0: /* Only some bits */
+	  mask[j] = rand () & 0xff;
+	  break;
+	case 1: /* Zeros at both ends, so the scans start further in */
+	  mask[j] = (j < length / 3 || j >= length - length / 4) ? 0 : 0xff;
+	  break;
+	case 2: /* Nothing at all */
+	  mask[j] = 0;
+	  break;
+	default: /* Everything but the case of letters */
+	  mask[j] = 0xdf;
+	  break;
+	}
+    }
+}
+
+static void
+check_exhaustively (const int *implementations,
+		    int        n_implementations)
+{
+  unsigned char value[MAX_VALUE], mask[MAX_VALUE], data[MAX_DATA];
+  unsigned int value_length, offset, range_length;
+  int kind, letters, plant;
+  size_t len;
+
+  for (value_length = 0; value_length <= MAX_VALUE; value_length++)
+    for (kind = -1; kind < 4; kind++)
+      for (letters = 1; letters <= 3; letters += 2)
+	for (len = 0; len <= MAX_DATA; len += (len < 40 ? 1 : 7))
+	  {
+	    fill (value, value_length, letters);
+	    fill (data, len, letters);
+	    if (kind >= 0)
+	      make_mask (mask, value_length, kind);
+
+	    for (offset = 0; offset <= len + 1; offset += (offset < 20 ? 1 : 5))
+	      for (range_length = 0; range_length <= len + 2 - offset; range_length += (range_length < 40 ? 1 : 9))
+		{
+		  check_one (value, kind >= 0 ? mask : NULL, value_length, offset, range_length,
+			     data, len, implementations, n_implementations);
+
+		  /* And with the value planted somewhere in the data */
+		  if (value_length <= len && range_length > 0)
+		    {
+		      unsigned char planted[MAX_DATA];
+
+		      plant = rand () % (len - value_length + 1);
+		      memcpy (planted, data, len);
+		      memcpy (planted + plant, value, value_length);
+		      /* Bits the mask doesn't look at don't matter */
+		      if (kind >= 0 && value_length > 0)
+			{
+			  int j = rand () % value_length;
+			  planted[plant + j] ^= ~mask[j];
+			}
+		      check_one (value, kind >= 0 ? mask : NULL, value_length, offset, range_length,
+				 planted, len, implementations, n_implementations);
+		    }
+		}
+	  }
+}
+
+/* The kind of search that costs the most: a marker that isn't there,
+ * looked for over the first few kilobytes */
+static void
+time_implementations (const int *implementations,
+		      int        n_implementations)
+{
+  static const unsigned char value[] = "<!DOCTYPE html";
+  static const unsigned char mask[] = { 0xff, 0xff, 0xdf, 0xdf, 0xdf, 0xdf, 0xdf, 0xdf, 0xdf, 0xff, 0xdf, 0xdf, 0xdf, 0xdf };
+  unsigned char data[4096];
+  double start, scalar_time = 0;
+  volatile int found = 0;
+  int i, k;
+
+  for (i = 0; i < (int) sizeof (data); i++)
+    data[i] = "<p>Some text, with tags</p>\n"[i % 28];
+
+  for (k = 0; k < n_implementations; k++)
+    {
+      double unmasked, masked;
+
+      _xdg_mime_match_set_implementation (implementations[k]);
+
+      start = now ();
+      for (i = 0; i < 100000; i++)
+	found += _xdg_mime_match_range (value, NULL, sizeof (value) - 1, 0, sizeof (data), data, sizeof (data));
+      unmasked = now () - start;
+
+      start = now ();
+      for (i = 0; i < 100000; i++)
+	found += _xdg_mime_match_range (value, mask, sizeof (value) - 1, 0, sizeof (data), data, sizeof (data));
+      masked = now () - start;
+
+      if (k == 0)
+	scalar_time = masked;
+      printf ("%-6s  unmasked %.3fs  masked %.3fs  (%.1fx the scalar masked scan)\n",
+	      implementation_names[implementations[k]], unmasked, masked,
+	      masked > 0 ? scalar_time / masked : 0.0);
+    }
+
+  start = now ();
+  for (i = 0; i < 100000; i++)
+    found += reference_match (value, mask, sizeof (value) - 1, 0, sizeof (data), data, sizeof (data));
+  printf ("old loop        masked %.3fs\n", now () - start);
+
+  n_checks++;
+  if (found != 0)
+    {
+      printf ("Test Failed: the marker is found where it isn't\n");
+      n_failures++;
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  int implementations[N_IMPLEMENTATIONS];
+  int n_implementations = 0;
+  int best, k;
+
+  srand (12345);
+
+  best = _xdg_mime_match_get_implementation ();
+  printf ("Using %s by default\n", implementation_names[best]);
+
+  for (k = 0; k < N_IMPLEMENTATIONS; k++)
+    {
+      if (_xdg_mime_match_set_implementation (k))
+	implementations[n_implementations++] = k;
+      else
+	printf ("No %s here, not checking it\n", implementation_names[k]);
+    }
+
+  check_exhaustively (implementations, n_implementations);
+  time_implementations (implementations, n_implementations);
+
+  _xdg_mime_match_set_implementation (best);
+
+  printf ("%d checks, %d failures\n", n_checks, n_failures);
+
+  return n_failures != 0;
+}
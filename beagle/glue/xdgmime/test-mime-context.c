@@ -0,0 +1,224 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* test-mime-context.c: Sniffs from several threads through one context
+ * while the database under it keeps changing.
+ *
+ * Build with something like
+ *   gcc -DHAVE_MMAP -pthread -o test-mime-context test-mime-context.c xdgmime*.c
+ * and run as
+ *   test-mime-context [seconds]
+ * The MIME database files in /usr/share/mime are copied to a temporary
+ * directory, where the magic file gets a new mtime every second, so that
+ * the context replaces its snapshot every 5 seconds under the lookups.
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#define _XOPEN_SOURCE 700
+#include "xdgmime.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#define N_THREADS 8
+
+static const char *samples[] = {
+  "/usr/share/mime/magic",
+  "/usr/share/mime/packages/freedesktop.org.xml",
+  "/bin/sh",
+  "/etc/passwd",
+  "/usr/share/pixmaps/debian-logo.png",
+};
+#define N_SAMPLES ((int) (sizeof (samples) / sizeof (samples[0])))
+
+static const char *database_files[] = { "magic", "globs", "aliases", "subclasses" };
+#define N_DATABASE_FILES ((int) (sizeof (database_files) / sizeof (database_files[0])))
+
+static unsigned char sample_data[N_SAMPLES][4096];
+static int sample_len[N_SAMPLES];
+static char sample_type[N_SAMPLES][256];
+
+static XdgMimeContext *context;
+static int done = 0;
+
+typedef struct
+{
+  long lookups;
+  long snapshots_seen;
+  long failures;
+} ThreadResult;
+
+static void *
+sniff_thread (void *data)
+{
+  ThreadResult *result = data;
+  XdgMimeSnapshot *last = NULL;
+  int i;
+
+  while (! __atomic_load_n (&done, __ATOMIC_RELAXED))
+    {
+      XdgMimeSnapshot *snapshot = xdg_mime_context_get_snapshot (context);
+
+      if (snapshot != last)
+	result->snapshots_seen++;
+      last = snapshot;
+
+      for (i = 0; i < N_SAMPLES; i++)
+	{
+	  const char *mime_type;
+
+	  mime_type = xdg_mime_snapshot_get_mime_type_for_data (snapshot,
+								sample_data[i],
+								sample_len[i]);
+	  if (strcmp (mime_type, sample_type[i]) != 0)
+	    result->failures++;
+
+	  mime_type = xdg_mime_snapshot_get_mime_type_from_file_name (snapshot, samples[i]);
+	  if (! xdg_mime_snapshot_mime_type_subclass (snapshot, mime_type, mime_type))
+	    result->failures++;
+
+	  result->lookups++;
+	}
+
+      xdg_mime_snapshot_unref (snapshot);
+    }
+
+  return NULL;
+}
+
+static int
+copy_file (const char *from, const char *to)
+{
+  char buffer[65536];
+  ssize_t n;
+  int in, out;
+
+  in = open (from, O_RDONLY);
+  if (in == -1)
+    return -1;
+  out = open (to, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (out == -1)
+    {
+      close (in);
+      return -1;
+    }
+
+  while ((n = read (in, buffer, sizeof (buffer))) > 0)
+    write (out, buffer, n);
+
+  close (in);
+  close (out);
+
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  pthread_t threads[N_THREADS];
+  ThreadResult results[N_THREADS];
+  XdgMimeSnapshot *snapshot;
+  char dir[] = "/tmp/test-mime-context-XXXXXX";
+  char path[1024], target[1024];
+  struct utimbuf times;
+  long lookups = 0, failures = 0;
+  int seconds, i, fd;
+
+  seconds = argc > 1 ? atoi (argv[1]) : 12;
+
+  if (mkdtemp (dir) == NULL)
+    return 1;
+  snprintf (path, sizeof (path), "%s/mime", dir);
+  mkdir (path, 0700);
+  for (i = 0; i < N_DATABASE_FILES; i++)
+    {
+      snprintf (target, sizeof (target), "/usr/share/mime/%s", database_files[i]);
+      snprintf (path, sizeof (path), "%s/mime/%s", dir, database_files[i]);
+      if (copy_file (target, path) != 0)
+	{
+	  printf ("No %s to test with\n", target);
+	  return 1;
+	}
+    }
+
+  setenv ("XDG_DATA_HOME", dir, 1);
+  setenv ("XDG_DATA_DIRS", dir, 1);
+
+  context = xdg_mime_context_new ();
+
+  snapshot = xdg_mime_context_get_snapshot (context);
+  for (i = 0; i < N_SAMPLES; i++)
+    {
+      fd = open (samples[i], O_RDONLY);
+      if (fd != -1)
+	{
+	  sample_len[i] = read (fd, sample_data[i], sizeof (sample_data[i]));
+	  close (fd);
+	}
+      if (sample_len[i] < 0)
+	sample_len[i] = 0;
+
+      snprintf (sample_type[i], sizeof (sample_type[i]), "%s",
+		xdg_mime_snapshot_get_mime_type_for_data (snapshot, sample_data[i], sample_len[i]));
+      printf ("%s: %s\n", samples[i], sample_type[i]);
+    }
+  xdg_mime_snapshot_unref (snapshot);
+
+  memset (results, 0, sizeof (results));
+  for (i = 0; i < N_THREADS; i++)
+    pthread_create (&threads[i], NULL, sniff_thread, &results[i]);
+
+  snprintf (path, sizeof (path), "%s/mime/magic", dir);
+  for (i = 0; i < seconds; i++)
+    {
+      sleep (1);
+      times.actime = times.modtime = 1000000000 + i;
+      utime (path, &times);
+    }
+
+  __atomic_store_n (&done, 1, __ATOMIC_RELAXED);
+  for (i = 0; i < N_THREADS; i++)
+    {
+      pthread_join (threads[i], NULL);
+      printf ("Thread %d: %ld lookups over %ld snapshots\n",
+	      i, results[i].lookups, results[i].snapshots_seen);
+      lookups += results[i].lookups;
+      failures += results[i].failures;
+    }
+
+  xdg_mime_context_free (context);
+
+  for (i = 0; i < N_DATABASE_FILES; i++)
+    {
+      snprintf (path, sizeof (path), "%s/mime/%s", dir, database_files[i]);
+      unlink (path);
+    }
+  snprintf (path, sizeof (path), "%s/mime", dir);
+  rmdir (path);
+  rmdir (dir);
+
+  printf ("%ld lookups, %ld failures\n", lookups, failures);
+
+  return failures != 0;
+}
@@ -0,0 +1,179 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* test-mime-fd.c: Checks that looking files up by descriptor, and in
+ * batches by directory, gives the same answers as by path, and the same
+ * bytes as reading them.
+ *
+ * Build with something like
+ *   gcc -DHAVE_MMAP -pthread -o test-mime-fd test-mime-fd.c xdgmime*.c
+ * and run as
+ *   test-mime-fd [dir...]
+ * to use the files directly under the given directories (by default
+ * /usr/bin, /etc and /usr/share/pixmaps) as the corpus.
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#define _XOPEN_SOURCE 700
+#include "xdgmime.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_BATCH 512
+#define HEADER_SIZE 256
+
+static int n_checks = 0;
+static int n_failures = 0;
+
+static void
+check (int         ok,
+       const char *dir,
+       const char *name,
+       const char *what)
+{
+  n_checks++;
+  if (! ok)
+    {
+      printf ("Test Failed: %s/%s: %s\n", dir, name, what);
+      n_failures++;
+    }
+}
+
+static void
+check_dir (const char *dir)
+{
+  static char names[MAX_BATCH][256];
+  static unsigned char headers[MAX_BATCH][HEADER_SIZE];
+  XdgMimeBatchEntry entries[MAX_BATCH];
+  unsigned char expected_data[HEADER_SIZE];
+  char path[1024], expected[256];
+  struct dirent *dirent;
+  struct stat st;
+  DIR *d;
+  int dirfd, fd, n = 0, i;
+
+  d = opendir (dir);
+  if (d == NULL)
+    return;
+
+  while (n < MAX_BATCH - 1 && (dirent = readdir (d)) != NULL)
+    {
+      snprintf (path, sizeof (path), "%s/%s", dir, dirent->d_name);
+      if (stat (path, &st) != 0 || ! S_ISREG (st.st_mode))
+	continue;
+      snprintf (names[n], sizeof (names[n]), "%s", dirent->d_name);
+      n++;
+    }
+  closedir (d);
+
+  /* One missing file, to see the error come back */
+  snprintf (names[n++], sizeof (names[0]), "no-such-file.png");
+
+  for (i = 0; i < n; i++)
+    {
+      entries[i].name = names[i];
+      entries[i].header = i % 2 ? headers[i] : NULL;
+      entries[i].header_size = HEADER_SIZE;
+    }
+
+  dirfd = open (dir, O_RDONLY | O_DIRECTORY);
+  xdg_mime_get_mime_types_at (dirfd, entries, n);
+  close (dirfd);
+
+  for (i = 0; i < n; i++)
+    {
+      const char *mime_type;
+      const void *data;
+      size_t len;
+      ssize_t expected_len = -1;
+
+      snprintf (path, sizeof (path), "%s/%s", dir, names[i]);
+
+      fd = open (path, O_RDONLY);
+      if (fd == -1)
+	{
+	  check (entries[i].error == ENOENT, dir, names[i], "no error for a missing file");
+	  continue;
+	}
+      expected_len = read (fd, expected_data, HEADER_SIZE);
+
+      /* Without a mime.cache the database is reread every few seconds, which
+       * frees the strings earlier lookups returned */
+      snprintf (expected, sizeof (expected), "%s", xdg_mime_get_mime_type_for_file (path, NULL));
+
+      mime_type = xdg_mime_get_mime_type_for_fd (fd, path, &data, &len);
+      check (strcmp (mime_type, expected) == 0, dir, names[i], "a different type by descriptor");
+      check (data != NULL && len >= (size_t) expected_len &&
+	     memcmp (data, expected_data, expected_len) == 0,
+	     dir, names[i], "different data by descriptor");
+
+      /* Without a name it comes down to the contents */
+      mime_type = xdg_mime_get_mime_type_for_fd (fd, NULL, &data, &len);
+      check (strcmp (mime_type, xdg_mime_get_mime_type_for_data (data, len)) == 0,
+	     dir, names[i], "a different type by descriptor and contents");
+      close (fd);
+
+      check (entries[i].error == 0, dir, names[i], "an error in the batch");
+      check (strcmp (entries[i].mime_type, expected) == 0, dir, names[i], "a different type in the batch");
+      if (entries[i].header != NULL)
+	check (entries[i].header_len == (size_t) expected_len &&
+	       memcmp (entries[i].header, expected_data, expected_len) == 0,
+	       dir, names[i], "a different header in the batch");
+      else
+	check (entries[i].header_len == 0, dir, names[i], "a header nobody asked for");
+    }
+
+  /* A descriptor that can't be read */
+  {
+    const void *data;
+    size_t len;
+
+    check (strcmp (xdg_mime_get_mime_type_for_fd (-1, NULL, &data, &len), XDG_MIME_TYPE_UNKNOWN) == 0 &&
+	   data == NULL && len == 0 && errno == EBADF,
+	   dir, "(bad descriptor)", "not unknown");
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const char *default_dirs[] = { "/usr/bin", "/etc", "/usr/share/pixmaps", NULL };
+  int i;
+
+  if (argc > 1)
+    {
+      for (i = 1; i < argc; i++)
+	check_dir (argv[i]);
+    }
+  else
+    {
+      for (i = 0; default_dirs[i]; i++)
+	check_dir (default_dirs[i]);
+    }
+
+  printf ("%d checks, %d failures\n", n_checks, n_failures);
+
+  return n_failures != 0;
+}
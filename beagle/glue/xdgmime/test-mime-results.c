@@ -0,0 +1,261 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* test-mime-results.c: Checks that the result cache hands back what the
+ * lookups found, notices files changing, and lasts from one context to
+ * the next through its file.
+ *
+ * Build with something like
+ *   gcc -DHAVE_MMAP -pthread -o test-mime-results test-mime-results.c xdgmime*.c
+ * and run as
+ *   test-mime-results
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#define _XOPEN_SOURCE 700
+#include "xdgmime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+/* Contents the magic rules know, under names the globs don't */
+static const struct
+{
+  const char *name;
+  const char *contents;
+  int len;
+} files[] = {
+  { "picture", "\x89PNG\r\n\x1a\n\0\0\0\rIHDR", 16 },
+  { "document", "%PDF-1.4\n%\xe2\xe3\xcf\xd3\n", 15 },
+  { "archive", "PK\x03\x04\x14\0\0\0\x08\0", 10 },
+  { "script", "#!/bin/sh\necho hello\n", 21 },
+  { "nothing", "\x01\x02\x03\x04", 4 },
+};
+#define N_FILES ((int) (sizeof (files) / sizeof (files[0])))
+
+static char dir[] = "/tmp/test-mime-results-XXXXXX";
+static char results_file[1024];
+static char expected[N_FILES][256];
+
+static int n_checks = 0;
+static int n_failures = 0;
+
+static void
+check (int         ok,
+       const char *what)
+{
+  n_checks++;
+  if (! ok)
+    {
+      printf ("Test Failed: %s\n", what);
+      n_failures++;
+    }
+}
+
+static void
+write_file (int         i,
+	    const char *contents,
+	    int         len,
+	    time_t      mtime)
+{
+  struct utimbuf times;
+  char path[1024];
+  int fd;
+
+  snprintf (path, sizeof (path), "%s/%s", dir, files[i].name);
+  fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  write (fd, contents, len);
+  close (fd);
+
+  times.actime = times.modtime = mtime;
+  utime (path, &times);
+}
+
+/* Looks every file up, by name and by descriptor, and checks the answers */
+static void
+check_files (XdgMimeContext *context,
+	     const char     *what)
+{
+  XdgMimeSnapshot *snapshot;
+  char path[1024], message[2048];
+  int i, fd;
+
+  snapshot = xdg_mime_context_get_snapshot (context);
+
+  for (i = 0; i < N_FILES; i++)
+    {
+      const char *mime_type;
+
+      snprintf (path, sizeof (path), "%s/%s", dir, files[i].name);
+
+      mime_type = xdg_mime_snapshot_get_mime_type_for_file (snapshot, path, NULL);
+      snprintf (message, sizeof (message), "%s: %s is %s by path, not %s",
+		what, files[i].name, mime_type, expected[i]);
+      check (strcmp (mime_type, expected[i]) == 0, message);
+
+      fd = open (path, O_RDONLY);
+      mime_type = xdg_mime_snapshot_get_mime_type_for_fd (snapshot, fd, path, NULL, NULL);
+      close (fd);
+      snprintf (message, sizeof (message), "%s: %s is %s by descriptor, not %s",
+		what, files[i].name, mime_type, expected[i]);
+      check (strcmp (mime_type, expected[i]) == 0, message);
+    }
+
+  xdg_mime_snapshot_unref (snapshot);
+}
+
+static void
+check_stats (XdgMimeContext *context,
+	     const char     *what,
+	     uint64_t        hits,
+	     uint64_t        misses,
+	     int             persistent)
+{
+  XdgMimeResultCacheStats stats;
+  char message[1024];
+
+  xdg_mime_context_get_result_cache_stats (context, &stats);
+  snprintf (message, sizeof (message),
+	    "%s: %d hits and %d misses (%s), not %d and %d (%s)",
+	    what, (int) stats.hits, (int) stats.misses,
+	    stats.persistent ? "persistent" : "in memory",
+	    (int) hits, (int) misses, persistent ? "persistent" : "in memory");
+  check (stats.hits == hits && stats.misses == misses &&
+	 (stats.persistent != 0) == persistent, message);
+}
+
+int
+main (int argc, char *argv[])
+{
+  XdgMimeContext *context, *other;
+  XdgMimeSnapshot *snapshot;
+  XdgMimeFileStamp stamp;
+  const char *mime_type;
+  char path[1024];
+  int i, fd;
+
+  if (mkdtemp (dir) == NULL)
+    return 1;
+  snprintf (results_file, sizeof (results_file), "%s/results", dir);
+
+  for (i = 0; i < N_FILES; i++)
+    write_file (i, files[i].contents, files[i].len, 1000000000);
+
+  /* What the lookups say without a cache */
+  context = xdg_mime_context_new ();
+  snapshot = xdg_mime_context_get_snapshot (context);
+  for (i = 0; i < N_FILES; i++)
+    {
+      snprintf (path, sizeof (path), "%s/%s", dir, files[i].name);
+      snprintf (expected[i], sizeof (expected[i]), "%s",
+		xdg_mime_snapshot_get_mime_type_for_file (snapshot, path, NULL));
+      printf ("%s: %s\n", files[i].name, expected[i]);
+    }
+  xdg_mime_snapshot_unref (snapshot);
+
+  check (xdg_mime_context_set_result_cache (context, results_file, 1000) == 0,
+	 "couldn't set a result cache");
+  check (xdg_mime_context_set_result_cache (context, NULL, 1000) != 0,
+	 "could set a second result cache");
+
+  /* The first round misses by path, and then hits by descriptor; the
+   * second hits both ways */
+  check_files (context, "first round");
+  check_stats (context, "first round", N_FILES, N_FILES, 1);
+  check_files (context, "second round");
+  check_stats (context, "second round", 3 * N_FILES, N_FILES, 1);
+
+  /* Another process, or context, can't have the same file */
+  other = xdg_mime_context_new ();
+  xdg_mime_context_set_result_cache (other, results_file, 1000);
+  check_stats (other, "second context", 0, 0, 0);
+  xdg_mime_context_free (other);
+
+  /* Changing a file, but not its size, is noticed by its mtime */
+  memcpy (expected[0], expected[4], sizeof (expected[0]));
+  write_file (0, "\x01\x02\x03\x04\x01\x02\x03\x04\x01\x02\x03\x04\x01\x02\x03\x04", 16, 1000000001);
+  check_files (context, "changed file");
+  check_stats (context, "changed file", 5 * N_FILES - 1, N_FILES + 1, 1);
+
+  xdg_mime_context_free (context);
+
+  /* And the next context reads the results back */
+  context = xdg_mime_context_new ();
+  xdg_mime_context_set_result_cache (context, results_file, 1000);
+  check_files (context, "next context");
+  check_stats (context, "next context", 2 * N_FILES, 0, 1);
+  xdg_mime_context_free (context);
+
+  /* Unless it wants a different size, or the file is damaged */
+  context = xdg_mime_context_new ();
+  xdg_mime_context_set_result_cache (context, results_file, 5000);
+  check_files (context, "different size");
+  check_stats (context, "different size", N_FILES, N_FILES, 1);
+  xdg_mime_context_free (context);
+
+  fd = open (results_file, O_WRONLY);
+  pwrite (fd, "garbage", 7, 0);
+  close (fd);
+  context = xdg_mime_context_new ();
+  xdg_mime_context_set_result_cache (context, results_file, 5000);
+  check_files (context, "damaged file");
+  check_stats (context, "damaged file", N_FILES, N_FILES, 1);
+  xdg_mime_context_free (context);
+
+  /* Types callers settle on themselves are kept by name, apart from ours */
+  context = xdg_mime_context_new ();
+  snapshot = xdg_mime_context_get_snapshot (context);
+  snprintf (path, sizeof (path), "%s/%s", dir, files[4].name);
+  check (xdg_mime_snapshot_get_file_result (snapshot, path, &stamp) == NULL && ! stamp.valid,
+	 "file result without a result cache");
+  xdg_mime_snapshot_unref (snapshot);
+
+  xdg_mime_context_set_result_cache (context, NULL, 1000);
+  check_files (context, "file results");
+  snapshot = xdg_mime_context_get_snapshot (context);
+  check (xdg_mime_snapshot_get_file_result (snapshot, path, &stamp) == NULL && stamp.valid,
+	 "file result found before it was kept");
+  xdg_mime_snapshot_set_file_result (snapshot, &stamp, "text/plain");
+  mime_type = xdg_mime_snapshot_get_file_result (snapshot, path, &stamp);
+  check (mime_type != NULL && strcmp (mime_type, "text/plain") == 0,
+	 "file result not found after it was kept");
+  check_files (context, "file results kept");
+
+  write_file (4, files[4].contents, files[4].len, 1000000002);
+  check (xdg_mime_snapshot_get_file_result (snapshot, path, &stamp) == NULL,
+	 "file result found after the file changed");
+  xdg_mime_snapshot_unref (snapshot);
+  xdg_mime_context_free (context);
+
+  for (i = 0; i < N_FILES; i++)
+    {
+      snprintf (path, sizeof (path), "%s/%s", dir, files[i].name);
+      unlink (path);
+    }
+  unlink (results_file);
+  rmdir (dir);
+
+  printf ("%d checks, %d failures\n", n_checks, n_failures);
+
+  return n_failures != 0;
+}
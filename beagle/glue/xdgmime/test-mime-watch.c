@@ -0,0 +1,269 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* test-mime-watch.c: Checks that a context watching the MIME directories
+ * picks up changes to them in the background, while threads sniff through
+ * it.
+ *
+ * Build with something like
+ *   gcc -DHAVE_MMAP -DHAVE_SYS_INOTIFY_H -pthread -o test-mime-watch test-mime-watch.c xdgmime*.c
+ * The MIME database files in /usr/share/mime are copied to a temporary
+ * directory, whose globs file then gets new globs added, and a second
+ * directory gets a mime directory of its own after the context started
+ * watching.
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+#define _XOPEN_SOURCE 700
+#include "xdgmime.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define N_THREADS 4
+
+static const char *database_files[] = { "magic", "globs", "aliases", "subclasses" };
+#define N_DATABASE_FILES ((int) (sizeof (database_files) / sizeof (database_files[0])))
+
+static XdgMimeContext *context;
+static int done = 0;
+
+static int n_checks = 0;
+static int n_failures = 0;
+
+static void
+check (int         condition,
+       const char *what)
+{
+  n_checks++;
+  if (! condition)
+    {
+      printf ("Test Failed: %s\n", what);
+      n_failures++;
+    }
+}
+
+static void *
+sniff_thread (void *data)
+{
+  long *lookups = data;
+
+  while (! __atomic_load_n (&done, __ATOMIC_RELAXED))
+    {
+      XdgMimeSnapshot *snapshot = xdg_mime_context_get_snapshot (context);
+
+      xdg_mime_snapshot_get_mime_type_from_file_name (snapshot, "foo.txt");
+      xdg_mime_snapshot_get_mime_type_from_file_name (snapshot, "foo.watchtest");
+      xdg_mime_snapshot_unref (snapshot);
+      (*lookups)++;
+    }
+
+  return NULL;
+}
+
+static const char *
+lookup (const char *file_name,
+	char       *buffer,
+	size_t      size)
+{
+  XdgMimeSnapshot *snapshot = xdg_mime_context_get_snapshot (context);
+
+  snprintf (buffer, size, "%s", xdg_mime_snapshot_get_mime_type_from_file_name (snapshot, file_name));
+  xdg_mime_snapshot_unref (snapshot);
+
+  return buffer;
+}
+
+/* Waits up to 5 seconds for file_name to be seen as mime_type */
+static int
+wait_for (const char *file_name,
+	  const char *mime_type)
+{
+  struct timespec delay = { 0, 100000000 };
+  char buffer[256];
+  int i;
+
+  for (i = 0; i < 50; i++)
+    {
+      if (strcmp (lookup (file_name, buffer, sizeof (buffer)), mime_type) == 0)
+	return 1;
+      nanosleep (&delay, NULL);
+    }
+
+  return 0;
+}
+
+static int
+copy_file (const char *from, const char *to)
+{
+  char buffer[65536];
+  ssize_t n;
+  int in, out;
+
+  in = open (from, O_RDONLY);
+  if (in == -1)
+    return -1;
+  out = open (to, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (out == -1)
+    {
+      close (in);
+      return -1;
+    }
+
+  while ((n = read (in, buffer, sizeof (buffer))) > 0)
+    write (out, buffer, n);
+
+  close (in);
+  close (out);
+
+  return 0;
+}
+
+/* Replaces the globs file in dir the way update-mime-database does, by
+ * renaming a new one over it */
+static void
+write_globs (const char *dir,
+	     const char *extra)
+{
+  char path[1024], temp[1024];
+  FILE *file;
+
+  snprintf (temp, sizeof (temp), "%s/mime/globs.new", dir);
+  snprintf (path, sizeof (path), "%s/mime/globs", dir);
+  copy_file ("/usr/share/mime/globs", temp);
+  file = fopen (temp, "a");
+  fputs (extra, file);
+  fclose (file);
+  rename (temp, path);
+}
+
+int
+main (int argc, char *argv[])
+{
+  pthread_t threads[N_THREADS];
+  long lookups[N_THREADS];
+  XdgMimeReloadStats stats;
+  char dir[] = "/tmp/test-mime-watch-XXXXXX";
+  char other[] = "/tmp/test-mime-watch-XXXXXX";
+  char path[1024], target[1024], buffer[256];
+  uint64_t reloads;
+  int i;
+
+  if (mkdtemp (dir) == NULL || mkdtemp (other) == NULL)
+    return 1;
+  snprintf (path, sizeof (path), "%s/mime", dir);
+  mkdir (path, 0700);
+  for (i = 0; i < N_DATABASE_FILES; i++)
+    {
+      snprintf (target, sizeof (target), "/usr/share/mime/%s", database_files[i]);
+      snprintf (path, sizeof (path), "%s/mime/%s", dir, database_files[i]);
+      if (copy_file (target, path) != 0)
+	{
+	  printf ("No %s to test with\n", target);
+	  return 1;
+	}
+    }
+
+  setenv ("XDG_DATA_HOME", other, 1);
+  setenv ("XDG_DATA_DIRS", dir, 1);
+
+  context = xdg_mime_context_new ();
+  check (xdg_mime_context_watch (context) == 0, "the context can watch the directories");
+  check (xdg_mime_context_watch (context) == 0, "watching twice is fine");
+
+  xdg_mime_context_get_reload_stats (context, &stats);
+  check (stats.watching, "the context says it is watching");
+  check (stats.reloads == 0, "nothing is reread before anything changes");
+  check (strcmp (lookup ("foo.watchtest", buffer, sizeof (buffer)), XDG_MIME_TYPE_UNKNOWN) == 0,
+	 "the new glob isn't there yet");
+
+  for (i = 0; i < N_THREADS; i++)
+    {
+      lookups[i] = 0;
+      pthread_create (&threads[i], NULL, sniff_thread, &lookups[i]);
+    }
+
+  /* A change to the globs */
+  write_globs (dir, "text/x-watchtest:*.watchtest\n");
+  check (wait_for ("foo.watchtest", "text/x-watchtest"), "a new glob is seen");
+
+  xdg_mime_context_get_reload_stats (context, &stats);
+  check (stats.reloads == 1, "one change is one reload");
+  check (stats.last_reload > 0, "the time of the reload is kept");
+  check (stats.events > 0, "the events are counted");
+  reloads = stats.reloads;
+
+  /* Files the database isn't read from don't count */
+  snprintf (path, sizeof (path), "%s/mime/packages", dir);
+  mkdir (path, 0700);
+  snprintf (path, sizeof (path), "%s/mime/packages/watchtest.xml", dir);
+  copy_file ("/etc/passwd", path);
+  sleep (1);
+  xdg_mime_context_get_reload_stats (context, &stats);
+  check (stats.reloads == reloads, "other files in the directory don't cause a reload");
+  unlink (path);
+  snprintf (path, sizeof (path), "%s/mime/packages", dir);
+  rmdir (path);
+
+  /* A directory that didn't have a mime directory at first, and comes
+   * first in the search path */
+  snprintf (path, sizeof (path), "%s/mime", other);
+  mkdir (path, 0700);
+  write_globs (other, "text/x-watchtest-other:*.watchtest\n");
+  check (wait_for ("foo.watchtest", "text/x-watchtest-other"), "a new mime directory is seen");
+
+  /* And going away again */
+  snprintf (path, sizeof (path), "%s/mime/globs", other);
+  unlink (path);
+  snprintf (path, sizeof (path), "%s/mime", other);
+  rmdir (path);
+  check (wait_for ("foo.watchtest", "text/x-watchtest"), "a mime directory going away is seen");
+
+  __atomic_store_n (&done, 1, __ATOMIC_RELAXED);
+  for (i = 0; i < N_THREADS; i++)
+    {
+      pthread_join (threads[i], NULL);
+      check (lookups[i] > 0, "the threads carry on looking things up");
+    }
+
+  xdg_mime_context_get_reload_stats (context, &stats);
+  printf ("%llu reloads, %llu events\n",
+	  (unsigned long long) stats.reloads, (unsigned long long) stats.events);
+
+  xdg_mime_context_free (context);
+
+  for (i = 0; i < N_DATABASE_FILES; i++)
+    {
+      snprintf (path, sizeof (path), "%s/mime/%s", dir, database_files[i]);
+      unlink (path);
+    }
+  snprintf (path, sizeof (path), "%s/mime", dir);
+  rmdir (path);
+  rmdir (dir);
+  rmdir (other);
+
+  printf ("%d checks, %d failures\n", n_checks, n_failures);
+
+  return n_failures != 0;
+}
@@ -36,32 +36,63 @@
 #include "xdgmimealias.h"
 #include "xdgmimeparent.h"
 #include "xdgmimecache.h"
+#include "xdgmimeresults.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
 
 typedef struct XdgDirTimeList XdgDirTimeList;
 typedef struct XdgCallbackList XdgCallbackList;
 
-static int need_reread = TRUE;
-static time_t last_stat_time = 0;
-
-static XdgGlobHash *global_hash = NULL;
-static XdgMimeMagic *global_magic = NULL;
-static XdgAliasList *alias_list = NULL;
-static XdgParentList *parent_list = NULL;
-static XdgDirTimeList *dir_time_list = NULL;
+/* The context behind the functions that don't take one */
+static XdgMimeContext *default_context = NULL;
 static XdgCallbackList *callback_list = NULL;
 
-XdgMimeCache **_caches = NULL;
-static int n_caches = 0;
+/* The database as seen by the calling thread, set from the snapshot it is
+ * looking things up in for as long as it does.  The rest of the code reads
+ * these rather than being passed the snapshot around.
+ */
+static __thread XdgMimeSnapshot *current_snapshot = NULL;
+static __thread XdgGlobHash *global_hash = NULL;
+static __thread XdgMimeMagic *global_magic = NULL;
+static __thread XdgAliasList *alias_list = NULL;
+static __thread XdgParentList *parent_list = NULL;
+static __thread XdgDirTimeList *dir_time_list = NULL;
+static __thread XdgMimeResultCache *result_cache = NULL;
+
+__thread XdgMimeCache **_caches = NULL;
+__thread XdgGlobIndex *_caches_glob_index = NULL;
 
 const char xdg_mime_type_unknown[] = "application/octet-stream";
 
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+/* Where each thread reads the start of the files it looks at, kept from
+ * one file to the next and freed when the thread exits */
+typedef struct
+{
+  size_t size;
+  unsigned char data[1];
+} XdgReadBuffer;
+
+static pthread_key_t read_buffer_key;
+static pthread_once_t read_buffer_once = PTHREAD_ONCE_INIT;
+
 
 enum
 {
@@ -78,6 +109,64 @@ struct XdgDirTimeList
   XdgDirTimeList *next;
 };
 
+/* Everything read from the MIME directories at one time.  Once built it is
+ * only read from, apart from the dir_time_list bookkeeping done by whoever
+ * holds the context's reload lock, and it is freed when the last reference
+ * to it goes away.
+ */
+struct XdgMimeSnapshot
+{
+  int ref_count;
+
+  XdgGlobHash *hash;
+  XdgMimeMagic *magic;
+  XdgAliasList *alias_list;
+  XdgParentList *parent_list;
+  XdgMimeCache **caches;
+  int n_caches;
+  XdgGlobIndex *caches_glob_index;
+  XdgDirTimeList *dir_time_list;
+
+  /* The context's, if it keeps one; set once, possibly after the rest */
+  XdgMimeResultCache *results;
+  /* Stands for the files the snapshot was read from in the results */
+  xdg_uint32_t results_key;
+};
+
+struct XdgMimeContext
+{
+  /* Replaced as a whole when the files change */
+  XdgMimeSnapshot *snapshot;
+
+  /* Threads between reading 'snapshot' and taking their reference to it,
+   * counted under the epoch they started in */
+  int epoch;
+  int n_acquiring[2];
+
+  time_t last_stat_time;
+  pthread_mutex_t reload_lock;
+
+  /* The one before 'snapshot', kept for the strings the functions that
+   * don't take a snapshot have handed out of it */
+  XdgMimeSnapshot *retired;
+
+  /* Counted under the reload lock; n_reloads_seen is as far as
+   * xdg_mime_context_check () has told its callers about */
+  uint64_t n_reloads;
+  uint64_t last_reload;
+  uint64_t n_reloads_seen;
+
+  /* Set once a thread watches the directories, which then does the
+   * reloading instead of the lookups */
+  int watching;
+  int watch_fd;
+  int stop_fds[2];
+  pthread_t watch_thread;
+  uint64_t n_events;
+
+  XdgMimeResultCache *results;
+};
+
 struct XdgCallbackList
 {
   XdgCallbackList *next;
@@ -119,7 +208,8 @@ xdg_dir_time_list_free (XdgDirTimeList *list)
 }
 
 static int
-xdg_mime_init_from_directory (const char *directory)
+xdg_mime_init_from_directory (const char      *directory,
+			      XdgMimeSnapshot *snapshot)
 {
   char *file_name;
   struct stat st;
@@ -138,13 +228,13 @@ xdg_mime_init_from_directory (const char *directory)
 	  list = xdg_dir_time_list_new ();
 	  list->directory_name = file_name;
 	  list->mtime = st.st_mtime;
-	  list->next = dir_time_list;
-	  dir_time_list = list;
+	  list->next = snapshot->dir_time_list;
+	  snapshot->dir_time_list = list;
 
-	  _caches = realloc (_caches, sizeof (XdgMimeCache *) * (n_caches + 2));
-	  _caches[n_caches] = cache;
-          _caches[n_caches + 1] = NULL;
-	  n_caches++;
+	  snapshot->caches = realloc (snapshot->caches, sizeof (XdgMimeCache *) * (snapshot->n_caches + 2));
+	  snapshot->caches[snapshot->n_caches] = cache;
+          snapshot->caches[snapshot->n_caches + 1] = NULL;
+	  snapshot->n_caches++;
 
 	  return FALSE;
 	}
@@ -155,13 +245,13 @@ xdg_mime_init_from_directory (const char *directory)
   strcpy (file_name, directory); strcat (file_name, "/mime/globs");
   if (stat (file_name, &st) == 0)
     {
-      _xdg_mime_glob_read_from_file (global_hash, file_name);
+      _xdg_mime_glob_read_from_file (snapshot->hash, file_name);
 
       list = xdg_dir_time_list_new ();
       list->directory_name = file_name;
       list->mtime = st.st_mtime;
-      list->next = dir_time_list;
-      dir_time_list = list;
+      list->next = snapshot->dir_time_list;
+      snapshot->dir_time_list = list;
     }
   else
     {
@@ -172,13 +262,13 @@ xdg_mime_init_from_directory (const char *directory)
   strcpy (file_name, directory); strcat (file_name, "/mime/magic");
   if (stat (file_name, &st) == 0)
     {
-      _xdg_mime_magic_read_from_file (global_magic, file_name);
+      _xdg_mime_magic_read_from_file (snapshot->magic, file_name);
 
       list = xdg_dir_time_list_new ();
       list->directory_name = file_name;
       list->mtime = st.st_mtime;
-      list->next = dir_time_list;
-      dir_time_list = list;
+      list->next = snapshot->dir_time_list;
+      snapshot->dir_time_list = list;
     }
   else
     {
@@ -187,12 +277,12 @@ xdg_mime_init_from_directory (const char *directory)
 
   file_name = malloc (strlen (directory) + strlen ("/mime/aliases") + 1);
   strcpy (file_name, directory); strcat (file_name, "/mime/aliases");
-  _xdg_mime_alias_read_from_file (alias_list, file_name);
+  _xdg_mime_alias_read_from_file (snapshot->alias_list, file_name);
   free (file_name);
 
   file_name = malloc (strlen (directory) + strlen ("/mime/subclasses") + 1);
   strcpy (file_name, directory); strcat (file_name, "/mime/subclasses");
-  _xdg_mime_parent_read_from_file (parent_list, file_name);
+  _xdg_mime_parent_read_from_file (snapshot->parent_list, file_name);
   free (file_name);
 
   return FALSE; /* Keep processing */
@@ -391,348 +481,982 @@ xdg_check_dirs (void)
   return FALSE;
 }
 
-/* We want to avoid stat()ing on every single mime call, so we only look for
- * newer files every 5 seconds.  This will return TRUE if we need to reread the
- * mime data from disk.
+/* Points the calling thread's view of the database at 'snapshot', and
+ * returns the snapshot it was looking at before so that it can be put back.
  */
-static int
-xdg_check_time_and_dirs (void)
+static XdgMimeSnapshot *
+xdg_mime_use_snapshot (XdgMimeSnapshot *snapshot)
 {
-  struct timeval tv;
-  time_t current_time;
-  int retval = FALSE;
-
-  gettimeofday (&tv, NULL);
-  current_time = tv.tv_sec;
-
-  if (current_time >= last_stat_time + 5)
-    {
-      retval = xdg_check_dirs ();
-      last_stat_time = current_time;
-    }
-
-  return retval;
+  XdgMimeSnapshot *previous = current_snapshot;
+
+  current_snapshot = snapshot;
+  global_hash = snapshot ? snapshot->hash : NULL;
+  global_magic = snapshot ? snapshot->magic : NULL;
+  alias_list = snapshot ? snapshot->alias_list : NULL;
+  parent_list = snapshot ? snapshot->parent_list : NULL;
+  dir_time_list = snapshot ? snapshot->dir_time_list : NULL;
+  _caches = snapshot ? snapshot->caches : NULL;
+  _caches_glob_index = snapshot ? snapshot->caches_glob_index : NULL;
+  result_cache = snapshot ? __atomic_load_n (&snapshot->results, __ATOMIC_ACQUIRE) : NULL;
+
+  return previous;
 }
 
-/* Called in every public function.  It reloads the hash function if need be.
- */
-static void
-xdg_mime_init (void)
+static XdgMimeSnapshot *
+xdg_mime_snapshot_new (XdgMimeResultCache *results)
 {
-  if (xdg_check_time_and_dirs ())
+  XdgMimeSnapshot *snapshot, *previous;
+  XdgDirTimeList *list;
+  int i;
+
+  snapshot = calloc (1, sizeof (XdgMimeSnapshot));
+  snapshot->ref_count = 1;
+  snapshot->hash = _xdg_glob_hash_new ();
+  snapshot->magic = _xdg_mime_magic_new ();
+  snapshot->alias_list = _xdg_mime_alias_list_new ();
+  snapshot->parent_list = _xdg_mime_parent_list_new ();
+
+  xdg_run_command_on_dirs ((XdgDirectoryFunc) xdg_mime_init_from_directory,
+			   snapshot);
+
+  /* The magic indexes go by unaliased type, so they wait for the rest */
+  previous = xdg_mime_use_snapshot (snapshot);
+  for (i = 0; i < snapshot->n_caches; i++)
+    _xdg_mime_cache_build_index (snapshot->caches[i]);
+  _xdg_mime_magic_build_index (snapshot->magic);
+  xdg_mime_use_snapshot (previous);
+
+  if (snapshot->caches)
+    snapshot->caches_glob_index = _xdg_mime_cache_build_glob_index (snapshot->caches);
+  _xdg_glob_hash_build_index (snapshot->hash);
+
+  /* Results from other files, or other versions of them, don't count */
+  for (list = snapshot->dir_time_list; list; list = list->next)
     {
-      xdg_mime_shutdown ();
+      char mtime[32];
+
+      snprintf (mtime, sizeof (mtime), "%ld", (long) list->mtime);
+      snapshot->results_key = _xdg_mime_result_key (snapshot->results_key, list->directory_name);
+      snapshot->results_key = _xdg_mime_result_key (snapshot->results_key, mtime);
     }
 
-  if (need_reread)
-    {
-      global_hash = _xdg_glob_hash_new ();
-      global_magic = _xdg_mime_magic_new ();
-      alias_list = _xdg_mime_alias_list_new ();
-      parent_list = _xdg_mime_parent_list_new ();
+  if (results)
+    snapshot->results = _xdg_mime_result_cache_ref (results);
 
-      xdg_run_command_on_dirs ((XdgDirectoryFunc) xdg_mime_init_from_directory,
-			       NULL);
+  return snapshot;
+}
 
-      need_reread = FALSE;
-    }
+XdgMimeSnapshot *
+xdg_mime_snapshot_ref (XdgMimeSnapshot *snapshot)
+{
+  __atomic_add_fetch (&snapshot->ref_count, 1, __ATOMIC_RELAXED);
+
+  return snapshot;
 }
 
-const char *
-xdg_mime_get_mime_type_for_data (const void *data,
-				 size_t      len)
+void
+xdg_mime_snapshot_unref (XdgMimeSnapshot *snapshot)
 {
-  const char *mime_type;
+  int i;
 
-  xdg_mime_init ();
+  if (__atomic_sub_fetch (&snapshot->ref_count, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
 
-  if (_caches)
-    return _xdg_mime_cache_get_mime_type_for_data (data, len);
+  xdg_dir_time_list_free (snapshot->dir_time_list);
+  _xdg_glob_hash_free (snapshot->hash);
+  _xdg_mime_magic_free (snapshot->magic);
+  _xdg_mime_alias_list_free (snapshot->alias_list);
+  _xdg_mime_parent_list_free (snapshot->parent_list);
 
-  mime_type = _xdg_mime_magic_lookup_data (global_magic, data, len, NULL, 0);
+  for (i = 0; i < snapshot->n_caches; i++)
+    _xdg_mime_cache_unref (snapshot->caches[i]);
+  free (snapshot->caches);
+  _xdg_glob_index_free (snapshot->caches_glob_index);
 
-  if (mime_type)
-    return mime_type;
+  if (snapshot->results)
+    _xdg_mime_result_cache_unref (snapshot->results);
 
-  return XDG_MIME_TYPE_UNKNOWN;
+  free (snapshot);
 }
 
-const char *
-xdg_mime_get_mime_type_for_file (const char  *file_name,
-                                 struct stat *statbuf)
+XdgMimeContext *
+xdg_mime_context_new (void)
 {
-  const char *mime_type;
-  /* currently, only a few globs occur twice, and none
-   * more often, so 5 seems plenty.
-   */
-  const char *mime_types[5];
-  FILE *file;
-  unsigned char *data;
-  int max_extent;
-  int bytes_read;
-  struct stat buf;
-  const char *base_name;
-  int n;
-
-  if (file_name == NULL)
-    return NULL;
-  if (! _xdg_utf8_validate (file_name))
-    return NULL;
+  XdgMimeContext *context;
+  struct timeval tv;
 
-  xdg_mime_init ();
+  context = calloc (1, sizeof (XdgMimeContext));
+  pthread_mutex_init (&context->reload_lock, NULL);
+  context->watch_fd = -1;
+  context->snapshot = xdg_mime_snapshot_new (NULL);
 
-  if (_caches)
-    return _xdg_mime_cache_get_mime_type_for_file (file_name, statbuf);
+  gettimeofday (&tv, NULL);
+  context->last_stat_time = tv.tv_sec;
 
-  base_name = _xdg_get_base_name (file_name);
-  n = _xdg_glob_hash_lookup_file_name (global_hash, base_name, mime_types, 5);
+  return context;
+}
 
-  if (n == 1)
-    return mime_types[0];
+void
+xdg_mime_context_free (XdgMimeContext *context)
+{
+  if (context == NULL)
+    return;
 
-  if (!statbuf)
+#ifdef HAVE_SYS_INOTIFY_H
+  if (context->watching)
     {
-      if (stat (file_name, &buf) != 0)
-	return XDG_MIME_TYPE_UNKNOWN;
-
-      statbuf = &buf;
+      write (context->stop_fds[1], "", 1);
+      pthread_join (context->watch_thread, NULL);
+      close (context->stop_fds[0]);
+      close (context->stop_fds[1]);
+      close (context->watch_fd);
     }
+#endif
 
-  if (!S_ISREG (statbuf->st_mode))
-    return XDG_MIME_TYPE_UNKNOWN;
+  xdg_mime_snapshot_unref (context->snapshot);
+  if (context->retired)
+    xdg_mime_snapshot_unref (context->retired);
+  if (context->results)
+    _xdg_mime_result_cache_unref (context->results);
+  pthread_mutex_destroy (&context->reload_lock);
+  free (context);
+}
 
-  /* FIXME: Need to make sure that max_extent isn't totally broken.  This could
-   * be large and need getting from a stream instead of just reading it all
-   * in. */
-  max_extent = _xdg_mime_magic_get_buffer_extents (global_magic);
-  data = malloc (max_extent);
-  if (data == NULL)
-    return XDG_MIME_TYPE_UNKNOWN;
-        
-  file = fopen (file_name, "r");
-  if (file == NULL)
-    {
-      free (data);
-      return XDG_MIME_TYPE_UNKNOWN;
-    }
+int
+xdg_mime_context_set_result_cache (XdgMimeContext *context,
+				   const char     *file_name,
+				   int             n_entries)
+{
+  XdgMimeResultCache *results = NULL;
 
-  bytes_read = fread (data, 1, max_extent, file);
-  if (ferror (file))
-    {
-      free (data);
-      fclose (file);
-      return XDG_MIME_TYPE_UNKNOWN;
-    }
+  pthread_mutex_lock (&context->reload_lock);
 
-  mime_type = _xdg_mime_magic_lookup_data (global_magic, data, bytes_read,
-					   mime_types, n);
+  if (context->results == NULL)
+    results = _xdg_mime_result_cache_new (file_name, n_entries);
 
-  free (data);
-  fclose (file);
+  if (results)
+    {
+      __atomic_store_n (&context->results, results, __ATOMIC_RELEASE);
 
-  if (mime_type)
-    return mime_type;
+      /* New snapshots get it from the context, but the current one was
+       * made before it */
+      __atomic_store_n (&context->snapshot->results,
+			_xdg_mime_result_cache_ref (results), __ATOMIC_RELEASE);
+    }
 
-  return XDG_MIME_TYPE_UNKNOWN;
+  pthread_mutex_unlock (&context->reload_lock);
+
+  return results ? 0 : -1;
 }
 
-const char *
-xdg_mime_get_mime_type_from_file_name (const char *file_name)
+int
+xdg_mime_context_get_result_cache_stats (XdgMimeContext          *context,
+					 XdgMimeResultCacheStats *stats)
 {
-  const char *mime_type;
+  XdgMimeResultCache *results;
 
-  xdg_mime_init ();
+  memset (stats, 0, sizeof (XdgMimeResultCacheStats));
 
-  if (_caches)
-    return _xdg_mime_cache_get_mime_type_from_file_name (file_name);
+  results = __atomic_load_n (&context->results, __ATOMIC_ACQUIRE);
+  if (results == NULL)
+    return -1;
 
-  if (_xdg_glob_hash_lookup_file_name (global_hash, file_name, &mime_type, 1))
-    return mime_type;
-  else
-    return XDG_MIME_TYPE_UNKNOWN;
+  _xdg_mime_result_cache_get_stats (results, stats);
+
+  return 0;
 }
 
-int
-xdg_mime_is_valid_mime_type (const char *mime_type)
+void
+xdg_mime_context_get_reload_stats (XdgMimeContext     *context,
+				   XdgMimeReloadStats *stats)
 {
-  /* FIXME: We should make this a better test
-   */
-  return _xdg_utf8_validate (mime_type);
+  stats->reloads = __atomic_load_n (&context->n_reloads, __ATOMIC_RELAXED);
+  stats->last_reload = __atomic_load_n (&context->last_reload, __ATOMIC_RELAXED);
+  stats->events = __atomic_load_n (&context->n_events, __ATOMIC_RELAXED);
+  stats->watching = __atomic_load_n (&context->watching, __ATOMIC_RELAXED);
 }
 
-void
-xdg_mime_shutdown (void)
+/* Puts 'snapshot' in place of the context's one.  Called with the reload
+ * lock held.
+ */
+static void
+xdg_mime_context_replace_snapshot (XdgMimeContext  *context,
+				   XdgMimeSnapshot *snapshot)
 {
-  XdgCallbackList *list;
+  XdgMimeSnapshot *old;
+  struct timeval tv;
+  int epoch;
 
-  /* FIXME: Need to make this (and the whole library) thread safe */
-  if (dir_time_list)
-    {
-      xdg_dir_time_list_free (dir_time_list);
-      dir_time_list = NULL;
-    }
-	
-  if (global_hash)
-    {
-      _xdg_glob_hash_free (global_hash);
-      global_hash = NULL;
-    }
-  if (global_magic)
-    {
-      _xdg_mime_magic_free (global_magic);
-      global_magic = NULL;
-    }
+  /* Counted first, so that whoever sees the new snapshot sees it counted */
+  gettimeofday (&tv, NULL);
+  __atomic_store_n (&context->last_reload, (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec, __ATOMIC_RELAXED);
+  __atomic_add_fetch (&context->n_reloads, 1, __ATOMIC_RELAXED);
 
-  if (alias_list)
-    {
-      _xdg_mime_alias_list_free (alias_list);
-      alias_list = NULL;
-    }
+  old = __atomic_exchange_n (&context->snapshot, snapshot, __ATOMIC_SEQ_CST);
+
+  /* Whoever can still be about to take a reference to the old snapshot is
+   * counted under the epoch that is ending here.  Those starting from now
+   * on count under the next one, and can only see the new snapshot. */
+  epoch = __atomic_fetch_add (&context->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+  while (__atomic_load_n (&context->n_acquiring[epoch], __ATOMIC_SEQ_CST) != 0)
+    sched_yield ();
+
+  if (context->retired)
+    xdg_mime_snapshot_unref (context->retired);
+  context->retired = old;
+}
+
+/* We want to avoid stat()ing on every single mime call, so we only look for
+ * newer files every 5 seconds, and only in one thread at a time; the others
+ * carry on with the snapshot they have.  This rereads the mime data from
+ * disk if need be, and returns TRUE if it did.  Once a thread watches the
+ * files, it only tells whether that thread has reread them since.
+ */
+static int
+xdg_mime_context_check (XdgMimeContext *context)
+{
+  struct timeval tv;
+  XdgMimeSnapshot *previous;
+  uint64_t n_reloads;
+  int changed = FALSE;
 
-  if (parent_list)
+  if (__atomic_load_n (&context->watching, __ATOMIC_ACQUIRE))
     {
-      _xdg_mime_parent_list_free (parent_list);
-      parent_list = NULL;
+      n_reloads = __atomic_load_n (&context->n_reloads, __ATOMIC_RELAXED);
+      return __atomic_exchange_n (&context->n_reloads_seen, n_reloads, __ATOMIC_RELAXED) != n_reloads;
     }
-  
-  if (_caches)
+
+  gettimeofday (&tv, NULL);
+
+  if (tv.tv_sec < __atomic_load_n (&context->last_stat_time, __ATOMIC_RELAXED) + 5)
+    return FALSE;
+
+  if (pthread_mutex_trylock (&context->reload_lock) != 0)
+    return FALSE;
+
+  if (tv.tv_sec >= context->last_stat_time + 5)
     {
-      int i;
+      previous = xdg_mime_use_snapshot (context->snapshot);
+      changed = xdg_check_dirs ();
+      xdg_mime_use_snapshot (previous);
+
+      if (changed)
+	{
+	  xdg_mime_context_replace_snapshot (context, xdg_mime_snapshot_new (context->results));
+	  __atomic_store_n (&context->n_reloads_seen, context->n_reloads, __ATOMIC_RELAXED);
+	}
 
-      for (i = 0; i < n_caches; i++)
-        _xdg_mime_cache_unref (_caches[i]);
-      free (_caches);
-      _caches = NULL;
-      n_caches = 0;
+      __atomic_store_n (&context->last_stat_time, tv.tv_sec, __ATOMIC_RELAXED);
     }
 
-  for (list = callback_list; list; list = list->next)
-    (list->callback) (list->data);
+  pthread_mutex_unlock (&context->reload_lock);
 
-  need_reread = TRUE;
+  return changed;
 }
 
-int
-xdg_mime_get_max_buffer_extents (void)
+#ifdef HAVE_SYS_INOTIFY_H
+
+/* update-mime-database writes the files one after the other, so they are
+ * only reread once they have been left alone this long (or, if they never
+ * are, after XDG_WATCH_MAX_SETTLE of these) */
+#define XDG_WATCH_SETTLE_MS 500
+#define XDG_WATCH_MAX_SETTLE 20
+
+#define XDG_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | \
+			IN_DELETE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* The files xdg_mime_init_from_directory () reads, and their directory */
+static const char *watched_names[] = {
+  "mime", "mime.cache", "globs", "magic", "aliases", "subclasses", NULL
+};
+
+static int
+xdg_watch_directory (const char     *directory,
+		     XdgMimeContext *context)
 {
-  xdg_mime_init ();
-  
-  if (_caches)
-    return _xdg_mime_cache_get_max_buffer_extents ();
+  char *file_name;
 
-  return _xdg_mime_magic_get_buffer_extents (global_magic);
+  /* For the mime directory coming and going */
+  inotify_add_watch (context->watch_fd, directory,
+		     IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR);
+
+  file_name = malloc (strlen (directory) + strlen ("/mime") + 1);
+  strcpy (file_name, directory); strcat (file_name, "/mime");
+  inotify_add_watch (context->watch_fd, file_name, XDG_WATCH_MASK | IN_ONLYDIR);
+  free (file_name);
+
+  return FALSE; /* Keep processing */
 }
 
-const char *
-_xdg_mime_unalias_mime_type (const char *mime_type)
+static int
+xdg_watch_event_matters (const struct inotify_event *event)
 {
-  const char *lookup;
+  int i;
 
-  if (_caches)
-    return _xdg_mime_cache_unalias_mime_type (mime_type);
+  /* Events were lost, or a mime directory went */
+  if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF))
+    return TRUE;
 
-  if ((lookup = _xdg_mime_alias_list_lookup (alias_list, mime_type)) != NULL)
-    return lookup;
+  if (event->len == 0)
+    return FALSE;
 
-  return mime_type;
+  for (i = 0; watched_names[i]; i++)
+    {
+      if (strcmp (event->name, watched_names[i]) == 0)
+	return TRUE;
+    }
+
+  return FALSE;
 }
 
-const char *
-xdg_mime_unalias_mime_type (const char *mime_type)
+/* Reads the events waiting, and returns whether any were about the files
+ * the database is read from */
+static int
+xdg_watch_read_events (XdgMimeContext *context)
 {
-  xdg_mime_init ();
+  union
+  {
+    struct inotify_event event;
+    char data[4096];
+  } buffer;
+  const struct inotify_event *event;
+  ssize_t n, offset;
+  int matters = FALSE;
+
+  while ((n = read (context->watch_fd, &buffer, sizeof (buffer))) > 0)
+    {
+      for (offset = 0; offset < n; offset += sizeof (struct inotify_event) + event->len)
+	{
+	  event = (const struct inotify_event *) (buffer.data + offset);
+
+	  if (xdg_watch_event_matters (event))
+	    {
+	      __atomic_add_fetch (&context->n_events, 1, __ATOMIC_RELAXED);
+	      matters = TRUE;
+	    }
+	}
+    }
 
-  return _xdg_mime_unalias_mime_type (mime_type);
+  return matters;
 }
 
-int
-_xdg_mime_mime_type_equal (const char *mime_a,
-			   const char *mime_b)
+/* Rereads the files, if they have changed or if 'check' is FALSE, and
+ * swaps the new snapshot in */
+static void
+xdg_watch_reload (XdgMimeContext *context,
+		  int             check)
 {
-  const char *unalias_a, *unalias_b;
+  XdgMimeSnapshot *previous;
+  int changed = TRUE;
 
-  unalias_a = _xdg_mime_unalias_mime_type (mime_a);
-  unalias_b = _xdg_mime_unalias_mime_type (mime_b);
+  pthread_mutex_lock (&context->reload_lock);
 
-  if (strcmp (unalias_a, unalias_b) == 0)
-    return 1;
+  if (check)
+    {
+      previous = xdg_mime_use_snapshot (context->snapshot);
+      changed = xdg_check_dirs ();
+      xdg_mime_use_snapshot (previous);
+    }
 
-  return 0;
+  if (changed)
+    xdg_mime_context_replace_snapshot (context, xdg_mime_snapshot_new (context->results));
+
+  pthread_mutex_unlock (&context->reload_lock);
 }
 
-int
-xdg_mime_mime_type_equal (const char *mime_a,
-			  const char *mime_b)
+static void *
+xdg_watch_thread (void *data)
 {
-  xdg_mime_init ();
+  XdgMimeContext *context = data;
+  struct pollfd fds[2];
+  int n, settle;
 
-  return _xdg_mime_mime_type_equal (mime_a, mime_b);
-}
+  fds[0].fd = context->watch_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = context->stop_fds[0];
+  fds[1].events = POLLIN;
 
-int
-xdg_mime_media_type_equal (const char *mime_a,
-			   const char *mime_b)
-{
-  char *sep;
+  /* Whatever changed before the watches were in place */
+  xdg_watch_reload (context, TRUE);
 
-  xdg_mime_init ();
+  for (;;)
+    {
+      n = poll (fds, 2, -1);
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n < 0 || fds[1].revents)
+	break;
 
-  sep = strchr (mime_a, '/');
-  
-  if (sep && strncmp (mime_a, mime_b, sep - mime_a + 1) == 0)
-    return 1;
+      if (! xdg_watch_read_events (context))
+	continue;
 
-  return 0;
-}
+      for (settle = 0; settle < XDG_WATCH_MAX_SETTLE; settle++)
+	{
+	  do
+	    n = poll (fds, 2, XDG_WATCH_SETTLE_MS);
+	  while (n < 0 && errno == EINTR);
 
-#if 1
-static int
-xdg_mime_is_super_type (const char *mime)
-{
-  int length;
-  const char *type;
+	  if (n <= 0)
+	    break;
+	  if (fds[1].revents)
+	    return NULL;
 
-  length = strlen (mime);
-  type = &(mime[length - 2]);
+	  xdg_watch_read_events (context);
+	}
 
-  if (strcmp (type, "/*") == 0)
-    return 1;
+      /* A mime directory may have come since */
+      xdg_run_command_on_dirs ((XdgDirectoryFunc) xdg_watch_directory, context);
 
-  return 0;
+      xdg_watch_reload (context, FALSE);
+    }
+
+  return NULL;
 }
-#endif
+
+#endif /* HAVE_SYS_INOTIFY_H */
 
 int
-_xdg_mime_mime_type_subclass (const char *mime,
-			      const char *base)
+xdg_mime_context_watch (XdgMimeContext *context)
 {
-  const char *umime, *ubase;
-  const char **parents;
+#ifdef HAVE_SYS_INOTIFY_H
+  int result = -1;
 
-  if (_caches)
-    return _xdg_mime_cache_mime_type_subclass (mime, base);
+  pthread_mutex_lock (&context->reload_lock);
 
-  umime = _xdg_mime_unalias_mime_type (mime);
-  ubase = _xdg_mime_unalias_mime_type (base);
+  if (context->watching)
+    {
+      pthread_mutex_unlock (&context->reload_lock);
+      return 0;
+    }
 
-  if (strcmp (umime, ubase) == 0)
-    return 1;
+  context->watch_fd = inotify_init ();
+  if (context->watch_fd != -1)
+    {
+      fcntl (context->watch_fd, F_SETFL, O_NONBLOCK);
+      fcntl (context->watch_fd, F_SETFD, FD_CLOEXEC);
 
-#if 1  
-  /* Handle supertypes */
-  if (xdg_mime_is_super_type (ubase) &&
-      xdg_mime_media_type_equal (umime, ubase))
+      if (pipe (context->stop_fds) == 0)
+	{
+	  xdg_run_command_on_dirs ((XdgDirectoryFunc) xdg_watch_directory, context);
+
+	  if (pthread_create (&context->watch_thread, NULL, xdg_watch_thread, context) == 0)
+	    result = 0;
+	  else
+	    {
+	      close (context->stop_fds[0]);
+	      close (context->stop_fds[1]);
+	    }
+	}
+
+      if (result != 0)
+	{
+	  close (context->watch_fd);
+	  context->watch_fd = -1;
+	}
+    }
+
+  if (result == 0)
+    {
+      __atomic_store_n (&context->n_reloads_seen, context->n_reloads, __ATOMIC_RELAXED);
+      __atomic_store_n (&context->watching, TRUE, __ATOMIC_RELEASE);
+    }
+
+  pthread_mutex_unlock (&context->reload_lock);
+
+  return result;
+#else
+  return -1;
+#endif
+}
+
+XdgMimeSnapshot *
+xdg_mime_context_get_snapshot (XdgMimeContext *context)
+{
+  XdgMimeSnapshot *snapshot;
+  int epoch;
+
+  xdg_mime_context_check (context);
+
+  epoch = __atomic_load_n (&context->epoch, __ATOMIC_SEQ_CST) & 1;
+  __atomic_add_fetch (&context->n_acquiring[epoch], 1, __ATOMIC_SEQ_CST);
+
+  snapshot = __atomic_load_n (&context->snapshot, __ATOMIC_SEQ_CST);
+  xdg_mime_snapshot_ref (snapshot);
+
+  __atomic_sub_fetch (&context->n_acquiring[epoch], 1, __ATOMIC_SEQ_CST);
+
+  return snapshot;
+}
+
+/* Called in every function that doesn't take a snapshot.  It loads the
+ * default context, or reloads it if need be.
+ */
+static void
+xdg_mime_init (void)
+{
+  XdgCallbackList *list;
+
+  if (default_context == NULL)
+    default_context = xdg_mime_context_new ();
+  else if (xdg_mime_context_check (default_context))
+    {
+      for (list = callback_list; list; list = list->next)
+	(list->callback) (list->data);
+    }
+}
+
+/* The snapshot of the default context, which a watching thread may swap
+ * at any time */
+static XdgMimeSnapshot *
+xdg_mime_default_snapshot (void)
+{
+  return __atomic_load_n (&default_context->snapshot, __ATOMIC_ACQUIRE);
+}
+
+/* The lookups themselves, on the calling thread's snapshot */
+
+static int
+xdg_get_max_buffer_extents (void)
+{
+  if (_caches)
+    return _xdg_mime_cache_get_max_buffer_extents ();
+
+  return _xdg_mime_magic_get_buffer_extents (global_magic);
+}
+
+static void
+xdg_read_buffer_key_init (void)
+{
+  pthread_key_create (&read_buffer_key, free);
+}
+
+static unsigned char *
+xdg_get_read_buffer (size_t size)
+{
+  XdgReadBuffer *buffer;
+
+  pthread_once (&read_buffer_once, xdg_read_buffer_key_init);
+
+  buffer = pthread_getspecific (read_buffer_key);
+  if (buffer != NULL && buffer->size >= size)
+    return buffer->data;
+
+  free (buffer);
+  buffer = malloc (sizeof (XdgReadBuffer) + size);
+  pthread_setspecific (read_buffer_key, buffer);
+  if (buffer == NULL)
+    return NULL;
+
+  buffer->size = size;
+  return buffer->data;
+}
+
+/* Reads as much of the start of fd as the magic rules look at into the
+ * thread's buffer, with a single read.  Returns the number of bytes read,
+ * or -1 with errno set. */
+static ssize_t
+xdg_read_header (int          fd,
+		 const void **data)
+{
+  unsigned char *buffer;
+  size_t max_extent;
+  ssize_t bytes_read;
+
+  *data = NULL;
+
+  /* FIXME: Need to make sure that max_extent isn't totally broken.  This could
+   * be large and need getting from a stream instead of just reading it all
+   * in. */
+  max_extent = xdg_get_max_buffer_extents ();
+  buffer = xdg_get_read_buffer (max_extent);
+  if (buffer == NULL)
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+  do
+    bytes_read = pread (fd, buffer, max_extent, 0);
+  while (bytes_read == -1 && errno == EINTR);
+
+  if (bytes_read >= 0)
+    *data = buffer;
+
+  return bytes_read;
+}
+
+/* currently, only a few globs occur twice, and none
+ * more often, so 5 seems plenty.
+ */
+#define MAX_GLOB_MATCHES 5
+
+static int
+xdg_glob_lookup_file_name (const char *file_name,
+			   const char *mime_types[MAX_GLOB_MATCHES])
+{
+  const char *base_name;
+
+  base_name = _xdg_get_base_name (file_name);
+
+  if (_caches)
+    return _xdg_mime_cache_glob_lookup_file_name (base_name, mime_types, 2);
+
+  return _xdg_glob_hash_lookup_file_name (global_hash, base_name,
+					  mime_types, MAX_GLOB_MATCHES);
+}
+
+static const char *
+xdg_magic_lookup_data (const void *data,
+		       size_t      len,
+		       const char *mime_types[],
+		       int         n_mime_types)
+{
+  const char *mime_type;
+
+  if (_caches)
+    return _xdg_mime_cache_magic_lookup_data (data, len,
+					      mime_types, n_mime_types);
+
+  mime_type = _xdg_mime_magic_lookup_data (global_magic, data, len,
+					   mime_types, n_mime_types);
+
+  if (mime_type)
+    return mime_type;
+
+  return XDG_MIME_TYPE_UNKNOWN;
+}
+
+static const char *
+xdg_get_mime_type_for_data (const void *data,
+			    size_t      len)
+{
+  return xdg_magic_lookup_data (data, len, NULL, 0);
+}
+
+/* What the result cache has for a file, if there is one */
+static const char *
+xdg_result_lookup (const struct stat *statbuf,
+		   const char        *file_name,
+		   xdg_uint32_t      *key)
+{
+  const char *mime_type;
+
+  *key = _xdg_mime_result_key (current_snapshot->results_key,
+			       file_name ? _xdg_get_base_name (file_name) : NULL);
+
+  mime_type = _xdg_mime_result_cache_lookup (result_cache, statbuf, *key);
+  if (mime_type && strcmp (mime_type, XDG_MIME_TYPE_UNKNOWN) == 0)
+    return XDG_MIME_TYPE_UNKNOWN;
+
+  return mime_type;
+}
+
+static const char *
+xdg_get_mime_type_for_file (const char  *file_name,
+			    struct stat *statbuf)
+{
+  const char *mime_types[MAX_GLOB_MATCHES];
+  const char *mime_type;
+  const void *data;
+  ssize_t bytes_read;
+  struct stat buf;
+  xdg_uint32_t key;
+  int fd;
+  int n;
+
+  if (file_name == NULL)
+    return NULL;
+  if (! _xdg_utf8_validate (file_name))
+    return NULL;
+
+  n = xdg_glob_lookup_file_name (file_name, mime_types);
+
+  if (n == 1)
+    return mime_types[0];
+
+  if (!statbuf)
+    {
+      if (stat (file_name, &buf) != 0)
+	return XDG_MIME_TYPE_UNKNOWN;
+
+      statbuf = &buf;
+    }
+
+  if (!S_ISREG (statbuf->st_mode))
+    return XDG_MIME_TYPE_UNKNOWN;
+
+  if (result_cache &&
+      (mime_type = xdg_result_lookup (statbuf, file_name, &key)) != NULL)
+    return mime_type;
+
+  fd = open (file_name, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+  if (fd == -1)
+    return XDG_MIME_TYPE_UNKNOWN;
+
+  bytes_read = xdg_read_header (fd, &data);
+  close (fd);
+
+  if (bytes_read < 0)
+    return XDG_MIME_TYPE_UNKNOWN;
+
+  mime_type = xdg_magic_lookup_data (data, bytes_read, mime_types, n);
+
+  if (result_cache)
+    _xdg_mime_result_cache_insert (result_cache, statbuf, key, mime_type);
+
+  return mime_type;
+}
+
+/* 'data' and 'len' may be NULL if the caller has no use for the bytes, in
+ * which case the answer can come from the result cache without reading.
+ * 'error' gets the errno of a failed read, or 0.
+ */
+static const char *
+xdg_get_mime_type_for_fd (int          fd,
+			  const char  *file_name,
+			  const void **data,
+			  size_t      *len,
+			  int         *error)
+{
+  const char *mime_types[MAX_GLOB_MATCHES];
+  const char *mime_type;
+  const void *buffer;
+  ssize_t bytes_read;
+  struct stat st;
+  xdg_uint32_t key;
+  int cacheable = FALSE;
+  int n = 0;
+
+  if (data)
+    *data = NULL;
+  if (len)
+    *len = 0;
+  *error = 0;
+
+  /* Names that can't be matched against the globs are just left out */
+  if (file_name != NULL && _xdg_utf8_validate (file_name))
+    n = xdg_glob_lookup_file_name (file_name, mime_types);
+  else
+    file_name = NULL;
+
+  if (data == NULL)
+    {
+      if (n == 1)
+	return mime_types[0];
+
+      if (result_cache && fstat (fd, &st) == 0 && S_ISREG (st.st_mode))
+	{
+	  mime_type = xdg_result_lookup (&st, file_name, &key);
+	  if (mime_type)
+	    return mime_type;
+	  cacheable = TRUE;
+	}
+    }
+
+  /* Read even when the globs settle it, if the caller wants the data */
+  bytes_read = xdg_read_header (fd, &buffer);
+  if (bytes_read < 0)
+    *error = errno;
+  else if (data)
+    {
+      *data = buffer;
+      if (len)
+	*len = bytes_read;
+    }
+
+  if (n == 1)
+    return mime_types[0];
+
+  if (bytes_read < 0)
+    return XDG_MIME_TYPE_UNKNOWN;
+
+  mime_type = xdg_magic_lookup_data (buffer, bytes_read, mime_types, n);
+
+  if (cacheable)
+    _xdg_mime_result_cache_insert (result_cache, &st, key, mime_type);
+
+  return mime_type;
+}
+
+static void
+xdg_get_mime_types_at (int                dirfd,
+		       XdgMimeBatchEntry *entries,
+		       int                n_entries)
+{
+  int i;
+
+  for (i = 0; i < n_entries; i++)
+    {
+      XdgMimeBatchEntry *entry = &entries[i];
+      const void *data = NULL;
+      size_t len = 0;
+      int fd;
+
+      entry->mime_type = NULL;
+      entry->header_len = 0;
+      entry->error = 0;
+
+      if (entry->name == NULL)
+	{
+	  entry->error = EINVAL;
+	  continue;
+	}
+
+      /* Not blocking on FIFOs; anything that isn't a plain file fails the
+       * read and comes back unknown, unless its name settles it */
+      fd = openat (dirfd, entry->name,
+		   O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+      if (fd == -1)
+	{
+	  entry->error = errno;
+	  entry->mime_type = XDG_MIME_TYPE_UNKNOWN;
+	  continue;
+	}
+
+      /* Without a header to fill in, this can come from the result cache */
+      entry->mime_type = xdg_get_mime_type_for_fd (fd, entry->name,
+						   entry->header ? &data : NULL,
+						   &len, &entry->error);
+      close (fd);
+
+      if (entry->header != NULL && data != NULL)
+	{
+	  entry->header_len = len < entry->header_size ? len : entry->header_size;
+	  memcpy (entry->header, data, entry->header_len);
+	}
+    }
+}
+
+static const char *
+xdg_get_mime_type_from_file_name (const char *file_name)
+{
+  const char *mime_type;
+
+  if (_caches)
+    return _xdg_mime_cache_get_mime_type_from_file_name (file_name);
+
+  if (_xdg_glob_hash_lookup_file_name (global_hash, file_name, &mime_type, 1))
+    return mime_type;
+  else
+    return XDG_MIME_TYPE_UNKNOWN;
+}
+
+static char **
+xdg_list_mime_parents (const char *mime)
+{
+  const char **parents;
+  char **result;
+  int i, n;
+
+  if (_caches)
+    return _xdg_mime_cache_list_mime_parents (mime);
+
+  parents = _xdg_mime_parent_list_lookup (parent_list,
+					  _xdg_mime_unalias_mime_type (mime));
+
+  if (!parents)
+    return NULL;
+
+  for (i = 0; parents[i]; i++) ;
+
+  n = (i + 1) * sizeof (char *);
+  result = (char **) malloc (n);
+  memcpy (result, parents, n);
+
+  return result;
+}
+
+const char *
+_xdg_mime_unalias_mime_type (const char *mime_type)
+{
+  const char *lookup;
+
+  if (_caches)
+    return _xdg_mime_cache_unalias_mime_type (mime_type);
+
+  if ((lookup = _xdg_mime_alias_list_lookup (alias_list, mime_type)) != NULL)
+    return lookup;
+
+  return mime_type;
+}
+
+int
+_xdg_mime_mime_type_equal (const char *mime_a,
+			   const char *mime_b)
+{
+  const char *unalias_a, *unalias_b;
+
+  unalias_a = _xdg_mime_unalias_mime_type (mime_a);
+  unalias_b = _xdg_mime_unalias_mime_type (mime_b);
+
+  if (strcmp (unalias_a, unalias_b) == 0)
+    return 1;
+
+  return 0;
+}
+
+int
+_xdg_mime_media_type_equal (const char *mime_a,
+			    const char *mime_b)
+{
+  char *sep;
+
+  sep = strchr (mime_a, '/');
+
+  if (sep && strncmp (mime_a, mime_b, sep - mime_a + 1) == 0)
+    return 1;
+
+  return 0;
+}
+
+#if 1
+static int
+xdg_mime_is_super_type (const char *mime)
+{
+  int length;
+  const char *type;
+
+  length = strlen (mime);
+  type = &(mime[length - 2]);
+
+  if (strcmp (type, "/*") == 0)
+    return 1;
+
+  return 0;
+}
+#endif
+
+int
+_xdg_mime_mime_type_subclass (const char *mime,
+			      const char *base)
+{
+  const char *umime, *ubase;
+  const char **parents;
+
+  if (_caches)
+    return _xdg_mime_cache_mime_type_subclass (mime, base);
+
+  umime = _xdg_mime_unalias_mime_type (mime);
+  ubase = _xdg_mime_unalias_mime_type (base);
+
+  if (strcmp (umime, ubase) == 0)
+    return 1;
+
+#if 1
+  /* Handle supertypes */
+  if (xdg_mime_is_super_type (ubase) &&
+      _xdg_mime_media_type_equal (umime, ubase))
     return 1;
 #endif
 
   /*  Handle special cases text/plain and application/octet-stream */
-  if (strcmp (ubase, "text/plain") == 0 && 
+  if (strcmp (ubase, "text/plain") == 0 &&
       strncmp (umime, "text/", 5) == 0)
     return 1;
 
   if (strcmp (ubase, "application/octet-stream") == 0)
     return 1;
-  
+
   parents = _xdg_mime_parent_list_lookup (parent_list, umime);
   for (; parents && *parents; parents++)
     {
@@ -743,58 +1467,400 @@ _xdg_mime_mime_type_subclass (const char *mime,
   return 0;
 }
 
+/* The same on a given snapshot, for any thread */
+
+const char *
+xdg_mime_snapshot_get_mime_type_for_data (XdgMimeSnapshot *snapshot,
+					  const void      *data,
+					  size_t           len)
+{
+  XdgMimeSnapshot *previous;
+  const char *mime_type;
+
+  previous = xdg_mime_use_snapshot (snapshot);
+  mime_type = xdg_get_mime_type_for_data (data, len);
+  xdg_mime_use_snapshot (previous);
+
+  return mime_type;
+}
+
+const char *
+xdg_mime_snapshot_get_mime_type_for_file (XdgMimeSnapshot *snapshot,
+					  const char      *file_name,
+					  struct stat     *statbuf)
+{
+  XdgMimeSnapshot *previous;
+  const char *mime_type;
+
+  previous = xdg_mime_use_snapshot (snapshot);
+  mime_type = xdg_get_mime_type_for_file (file_name, statbuf);
+  xdg_mime_use_snapshot (previous);
+
+  return mime_type;
+}
+
+const char *
+xdg_mime_snapshot_get_mime_type_for_fd (XdgMimeSnapshot *snapshot,
+					int              fd,
+					const char      *file_name,
+					const void     **data,
+					size_t          *len)
+{
+  XdgMimeSnapshot *previous;
+  const char *mime_type;
+  int error;
+
+  previous = xdg_mime_use_snapshot (snapshot);
+  mime_type = xdg_get_mime_type_for_fd (fd, file_name, data, len, &error);
+  xdg_mime_use_snapshot (previous);
+
+  if (error)
+    errno = error;
+
+  return mime_type;
+}
+
+/* Tells the results callers keep from the ones we keep ourselves */
+#define FILE_RESULT_TAG "\001file"
+
+const char *
+xdg_mime_snapshot_get_file_result (XdgMimeSnapshot  *snapshot,
+				   const char       *file_name,
+				   XdgMimeFileStamp *stamp)
+{
+  XdgMimeResultCache *results;
+  struct stat st;
+  xdg_uint32_t key;
+
+  memset (stamp, 0, sizeof (XdgMimeFileStamp));
+
+  results = __atomic_load_n (&snapshot->results, __ATOMIC_ACQUIRE);
+  if (results == NULL || file_name == NULL ||
+      stat (file_name, &st) != 0 || ! S_ISREG (st.st_mode))
+    return NULL;
+
+  key = _xdg_mime_result_key (snapshot->results_key, _xdg_get_base_name (file_name));
+
+  stamp->dev = st.st_dev;
+  stamp->ino = st.st_ino;
+  stamp->size = st.st_size;
+  stamp->mtime = st.st_mtime;
+  stamp->key = _xdg_mime_result_key (key, FILE_RESULT_TAG);
+  stamp->valid = TRUE;
+
+  return _xdg_mime_result_cache_lookup (results, &st, stamp->key);
+}
+
+void
+xdg_mime_snapshot_set_file_result (XdgMimeSnapshot        *snapshot,
+				   const XdgMimeFileStamp *stamp,
+				   const char             *mime_type)
+{
+  XdgMimeResultCache *results;
+  struct stat st;
+
+  results = __atomic_load_n (&snapshot->results, __ATOMIC_ACQUIRE);
+  if (results == NULL || ! stamp->valid || mime_type == NULL)
+    return;
+
+  /* The cache only looks at these */
+  memset (&st, 0, sizeof (st));
+  st.st_dev = stamp->dev;
+  st.st_ino = stamp->ino;
+  st.st_size = stamp->size;
+  st.st_mtime = stamp->mtime;
+
+  _xdg_mime_result_cache_insert (results, &st, stamp->key, mime_type);
+}
+
+void
+xdg_mime_snapshot_get_mime_types_at (XdgMimeSnapshot   *snapshot,
+				     int                dirfd,
+				     XdgMimeBatchEntry *entries,
+				     int                n_entries)
+{
+  XdgMimeSnapshot *previous;
+
+  previous = xdg_mime_use_snapshot (snapshot);
+  xdg_get_mime_types_at (dirfd, entries, n_entries);
+  xdg_mime_use_snapshot (previous);
+}
+
+const char *
+xdg_mime_snapshot_get_mime_type_from_file_name (XdgMimeSnapshot *snapshot,
+						const char      *file_name)
+{
+  XdgMimeSnapshot *previous;
+  const char *mime_type;
+
+  previous = xdg_mime_use_snapshot (snapshot);
+  mime_type = xdg_get_mime_type_from_file_name (file_name);
+  xdg_mime_use_snapshot (previous);
+
+  return mime_type;
+}
+
 int
-xdg_mime_mime_type_subclass (const char *mime,
-			     const char *base)
+xdg_mime_snapshot_mime_type_equal (XdgMimeSnapshot *snapshot,
+				   const char      *mime_a,
+				   const char      *mime_b)
 {
-  xdg_mime_init ();
+  XdgMimeSnapshot *previous;
+  int equal;
 
-  return _xdg_mime_mime_type_subclass (mime, base);
+  previous = xdg_mime_use_snapshot (snapshot);
+  equal = _xdg_mime_mime_type_equal (mime_a, mime_b);
+  xdg_mime_use_snapshot (previous);
+
+  return equal;
+}
+
+int
+xdg_mime_snapshot_mime_type_subclass (XdgMimeSnapshot *snapshot,
+				      const char      *mime,
+				      const char      *base)
+{
+  XdgMimeSnapshot *previous;
+  int subclass;
+
+  previous = xdg_mime_use_snapshot (snapshot);
+  subclass = _xdg_mime_mime_type_subclass (mime, base);
+  xdg_mime_use_snapshot (previous);
+
+  return subclass;
 }
 
 char **
-xdg_mime_list_mime_parents (const char *mime)
+xdg_mime_snapshot_list_mime_parents (XdgMimeSnapshot *snapshot,
+				     const char      *mime)
 {
-  const char **parents;
-  char **result;
-  int i, n;
+  XdgMimeSnapshot *previous;
+  char **parents;
 
-  if (_caches)
-    return _xdg_mime_cache_list_mime_parents (mime);
+  previous = xdg_mime_use_snapshot (snapshot);
+  parents = xdg_list_mime_parents (mime);
+  xdg_mime_use_snapshot (previous);
 
-  parents = xdg_mime_get_mime_parents (mime);
+  return parents;
+}
 
-  if (!parents)
-    return NULL;
+const char *
+xdg_mime_snapshot_unalias_mime_type (XdgMimeSnapshot *snapshot,
+				     const char      *mime)
+{
+  XdgMimeSnapshot *previous;
+  const char *unaliased;
 
-  for (i = 0; parents[i]; i++) ;
-  
-  n = (i + 1) * sizeof (char *);
-  result = (char **) malloc (n);
-  memcpy (result, parents, n);
+  previous = xdg_mime_use_snapshot (snapshot);
+  unaliased = _xdg_mime_unalias_mime_type (mime);
+  xdg_mime_use_snapshot (previous);
 
-  return result;
+  return unaliased;
+}
+
+int
+xdg_mime_snapshot_get_max_buffer_extents (XdgMimeSnapshot *snapshot)
+{
+  XdgMimeSnapshot *previous;
+  int max_extent;
+
+  previous = xdg_mime_use_snapshot (snapshot);
+  max_extent = xdg_get_max_buffer_extents ();
+  xdg_mime_use_snapshot (previous);
+
+  return max_extent;
+}
+
+/* And on the default context's, for callers that don't use threads */
+
+const char *
+xdg_mime_get_mime_type_for_data (const void *data,
+				 size_t      len)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_snapshot_get_mime_type_for_data (xdg_mime_default_snapshot (),
+						   data, len);
+}
+
+const char *
+xdg_mime_get_mime_type_for_file (const char  *file_name,
+                                 struct stat *statbuf)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_snapshot_get_mime_type_for_file (xdg_mime_default_snapshot (),
+						   file_name, statbuf);
+}
+
+const char *
+xdg_mime_get_mime_type_for_fd (int          fd,
+			       const char  *file_name,
+			       const void **data,
+			       size_t      *len)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_snapshot_get_mime_type_for_fd (xdg_mime_default_snapshot (),
+						 fd, file_name, data, len);
+}
+
+void
+xdg_mime_get_mime_types_at (int                dirfd,
+			    XdgMimeBatchEntry *entries,
+			    int                n_entries)
+{
+  xdg_mime_init ();
+
+  xdg_mime_snapshot_get_mime_types_at (xdg_mime_default_snapshot (),
+				       dirfd, entries, n_entries);
+}
+
+int
+xdg_mime_set_result_cache (const char *file_name,
+			   int         n_entries)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_context_set_result_cache (default_context, file_name, n_entries);
+}
+
+int
+xdg_mime_get_result_cache_stats (XdgMimeResultCacheStats *stats)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_context_get_result_cache_stats (default_context, stats);
+}
+
+int
+xdg_mime_watch (void)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_context_watch (default_context);
+}
+
+void
+xdg_mime_get_reload_stats (XdgMimeReloadStats *stats)
+{
+  xdg_mime_init ();
+
+  xdg_mime_context_get_reload_stats (default_context, stats);
+}
+
+const char *
+xdg_mime_get_mime_type_from_file_name (const char *file_name)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_snapshot_get_mime_type_from_file_name (xdg_mime_default_snapshot (),
+							 file_name);
+}
+
+int
+xdg_mime_is_valid_mime_type (const char *mime_type)
+{
+  /* FIXME: We should make this a better test
+   */
+  return _xdg_utf8_validate (mime_type);
+}
+
+void
+xdg_mime_shutdown (void)
+{
+  XdgCallbackList *list;
+
+  if (default_context)
+    {
+      xdg_mime_context_free (default_context);
+      default_context = NULL;
+    }
+
+  for (list = callback_list; list; list = list->next)
+    (list->callback) (list->data);
+}
+
+int
+xdg_mime_get_max_buffer_extents (void)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_snapshot_get_max_buffer_extents (xdg_mime_default_snapshot ());
+}
+
+const char *
+xdg_mime_unalias_mime_type (const char *mime_type)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_snapshot_unalias_mime_type (xdg_mime_default_snapshot (),
+					      mime_type);
+}
+
+int
+xdg_mime_mime_type_equal (const char *mime_a,
+			  const char *mime_b)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_snapshot_mime_type_equal (xdg_mime_default_snapshot (),
+					    mime_a, mime_b);
+}
+
+int
+xdg_mime_media_type_equal (const char *mime_a,
+			   const char *mime_b)
+{
+  xdg_mime_init ();
+
+  return _xdg_mime_media_type_equal (mime_a, mime_b);
+}
+
+int
+xdg_mime_mime_type_subclass (const char *mime,
+			     const char *base)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_snapshot_mime_type_subclass (xdg_mime_default_snapshot (),
+					       mime, base);
+}
+
+char **
+xdg_mime_list_mime_parents (const char *mime)
+{
+  xdg_mime_init ();
+
+  return xdg_mime_snapshot_list_mime_parents (xdg_mime_default_snapshot (),
+					      mime);
 }
 
 const char **
 xdg_mime_get_mime_parents (const char *mime)
 {
-  const char *umime;
+  XdgMimeSnapshot *previous;
+  const char **parents;
 
   xdg_mime_init ();
 
-  umime = _xdg_mime_unalias_mime_type (mime);
+  previous = xdg_mime_use_snapshot (xdg_mime_default_snapshot ());
+  parents = _xdg_mime_parent_list_lookup (parent_list,
+					  _xdg_mime_unalias_mime_type (mime));
+  xdg_mime_use_snapshot (previous);
 
-  return _xdg_mime_parent_list_lookup (parent_list, umime);
+  return parents;
 }
 
-void 
+void
 xdg_mime_dump (void)
 {
+  xdg_mime_init ();
+
   printf ("*** ALIASES ***\n\n");
-  _xdg_mime_alias_list_dump (alias_list);
+  _xdg_mime_alias_list_dump (xdg_mime_default_snapshot ()->alias_list);
   printf ("\n*** PARENTS ***\n\n");
-  _xdg_mime_parent_list_dump (parent_list);
+  _xdg_mime_parent_list_dump (xdg_mime_default_snapshot ()->parent_list);
 }
 
 
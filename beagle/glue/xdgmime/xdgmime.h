@@ -30,6 +30,7 @@
 #define __XDG_MIME_H__
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <sys/stat.h>
 
 #ifdef __cplusplus
@@ -45,10 +46,62 @@ extern "C" {
 typedef void (*XdgMimeCallback) (void *user_data);
 typedef void (*XdgMimeDestroy)  (void *user_data);
 
+typedef struct XdgMimeContext  XdgMimeContext;
+typedef struct XdgMimeSnapshot XdgMimeSnapshot;
+
+/* A file to look up with xdg_mime_get_mime_types_at ().  The caller sets
+ * the name, relative to the directory, and optionally a buffer to get the
+ * start of the file in; the rest is filled in. */
+typedef struct
+{
+  const char *name;
+  void       *header;
+  size_t      header_size;
+
+  const char *mime_type;
+  size_t      header_len;
+  int         error;
+} XdgMimeBatchEntry;
+
+typedef struct
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t insertions;
+  uint64_t evictions;		/* entries dropped to make room */
+  uint64_t entries;		/* in use, including any read back from the file */
+  uint64_t capacity;
+  uint64_t persistent;		/* whether they are kept in a file */
+} XdgMimeResultCacheStats;
+
+typedef struct
+{
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t  mtime;
+  uint32_t key;
+  int      valid;		/* whether there is a result to keep for it */
+} XdgMimeFileStamp;
+
+typedef struct
+{
+  uint64_t reloads;		/* times the files were reread after changing */
+  uint64_t last_reload;		/* when they last were, in microseconds since the epoch */
+  uint64_t events;		/* changes to the files a watching thread was told of */
+  uint64_t watching;		/* whether a thread watches them */
+} XdgMimeReloadStats;
+
   
 #ifdef XDG_PREFIX
 #define xdg_mime_get_mime_type_for_data       XDG_ENTRY(get_mime_type_for_data)
 #define xdg_mime_get_mime_type_for_file       XDG_ENTRY(get_mime_type_for_file)
+#define xdg_mime_get_mime_type_for_fd         XDG_ENTRY(get_mime_type_for_fd)
+#define xdg_mime_get_mime_types_at            XDG_ENTRY(get_mime_types_at)
+#define xdg_mime_set_result_cache             XDG_ENTRY(set_result_cache)
+#define xdg_mime_get_result_cache_stats       XDG_ENTRY(get_result_cache_stats)
+#define xdg_mime_watch                        XDG_ENTRY(watch)
+#define xdg_mime_get_reload_stats             XDG_ENTRY(get_reload_stats)
 #define xdg_mime_get_mime_type_from_file_name XDG_ENTRY(get_mime_type_from_file_name)
 #define xdg_mime_is_valid_mime_type           XDG_ENTRY(is_valid_mime_type)
 #define xdg_mime_mime_type_equal              XDG_ENTRY(mime_type_equal)
@@ -63,6 +116,27 @@ typedef void (*XdgMimeDestroy)  (void *user_data);
 #define xdg_mime_register_reload_callback     XDG_ENTRY(register_reload_callback)
 #define xdg_mime_remove_callback              XDG_ENTRY(remove_callback)
 #define xdg_mime_type_unknown                 XDG_ENTRY(type_unknown)
+#define xdg_mime_context_new                  XDG_ENTRY(context_new)
+#define xdg_mime_context_free                 XDG_ENTRY(context_free)
+#define xdg_mime_context_get_snapshot         XDG_ENTRY(context_get_snapshot)
+#define xdg_mime_context_set_result_cache     XDG_ENTRY(context_set_result_cache)
+#define xdg_mime_context_get_result_cache_stats XDG_ENTRY(context_get_result_cache_stats)
+#define xdg_mime_context_watch                XDG_ENTRY(context_watch)
+#define xdg_mime_context_get_reload_stats     XDG_ENTRY(context_get_reload_stats)
+#define xdg_mime_snapshot_ref                 XDG_ENTRY(snapshot_ref)
+#define xdg_mime_snapshot_unref               XDG_ENTRY(snapshot_unref)
+#define xdg_mime_snapshot_get_mime_type_for_data       XDG_ENTRY(snapshot_get_mime_type_for_data)
+#define xdg_mime_snapshot_get_mime_type_for_file       XDG_ENTRY(snapshot_get_mime_type_for_file)
+#define xdg_mime_snapshot_get_mime_type_for_fd         XDG_ENTRY(snapshot_get_mime_type_for_fd)
+#define xdg_mime_snapshot_get_mime_types_at            XDG_ENTRY(snapshot_get_mime_types_at)
+#define xdg_mime_snapshot_get_mime_type_from_file_name XDG_ENTRY(snapshot_get_mime_type_from_file_name)
+#define xdg_mime_snapshot_get_file_result              XDG_ENTRY(snapshot_get_file_result)
+#define xdg_mime_snapshot_set_file_result              XDG_ENTRY(snapshot_set_file_result)
+#define xdg_mime_snapshot_mime_type_equal              XDG_ENTRY(snapshot_mime_type_equal)
+#define xdg_mime_snapshot_mime_type_subclass           XDG_ENTRY(snapshot_mime_type_subclass)
+#define xdg_mime_snapshot_list_mime_parents            XDG_ENTRY(snapshot_list_mime_parents)
+#define xdg_mime_snapshot_unalias_mime_type            XDG_ENTRY(snapshot_unalias_mime_type)
+#define xdg_mime_snapshot_get_max_buffer_extents       XDG_ENTRY(snapshot_get_max_buffer_extents)
 #endif
 
 extern const char xdg_mime_type_unknown[];
@@ -72,6 +146,44 @@ const char  *xdg_mime_get_mime_type_for_data       (const void *data,
 						    size_t      len);
 const char  *xdg_mime_get_mime_type_for_file       (const char *file_name,
                                                     struct stat *statbuf);
+  /* Like xdg_mime_get_mime_type_for_file (), on a file the caller has
+   * open, matching file_name (if not NULL) against the globs.  Reads the
+   * start of the file once with pread () into a buffer of the calling
+   * thread's, and points data and len at what it read, or at NULL and 0
+   * if it couldn't (with errno set).  That stays valid until the thread's
+   * next lookup by descriptor, so callers can look at the bytes themselves
+   * rather than reading them again.  Callers that don't need them can
+   * pass NULL for data and len, which lets the answer come from the
+   * result cache, if there is one, without reading at all.
+   */
+const char  *xdg_mime_get_mime_type_for_fd         (int          fd,
+						    const char  *file_name,
+						    const void **data,
+						    size_t      *len);
+  /* The same for each of a batch of files in the directory dirfd (or the
+   * current one, for AT_FDCWD): one open and one read per file, or no read
+   * for entries without a header buffer the result cache has.  An entry
+   * that can't be opened or read gets its errno in error. */
+void         xdg_mime_get_mime_types_at            (int                dirfd,
+						    XdgMimeBatchEntry *entries,
+						    int                n_entries);
+  /* Keeps what the magic lookups find for up to n_entries files, so that
+   * files that haven't changed since (by device, inode, mtime and size)
+   * aren't read again.  With a file_name the results are also kept there
+   * for the next run, unless another process is already using the file.
+   * Can only be set once; returns 0 on success, -1 otherwise. */
+int          xdg_mime_set_result_cache             (const char *file_name,
+						    int         n_entries);
+  /* Returns -1, with stats zeroed, if there is no result cache */
+int          xdg_mime_get_result_cache_stats       (XdgMimeResultCacheStats *stats);
+  /* Has a thread watch the MIME directories with inotify, and reread the
+   * files in the background as soon as they change, rather than lookups
+   * stat()ing them every 5 seconds and rereading them on the spot.  The
+   * strings the functions here return then stay valid until the second
+   * reload after they were returned.  Returns 0 if the files are being
+   * watched, -1 if they can't be. */
+int          xdg_mime_watch                        (void);
+void         xdg_mime_get_reload_stats             (XdgMimeReloadStats *stats);
 const char  *xdg_mime_get_mime_type_from_file_name (const char *file_name);
 int          xdg_mime_is_valid_mime_type           (const char *mime_type);
 int          xdg_mime_mime_type_equal              (const char *mime_a,
@@ -96,6 +208,67 @@ int          xdg_mime_register_reload_callback     (XdgMimeCallback  callback,
 						    XdgMimeDestroy   destroy);
 void         xdg_mime_remove_callback              (int              callback_id);
 
+  /* The functions above share one database between all callers, and can
+   * free it under them when its files change.  Threads should instead take
+   * a snapshot of a context's database for the lookups they are about to
+   * make, and drop it once they are done with the strings those return.
+   * Snapshots never change; a context swaps in a new one when the files
+   * do, and taking one never blocks.
+   */
+XdgMimeContext  *xdg_mime_context_new              (void);
+void             xdg_mime_context_free             (XdgMimeContext  *context);
+XdgMimeSnapshot *xdg_mime_context_get_snapshot     (XdgMimeContext  *context);
+int              xdg_mime_context_set_result_cache (XdgMimeContext  *context,
+						    const char      *file_name,
+						    int              n_entries);
+int              xdg_mime_context_get_result_cache_stats (XdgMimeContext          *context,
+							  XdgMimeResultCacheStats *stats);
+int              xdg_mime_context_watch            (XdgMimeContext  *context);
+void             xdg_mime_context_get_reload_stats (XdgMimeContext     *context,
+						    XdgMimeReloadStats *stats);
+XdgMimeSnapshot *xdg_mime_snapshot_ref             (XdgMimeSnapshot *snapshot);
+void             xdg_mime_snapshot_unref           (XdgMimeSnapshot *snapshot);
+
+const char  *xdg_mime_snapshot_get_mime_type_for_data       (XdgMimeSnapshot *snapshot,
+							     const void      *data,
+							     size_t           len);
+const char  *xdg_mime_snapshot_get_mime_type_for_file       (XdgMimeSnapshot *snapshot,
+							     const char      *file_name,
+							     struct stat     *statbuf);
+const char  *xdg_mime_snapshot_get_mime_type_for_fd         (XdgMimeSnapshot *snapshot,
+							     int              fd,
+							     const char      *file_name,
+							     const void     **data,
+							     size_t          *len);
+void         xdg_mime_snapshot_get_mime_types_at            (XdgMimeSnapshot   *snapshot,
+							     int                dirfd,
+							     XdgMimeBatchEntry *entries,
+							     int                n_entries);
+const char  *xdg_mime_snapshot_get_mime_type_from_file_name (XdgMimeSnapshot *snapshot,
+							     const char      *file_name);
+  /* For callers that settle on a type of their own after the lookups above:
+   * the first looks what they settled on for file_name up in the result
+   * cache, with no more than a stat(), and returns NULL if it isn't there.
+   * Either way it fills in stamp, with which the second keeps what they
+   * settle on this time, by what stat() said before they looked. */
+const char  *xdg_mime_snapshot_get_file_result              (XdgMimeSnapshot  *snapshot,
+							     const char       *file_name,
+							     XdgMimeFileStamp *stamp);
+void         xdg_mime_snapshot_set_file_result              (XdgMimeSnapshot        *snapshot,
+							     const XdgMimeFileStamp *stamp,
+							     const char             *mime_type);
+int          xdg_mime_snapshot_mime_type_equal              (XdgMimeSnapshot *snapshot,
+							     const char      *mime_a,
+							     const char      *mime_b);
+int          xdg_mime_snapshot_mime_type_subclass           (XdgMimeSnapshot *snapshot,
+							     const char      *mime_a,
+							     const char      *mime_b);
+char       **xdg_mime_snapshot_list_mime_parents            (XdgMimeSnapshot *snapshot,
+							     const char      *mime);
+const char  *xdg_mime_snapshot_unalias_mime_type            (XdgMimeSnapshot *snapshot,
+							     const char      *mime);
+int          xdg_mime_snapshot_get_max_buffer_extents       (XdgMimeSnapshot *snapshot);
+
    /* Private versions of functions that don't call xdg_mime_init () */
 int          _xdg_mime_mime_type_equal             (const char *mime_a,
 						    const char *mime_b);
@@ -103,6 +276,7 @@ int          _xdg_mime_media_type_equal            (const char *mime_a,
 						    const char *mime_b);
 int          _xdg_mime_mime_type_subclass          (const char *mime,
 						    const char *base);
+const char  *_xdg_mime_unalias_mime_type           (const char *mime);
 
 
 #ifdef __cplusplus
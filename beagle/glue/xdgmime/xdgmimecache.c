@@ -48,6 +48,9 @@
 
 #include "xdgmimecache.h"
 #include "xdgmimeint.h"
+#include "xdgmimemagicindex.h"
+#include "xdgmimeglobindex.h"
+#include "xdgmimematch.h"
 
 #ifndef MAX
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
@@ -78,6 +81,9 @@ struct _XdgMimeCache
 
   size_t  size;
   char   *buffer;
+
+  /* Built once the rest of the database is read */
+  XdgMimeMagicIndex *magic_index;
 };
 
 #define GET_UINT16(cache,offset) (ntohs(*(xdg_uint16_t*)((cache) + (offset))))
@@ -100,6 +106,7 @@ _xdg_mime_cache_unref (XdgMimeCache *cache)
 #ifdef HAVE_MMAP
       munmap (cache->buffer, cache->size);
 #endif
+      _xdg_mime_magic_index_free (cache->magic_index);
       free (cache);
     }
 }
@@ -141,6 +148,7 @@ _xdg_mime_cache_new_from_file (const char *file_name)
   cache->ref_count = 1;
   cache->buffer = buffer;
   cache->size = st.st_size;
+  cache->magic_index = NULL;
 
  done:
   if (fd != -1)
@@ -162,45 +170,14 @@ cache_magic_matchlet_compare_to_data (XdgMimeCache *cache,
   xdg_uint32_t data_length = GET_UINT32 (cache->buffer, offset + 12);
   xdg_uint32_t data_offset = GET_UINT32 (cache->buffer, offset + 16);
   xdg_uint32_t mask_offset = GET_UINT32 (cache->buffer, offset + 20);
-  
-  int i, j;
-
-  for (i = range_start; i <= range_start + range_length; i++)
-    {
-      int valid_matchlet = TRUE;
-      
-      if (i + data_length > len)
-	return FALSE;
 
-      if (mask_offset)
-	{
-	  for (j = 0; j < data_length; j++)
-	    {
-	      if ((((unsigned char *)cache->buffer)[data_offset + j] & ((unsigned char *)cache->buffer)[mask_offset + j]) !=
-		  ((((unsigned char *) data)[j + i]) & ((unsigned char *)cache->buffer)[mask_offset + j]))
-		{
-		  valid_matchlet = FALSE;
-		  break;
-		}
-	    }
-	}
-      else
-	{
-	  for (j = 0; j < data_length; j++)
-	    {
-	      if (((unsigned char *)cache->buffer)[data_offset + j] != ((unsigned char *) data)[j + i])
-		{
-		  valid_matchlet = FALSE;
-		  break;
-		}
-	    }
-	}
-      
-      if (valid_matchlet)
-	return TRUE;
-    }
-  
-  return FALSE;  
+  /* The cache has always been read as covering range_length + 1
+   * positions, unlike the magic file */
+  return _xdg_mime_match_range ((const unsigned char *) cache->buffer + data_offset,
+				mask_offset ? (const unsigned char *) cache->buffer + mask_offset : NULL,
+				data_length,
+				range_start, (size_t) range_length + 1,
+				data, len);
 }
 
 static int
@@ -258,13 +235,139 @@ cache_magic_compare_to_data (XdgMimeCache *cache,
   return NULL;
 }
 
+/* Index the magic entries by their top level matchlets.  Types are
+ * unaliased through all the caches, so this has to wait until they are
+ * all loaded.
+ */
+void
+_xdg_mime_cache_build_index (XdgMimeCache *cache)
+{
+  xdg_uint32_t list_offset;
+  xdg_uint32_t n_entries;
+  xdg_uint32_t offset;
+
+  int j, i;
+
+  list_offset = GET_UINT32 (cache->buffer, 24);
+  n_entries = GET_UINT32 (cache->buffer, list_offset);
+  offset = GET_UINT32 (cache->buffer, list_offset + 8);
+
+  cache->magic_index = _xdg_mime_magic_index_new (n_entries);
+
+  for (j = 0; j < n_entries; j++)
+    {
+      xdg_uint32_t mimetype_offset = GET_UINT32 (cache->buffer, offset + 16 * j + 4);
+      xdg_uint32_t n_matchlets = GET_UINT32 (cache->buffer, offset + 16 * j + 8);
+      xdg_uint32_t matchlet_offset = GET_UINT32 (cache->buffer, offset + 16 * j + 12);
+
+      for (i = 0; i < n_matchlets; i++)
+	{
+	  xdg_uint32_t m = matchlet_offset + 32 * i;
+	  xdg_uint32_t range_start = GET_UINT32 (cache->buffer, m);
+	  xdg_uint32_t range_length = GET_UINT32 (cache->buffer, m + 4);
+	  xdg_uint32_t data_length = GET_UINT32 (cache->buffer, m + 12);
+	  xdg_uint32_t data_offset = GET_UINT32 (cache->buffer, m + 16);
+	  xdg_uint32_t mask_offset = GET_UINT32 (cache->buffer, m + 20);
+	  unsigned char value, mask;
+
+	  value = data_length ? ((unsigned char *)cache->buffer)[data_offset] : 0;
+	  mask = mask_offset ? ((unsigned char *)cache->buffer)[mask_offset] : 0xff;
+
+	  /* The cache tries range_length + 1 positions */
+	  if (range_length + 1 == 0)
+	    mask = 0;
+
+	  _xdg_mime_magic_index_add_probe (cache->magic_index, j,
+					   range_start, range_length + 1,
+					   data_length, value, mask);
+	}
+
+      _xdg_mime_magic_index_set_type (cache->magic_index, j,
+				      _xdg_mime_unalias_mime_type (cache->buffer + mimetype_offset));
+    }
+
+  _xdg_mime_magic_index_compile (cache->magic_index);
+}
+
+/* The same as cache_magic_lookup_data_all, but only trying the entries
+ * the index leaves as candidates.
+ */
 static const char *
-cache_magic_lookup_data (XdgMimeCache *cache, 
-			 const void   *data, 
-			 size_t        len, 
-			 int          *prio,
-			 const char   *mime_types[],
-			 int           n_mime_types)
+cache_magic_lookup_data_indexed (XdgMimeCache *cache, 
+				 const void   *data, 
+				 size_t        len, 
+				 int          *prio,
+				 const char   *mime_types[],
+				 int           n_mime_types)
+{
+  XdgMimeRuleSetStack stack;
+  XdgMimeRuleSet *set;
+  xdg_uint32_t list_offset;
+  xdg_uint32_t offset;
+  const char *match;
+
+  int n_rules, n_words, first, w, n;
+
+  *prio = 0;
+
+  list_offset = GET_UINT32 (cache->buffer, 24);
+  offset = GET_UINT32 (cache->buffer, list_offset + 8);
+
+  n_rules = _xdg_mime_magic_index_n_rules (cache->magic_index);
+  n_words = XDG_RULE_SET_SIZE (n_rules);
+  set = _xdg_mime_rule_set_alloc (&stack, n_words);
+  _xdg_mime_magic_index_candidates (cache->magic_index, data, len, set);
+
+  /* The first candidate that matches wins */
+  match = NULL;
+  first = n_rules;
+  for (w = 0; w < n_words && match == NULL; w++)
+    {
+      XdgMimeRuleSet bits = set[w];
+
+      while (bits)
+	{
+	  int j = w * XDG_RULE_SET_BITS + XDG_RULE_SET_LOWEST (bits);
+
+	  bits &= bits - 1;
+
+	  match = cache_magic_compare_to_data (cache, offset + 16 * j,
+					       data, len, prio);
+	  if (match)
+	    {
+	      first = j;
+	      break;
+	    }
+	}
+    }
+
+  _xdg_mime_rule_set_free (&stack, set);
+
+  /* Every entry before it failed, so those rule out their types */
+  for (n = 0; n < n_mime_types; n++)
+    {
+      const int *rules;
+
+      if (mime_types[n] == NULL)
+	continue;
+
+      if (_xdg_mime_magic_index_rules_of_type (cache->magic_index,
+					       _xdg_mime_unalias_mime_type (mime_types[n]),
+					       &rules) > 0 &&
+	  rules[0] < first)
+	mime_types[n] = NULL;
+    }
+
+  return match;
+}
+
+static const char *
+cache_magic_lookup_data_all (XdgMimeCache *cache, 
+			     const void   *data, 
+			     size_t        len, 
+			     int          *prio,
+			     const char   *mime_types[],
+			     int           n_mime_types)
 {
   xdg_uint32_t list_offset;
   xdg_uint32_t n_entries;
@@ -306,6 +409,22 @@ cache_magic_lookup_data (XdgMimeCache *cache,
   return NULL;
 }
 
+static const char *
+cache_magic_lookup_data (XdgMimeCache *cache, 
+			 const void   *data, 
+			 size_t        len, 
+			 int          *prio,
+			 const char   *mime_types[],
+			 int           n_mime_types)
+{
+  if (_xdg_mime_magic_index_enabled && cache->magic_index != NULL)
+    return cache_magic_lookup_data_indexed (cache, data, len, prio,
+					    mime_types, n_mime_types);
+
+  return cache_magic_lookup_data_all (cache, data, len, prio,
+				      mime_types, n_mime_types);
+}
+
 static const char *
 cache_alias_lookup (const char *alias)
 {
@@ -472,7 +591,7 @@ cache_glob_node_lookup_suffix (XdgMimeCache *cache,
 	      while (n < n_mime_types && i < n_children)
 		{
 		  match_char = GET_UINT32 (cache->buffer, child_offset + 16 * i);
-		  mimetype_offset = GET_UINT32 (cache->buffer, offset + 16 * i + 4);
+		  mimetype_offset = GET_UINT32 (cache->buffer, child_offset + 16 * i + 4);
 		  if (match_char != 0)
 		    break;
 
@@ -575,6 +694,14 @@ cache_glob_lookup_file_name (const char *file_name,
   
   assert (file_name != NULL);
 
+  if (_caches_glob_index && _xdg_glob_index_enabled)
+    {
+      n = _xdg_glob_index_lookup_file_name (_caches_glob_index, file_name,
+					    mime_types, n_mime_types);
+      if (n >= 0)
+	return n;
+    }
+
   /* First, check the literals */
   n = cache_glob_lookup_literal (file_name, mime_types, n_mime_types);
   if (n > 0)
@@ -601,6 +728,92 @@ cache_glob_lookup_file_name (const char *file_name,
   return cache_glob_lookup_fnmatch (file_name, mime_types, n_mime_types);
 }
 
+/* Adds the suffixes in the tree at 'offset', whose characters follow
+ * those in 'suffix', to the index */
+static void
+cache_glob_index_nodes (XdgGlobIndex  *index,
+			XdgMimeCache  *cache,
+			xdg_uint32_t   n_entries,
+			xdg_uint32_t   offset,
+			xdg_unichar_t *suffix,
+			int            depth)
+{
+  const char *mime_types[16];
+  int i, j, n;
+
+  for (i = 0; i < n_entries; i++)
+    {
+      xdg_uint32_t match_char = GET_UINT32 (cache->buffer, offset + 16 * i);
+      xdg_uint32_t mimetype_offset = GET_UINT32 (cache->buffer, offset + 16 * i + 4);
+      xdg_uint32_t n_children = GET_UINT32 (cache->buffer, offset + 16 * i + 8);
+      xdg_uint32_t child_offset = GET_UINT32 (cache->buffer, offset + 16 * i + 12);
+
+      /* The other types of the suffix above */
+      if (match_char == 0)
+	continue;
+
+      suffix[depth] = match_char;
+
+      n = 0;
+      if (mimetype_offset)
+	mime_types[n++] = cache->buffer + mimetype_offset;
+      for (j = 0; j < n_children && n < 16; j++)
+	{
+	  if (GET_UINT32 (cache->buffer, child_offset + 16 * j) != 0)
+	    break;
+	  mime_types[n++] = cache->buffer + GET_UINT32 (cache->buffer, child_offset + 16 * j + 4);
+	}
+      if (n > 0)
+	_xdg_glob_index_add_suffix (index, suffix, depth + 1, mime_types, n);
+
+      if (depth + 1 < 255)
+	cache_glob_index_nodes (index, cache, n_children, child_offset, suffix, depth + 1);
+    }
+}
+
+/* The globs of all the caches in one index, in the order they are tried:
+ * the literals and suffixes of a cache hide those of the ones after it,
+ * and the other globs go by cache */
+XdgGlobIndex *
+_xdg_mime_cache_build_glob_index (XdgMimeCache **caches)
+{
+  XdgGlobIndex *index;
+  xdg_unichar_t suffix[255];
+  int i, j;
+
+  index = _xdg_glob_index_new ();
+
+  for (i = 0; caches[i]; i++)
+    {
+      XdgMimeCache *cache = caches[i];
+      xdg_uint32_t list_offset = GET_UINT32 (cache->buffer, 12);
+      xdg_uint32_t n_entries = GET_UINT32 (cache->buffer, list_offset);
+
+      for (j = 0; j < n_entries; j++)
+	_xdg_glob_index_add_literal (index,
+				     cache->buffer + GET_UINT32 (cache->buffer, list_offset + 4 + 8 * j),
+				     cache->buffer + GET_UINT32 (cache->buffer, list_offset + 4 + 8 * j + 4));
+
+      list_offset = GET_UINT32 (cache->buffer, 16);
+      cache_glob_index_nodes (index, cache,
+			      GET_UINT32 (cache->buffer, list_offset),
+			      GET_UINT32 (cache->buffer, list_offset + 4),
+			      suffix, 0);
+
+      list_offset = GET_UINT32 (cache->buffer, 20);
+      n_entries = GET_UINT32 (cache->buffer, list_offset);
+      for (j = 0; j < n_entries; j++)
+	_xdg_glob_index_add_glob (index,
+				  cache->buffer + GET_UINT32 (cache->buffer, list_offset + 4 + 8 * j),
+				  cache->buffer + GET_UINT32 (cache->buffer, list_offset + 4 + 8 * j + 4),
+				  i);
+    }
+
+  _xdg_glob_index_compile (index);
+
+  return index;
+}
+
 int
 _xdg_mime_cache_get_max_buffer_extents (void)
 {
@@ -666,73 +879,21 @@ _xdg_mime_cache_get_mime_type_for_data (const void *data,
   return cache_get_mime_type_for_data (data, len, NULL, 0);
 }
 
-const char *
-_xdg_mime_cache_get_mime_type_for_file (const char  *file_name,
-					struct stat *statbuf)
+int
+_xdg_mime_cache_glob_lookup_file_name (const char *file_name,
+				       const char *mime_types[],
+				       int         n_mime_types)
 {
-  const char *mime_type;
-  const char *mime_types[2];
-  FILE *file;
-  unsigned char *data;
-  int max_extent;
-  int bytes_read;
-  struct stat buf;
-  const char *base_name;
-  int n;
-
-  if (file_name == NULL)
-    return NULL;
-
-  if (! _xdg_utf8_validate (file_name))
-    return NULL;
-
-  base_name = _xdg_get_base_name (file_name);
-  n = cache_glob_lookup_file_name (base_name, mime_types, 2);
-
-  if (n == 1)
-    return mime_types[0];
-
-  if (!statbuf)
-    {
-      if (stat (file_name, &buf) != 0)
-	return XDG_MIME_TYPE_UNKNOWN;
-
-      statbuf = &buf;
-    }
-
-  if (!S_ISREG (statbuf->st_mode))
-    return XDG_MIME_TYPE_UNKNOWN;
-
-  /* FIXME: Need to make sure that max_extent isn't totally broken.  This could
-   * be large and need getting from a stream instead of just reading it all
-   * in. */
-  max_extent = _xdg_mime_cache_get_max_buffer_extents ();
-  data = malloc (max_extent);
-  if (data == NULL)
-    return XDG_MIME_TYPE_UNKNOWN;
-        
-  file = fopen (file_name, "r");
-  if (file == NULL)
-    {
-      free (data);
-      return XDG_MIME_TYPE_UNKNOWN;
-    }
-
-  bytes_read = fread (data, 1, max_extent, file);
-  if (ferror (file))
-    {
-      free (data);
-      fclose (file);
-      return XDG_MIME_TYPE_UNKNOWN;
-    }
-
-  mime_type = cache_get_mime_type_for_data (data, bytes_read,
-					    mime_types, n);
-
-  free (data);
-  fclose (file);
+  return cache_glob_lookup_file_name (file_name, mime_types, n_mime_types);
+}
 
-  return mime_type;
+const char *
+_xdg_mime_cache_magic_lookup_data (const void *data,
+				   size_t      len,
+				   const char *mime_types[],
+				   int         n_mime_types)
+{
+  return cache_get_mime_type_for_data (data, len, mime_types, n_mime_types);
 }
 
 const char *
@@ -783,7 +944,7 @@ _xdg_mime_cache_mime_type_subclass (const char *mime,
 #if 1
   /* Handle supertypes */
   if (is_super_type (ubase) &&
-      xdg_mime_media_type_equal (umime, ubase))
+      _xdg_mime_media_type_equal (umime, ubase))
     return 1;
 #endif
 
@@ -855,7 +1016,7 @@ _xdg_mime_cache_list_mime_parents (const char *mime)
   char *all_parents[128]; /* we'll stop at 128 */ 
   char **result;
 
-  mime = xdg_mime_unalias_mime_type (mime);
+  mime = _xdg_mime_unalias_mime_type (mime);
 
   p = 0;
   for (i = 0; _caches[i]; i++)
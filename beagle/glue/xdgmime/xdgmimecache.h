@@ -28,6 +28,7 @@
 #define __XDG_MIME_CACHE_H__
 
 #include "xdgmime.h"
+#include "xdgmimeglobindex.h"
 
 typedef struct _XdgMimeCache XdgMimeCache;
 
@@ -37,25 +38,41 @@ typedef struct _XdgMimeCache XdgMimeCache;
 #define _xdg_mime_cache_unref                         XDG_ENTRY(cache_unref)
 #define _xdg_mime_cache_get_max_buffer_extents        XDG_ENTRY(cache_get_max_buffer_extents)
 #define _xdg_mime_cache_get_mime_type_for_data        XDG_ENTRY(cache_get_mime_type_for_data)
-#define _xdg_mime_cache_get_mime_type_for_file        XDG_ENTRY(cache_get_mime_type_for_file)
+#define _xdg_mime_cache_glob_lookup_file_name         XDG_ENTRY(cache_glob_lookup_file_name)
+#define _xdg_mime_cache_magic_lookup_data             XDG_ENTRY(cache_magic_lookup_data)
 #define _xdg_mime_cache_get_mime_type_from_file_name  XDG_ENTRY(cache_get_mime_type_from_file_name)
 #define _xdg_mime_cache_list_mime_parents             XDG_ENTRY(cache_list_mime_parents)
 #define _xdg_mime_cache_mime_type_subclass            XDG_ENTRY(cache_mime_type_subclass)
 #define _xdg_mime_cache_unalias_mime_type             XDG_ENTRY(cache_unalias_mime_type)
+#define _xdg_mime_cache_build_index                   XDG_ENTRY(cache_build_index)
+#define _xdg_mime_cache_build_glob_index              XDG_ENTRY(cache_build_glob_index)
 
 #endif
 
-extern XdgMimeCache **_caches;
+/* Those of the snapshot the calling thread is using */
+extern __thread XdgMimeCache **_caches;
+/* And the index of their globs */
+extern __thread XdgGlobIndex *_caches_glob_index;
 
 XdgMimeCache *_xdg_mime_cache_new_from_file (const char   *file_name);
 XdgMimeCache *_xdg_mime_cache_ref           (XdgMimeCache *cache);
 void          _xdg_mime_cache_unref         (XdgMimeCache *cache);
+void          _xdg_mime_cache_build_index   (XdgMimeCache *cache);
+XdgGlobIndex *_xdg_mime_cache_build_glob_index (XdgMimeCache **caches);
 
 
 const char  *_xdg_mime_cache_get_mime_type_for_data       (const void *data,
 		 				           size_t      len);
-const char  *_xdg_mime_cache_get_mime_type_for_file       (const char  *file_name,
-							   struct stat *statbuf);
+/* The steps of a lookup by file name and contents.  The glob lookup takes
+ * a base name; the magic lookup picks between the glob candidates it is
+ * given, if any, and falls back on the first of them. */
+int          _xdg_mime_cache_glob_lookup_file_name        (const char *file_name,
+							   const char *mime_types[],
+							   int         n_mime_types);
+const char  *_xdg_mime_cache_magic_lookup_data            (const void *data,
+							   size_t      len,
+							   const char *mime_types[],
+							   int         n_mime_types);
 const char  *_xdg_mime_cache_get_mime_type_from_file_name (const char *file_name);
 int          _xdg_mime_cache_is_valid_mime_type           (const char *mime_type);
 int          _xdg_mime_cache_mime_type_equal              (const char *mime_a,
@@ -30,6 +30,7 @@
 #endif
 
 #include "xdgmimeglob.h"
+#include "xdgmimeglobindex.h"
 #include "xdgmimeint.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -67,6 +68,9 @@ struct XdgGlobHash
   XdgGlobList *literal_list;
   XdgGlobHashNode *simple_node;
   XdgGlobList *full_list;
+
+  /* Built once the globs are all read */
+  XdgGlobIndex *index;
 };
 
 
@@ -349,6 +353,14 @@ _xdg_glob_hash_lookup_file_name (XdgGlobHash *glob_hash,
 
   assert (file_name != NULL && n_mime_types > 0);
 
+  if (glob_hash->index && _xdg_glob_index_enabled)
+    {
+      n = _xdg_glob_index_lookup_file_name (glob_hash->index, file_name,
+					    mime_types, n_mime_types);
+      if (n >= 0)
+	return n;
+    }
+
   for (list = glob_hash->literal_list; list; list = list->next)
     {
       if (strcmp ((const char *)list->data, file_name) == 0)
@@ -430,9 +442,65 @@ _xdg_glob_hash_free (XdgGlobHash *glob_hash)
   _xdg_glob_list_free (glob_hash->literal_list);
   _xdg_glob_list_free (glob_hash->full_list);
   _xdg_glob_hash_free_nodes (glob_hash->simple_node);
+  _xdg_glob_index_free (glob_hash->index);
   free (glob_hash);
 }
 
+/* Adds the suffixes under 'node', whose characters follow those in
+ * 'suffix', to the index */
+static void
+_xdg_glob_hash_index_nodes (XdgGlobIndex    *index,
+			    XdgGlobHashNode *node,
+			    xdg_unichar_t   *suffix,
+			    int              depth)
+{
+  const char *mime_types[16];
+  XdgGlobHashNode *child;
+  int n;
+
+  for (; node; node = node->next)
+    {
+      /* The other types of the suffix above */
+      if (node->character == 0)
+	continue;
+
+      suffix[depth] = node->character;
+
+      if (node->mime_type)
+	{
+	  n = 0;
+	  mime_types[n++] = node->mime_type;
+	  for (child = node->child; child && child->character == 0 && n < 16; child = child->next)
+	    mime_types[n++] = child->mime_type;
+
+	  _xdg_glob_index_add_suffix (index, suffix, depth + 1, mime_types, n);
+	}
+
+      if (depth + 1 < 255)
+	_xdg_glob_hash_index_nodes (index, node->child, suffix, depth + 1);
+    }
+}
+
+void
+_xdg_glob_hash_build_index (XdgGlobHash *glob_hash)
+{
+  xdg_unichar_t suffix[255];
+  XdgGlobList *list;
+
+  _xdg_glob_index_free (glob_hash->index);
+  glob_hash->index = _xdg_glob_index_new ();
+
+  for (list = glob_hash->literal_list; list; list = list->next)
+    _xdg_glob_index_add_literal (glob_hash->index, list->data, list->mime_type);
+
+  _xdg_glob_hash_index_nodes (glob_hash->index, glob_hash->simple_node, suffix, 0);
+
+  for (list = glob_hash->full_list; list; list = list->next)
+    _xdg_glob_index_add_glob (glob_hash->index, list->data, list->mime_type, 0);
+
+  _xdg_glob_index_compile (glob_hash->index);
+}
+
 XdgGlobType
 _xdg_glob_determine_type (const char *glob)
 {
@@ -48,6 +48,7 @@ typedef enum
 #define _xdg_glob_hash_append_glob            XDG_ENTRY(hash_append_glob)
 #define _xdg_glob_determine_type              XDG_ENTRY(determine_type)
 #define _xdg_glob_hash_dump                   XDG_ENTRY(hash_dump)
+#define _xdg_glob_hash_build_index            XDG_ENTRY(hash_build_index)
 #endif
 
 void         _xdg_mime_glob_read_from_file   (XdgGlobHash *glob_hash,
@@ -63,5 +64,7 @@ void         _xdg_glob_hash_append_glob      (XdgGlobHash *glob_hash,
 					      const char  *mime_type);
 XdgGlobType  _xdg_glob_determine_type        (const char  *glob);
 void         _xdg_glob_hash_dump             (XdgGlobHash *glob_hash);
+/* Compiles the globs read so far for faster lookups */
+void         _xdg_glob_hash_build_index      (XdgGlobHash *glob_hash);
 
 #endif /* __XDG_MIME_GLOB_H__ */
@@ -0,0 +1,758 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* xdgmimeglobindex.c: Private file.  The globs compiled for matching file
+ * names in a single pass.
+ *
+ * More info can be found at http://www.freedesktop.org/standards/
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "xdgmimeglobindex.h"
+#include "xdgmimeint.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+/* The suffix trie is built as linked nodes, then laid out as states with
+ * their edges sorted by character.  The root, which the last character of
+ * a name leads out of, has a table for the ASCII ones.
+ */
+typedef struct XdgGlobSuffixNode XdgGlobSuffixNode;
+
+struct XdgGlobSuffixNode
+{
+  xdg_unichar_t character;
+  const char **mime_types;
+  int n_mime_types;
+  XdgGlobSuffixNode *next;
+  XdgGlobSuffixNode *child;
+};
+
+typedef struct
+{
+  int first_edge;
+  int n_edges;
+  int first_type;
+  int n_types;
+} XdgGlobSuffixState;
+
+typedef struct
+{
+  xdg_unichar_t character;
+  int state;
+} XdgGlobSuffixEdge;
+
+typedef struct
+{
+  const char *literal;
+  const char *mime_type;
+  xdg_uint32_t hash;
+} XdgGlobLiteral;
+
+/* The automaton has a bit for each position in each glob it takes, set
+ * while the name read so far matches the glob up to there.  A character
+ * moves the bits past the elements it matches, and '*' keeps its bit set
+ * and lets it through to the next position without reading anything.
+ */
+typedef struct
+{
+  const char *glob;
+  const char *mime_type;
+  int group;
+  int accept;			/* The bit for a whole match, or -1 */
+} XdgGlobPattern;
+
+typedef struct
+{
+  int star;
+  unsigned char set[128];
+} XdgGlobElement;
+
+#define GLOB_WORD_BITS 64
+#define MAX_STACK_WORDS 16
+
+struct XdgGlobIndex
+{
+  XdgGlobLiteral *literals;
+  int n_literals;
+  int n_allocated_literals;
+  int *literal_table;		/* Literal + 1, or 0 */
+  xdg_uint32_t literal_mask;
+
+  XdgGlobSuffixNode *suffix_nodes;
+  int n_suffix_nodes;
+  XdgGlobSuffixState *states;
+  XdgGlobSuffixEdge *edges;
+  const char **types;
+  int root[128];
+  unsigned char stopchars[128];
+
+  XdgGlobPattern *globs;
+  int n_globs;
+  int n_allocated_globs;
+  int n_words;
+  uint64_t *masks;		/* n_words for each ASCII character */
+  uint64_t *star;
+  uint64_t *start;
+};
+
+int _xdg_glob_index_enabled = TRUE;
+
+#define FNV_OFFSET 2166136261U
+#define FNV_PRIME 16777619U
+
+static xdg_uint32_t
+glob_index_hash (const char *string)
+{
+  const unsigned char *p;
+  xdg_uint32_t hash = FNV_OFFSET;
+
+  for (p = (const unsigned char *) string; *p; p++)
+    hash = (hash ^ *p) * FNV_PRIME;
+
+  return hash;
+}
+
+XdgGlobIndex *
+_xdg_glob_index_new (void)
+{
+  XdgGlobIndex *index;
+
+  index = calloc (1, sizeof (XdgGlobIndex));
+  index->suffix_nodes = calloc (1, sizeof (XdgGlobSuffixNode));
+  index->n_suffix_nodes = 1;
+
+  return index;
+}
+
+static void
+glob_index_free_nodes (XdgGlobSuffixNode *node)
+{
+  while (node)
+    {
+      XdgGlobSuffixNode *next = node->next;
+
+      glob_index_free_nodes (node->child);
+      free (node->mime_types);
+      free (node);
+      node = next;
+    }
+}
+
+void
+_xdg_glob_index_free (XdgGlobIndex *index)
+{
+  if (index == NULL)
+    return;
+
+  if (index->suffix_nodes)
+    {
+      glob_index_free_nodes (index->suffix_nodes->child);
+      free (index->suffix_nodes->mime_types);
+      free (index->suffix_nodes);
+    }
+
+  free (index->literals);
+  free (index->literal_table);
+  free (index->states);
+  free (index->edges);
+  free (index->types);
+  free (index->globs);
+  free (index->masks);
+  free (index->star);
+  free (index->start);
+  free (index);
+}
+
+void
+_xdg_glob_index_add_literal (XdgGlobIndex *index,
+			     const char   *literal,
+			     const char   *mime_type)
+{
+  XdgGlobLiteral *entry;
+
+  if (index->n_literals == index->n_allocated_literals)
+    {
+      index->n_allocated_literals = index->n_allocated_literals ? 2 * index->n_allocated_literals : 64;
+      index->literals = realloc (index->literals, index->n_allocated_literals * sizeof (XdgGlobLiteral));
+    }
+
+  entry = &index->literals[index->n_literals++];
+  entry->literal = literal;
+  entry->mime_type = mime_type;
+  entry->hash = glob_index_hash (literal);
+}
+
+/* The child of 'node' for 'character', added in order if there isn't one */
+static XdgGlobSuffixNode *
+glob_index_get_child (XdgGlobIndex      *index,
+		      XdgGlobSuffixNode *node,
+		      xdg_unichar_t      character)
+{
+  XdgGlobSuffixNode **link, *child;
+
+  for (link = &node->child; *link && (*link)->character < character; link = &(*link)->next)
+    ;
+
+  if (*link && (*link)->character == character)
+    return *link;
+
+  child = calloc (1, sizeof (XdgGlobSuffixNode));
+  child->character = character;
+  child->next = *link;
+  *link = child;
+  index->n_suffix_nodes++;
+
+  return child;
+}
+
+void
+_xdg_glob_index_add_suffix (XdgGlobIndex        *index,
+			    const xdg_unichar_t *suffix,
+			    int                  length,
+			    const char          *mime_types[],
+			    int                  n_mime_types)
+{
+  XdgGlobSuffixNode *node;
+  int i;
+
+  if (length <= 0 || n_mime_types <= 0)
+    return;
+
+  node = index->suffix_nodes;
+  for (i = length - 1; i >= 0; i--)
+    node = glob_index_get_child (index, node, suffix[i]);
+
+  if (node->n_mime_types > 0)
+    return;
+
+  node->mime_types = malloc (n_mime_types * sizeof (const char *));
+  memcpy (node->mime_types, mime_types, n_mime_types * sizeof (const char *));
+  node->n_mime_types = n_mime_types;
+
+  if (suffix[0] < 128)
+    index->stopchars[suffix[0]] = TRUE;
+}
+
+void
+_xdg_glob_index_add_glob (XdgGlobIndex *index,
+			  const char   *glob,
+			  const char   *mime_type,
+			  int           group)
+{
+  XdgGlobPattern *pattern;
+
+  if (index->n_globs == index->n_allocated_globs)
+    {
+      index->n_allocated_globs = index->n_allocated_globs ? 2 * index->n_allocated_globs : 16;
+      index->globs = realloc (index->globs, index->n_allocated_globs * sizeof (XdgGlobPattern));
+    }
+
+  pattern = &index->globs[index->n_globs++];
+  pattern->glob = glob;
+  pattern->mime_type = mime_type;
+  pattern->group = group;
+  pattern->accept = -1;
+}
+
+static void
+glob_index_compile_literals (XdgGlobIndex *index)
+{
+  xdg_uint32_t size, slot;
+  int i, j;
+
+  for (size = 16; size < 2 * (xdg_uint32_t) index->n_literals; size *= 2)
+    ;
+  index->literal_table = calloc (size, sizeof (int));
+  index->literal_mask = size - 1;
+
+  for (i = 0; i < index->n_literals; i++)
+    {
+      XdgGlobLiteral *entry = &index->literals[i];
+
+      for (slot = entry->hash & index->literal_mask;
+	   (j = index->literal_table[slot]) != 0;
+	   slot = (slot + 1) & index->literal_mask)
+	{
+	  if (strcmp (index->literals[j - 1].literal, entry->literal) == 0)
+	    break;
+	}
+
+      /* The first one for a name wins */
+      if (j == 0)
+	index->literal_table[slot] = i + 1;
+    }
+}
+
+/* Lays the states out breadth first, so that a state's edges are next to
+ * each other, and frees the nodes */
+static void
+glob_index_compile_suffixes (XdgGlobIndex *index)
+{
+  XdgGlobSuffixNode **queue, *node, *child;
+  int n_states, n_edges, n_types, head, i;
+
+  queue = malloc (index->n_suffix_nodes * sizeof (XdgGlobSuffixNode *));
+  index->states = calloc (index->n_suffix_nodes, sizeof (XdgGlobSuffixState));
+  index->edges = malloc (index->n_suffix_nodes * sizeof (XdgGlobSuffixEdge));
+
+  n_types = 0;
+  for (i = 0; i < 128; i++)
+    index->root[i] = -1;
+
+  queue[0] = index->suffix_nodes;
+  n_states = 1;
+  n_edges = 0;
+  for (head = 0; head < n_states; head++)
+    {
+      XdgGlobSuffixState *state = &index->states[head];
+
+      node = queue[head];
+      n_types += node->n_mime_types;
+
+      state->first_edge = n_edges;
+      for (child = node->child; child; child = child->next)
+	{
+	  index->edges[n_edges].character = child->character;
+	  index->edges[n_edges].state = n_states;
+	  if (head == 0 && child->character < 128)
+	    index->root[child->character] = n_states;
+	  queue[n_states++] = child;
+	  n_edges++;
+	}
+      state->n_edges = n_edges - state->first_edge;
+    }
+
+  index->types = malloc ((n_types ? n_types : 1) * sizeof (const char *));
+  n_types = 0;
+  for (i = 0; i < n_states; i++)
+    {
+      node = queue[i];
+      index->states[i].first_type = n_types;
+      index->states[i].n_types = node->n_mime_types;
+      if (node->n_mime_types)
+	memcpy (index->types + n_types, node->mime_types, node->n_mime_types * sizeof (const char *));
+      n_types += node->n_mime_types;
+    }
+
+  for (i = 0; i < n_states; i++)
+    {
+      free (queue[i]->mime_types);
+      free (queue[i]);
+    }
+  free (queue);
+
+  index->suffix_nodes = NULL;
+}
+
+/* Breaks a glob into what the automaton can match, or returns -1 for those
+ * fnmatch has to see to: anything not ASCII, character classes, and
+ * whatever it would read differently from the plain reading here.
+ */
+static int
+glob_index_parse (const char     *glob,
+		  XdgGlobElement *elements)
+{
+  const unsigned char *p = (const unsigned char *) glob;
+  int n = 0;
+  int negate, first, c, hi;
+
+  while (*p)
+    {
+      XdgGlobElement *element = &elements[n];
+
+      if (*p >= 128)
+	return -1;
+
+      memset (element, 0, sizeof (XdgGlobElement));
+
+      switch (*p)
+	{
+	case '*':
+	  p++;
+	  /* Runs of them are the same as one */
+	  if (n > 0 && elements[n - 1].star)
+	    continue;
+	  element->star = TRUE;
+	  break;
+	case '?':
+	  memset (element->set + 1, TRUE, 127);
+	  p++;
+	  break;
+	case '\\':
+	  p++;
+	  if (*p == '\0' || *p >= 128)
+	    return -1;
+	  element->set[*p++] = TRUE;
+	  break;
+	case '[':
+	  p++;
+	  negate = (*p == '!' || *p == '^');
+	  if (negate)
+	    p++;
+	  for (first = TRUE; ; first = FALSE)
+	    {
+	      c = *p;
+	      if (c == '\0' || c >= 128 || c == '\\')
+		return -1;
+	      if (c == ']' && ! first)
+		break;
+	      if (c == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.'))
+		return -1;
+
+	      if (p[1] == '-' && p[2] != ']' && p[2] != '\0')
+		{
+		  hi = p[2];
+		  if (hi >= 128 || hi == '\\' || hi < c ||
+		      (hi == '[' && (p[3] == ':' || p[3] == '=' || p[3] == '.')))
+		    return -1;
+		  memset (element->set + c, TRUE, hi - c + 1);
+		  p += 3;
+		}
+	      else
+		{
+		  element->set[c] = TRUE;
+		  p++;
+		}
+	    }
+	  p++;
+	  if (negate)
+	    {
+	      for (c = 1; c < 128; c++)
+		element->set[c] = ! element->set[c];
+	    }
+	  break;
+	default:
+	  element->set[*p++] = TRUE;
+	  break;
+	}
+
+      n++;
+    }
+
+  return n;
+}
+
+#define SET_BIT(words, bit) ((words)[(bit) / GLOB_WORD_BITS] |= (uint64_t) 1 << ((bit) % GLOB_WORD_BITS))
+#define HAS_BIT(words, bit) (((words)[(bit) / GLOB_WORD_BITS] >> ((bit) % GLOB_WORD_BITS)) & 1)
+
+/* Lets the bits before a '*' through it */
+static uint64_t
+glob_index_close (const uint64_t *star,
+		  uint64_t       *state,
+		  int             n_words)
+{
+  uint64_t carry = 0, any = 0;
+  int w;
+
+  for (w = 0; w < n_words; w++)
+    {
+      uint64_t through = state[w] & star[w];
+
+      state[w] |= (through << 1) | carry;
+      carry = through >> (GLOB_WORD_BITS - 1);
+      any |= state[w];
+    }
+
+  return any;
+}
+
+static void
+glob_index_compile_globs (XdgGlobIndex *index)
+{
+  XdgGlobElement *elements;
+  int *n_elements;
+  int i, j, c, bit, n_bits, max_length;
+
+  max_length = 0;
+  for (i = 0; i < index->n_globs; i++)
+    {
+      int length = strlen (index->globs[i].glob);
+
+      if (length > max_length)
+	max_length = length;
+    }
+
+  elements = malloc ((max_length + 1) * sizeof (XdgGlobElement));
+  n_elements = malloc ((index->n_globs + 1) * sizeof (int));
+
+  n_bits = 0;
+  for (i = 0; i < index->n_globs; i++)
+    {
+      n_elements[i] = glob_index_parse (index->globs[i].glob, elements);
+      if (n_elements[i] >= 0)
+	n_bits += n_elements[i] + 1;
+    }
+
+  index->n_words = (n_bits + GLOB_WORD_BITS - 1) / GLOB_WORD_BITS;
+  index->masks = calloc (128 * index->n_words + 1, sizeof (uint64_t));
+  index->star = calloc (index->n_words + 1, sizeof (uint64_t));
+  index->start = calloc (index->n_words + 1, sizeof (uint64_t));
+
+  bit = 0;
+  for (i = 0; i < index->n_globs; i++)
+    {
+      if (n_elements[i] < 0)
+	continue;
+
+      glob_index_parse (index->globs[i].glob, elements);
+
+      SET_BIT (index->start, bit);
+      for (j = 0; j < n_elements[i]; j++, bit++)
+	{
+	  if (elements[j].star)
+	    {
+	      SET_BIT (index->star, bit);
+	      continue;
+	    }
+
+	  for (c = 1; c < 128; c++)
+	    {
+	      if (elements[j].set[c])
+		SET_BIT (index->masks + c * index->n_words, bit);
+	    }
+	}
+
+      index->globs[i].accept = bit++;
+    }
+
+  glob_index_close (index->star, index->start, index->n_words);
+
+  free (elements);
+  free (n_elements);
+}
+
+void
+_xdg_glob_index_compile (XdgGlobIndex *index)
+{
+  glob_index_compile_literals (index);
+  glob_index_compile_suffixes (index);
+  glob_index_compile_globs (index);
+}
+
+static int
+glob_index_next_state (XdgGlobIndex  *index,
+		       int            state,
+		       xdg_unichar_t  character)
+{
+  const XdgGlobSuffixEdge *edges;
+  int min, max, mid;
+
+  if (state == 0 && character < 128)
+    return index->root[character];
+
+  edges = index->edges + index->states[state].first_edge;
+  min = 0;
+  max = index->states[state].n_edges - 1;
+  while (min <= max)
+    {
+      mid = (min + max) / 2;
+      if (edges[mid].character < character)
+	min = mid + 1;
+      else if (edges[mid].character > character)
+	max = mid - 1;
+      else
+	return edges[mid].state;
+    }
+
+  return -1;
+}
+
+/* Walks back from the end of the name, and returns the state of the
+ * longest suffix that begins with a stop character, or -1.  The name has
+ * to be valid UTF-8, for the characters to start where they are found to.
+ */
+static int
+glob_index_walk_suffix (XdgGlobIndex  *index,
+			const char    *file_name,
+			const char    *end,
+			int            ignore_case,
+			const char   **start)
+{
+  const char *p;
+  xdg_unichar_t character;
+  int state = 0, found = -1;
+
+  while (end > file_name)
+    {
+      p = end - 1;
+      while (p > file_name && (*p & 0xC0) == 0x80)
+	p--;
+
+      character = (unsigned char) *p < 128 ? (unsigned char) *p : _xdg_utf8_to_ucs4 (p);
+      if (ignore_case)
+	character = _xdg_ucs4_to_lower (character);
+
+      state = glob_index_next_state (index, state, character);
+      if (state < 0)
+	break;
+
+      if (index->states[state].n_types > 0 &&
+	  (unsigned char) *p < 128 && index->stopchars[(unsigned char) *p])
+	{
+	  found = state;
+	  *start = p;
+	}
+
+      end = p;
+    }
+
+  return found;
+}
+
+/* Returns whether any of the globs the automaton takes are still matching
+ * at the end of the name, with their bits set in 'state' */
+static int
+glob_index_run (XdgGlobIndex        *index,
+		const unsigned char *file_name,
+		uint64_t            *state)
+{
+  const uint64_t *mask;
+  uint64_t carry, moved;
+  int w;
+
+  memcpy (state, index->start, index->n_words * sizeof (uint64_t));
+
+  for (; *file_name; file_name++)
+    {
+      mask = index->masks + *file_name * index->n_words;
+
+      carry = 0;
+      for (w = 0; w < index->n_words; w++)
+	{
+	  moved = state[w] & mask[w];
+	  state[w] = (moved << 1) | carry | (state[w] & index->star[w]);
+	  carry = moved >> (GLOB_WORD_BITS - 1);
+	}
+
+      if (! glob_index_close (index->star, state, index->n_words))
+	return FALSE;
+    }
+
+  return TRUE;
+}
+
+int
+_xdg_glob_index_lookup_file_name (XdgGlobIndex *index,
+				  const char   *file_name,
+				  const char   *mime_types[],
+				  int           n_mime_types)
+{
+  const unsigned char *p;
+  const char *end, *start_exact = NULL, *start_folded = NULL;
+  uint64_t stack_state[MAX_STACK_WORDS], *state;
+  xdg_uint32_t hash, slot;
+  int ascii, matching, exact, folded, n, i, j, group;
+
+  /* Hash the name for the literals, and make sure it can be walked back */
+  hash = FNV_OFFSET;
+  ascii = TRUE;
+  for (p = (const unsigned char *) file_name; *p; )
+    {
+      if (*p < 128)
+	{
+	  hash = (hash ^ *p++) * FNV_PRIME;
+	  continue;
+	}
+
+      ascii = FALSE;
+      n = _xdg_utf8_char_size (p);
+      if (n == 1)
+	return -1;
+      hash = (hash ^ *p++) * FNV_PRIME;
+      for (i = 1; i < n; i++)
+	{
+	  if ((*p & 0xC0) != 0x80)
+	    return -1;
+	  hash = (hash ^ *p++) * FNV_PRIME;
+	}
+    }
+  end = (const char *) p;
+
+  for (slot = hash & index->literal_mask;
+       (j = index->literal_table[slot]) != 0;
+       slot = (slot + 1) & index->literal_mask)
+    {
+      if (index->literals[j - 1].hash == hash &&
+	  strcmp (index->literals[j - 1].literal, file_name) == 0)
+	{
+	  mime_types[0] = index->literals[j - 1].mime_type;
+	  return 1;
+	}
+    }
+
+  /* The leftmost suffix, matching the case first */
+  exact = glob_index_walk_suffix (index, file_name, end, FALSE, &start_exact);
+  folded = glob_index_walk_suffix (index, file_name, end, TRUE, &start_folded);
+  if (exact >= 0 && (folded < 0 || start_exact <= start_folded))
+    folded = exact;
+  if (folded >= 0)
+    {
+      const XdgGlobSuffixState *found = &index->states[folded];
+
+      n = found->n_types < n_mime_types ? found->n_types : n_mime_types;
+      memcpy (mime_types, index->types + found->first_type, n * sizeof (const char *));
+      return n;
+    }
+
+  if (index->n_globs == 0)
+    return 0;
+
+  state = stack_state;
+  if (index->n_words > MAX_STACK_WORDS)
+    state = malloc (index->n_words * sizeof (uint64_t));
+
+  matching = ascii && index->n_words > 0 &&
+    glob_index_run (index, (const unsigned char *) file_name, state);
+
+  n = 0;
+  group = index->globs[0].group;
+  for (i = 0; i < index->n_globs && n < n_mime_types; i++)
+    {
+      const XdgGlobPattern *pattern = &index->globs[i];
+      int matched;
+
+      /* Only the globs of the first group with a match count */
+      if (pattern->group != group)
+	{
+	  if (n > 0)
+	    break;
+	  group = pattern->group;
+	}
+
+      if (pattern->accept >= 0 && ascii)
+	matched = matching && HAS_BIT (state, pattern->accept);
+      else
+	matched = fnmatch (pattern->glob, file_name, 0) == 0;
+
+      if (matched)
+	mime_types[n++] = pattern->mime_type;
+    }
+
+  if (state != stack_state)
+    free (state);
+
+  return n;
+}
@@ -0,0 +1,94 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* xdgmimeglobindex.h: Private file.  The globs compiled for matching file
+ * names in a single pass.
+ *
+ * More info can be found at http://www.freedesktop.org/standards/
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __XDG_MIME_GLOB_INDEX_H__
+#define __XDG_MIME_GLOB_INDEX_H__
+
+#include "xdgmime.h"
+#include "xdgmimeint.h"
+
+typedef struct XdgGlobIndex XdgGlobIndex;
+
+#ifdef XDG_PREFIX
+#define _xdg_glob_index_enabled           XDG_ENTRY(glob_index_enabled)
+#define _xdg_glob_index_new               XDG_ENTRY(glob_index_new)
+#define _xdg_glob_index_free              XDG_ENTRY(glob_index_free)
+#define _xdg_glob_index_add_literal       XDG_ENTRY(glob_index_add_literal)
+#define _xdg_glob_index_add_suffix        XDG_ENTRY(glob_index_add_suffix)
+#define _xdg_glob_index_add_glob          XDG_ENTRY(glob_index_add_glob)
+#define _xdg_glob_index_compile           XDG_ENTRY(glob_index_compile)
+#define _xdg_glob_index_lookup_file_name  XDG_ENTRY(glob_index_lookup_file_name)
+#endif
+
+/* The three kinds of globs, looked up the way the glob hash and the
+ * mime.cache always have, but without going through them one by one:
+ *
+ *  - Literals go in a hash table; the first one added for a name wins.
+ *
+ *  - Suffixes ("*.tar.gz") go in a trie of their reversed characters,
+ *    walked back from the end of the name, once as it is and once in
+ *    lower case.  Of the suffixes it passes, the longest is the one that
+ *    starting from the leftmost stop character would have found, with the
+ *    case sensitive match first at each position.  Suffixes are added
+ *    with the types they stand for; the first addition of a suffix wins.
+ *
+ *  - The other globs run together in one automaton over the name, in
+ *    groups that stop the lookup once one of them has matched (the
+ *    caches, for the mime.cache; the glob hash has a single group).  Those
+ *    the automaton can't take, or names that aren't ASCII, go to fnmatch.
+ *
+ * Strings are not copied, and have to outlive the index.  Setting
+ * _xdg_glob_index_enabled to FALSE has the callers use their old lookups
+ * instead, for comparing the two.
+ */
+
+extern int _xdg_glob_index_enabled;
+
+XdgGlobIndex *_xdg_glob_index_new        (void);
+void          _xdg_glob_index_free       (XdgGlobIndex        *index);
+void          _xdg_glob_index_add_literal (XdgGlobIndex       *index,
+					   const char         *literal,
+					   const char         *mime_type);
+void          _xdg_glob_index_add_suffix (XdgGlobIndex        *index,
+					  const xdg_unichar_t *suffix,
+					  int                  length,
+					  const char          *mime_types[],
+					  int                  n_mime_types);
+void          _xdg_glob_index_add_glob   (XdgGlobIndex        *index,
+					  const char          *glob,
+					  const char          *mime_type,
+					  int                  group);
+void          _xdg_glob_index_compile    (XdgGlobIndex        *index);
+
+/* Returns the number of types found, or -1 for names that aren't valid
+ * UTF-8, which the callers' old lookups have to deal with */
+int           _xdg_glob_index_lookup_file_name (XdgGlobIndex *index,
+						const char   *file_name,
+						const char   *mime_types[],
+						int           n_mime_types);
+
+#endif /* __XDG_MIME_GLOB_INDEX_H__ */
@@ -31,6 +31,8 @@
 
 #include <assert.h>
 #include "xdgmimemagic.h"
+#include "xdgmimemagicindex.h"
+#include "xdgmimematch.h"
 #include "xdgmimeint.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -88,6 +90,10 @@ struct XdgMimeMagic
 {
   XdgMimeMagicMatch *match_list;
   int max_extent;
+
+  /* Built from match_list once all of it is read */
+  XdgMimeMagicIndex *index;
+  XdgMimeMagicMatch **matches;
 };
 
 static XdgMimeMagicMatch *
@@ -521,41 +527,10 @@ _xdg_mime_magic_matchlet_compare_to_data (XdgMimeMagicMatchlet *matchlet,
 					  const void           *data,
 					  size_t                len)
 {
-  int i, j;
-  for (i = matchlet->offset; i < matchlet->offset + matchlet->range_length; i++)
-    {
-      int valid_matchlet = TRUE;
-
-      if (i + matchlet->value_length > len)
-	return FALSE;
-
-      if (matchlet->mask)
-	{
-	  for (j = 0; j < matchlet->value_length; j++)
-	    {
-	      if ((matchlet->value[j] & matchlet->mask[j]) !=
-		  ((((unsigned char *) data)[j + i]) & matchlet->mask[j]))
-		{
-		  valid_matchlet = FALSE;
-		  break;
-		}
-	    }
-	}
-      else
-	{
-	  for (j = 0; j <  matchlet->value_length; j++)
-	    {
-	      if (matchlet->value[j] != ((unsigned char *) data)[j + i])
-		{
-		  valid_matchlet = FALSE;
-		  break;
-		}
-	    }
-	}
-      if (valid_matchlet)
-	return TRUE;
-    }
-  return FALSE;
+  return _xdg_mime_match_range (matchlet->value, matchlet->mask,
+				matchlet->value_length,
+				matchlet->offset, matchlet->range_length,
+				data, len);
 }
 
 static int
@@ -642,6 +617,8 @@ _xdg_mime_magic_free (XdgMimeMagic *mime_magic)
 {
   if (mime_magic) {
     _xdg_mime_magic_match_free (mime_magic->match_list);
+    _xdg_mime_magic_index_free (mime_magic->index);
+    free (mime_magic->matches);
     free (mime_magic);
   }
 }
@@ -652,12 +629,133 @@ _xdg_mime_magic_get_buffer_extents (XdgMimeMagic *mime_magic)
   return mime_magic->max_extent;
 }
 
-const char *
-_xdg_mime_magic_lookup_data (XdgMimeMagic *mime_magic,
-			     const void   *data,
-			     size_t        len,
-                             const char   *mime_types[],
-                             int           n_mime_types)
+/* Index the rules by their top level matchlets.  This has to wait until
+ * the aliases have been read as well, rather than be done as the magic
+ * files are read.
+ */
+void
+_xdg_mime_magic_build_index (XdgMimeMagic *mime_magic)
+{
+  XdgMimeMagicMatch *match;
+  XdgMimeMagicMatchlet *matchlet;
+  int n_rules, rule;
+
+  n_rules = 0;
+  for (match = mime_magic->match_list; match; match = match->next)
+    n_rules++;
+
+  mime_magic->matches = malloc ((n_rules ? n_rules : 1) * sizeof (XdgMimeMagicMatch *));
+  mime_magic->index = _xdg_mime_magic_index_new (n_rules);
+
+  for (match = mime_magic->match_list, rule = 0; match; match = match->next, rule++)
+    {
+      mime_magic->matches[rule] = match;
+
+      for (matchlet = match->matchlet; matchlet; matchlet = matchlet->next)
+	{
+	  if (matchlet->indent != 0)
+	    continue;
+
+	  _xdg_mime_magic_index_add_probe (mime_magic->index, rule,
+					   matchlet->offset,
+					   matchlet->range_length,
+					   matchlet->value_length,
+					   matchlet->value_length ? matchlet->value[0] : 0,
+					   matchlet->mask ? matchlet->mask[0] : 0xff);
+	}
+
+      _xdg_mime_magic_index_set_type (mime_magic->index, rule,
+				      _xdg_mime_unalias_mime_type (match->mime_type));
+    }
+
+  _xdg_mime_magic_index_compile (mime_magic->index);
+}
+
+/* The same as _xdg_mime_magic_lookup_data_all, but only trying the rules
+ * the index leaves as candidates.
+ */
+static const char *
+_xdg_mime_magic_lookup_data_indexed (XdgMimeMagic *mime_magic,
+				     const void   *data,
+				     size_t        len,
+				     const char   *mime_types[],
+				     int           n_mime_types)
+{
+  XdgMimeRuleSetStack stack;
+  XdgMimeRuleSet *set;
+  const char *mime_type;
+  int n_rules, n_words, w, n, i;
+
+  n_rules = _xdg_mime_magic_index_n_rules (mime_magic->index);
+  n_words = XDG_RULE_SET_SIZE (n_rules);
+  set = _xdg_mime_rule_set_alloc (&stack, n_words);
+  _xdg_mime_magic_index_candidates (mime_magic->index, data, len, set);
+
+  /* Leave only the rules that match in the set */
+  mime_type = NULL;
+  for (w = 0; w < n_words; w++)
+    {
+      XdgMimeRuleSet bits = set[w];
+
+      while (bits)
+	{
+	  int bit = XDG_RULE_SET_LOWEST (bits);
+	  XdgMimeMagicMatch *match = mime_magic->matches[w * XDG_RULE_SET_BITS + bit];
+
+	  bits &= bits - 1;
+
+	  if (_xdg_mime_magic_match_compare_to_data (match, data, len))
+	    {
+	      if ((mime_type == NULL) || (_xdg_mime_mime_type_subclass (match->mime_type, mime_type)))
+		mime_type = match->mime_type;
+	    }
+	  else
+	    set[w] &= ~(1UL << bit);
+	}
+    }
+
+  /* A candidate goes if any rule for its type didn't match */
+  for (n = 0; n < n_mime_types; n++)
+    {
+      const int *rules;
+      int n_of_type;
+
+      if (mime_types[n] == NULL)
+	continue;
+
+      n_of_type = _xdg_mime_magic_index_rules_of_type (mime_magic->index,
+						       _xdg_mime_unalias_mime_type (mime_types[n]),
+						       &rules);
+      for (i = 0; i < n_of_type; i++)
+	{
+	  if (! XDG_RULE_SET_HAS (set, rules[i]))
+	    {
+	      mime_types[n] = NULL;
+	      break;
+	    }
+	}
+    }
+
+  _xdg_mime_rule_set_free (&stack, set);
+
+  if (mime_type == NULL)
+    {
+      for (n = 0; n < n_mime_types; n++)
+	{
+	  if (mime_types[n])
+	    mime_type = mime_types[n];
+	}
+    }
+
+  return mime_type;
+}
+
+static const char *
+_xdg_mime_magic_lookup_data_all (XdgMimeMagic *mime_magic,
+				 const void   *data,
+				 size_t        len,
+				 const char   *mime_types[],
+				 int           n_mime_types)
 {
   XdgMimeMagicMatch *match;
   const char *mime_type;
@@ -695,6 +793,21 @@ _xdg_mime_magic_lookup_data (XdgMimeMagic *mime_magic,
   return mime_type;
 }
 
+const char *
+_xdg_mime_magic_lookup_data (XdgMimeMagic *mime_magic,
+			     const void   *data,
+			     size_t        len,
+                             const char   *mime_types[],
+                             int           n_mime_types)
+{
+  if (_xdg_mime_magic_index_enabled && mime_magic->index != NULL)
+    return _xdg_mime_magic_lookup_data_indexed (mime_magic, data, len,
+						mime_types, n_mime_types);
+
+  return _xdg_mime_magic_lookup_data_all (mime_magic, data, len,
+					  mime_types, n_mime_types);
+}
+
 static void
 _xdg_mime_update_mime_magic_extents (XdgMimeMagic *mime_magic)
 {
@@ -797,6 +910,12 @@ _xdg_mime_magic_read_from_file (XdgMimeMagic *mime_magic,
   if (magic_file == NULL)
     return;
 
+  /* The index has to be rebuilt with whatever this adds */
+  _xdg_mime_magic_index_free (mime_magic->index);
+  mime_magic->index = NULL;
+  free (mime_magic->matches);
+  mime_magic->matches = NULL;
+
   if (fread (header, 1, 12, magic_file) == 12)
     {
       if (memcmp ("MIME-Magic\0\n", header, 12) == 0)
@@ -39,6 +39,7 @@ typedef struct XdgMimeMagic XdgMimeMagic;
 #define _xdg_mime_magic_free                      XDG_ENTRY(magic_free)
 #define _xdg_mime_magic_get_buffer_extents        XDG_ENTRY(magic_get_buffer_extents)
 #define _xdg_mime_magic_lookup_data               XDG_ENTRY(magic_lookup_data)
+#define _xdg_mime_magic_build_index               XDG_ENTRY(magic_build_index)
 #endif
 
 
@@ -46,6 +47,7 @@ XdgMimeMagic *_xdg_mime_magic_new                (void);
 void          _xdg_mime_magic_read_from_file     (XdgMimeMagic *mime_magic,
 						  const char   *file_name);
 void          _xdg_mime_magic_free               (XdgMimeMagic *mime_magic);
+void          _xdg_mime_magic_build_index        (XdgMimeMagic *mime_magic);
 int           _xdg_mime_magic_get_buffer_extents (XdgMimeMagic *mime_magic);
 const char   *_xdg_mime_magic_lookup_data        (XdgMimeMagic *mime_magic,
 						  const void   *data,
@@ -0,0 +1,406 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* xdgmimemagicindex.c: Private file.  Index of magic rules by the bytes
+ * they look at first.
+ *
+ * More info can be found at http://www.freedesktop.org/standards/
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "xdgmimemagicindex.h"
+#include "xdgmimeint.h"
+#include "xdgmimematch.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Probes at a single offset go into a table per offset, with the rules for
+ * every value of the byte there; probes over a range of offsets, and those
+ * that can't be told apart by their first byte, are kept aside.
+ */
+
+typedef struct
+{
+  int rule;
+  unsigned int offset;
+  unsigned int range_length;
+  unsigned int value_length;
+  unsigned char value;
+  unsigned char mask;
+} XdgMimeMagicProbe;
+
+typedef struct
+{
+  const char *type;
+  int rule;
+} XdgMimeMagicTypeEntry;
+
+struct XdgMimeMagicIndex
+{
+  int n_rules;
+  int n_words;
+
+  /* Filled in as probes are added, and freed when compiling */
+  XdgMimeMagicProbe *probes;
+  int n_probes;
+  int n_allocated_probes;
+
+  XdgMimeRuleSet *always;
+
+  /* Probes at one offset: for the k'th offset, the rules for byte b are
+   * bucket_rules[bucket_start[257 * k + b]] up to that of b + 1 */
+  int n_offsets;
+  unsigned int *offsets;
+  int *bucket_start;
+  int *bucket_rules;
+
+  XdgMimeMagicProbe *ranges;
+  int n_ranges;
+
+  XdgMimeMagicTypeEntry *types;
+  int *type_rules;
+  int n_types;
+};
+
+int _xdg_mime_magic_index_enabled = TRUE;
+
+XdgMimeRuleSet *
+_xdg_mime_rule_set_alloc (XdgMimeRuleSetStack *stack,
+			  int                  n_words)
+{
+  if (n_words <= (int) (sizeof (stack->words) / sizeof (stack->words[0])))
+    return stack->words;
+
+  return malloc (n_words * sizeof (XdgMimeRuleSet));
+}
+
+void
+_xdg_mime_rule_set_free (XdgMimeRuleSetStack *stack,
+			 XdgMimeRuleSet      *set)
+{
+  if (set != stack->words)
+    free (set);
+}
+
+#ifndef __GNUC__
+int
+_xdg_mime_rule_set_lowest (XdgMimeRuleSet bits)
+{
+  int bit = 0;
+
+  while (! (bits & 1))
+    {
+      bits >>= 1;
+      bit++;
+    }
+
+  return bit;
+}
+#endif
+
+XdgMimeMagicIndex *
+_xdg_mime_magic_index_new (int n_rules)
+{
+  XdgMimeMagicIndex *index;
+
+  index = calloc (1, sizeof (XdgMimeMagicIndex));
+  index->n_rules = n_rules;
+  index->n_words = XDG_RULE_SET_SIZE (n_rules);
+  index->always = calloc (index->n_words ? index->n_words : 1, sizeof (XdgMimeRuleSet));
+  index->types = calloc (n_rules ? n_rules : 1, sizeof (XdgMimeMagicTypeEntry));
+
+  return index;
+}
+
+void
+_xdg_mime_magic_index_free (XdgMimeMagicIndex *index)
+{
+  if (index == NULL)
+    return;
+
+  free (index->probes);
+  free (index->always);
+  free (index->offsets);
+  free (index->bucket_start);
+  free (index->bucket_rules);
+  free (index->ranges);
+  free (index->types);
+  free (index->type_rules);
+  free (index);
+}
+
+int
+_xdg_mime_magic_index_n_rules (XdgMimeMagicIndex *index)
+{
+  return index->n_rules;
+}
+
+void
+_xdg_mime_magic_index_add_probe (XdgMimeMagicIndex *index,
+				 int                rule,
+				 unsigned int       offset,
+				 unsigned int       range_length,
+				 unsigned int       value_length,
+				 unsigned char      value,
+				 unsigned char      mask)
+{
+  XdgMimeMagicProbe *probe;
+
+  if (rule < 0 || rule >= index->n_rules)
+    return;
+
+  /* Nothing to go on */
+  if (value_length == 0 || mask == 0)
+    {
+      XDG_RULE_SET_ADD (index->always, rule);
+      return;
+    }
+
+  if (range_length == 0)
+    return;
+
+  if (index->n_probes == index->n_allocated_probes)
+    {
+      index->n_allocated_probes = index->n_allocated_probes ? 2 * index->n_allocated_probes : 64;
+      index->probes = realloc (index->probes, index->n_allocated_probes * sizeof (XdgMimeMagicProbe));
+    }
+
+  probe = &index->probes[index->n_probes++];
+  probe->rule = rule;
+  probe->offset = offset;
+  probe->range_length = range_length;
+  probe->value_length = value_length;
+  probe->value = value & mask;
+  probe->mask = mask;
+}
+
+void
+_xdg_mime_magic_index_set_type (XdgMimeMagicIndex *index,
+				int                rule,
+				const char        *unaliased_type)
+{
+  if (rule < 0 || rule >= index->n_rules)
+    return;
+
+  index->types[rule].type = unaliased_type;
+  index->types[rule].rule = rule;
+}
+
+static int
+compare_probes (const void *a, const void *b)
+{
+  const XdgMimeMagicProbe *pa = a, *pb = b;
+
+  if (pa->offset != pb->offset)
+    return pa->offset < pb->offset ? -1 : 1;
+
+  return pa->rule - pb->rule;
+}
+
+static int
+compare_types (const void *a, const void *b)
+{
+  const XdgMimeMagicTypeEntry *ta = a, *tb = b;
+  int cmp;
+
+  cmp = strcmp (ta->type ? ta->type : "", tb->type ? tb->type : "");
+  if (cmp != 0)
+    return cmp;
+
+  return ta->rule - tb->rule;
+}
+
+/* For each value of a byte, the number of rules in offset k's table, then
+ * turned into where each bucket starts */
+static void
+fill_buckets (XdgMimeMagicIndex *index,
+	      XdgMimeMagicProbe *probes,
+	      int                n_probes,
+	      int                k,
+	      int               *fill)
+{
+  int i, b;
+
+  for (i = 0; i < n_probes; i++)
+    {
+      for (b = 0; b < 256; b++)
+	{
+	  if ((b & probes[i].mask) != probes[i].value)
+	    continue;
+
+	  if (fill == NULL)
+	    index->bucket_start[257 * k + b + 1]++;
+	  else
+	    index->bucket_rules[fill[b]++] = probes[i].rule;
+	}
+    }
+}
+
+void
+_xdg_mime_magic_index_compile (XdgMimeMagicIndex *index)
+{
+  XdgMimeMagicProbe *exact;
+  int n_exact = 0;
+  int i, j, k, b, total;
+
+  /* Split off the probes over a range */
+  exact = malloc ((index->n_probes ? index->n_probes : 1) * sizeof (XdgMimeMagicProbe));
+  index->ranges = malloc ((index->n_probes ? index->n_probes : 1) * sizeof (XdgMimeMagicProbe));
+  for (i = 0; i < index->n_probes; i++)
+    {
+      if (index->probes[i].range_length == 1)
+	exact[n_exact++] = index->probes[i];
+      else
+	index->ranges[index->n_ranges++] = index->probes[i];
+    }
+
+  free (index->probes);
+  index->probes = NULL;
+  index->n_probes = index->n_allocated_probes = 0;
+
+  qsort (exact, n_exact, sizeof (XdgMimeMagicProbe), compare_probes);
+
+  index->n_offsets = 0;
+  for (i = 0; i < n_exact; i++)
+    if (i == 0 || exact[i].offset != exact[i - 1].offset)
+      index->n_offsets++;
+
+  index->offsets = malloc ((index->n_offsets ? index->n_offsets : 1) * sizeof (unsigned int));
+  index->bucket_start = calloc (257 * (index->n_offsets ? index->n_offsets : 1), sizeof (int));
+
+  /* Count, then lay the buckets out one after the other, then fill */
+  for (i = 0, k = 0; i < n_exact; i = j, k++)
+    {
+      for (j = i; j < n_exact && exact[j].offset == exact[i].offset; j++)
+	;
+      index->offsets[k] = exact[i].offset;
+      fill_buckets (index, exact + i, j - i, k, NULL);
+    }
+
+  total = 0;
+  for (k = 0; k < index->n_offsets; k++)
+    {
+      index->bucket_start[257 * k] = total;
+      for (b = 0; b < 256; b++)
+	index->bucket_start[257 * k + b + 1] += index->bucket_start[257 * k + b];
+      total = index->bucket_start[257 * k + 256];
+    }
+
+  index->bucket_rules = malloc ((total ? total : 1) * sizeof (int));
+
+  for (i = 0, k = 0; i < n_exact; i = j, k++)
+    {
+      int fill[256];
+
+      for (j = i; j < n_exact && exact[j].offset == exact[i].offset; j++)
+	;
+      memcpy (fill, &index->bucket_start[257 * k], sizeof (fill));
+      fill_buckets (index, exact + i, j - i, k, fill);
+    }
+
+  free (exact);
+
+  /* And the rules by type */
+  qsort (index->types, index->n_rules, sizeof (XdgMimeMagicTypeEntry), compare_types);
+  index->n_types = index->n_rules;
+  index->type_rules = malloc ((index->n_rules ? index->n_rules : 1) * sizeof (int));
+  for (i = 0; i < index->n_rules; i++)
+    index->type_rules[i] = index->types[i].rule;
+}
+
+void
+_xdg_mime_magic_index_candidates (XdgMimeMagicIndex *index,
+				  const void        *data,
+				  size_t             len,
+				  XdgMimeRuleSet    *set)
+{
+  const unsigned char *bytes = data;
+  int i, k;
+
+  memcpy (set, index->always, index->n_words * sizeof (XdgMimeRuleSet));
+
+  for (k = 0; k < index->n_offsets && index->offsets[k] < len; k++)
+    {
+      const int *bucket = &index->bucket_start[257 * k + bytes[index->offsets[k]]];
+
+      for (i = bucket[0]; i < bucket[1]; i++)
+	XDG_RULE_SET_ADD (set, index->bucket_rules[i]);
+    }
+
+  for (i = 0; i < index->n_ranges; i++)
+    {
+      const XdgMimeMagicProbe *probe = &index->ranges[i];
+      size_t start, end;
+
+      if (XDG_RULE_SET_HAS (set, probe->rule))
+	continue;
+
+      /* The first byte of a match is somewhere in [start, end) */
+      start = probe->offset;
+      if (len < probe->value_length || start > len - probe->value_length)
+	continue;
+      end = len - probe->value_length + 1;
+      if (end - start > probe->range_length)
+	end = start + probe->range_length;
+
+      if (probe->mask == 0xff)
+	{
+	  if (memchr (bytes + start, probe->value, end - start) != NULL)
+	    XDG_RULE_SET_ADD (set, probe->rule);
+	}
+      else if (_xdg_mime_match_range (&probe->value, &probe->mask, 1,
+				      start, end - start, bytes, len))
+	XDG_RULE_SET_ADD (set, probe->rule);
+    }
+}
+
+int
+_xdg_mime_magic_index_rules_of_type (XdgMimeMagicIndex *index,
+				     const char        *unaliased_type,
+				     const int        **rules)
+{
+  int min, max, mid, first, cmp;
+
+  /* Find the first entry that isn't less than the type */
+  min = 0;
+  max = index->n_types;
+  while (min < max)
+    {
+      mid = (min + max) / 2;
+      cmp = strcmp (index->types[mid].type ? index->types[mid].type : "", unaliased_type);
+      if (cmp < 0)
+	min = mid + 1;
+      else
+	max = mid;
+    }
+  first = min;
+
+  max = first;
+  while (max < index->n_types && index->types[max].type &&
+	 strcmp (index->types[max].type, unaliased_type) == 0)
+    max++;
+
+  *rules = index->type_rules + first;
+  return max - first;
+}
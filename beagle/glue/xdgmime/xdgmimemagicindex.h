@@ -0,0 +1,126 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* xdgmimemagicindex.h: Private file.  Index of magic rules by the bytes
+ * they look at first.
+ *
+ * More info can be found at http://www.freedesktop.org/standards/
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __XDG_MIME_MAGIC_INDEX_H__
+#define __XDG_MIME_MAGIC_INDEX_H__
+
+#include <stddef.h>
+#include "xdgmime.h"
+
+typedef struct XdgMimeMagicIndex XdgMimeMagicIndex;
+
+#ifdef XDG_PREFIX
+#define _xdg_mime_magic_index_enabled          XDG_ENTRY(magic_index_enabled)
+#define _xdg_mime_magic_index_new              XDG_ENTRY(magic_index_new)
+#define _xdg_mime_magic_index_free             XDG_ENTRY(magic_index_free)
+#define _xdg_mime_magic_index_add_probe        XDG_ENTRY(magic_index_add_probe)
+#define _xdg_mime_magic_index_set_type         XDG_ENTRY(magic_index_set_type)
+#define _xdg_mime_magic_index_compile          XDG_ENTRY(magic_index_compile)
+#define _xdg_mime_magic_index_candidates       XDG_ENTRY(magic_index_candidates)
+#define _xdg_mime_magic_index_n_rules          XDG_ENTRY(magic_index_n_rules)
+#define _xdg_mime_magic_index_rules_of_type    XDG_ENTRY(magic_index_rules_of_type)
+#define _xdg_mime_rule_set_alloc               XDG_ENTRY(rule_set_alloc)
+#define _xdg_mime_rule_set_free                XDG_ENTRY(rule_set_free)
+#define _xdg_mime_rule_set_lowest              XDG_ENTRY(rule_set_lowest)
+#endif
+
+/* A magic rule can only match when one of its top level matchlets does,
+ * and a matchlet can only match where its first byte does.  The index keeps
+ * one such probe per top level matchlet and hands back, for a buffer, the
+ * set of rules that have a probe that succeeds on it: a small superset of
+ * the rules that match, which the caller then checks as before, in the
+ * original order.  Rules are numbered from 0 in that order.
+ *
+ * It also keeps the rules by their unaliased MIME type, so that callers
+ * can tell which glob candidates a non-matching rule rules out without
+ * going through every rule.
+ *
+ * Setting _xdg_mime_magic_index_enabled to FALSE makes the lookups go
+ * through all the rules instead, for comparing the two.
+ */
+
+extern int _xdg_mime_magic_index_enabled;
+
+/* Sets of rules, as bitmaps */
+typedef unsigned long XdgMimeRuleSet;
+#define XDG_RULE_SET_BITS             (sizeof (XdgMimeRuleSet) * 8)
+#define XDG_RULE_SET_SIZE(n_rules)    (((n_rules) + XDG_RULE_SET_BITS - 1) / XDG_RULE_SET_BITS)
+#define XDG_RULE_SET_HAS(set, rule)   (((set)[(rule) / XDG_RULE_SET_BITS] >> ((rule) % XDG_RULE_SET_BITS)) & 1)
+#define XDG_RULE_SET_ADD(set, rule)   ((set)[(rule) / XDG_RULE_SET_BITS] |= 1UL << ((rule) % XDG_RULE_SET_BITS))
+
+/* The lowest bit set in a non-zero word */
+#ifdef __GNUC__
+#define XDG_RULE_SET_LOWEST(bits)     __builtin_ctzl (bits)
+#else
+#define XDG_RULE_SET_LOWEST(bits)     _xdg_mime_rule_set_lowest (bits)
+int _xdg_mime_rule_set_lowest (XdgMimeRuleSet bits);
+#endif
+
+/* Room for a set on the stack, for as many rules as there usually are;
+ * _xdg_mime_rule_set_alloc only goes to the heap for more. */
+typedef struct
+{
+  XdgMimeRuleSet words[64];
+} XdgMimeRuleSetStack;
+
+XdgMimeRuleSet    *_xdg_mime_rule_set_alloc      (XdgMimeRuleSetStack *stack,
+						  int                  n_words);
+void               _xdg_mime_rule_set_free       (XdgMimeRuleSetStack *stack,
+						  XdgMimeRuleSet      *set);
+
+XdgMimeMagicIndex *_xdg_mime_magic_index_new     (int                n_rules);
+void               _xdg_mime_magic_index_free    (XdgMimeMagicIndex *index);
+
+/* A probe succeeds if at some position from offset to offset + range_length
+ * - 1 there are at least value_length bytes, the first of which equals
+ * value under mask.  A value_length of 0 or a mask of 0 always succeeds. */
+void               _xdg_mime_magic_index_add_probe (XdgMimeMagicIndex *index,
+						    int                rule,
+						    unsigned int       offset,
+						    unsigned int       range_length,
+						    unsigned int       value_length,
+						    unsigned char      value,
+						    unsigned char      mask);
+/* 'unaliased_type' has to stay around for as long as the index does */
+void               _xdg_mime_magic_index_set_type  (XdgMimeMagicIndex *index,
+						    int                rule,
+						    const char        *unaliased_type);
+void               _xdg_mime_magic_index_compile   (XdgMimeMagicIndex *index);
+
+int                _xdg_mime_magic_index_n_rules   (XdgMimeMagicIndex *index);
+/* Fills 'set', of XDG_RULE_SET_SIZE (n_rules) words, with the candidates */
+void               _xdg_mime_magic_index_candidates (XdgMimeMagicIndex *index,
+						     const void        *data,
+						     size_t             len,
+						     XdgMimeRuleSet    *set);
+/* The rules whose unaliased type is 'unaliased_type', in ascending order.
+ * Returns how many there are and points 'rules' at them. */
+int                _xdg_mime_magic_index_rules_of_type (XdgMimeMagicIndex *index,
+							const char        *unaliased_type,
+							const int        **rules);
+
+#endif /* __XDG_MIME_MAGIC_INDEX_H__ */
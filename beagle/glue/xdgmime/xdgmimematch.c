@@ -0,0 +1,363 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* xdgmimematch.c: Private file.  Comparing magic values against a range
+ * of the data being sniffed.
+ *
+ * More info can be found at http://www.freedesktop.org/standards/
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "xdgmimematch.h"
+#include "xdgmimeint.h"
+#include <string.h>
+
+/* The vector versions are compiled for their instruction sets function by
+ * function, and only called once the CPU has said it has them, so the rest
+ * of the library is built for whatever it was built for before. */
+#if defined (__GNUC__) && (__GNUC__ >= 5 || defined (__clang__)) && \
+    (defined (__x86_64__) || defined (__i386__))
+#define XDG_MIME_MATCH_X86 1
+#include <immintrin.h>
+#define XDG_MIME_TARGET(isa) __attribute__ ((target (isa)))
+#endif
+
+/* A value to look for.  'first' and 'last' are the first and the last
+ * byte the mask looks at, which the scans go by; without a mask they are
+ * the ends of the value, and the masks are 0xff. */
+typedef struct
+{
+  const unsigned char *value;
+  const unsigned char *mask;
+  size_t length;
+  size_t first;
+  size_t last;
+  unsigned char first_value;
+  unsigned char first_mask;
+  unsigned char last_value;
+  unsigned char last_mask;
+} XdgMimeMatchPattern;
+
+static int implementation = -1;
+
+static int
+pattern_matches_at (const XdgMimeMatchPattern *pattern,
+		    const unsigned char       *data)
+{
+  size_t j;
+
+  if (pattern->mask == NULL)
+    return memcmp (pattern->value, data, pattern->length) == 0;
+
+  for (j = pattern->first; j <= pattern->last; j++)
+    {
+      if ((pattern->value[j] ^ data[j]) & pattern->mask[j])
+	return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Looks at the positions from start up to end, which all leave room for
+ * the whole value */
+static int
+scan_scalar (const XdgMimeMatchPattern *pattern,
+	     const unsigned char       *data,
+	     size_t                     start,
+	     size_t                     end)
+{
+  size_t p;
+
+  if (pattern->first_mask == 0xff)
+    {
+      p = start;
+      while (p < end)
+	{
+	  const unsigned char *hit;
+
+	  hit = memchr (data + p + pattern->first, pattern->first_value, end - p);
+	  if (hit == NULL)
+	    return FALSE;
+	  p = hit - data - pattern->first;
+	  if (pattern_matches_at (pattern, data + p))
+	    return TRUE;
+	  p++;
+	}
+
+      return FALSE;
+    }
+
+  for (p = start; p < end; p++)
+    {
+      if ((data[p + pattern->first] & pattern->first_mask) == pattern->first_value &&
+	  pattern_matches_at (pattern, data + p))
+	return TRUE;
+    }
+
+  return FALSE;
+}
+
+#ifdef XDG_MIME_MATCH_X86
+
+XDG_MIME_TARGET ("sse2") static int
+pattern_matches_at_sse2 (const XdgMimeMatchPattern *pattern,
+			 const unsigned char       *data)
+{
+  size_t j;
+
+  /* The C library's memcmp is vectorized already */
+  if (pattern->mask == NULL)
+    return memcmp (pattern->value, data, pattern->length) == 0;
+
+  for (j = pattern->first; j + 16 <= pattern->last + 1; j += 16)
+    {
+      __m128i value = _mm_loadu_si128 ((const __m128i *) (pattern->value + j));
+      __m128i mask = _mm_loadu_si128 ((const __m128i *) (pattern->mask + j));
+      __m128i bytes = _mm_loadu_si128 ((const __m128i *) (data + j));
+      __m128i diff = _mm_and_si128 (_mm_xor_si128 (value, bytes), mask);
+
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (diff, _mm_setzero_si128 ())) != 0xffff)
+	return FALSE;
+    }
+
+  for (; j <= pattern->last; j++)
+    {
+      if ((pattern->value[j] ^ data[j]) & pattern->mask[j])
+	return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Sixteen positions at a time: those where both the first and the last
+ * byte the mask looks at are right are compared in full */
+XDG_MIME_TARGET ("sse2") static int
+scan_sse2 (const XdgMimeMatchPattern *pattern,
+	   const unsigned char       *data,
+	   size_t                     start,
+	   size_t                     end)
+{
+  __m128i first_value = _mm_set1_epi8 ((char) pattern->first_value);
+  __m128i first_mask = _mm_set1_epi8 ((char) pattern->first_mask);
+  __m128i last_value = _mm_set1_epi8 ((char) pattern->last_value);
+  __m128i last_mask = _mm_set1_epi8 ((char) pattern->last_mask);
+  size_t p;
+
+  for (p = start; p + 16 <= end; p += 16)
+    {
+      __m128i first = _mm_loadu_si128 ((const __m128i *) (data + p + pattern->first));
+      __m128i last = _mm_loadu_si128 ((const __m128i *) (data + p + pattern->last));
+      unsigned int bits;
+
+      bits = _mm_movemask_epi8 (_mm_and_si128 (_mm_cmpeq_epi8 (_mm_and_si128 (first, first_mask), first_value),
+					       _mm_cmpeq_epi8 (_mm_and_si128 (last, last_mask), last_value)));
+      while (bits != 0)
+	{
+	  if (pattern_matches_at_sse2 (pattern, data + p + __builtin_ctz (bits)))
+	    return TRUE;
+	  bits &= bits - 1;
+	}
+    }
+
+  return scan_scalar (pattern, data, p, end);
+}
+
+XDG_MIME_TARGET ("avx2") static int
+pattern_matches_at_avx2 (const XdgMimeMatchPattern *pattern,
+			 const unsigned char       *data)
+{
+  size_t j;
+
+  if (pattern->mask == NULL)
+    return memcmp (pattern->value, data, pattern->length) == 0;
+
+  for (j = pattern->first; j + 32 <= pattern->last + 1; j += 32)
+    {
+      __m256i value = _mm256_loadu_si256 ((const __m256i *) (pattern->value + j));
+      __m256i mask = _mm256_loadu_si256 ((const __m256i *) (pattern->mask + j));
+      __m256i bytes = _mm256_loadu_si256 ((const __m256i *) (data + j));
+      __m256i diff = _mm256_and_si256 (_mm256_xor_si256 (value, bytes), mask);
+
+      if (! _mm256_testz_si256 (diff, diff))
+	return FALSE;
+    }
+
+  for (; j <= pattern->last; j++)
+    {
+      if ((pattern->value[j] ^ data[j]) & pattern->mask[j])
+	return FALSE;
+    }
+
+  return TRUE;
+}
+
+XDG_MIME_TARGET ("avx2") static int
+scan_avx2 (const XdgMimeMatchPattern *pattern,
+	   const unsigned char       *data,
+	   size_t                     start,
+	   size_t                     end)
+{
+  __m256i first_value = _mm256_set1_epi8 ((char) pattern->first_value);
+  __m256i first_mask = _mm256_set1_epi8 ((char) pattern->first_mask);
+  __m256i last_value = _mm256_set1_epi8 ((char) pattern->last_value);
+  __m256i last_mask = _mm256_set1_epi8 ((char) pattern->last_mask);
+  size_t p;
+
+  for (p = start; p + 32 <= end; p += 32)
+    {
+      __m256i first = _mm256_loadu_si256 ((const __m256i *) (data + p + pattern->first));
+      __m256i last = _mm256_loadu_si256 ((const __m256i *) (data + p + pattern->last));
+      unsigned int bits;
+
+      bits = _mm256_movemask_epi8 (_mm256_and_si256 (_mm256_cmpeq_epi8 (_mm256_and_si256 (first, first_mask), first_value),
+						     _mm256_cmpeq_epi8 (_mm256_and_si256 (last, last_mask), last_value)));
+      while (bits != 0)
+	{
+	  if (pattern_matches_at_avx2 (pattern, data + p + __builtin_ctz (bits)))
+	    return TRUE;
+	  bits &= bits - 1;
+	}
+    }
+
+  return scan_sse2 (pattern, data, p, end);
+}
+
+#endif /* XDG_MIME_MATCH_X86 */
+
+static int
+implementation_supported (XdgMimeMatchImplementation which)
+{
+  switch (which)
+    {
+    case XDG_MIME_MATCH_SCALAR:
+      return TRUE;
+#ifdef XDG_MIME_MATCH_X86
+    case XDG_MIME_MATCH_SSE2:
+      __builtin_cpu_init ();
+      return __builtin_cpu_supports ("sse2");
+    case XDG_MIME_MATCH_AVX2:
+      __builtin_cpu_init ();
+      return __builtin_cpu_supports ("avx2");
+#endif
+    default:
+      return FALSE;
+    }
+}
+
+int
+_xdg_mime_match_set_implementation (XdgMimeMatchImplementation which)
+{
+  if (! implementation_supported (which))
+    return FALSE;
+
+  __atomic_store_n (&implementation, which, __ATOMIC_RELAXED);
+
+  return TRUE;
+}
+
+XdgMimeMatchImplementation
+_xdg_mime_match_get_implementation (void)
+{
+  int which = __atomic_load_n (&implementation, __ATOMIC_RELAXED);
+
+  if (which < 0)
+    {
+      /* Threads racing here all come to the same answer */
+      if (implementation_supported (XDG_MIME_MATCH_AVX2))
+	which = XDG_MIME_MATCH_AVX2;
+      else if (implementation_supported (XDG_MIME_MATCH_SSE2))
+	which = XDG_MIME_MATCH_SSE2;
+      else
+	which = XDG_MIME_MATCH_SCALAR;
+      __atomic_store_n (&implementation, which, __ATOMIC_RELAXED);
+    }
+
+  return which;
+}
+
+int
+_xdg_mime_match_range (const unsigned char *value,
+		       const unsigned char *mask,
+		       size_t               value_length,
+		       size_t               offset,
+		       size_t               range_length,
+		       const void          *data,
+		       size_t               len)
+{
+  const unsigned char *bytes = data;
+  XdgMimeMatchPattern pattern;
+  size_t n_positions;
+
+  if (range_length == 0 || value_length > len || offset > len - value_length)
+    return FALSE;
+
+  n_positions = len - value_length - offset + 1;
+  if (n_positions > range_length)
+    n_positions = range_length;
+
+  pattern.value = value;
+  pattern.mask = mask;
+  pattern.length = value_length;
+
+  if (mask != NULL)
+    {
+      /* A mask that looks at nothing matches at the first position */
+      for (pattern.first = 0; pattern.first < value_length; pattern.first++)
+	if (mask[pattern.first] != 0)
+	  break;
+      if (pattern.first == value_length)
+	return TRUE;
+      for (pattern.last = value_length - 1; mask[pattern.last] == 0; pattern.last--)
+	;
+      pattern.first_mask = mask[pattern.first];
+      pattern.last_mask = mask[pattern.last];
+    }
+  else
+    {
+      if (value_length == 0)
+	return TRUE;
+      pattern.first = 0;
+      pattern.last = value_length - 1;
+      pattern.first_mask = 0xff;
+      pattern.last_mask = 0xff;
+    }
+  pattern.first_value = value[pattern.first] & pattern.first_mask;
+  pattern.last_value = value[pattern.last] & pattern.last_mask;
+
+  /* Most matchlets are at a single offset */
+  if (n_positions == 1)
+    return pattern_matches_at (&pattern, bytes + offset);
+
+  switch (_xdg_mime_match_get_implementation ())
+    {
+#ifdef XDG_MIME_MATCH_X86
+    case XDG_MIME_MATCH_AVX2:
+      return scan_avx2 (&pattern, bytes, offset, offset + n_positions);
+    case XDG_MIME_MATCH_SSE2:
+      return scan_sse2 (&pattern, bytes, offset, offset + n_positions);
+#endif
+    default:
+      return scan_scalar (&pattern, bytes, offset, offset + n_positions);
+    }
+}
@@ -0,0 +1,71 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* xdgmimematch.h: Private file.  Comparing magic values against a range
+ * of the data being sniffed.
+ *
+ * More info can be found at http://www.freedesktop.org/standards/
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __XDG_MIME_MATCH_H__
+#define __XDG_MIME_MATCH_H__
+
+#include <stddef.h>
+#include "xdgmime.h"
+
+#ifdef XDG_PREFIX
+#define _xdg_mime_match_range            XDG_ENTRY(match_range)
+#define _xdg_mime_match_set_implementation XDG_ENTRY(match_set_implementation)
+#define _xdg_mime_match_get_implementation XDG_ENTRY(match_get_implementation)
+#endif
+
+/* The ways of scanning a range.  The best one the CPU has is picked the
+ * first time a range is compared; the others are there for comparing them
+ * against each other. */
+typedef enum
+{
+  XDG_MIME_MATCH_SCALAR,
+  XDG_MIME_MATCH_SSE2,
+  XDG_MIME_MATCH_AVX2
+} XdgMimeMatchImplementation;
+
+/* Returns FALSE, and leaves things as they were, if the CPU (or the
+ * compiler) can't do 'implementation' */
+int                        _xdg_mime_match_set_implementation (XdgMimeMatchImplementation implementation);
+XdgMimeMatchImplementation _xdg_mime_match_get_implementation (void);
+
+/* Whether the value_length bytes of 'value' are found in 'data', under
+ * 'mask' if there is one, at any position from offset to offset +
+ * range_length - 1 that leaves room for all of them.  This is how both
+ * the magic file and the mime.cache matchlets compare.
+ *
+ * Candidate positions are found by scanning for the first and the last
+ * byte the mask looks at, a vector at a time where the CPU can, and only
+ * those are compared in full. */
+int _xdg_mime_match_range (const unsigned char *value,
+			   const unsigned char *mask,
+			   size_t               value_length,
+			   size_t               offset,
+			   size_t               range_length,
+			   const void          *data,
+			   size_t               len);
+
+#endif /* __XDG_MIME_MATCH_H__ */
@@ -0,0 +1,549 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* xdgmimeresults.c: Private file.  Cache of lookup results by inode.
+ *
+ * More info can be found at http://www.freedesktop.org/standards/
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/file.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "xdgmimeresults.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+/* The file (or the memory standing in for it) is a header, the entries,
+ * and the MIME types they point at, one after the other.  The entries come
+ * in sets of RESULT_WAYS, and a file can only be in the set its inode
+ * number hashes to.  Everything is in host byte order; a file written by
+ * a different kind of machine fails the header checks and starts over.
+ *
+ * Lookups take no lock.  An entry being written has its check cleared
+ * first and set last, so a lookup that finds the same valid check before
+ * and after copying the entry knows the copy isn't torn.  Inserts are
+ * serialized by the set they go in, over a few locks shared between sets,
+ * and strings are only ever appended, under a lock of their own.
+ */
+
+#define RESULT_MAGIC         "xdgmime-results"
+#define RESULT_VERSION       1
+#define RESULT_WAYS          4
+#define RESULT_MAX_ENTRIES   (1 << 22)
+#define RESULT_STRINGS_SIZE  (64 * 1024)
+/* Room to find each of the strings again, which is more than the MIME
+ * types there are; beyond half of it new types just aren't cached */
+#define RESULT_STRING_SLOTS  4096
+/* Locks for inserting, each shared by every set with its number mod this */
+#define RESULT_LOCKS         64
+
+typedef struct
+{
+  char magic[16];
+  xdg_uint32_t version;
+  xdg_uint32_t entry_size;
+  xdg_uint32_t n_sets;
+  xdg_uint32_t strings_size;
+  xdg_uint32_t strings_used;
+  xdg_uint32_t clock;
+} XdgResultHeader;
+
+typedef struct
+{
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime;
+  xdg_uint32_t key;
+  xdg_uint32_t type;		/* 1 + where the string starts, 0 if unused */
+  xdg_uint32_t check;		/* of the rest, against torn or stray writes */
+  xdg_uint32_t pad;
+} XdgResultEntry;
+
+struct XdgMimeResultCache
+{
+  int ref_count;
+  pthread_mutex_t set_locks[RESULT_LOCKS];
+  pthread_mutex_t strings_lock;
+
+  void *buffer;
+  size_t size;
+  int fd;			/* -1 if the buffer is just memory */
+
+  XdgResultHeader *header;
+  XdgResultEntry *entries;
+  char *strings;
+
+  xdg_uint32_t string_slots[RESULT_STRING_SLOTS];
+  int n_strings;
+
+  XdgMimeResultCacheStats stats;
+};
+
+xdg_uint32_t
+_xdg_mime_result_key (xdg_uint32_t  key,
+		      const char   *string)
+{
+  /* FNV-1a, with a byte that can't be in a string for NULL */
+  if (key == 0)
+    key = 2166136261U;
+
+  if (string == NULL)
+    return (key ^ 0xff) * 16777619U;
+
+  while (*string)
+    key = (key ^ (unsigned char) *string++) * 16777619U;
+
+  return key;
+}
+
+static xdg_uint32_t
+entry_check (const XdgResultEntry *entry)
+{
+  uint64_t h;
+
+  h = entry->dev * 0x9e3779b97f4a7c15ULL;
+  h = (h ^ entry->ino) * 0x9e3779b97f4a7c15ULL;
+  h = (h ^ entry->size) * 0x9e3779b97f4a7c15ULL;
+  h = (h ^ (uint64_t) entry->mtime) * 0x9e3779b97f4a7c15ULL;
+  h = (h ^ entry->key) * 0x9e3779b97f4a7c15ULL;
+  h = (h ^ entry->type) * 0x9e3779b97f4a7c15ULL;
+
+  return (xdg_uint32_t) (h >> 32) | 1;
+}
+
+static int
+entry_valid (XdgMimeResultCache   *cache,
+	     const XdgResultEntry *entry)
+{
+  return entry->type != 0 &&
+	 entry->type <= __atomic_load_n (&cache->header->strings_used, __ATOMIC_ACQUIRE) &&
+	 entry->check == entry_check (entry);
+}
+
+/* Copies 'entry' into 'copy', as another thread may be writing it.
+ * Returns whether the copy is whole and valid. */
+static int
+entry_read (XdgMimeResultCache   *cache,
+	    const XdgResultEntry *entry,
+	    XdgResultEntry       *copy)
+{
+  xdg_uint32_t check;
+
+  check = __atomic_load_n (&entry->check, __ATOMIC_ACQUIRE);
+  if (check == 0)
+    return FALSE;
+
+  copy->dev = __atomic_load_n (&entry->dev, __ATOMIC_RELAXED);
+  copy->ino = __atomic_load_n (&entry->ino, __ATOMIC_RELAXED);
+  copy->size = __atomic_load_n (&entry->size, __ATOMIC_RELAXED);
+  copy->mtime = __atomic_load_n (&entry->mtime, __ATOMIC_RELAXED);
+  copy->key = __atomic_load_n (&entry->key, __ATOMIC_RELAXED);
+  copy->type = __atomic_load_n (&entry->type, __ATOMIC_RELAXED);
+  copy->check = check;
+
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  if (__atomic_load_n (&entry->check, __ATOMIC_RELAXED) != check)
+    return FALSE;
+
+  return entry_valid (cache, copy);
+}
+
+/* Overwrites 'entry', for entry_read() to either see whole or not at all.
+ * The caller must hold the lock of its set. */
+static void
+entry_write (XdgResultEntry       *entry,
+	     const XdgResultEntry *value)
+{
+  __atomic_store_n (&entry->check, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  __atomic_store_n (&entry->dev, value->dev, __ATOMIC_RELAXED);
+  __atomic_store_n (&entry->ino, value->ino, __ATOMIC_RELAXED);
+  __atomic_store_n (&entry->size, value->size, __ATOMIC_RELAXED);
+  __atomic_store_n (&entry->mtime, value->mtime, __ATOMIC_RELAXED);
+  __atomic_store_n (&entry->key, value->key, __ATOMIC_RELAXED);
+  __atomic_store_n (&entry->type, value->type, __ATOMIC_RELAXED);
+
+  __atomic_store_n (&entry->check, value->check, __ATOMIC_RELEASE);
+}
+
+#define STAT_ADD(cache, field) \
+  __atomic_add_fetch (&(cache)->stats.field, 1, __ATOMIC_RELAXED)
+
+/* Returns the number of the set 'statbuf' goes in */
+static size_t
+find_set (XdgMimeResultCache *cache,
+	  const struct stat  *statbuf)
+{
+  uint64_t h;
+
+  h = ((uint64_t) statbuf->st_ino ^ ((uint64_t) statbuf->st_dev << 32)) * 0x9e3779b97f4a7c15ULL;
+
+  return (size_t) ((h >> 32) & (cache->header->n_sets - 1));
+}
+
+static xdg_uint32_t *
+find_string_slot (XdgMimeResultCache *cache,
+		  const char         *string)
+{
+  xdg_uint32_t i, slot;
+
+  i = _xdg_mime_result_key (0, string) & (RESULT_STRING_SLOTS - 1);
+  while ((slot = __atomic_load_n (&cache->string_slots[i], __ATOMIC_ACQUIRE)) != 0 &&
+	 strcmp (cache->strings + slot - 1, string) != 0)
+    i = (i + 1) & (RESULT_STRING_SLOTS - 1);
+
+  return &cache->string_slots[i];
+}
+
+/* Returns 1 + where 'string' is kept, adding it if need be, or 0 if there
+ * is no room for it */
+static xdg_uint32_t
+intern_string (XdgMimeResultCache *cache,
+	       const char         *string)
+{
+  XdgResultHeader *header = cache->header;
+  xdg_uint32_t *slot, type = 0;
+  size_t len;
+
+  /* Nearly always there already */
+  slot = find_string_slot (cache, string);
+  if (*slot != 0)
+    return *slot;
+
+  pthread_mutex_lock (&cache->strings_lock);
+
+  slot = find_string_slot (cache, string);
+  if (*slot != 0)
+    type = *slot;
+  else
+    {
+      len = strlen (string) + 1;
+      if (cache->n_strings < RESULT_STRING_SLOTS / 2 &&
+	  len <= header->strings_size - header->strings_used)
+	{
+	  memcpy (cache->strings + header->strings_used, string, len);
+	  type = header->strings_used + 1;
+	  __atomic_store_n (&header->strings_used, header->strings_used + len, __ATOMIC_RELEASE);
+	  __atomic_store_n (slot, type, __ATOMIC_RELEASE);
+	  cache->n_strings++;
+	}
+    }
+
+  pthread_mutex_unlock (&cache->strings_lock);
+
+  return type;
+}
+
+/* Checks what is in the buffer, and starts it over if it isn't ours */
+static void
+result_cache_load (XdgMimeResultCache *cache,
+		   xdg_uint32_t        n_sets)
+{
+  XdgResultHeader *header = cache->header;
+  xdg_uint32_t offset;
+  size_t i, n_entries = (size_t) n_sets * RESULT_WAYS;
+
+  if (memcmp (header->magic, RESULT_MAGIC, sizeof (RESULT_MAGIC)) != 0 ||
+      header->version != RESULT_VERSION ||
+      header->entry_size != sizeof (XdgResultEntry) ||
+      header->n_sets != n_sets ||
+      header->strings_size != RESULT_STRINGS_SIZE ||
+      header->strings_used > RESULT_STRINGS_SIZE ||
+      (header->strings_used > 0 && cache->strings[header->strings_used - 1] != '\0'))
+    {
+      memset (cache->buffer, 0, cache->size);
+      memcpy (header->magic, RESULT_MAGIC, sizeof (RESULT_MAGIC));
+      header->version = RESULT_VERSION;
+      header->entry_size = sizeof (XdgResultEntry);
+      header->n_sets = n_sets;
+      header->strings_size = RESULT_STRINGS_SIZE;
+      return;
+    }
+
+  for (offset = 0; offset < header->strings_used;
+       offset += strlen (cache->strings + offset) + 1)
+    {
+      xdg_uint32_t *slot = find_string_slot (cache, cache->strings + offset);
+
+      if (*slot == 0 && cache->n_strings < RESULT_STRING_SLOTS / 2)
+	{
+	  *slot = offset + 1;
+	  cache->n_strings++;
+	}
+    }
+
+  for (i = 0; i < n_entries; i++)
+    {
+      if (entry_valid (cache, &cache->entries[i]))
+	cache->stats.entries++;
+      else
+	memset (&cache->entries[i], 0, sizeof (XdgResultEntry));
+    }
+}
+
+/* Maps 'file_name' as the buffer, if no one else has it */
+static int
+result_cache_map (XdgMimeResultCache *cache,
+		  const char         *file_name)
+{
+#ifdef HAVE_MMAP
+  struct stat st;
+  void *buffer;
+  int fd;
+
+  fd = open (file_name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return FALSE;
+
+  /* Held by the open file, so it keeps out other contexts in the same
+   * process too */
+  if (flock (fd, LOCK_EX | LOCK_NB) == -1 || fstat (fd, &st) == -1)
+    goto fail;
+
+  /* Any other size is another layout; start over with zeroes */
+  if ((size_t) st.st_size != cache->size &&
+      (ftruncate (fd, 0) == -1 || ftruncate (fd, cache->size) == -1))
+    goto fail;
+
+  buffer = mmap (NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (buffer == MAP_FAILED)
+    goto fail;
+
+  cache->buffer = buffer;
+  cache->fd = fd;
+
+  return TRUE;
+
+ fail:
+  close (fd);
+#endif
+
+  return FALSE;
+}
+
+XdgMimeResultCache *
+_xdg_mime_result_cache_new (const char *file_name,
+			    int         n_entries)
+{
+  XdgMimeResultCache *cache;
+  xdg_uint32_t n_sets;
+  int i;
+
+  if (n_entries <= 0)
+    return NULL;
+  if (n_entries > RESULT_MAX_ENTRIES)
+    n_entries = RESULT_MAX_ENTRIES;
+
+  for (n_sets = 1; n_sets * RESULT_WAYS < (xdg_uint32_t) n_entries; n_sets *= 2)
+    ;
+
+  cache = calloc (1, sizeof (XdgMimeResultCache));
+  if (cache == NULL)
+    return NULL;
+
+  cache->ref_count = 1;
+  cache->fd = -1;
+  cache->size = sizeof (XdgResultHeader) +
+		(size_t) n_sets * RESULT_WAYS * sizeof (XdgResultEntry) +
+		RESULT_STRINGS_SIZE;
+
+  if (file_name == NULL || ! result_cache_map (cache, file_name))
+    {
+      cache->buffer = calloc (1, cache->size);
+      if (cache->buffer == NULL)
+	{
+	  free (cache);
+	  return NULL;
+	}
+    }
+
+  for (i = 0; i < RESULT_LOCKS; i++)
+    pthread_mutex_init (&cache->set_locks[i], NULL);
+  pthread_mutex_init (&cache->strings_lock, NULL);
+
+  cache->header = cache->buffer;
+  cache->entries = (XdgResultEntry *) (cache->header + 1);
+  cache->strings = (char *) (cache->entries + (size_t) n_sets * RESULT_WAYS);
+
+  result_cache_load (cache, n_sets);
+
+  cache->stats.capacity = (uint64_t) n_sets * RESULT_WAYS;
+  cache->stats.persistent = cache->fd != -1;
+
+  return cache;
+}
+
+XdgMimeResultCache *
+_xdg_mime_result_cache_ref (XdgMimeResultCache *cache)
+{
+  __atomic_add_fetch (&cache->ref_count, 1, __ATOMIC_RELAXED);
+
+  return cache;
+}
+
+void
+_xdg_mime_result_cache_unref (XdgMimeResultCache *cache)
+{
+  int i;
+
+  if (__atomic_sub_fetch (&cache->ref_count, 1, __ATOMIC_ACQ_REL) != 0)
+    return;
+
+#ifdef HAVE_MMAP
+  if (cache->fd != -1)
+    {
+      munmap (cache->buffer, cache->size);
+      close (cache->fd);
+    }
+  else
+#endif
+    free (cache->buffer);
+
+  for (i = 0; i < RESULT_LOCKS; i++)
+    pthread_mutex_destroy (&cache->set_locks[i]);
+  pthread_mutex_destroy (&cache->strings_lock);
+  free (cache);
+}
+
+const char *
+_xdg_mime_result_cache_lookup (XdgMimeResultCache *cache,
+			       const struct stat  *statbuf,
+			       xdg_uint32_t        key)
+{
+  XdgResultEntry *set, entry;
+  const char *mime_type = NULL;
+  int i;
+
+  set = cache->entries + find_set (cache, statbuf) * RESULT_WAYS;
+  for (i = 0; i < RESULT_WAYS; i++)
+    {
+      if (entry_read (cache, &set[i], &entry) &&
+	  entry.ino == (uint64_t) statbuf->st_ino &&
+	  entry.dev == (uint64_t) statbuf->st_dev &&
+	  entry.key == key &&
+	  entry.size == (uint64_t) statbuf->st_size &&
+	  entry.mtime == (int64_t) statbuf->st_mtime)
+	{
+	  mime_type = cache->strings + entry.type - 1;
+	  break;
+	}
+    }
+
+  if (mime_type)
+    STAT_ADD (cache, hits);
+  else
+    STAT_ADD (cache, misses);
+
+  return mime_type;
+}
+
+void
+_xdg_mime_result_cache_insert (XdgMimeResultCache *cache,
+			       const struct stat  *statbuf,
+			       xdg_uint32_t        key,
+			       const char         *mime_type)
+{
+  XdgResultEntry *set, *entry = NULL, value;
+  pthread_mutex_t *lock;
+  size_t n;
+  int i;
+
+  value.type = intern_string (cache, mime_type);
+  if (value.type == 0)
+    return;
+
+  value.dev = statbuf->st_dev;
+  value.ino = statbuf->st_ino;
+  value.size = statbuf->st_size;
+  value.mtime = statbuf->st_mtime;
+  value.key = key;
+  value.pad = 0;
+  value.check = entry_check (&value);
+
+  n = find_set (cache, statbuf);
+  set = cache->entries + n * RESULT_WAYS;
+  lock = &cache->set_locks[n % RESULT_LOCKS];
+
+  pthread_mutex_lock (lock);
+
+  /* The file's old entry, or a free one, or else the next in turn */
+  for (i = 0; i < RESULT_WAYS && entry == NULL; i++)
+    {
+      if (set[i].type != 0 &&
+	  set[i].ino == (uint64_t) statbuf->st_ino &&
+	  set[i].dev == (uint64_t) statbuf->st_dev &&
+	  set[i].key == key)
+	entry = &set[i];
+    }
+  for (i = 0; i < RESULT_WAYS && entry == NULL; i++)
+    {
+      if (set[i].type == 0)
+	{
+	  entry = &set[i];
+	  STAT_ADD (cache, entries);
+	}
+    }
+  if (entry == NULL)
+    {
+      entry = &set[__atomic_fetch_add (&cache->header->clock, 1, __ATOMIC_RELAXED) % RESULT_WAYS];
+      STAT_ADD (cache, evictions);
+    }
+
+  entry_write (entry, &value);
+
+  pthread_mutex_unlock (lock);
+
+  STAT_ADD (cache, insertions);
+}
+
+void
+_xdg_mime_result_cache_get_stats (XdgMimeResultCache      *cache,
+				  XdgMimeResultCacheStats *stats)
+{
+  stats->hits = __atomic_load_n (&cache->stats.hits, __ATOMIC_RELAXED);
+  stats->misses = __atomic_load_n (&cache->stats.misses, __ATOMIC_RELAXED);
+  stats->insertions = __atomic_load_n (&cache->stats.insertions, __ATOMIC_RELAXED);
+  stats->evictions = __atomic_load_n (&cache->stats.evictions, __ATOMIC_RELAXED);
+  stats->entries = __atomic_load_n (&cache->stats.entries, __ATOMIC_RELAXED);
+  stats->capacity = cache->stats.capacity;
+  stats->persistent = cache->stats.persistent;
+}
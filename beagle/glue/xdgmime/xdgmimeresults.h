@@ -0,0 +1,76 @@
+/* -*- mode: C; c-file-style: "gnu" -*- */
+/* xdgmimeresults.h: Private file.  Cache of lookup results by inode.
+ *
+ * More info can be found at http://www.freedesktop.org/standards/
+ *
+ * Copyright (C) 2026 the author(s) of beagle.
+ *
+ * Licensed under the Academic Free License version 2.0
+ * Or under the following terms:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __XDG_MIME_RESULTS_H__
+#define __XDG_MIME_RESULTS_H__
+
+#include "xdgmime.h"
+#include "xdgmimeint.h"
+
+typedef struct XdgMimeResultCache XdgMimeResultCache;
+
+#ifdef XDG_PREFIX
+#define _xdg_mime_result_cache_new        XDG_ENTRY(result_cache_new)
+#define _xdg_mime_result_cache_ref        XDG_ENTRY(result_cache_ref)
+#define _xdg_mime_result_cache_unref      XDG_ENTRY(result_cache_unref)
+#define _xdg_mime_result_cache_lookup     XDG_ENTRY(result_cache_lookup)
+#define _xdg_mime_result_cache_insert     XDG_ENTRY(result_cache_insert)
+#define _xdg_mime_result_cache_get_stats  XDG_ENTRY(result_cache_get_stats)
+#define _xdg_mime_result_key              XDG_ENTRY(result_key)
+#endif
+
+/* What the magic lookups found for files, by (st_dev, st_ino, st_mtime,
+ * st_size) and a key for everything else the answer depends on: the
+ * database it came from and the name the globs were matched against.
+ * There is room for a fixed number of files; older entries make way for
+ * new ones.
+ *
+ * With a file name, the entries are kept in that file, mmap()ed, so that
+ * they last from one run to the next.  Only one cache uses the file at a
+ * time; the others, and those that can't map it, keep theirs in memory.
+ *
+ * The strings handed back stay valid for as long as the cache does.
+ */
+XdgMimeResultCache *_xdg_mime_result_cache_new       (const char         *file_name,
+						      int                 n_entries);
+XdgMimeResultCache *_xdg_mime_result_cache_ref       (XdgMimeResultCache *cache);
+void                _xdg_mime_result_cache_unref     (XdgMimeResultCache *cache);
+
+const char         *_xdg_mime_result_cache_lookup    (XdgMimeResultCache *cache,
+						      const struct stat  *statbuf,
+						      xdg_uint32_t        key);
+void                _xdg_mime_result_cache_insert    (XdgMimeResultCache *cache,
+						      const struct stat  *statbuf,
+						      xdg_uint32_t        key,
+						      const char         *mime_type);
+void                _xdg_mime_result_cache_get_stats (XdgMimeResultCache      *cache,
+						      XdgMimeResultCacheStats *stats);
+
+/* Hashes 'string' (which may be NULL) into 'key' */
+xdg_uint32_t        _xdg_mime_result_key             (xdg_uint32_t        key,
+						      const char         *string);
+
+#endif /* __XDG_MIME_RESULTS_H__ */
@@ -41,8 +41,20 @@ class DocExtractor {
 						   IntPtr hot_byte_array, int hot_len,
 						   bool append_break);
 		
+	// What extracting took, as wv1-glue counts it
+	[StructLayout (LayoutKind.Sequential)]
+	private struct ExtractStats {
+		public int TextBytes;
+		public int HotBytes;
+		public int Flushes;
+		public int StructBreaks;
+		public int Msec;
+		public int Stopped;
+	}
+
 	[DllImport ("libbeagleglue")]
-	private static extern int wv1_glue_init_doc_parsing (string filename, TextHandlerCallback callback);
+	private static extern int wv1_glue_extract (string filename, TextHandlerCallback callback,
+						    int max_bytes, int max_msec, out ExtractStats stats);
 
 	[DllImport ("libbeagleglue")]
 	private static extern int wv1_init ();
@@ -95,16 +107,35 @@ class DocExtractor {
 	{
 		SystemInformation.SetProcessName ("beagle-doc-extractor");
 
-		if (args.Length != 1) {
-			Console.Error.WriteLine ("Usage: beagle-doc-extractor <file>");
+		int max_bytes = 0, max_seconds = 0;
+		int i;
+
+		for (i = 0; i < args.Length - 1; i += 2) {
+			if (args [i] == "--max-bytes")
+				max_bytes = Int32.Parse (args [i + 1]);
+			else if (args [i] == "--max-seconds")
+				max_seconds = Int32.Parse (args [i + 1]);
+			else
+				break;
+		}
+
+		if (i != args.Length - 1) {
+			Console.Error.WriteLine ("Usage: beagle-doc-extractor [--max-bytes <bytes>] [--max-seconds <seconds>] <file>");
 			return 1;
 		}
 
-		filename = args [0];
+		filename = args [i];
 
 		wv1_init ();
 
-		int ret = wv1_glue_init_doc_parsing (filename, ExtractText);
+		ExtractStats stats;
+		int ret = wv1_glue_extract (filename, ExtractText, max_bytes, max_seconds * 1000, out stats);
+
+		// Last line of the output, for FilterDOC
+		if (ret == 0 || ret == -4)
+			Console.WriteLine ("**STATS** {0} {1} {2} {3} {4} {5}",
+					   stats.TextBytes, stats.HotBytes, stats.Flushes,
+					   stats.StructBreaks, stats.Msec, stats.Stopped);
 
 		switch (ret) {
 		case -1:
@@ -119,6 +150,10 @@ class DocExtractor {
 			Console.Error.WriteLine ("Unable to start the parser for {0}", filename);
 			return 1;
 
+		case -4:
+			Console.Error.WriteLine ("Stopped after {0} bytes in {1} ms: {2}", stats.TextBytes, stats.Msec, filename);
+			return 0;
+
 		default:
 			return 0;
 		}
@@ -15,6 +15,16 @@
 
 #include "hit.h"
 #include "file.h"
+#include "snapshot.h"
+
+enum {
+	BEAGLEFS_OPT_KEY_FILES
+};
+
+static struct fuse_opt beaglefs_opts[] = {
+	FUSE_OPT_KEY ("--files", BEAGLEFS_OPT_KEY_FILES),
+	FUSE_OPT_END
+};
 
 static int opt_process (G_GNUC_UNUSED void *data,
 			const char *arg,
@@ -23,6 +33,16 @@ static int opt_process (G_GNUC_UNUSED void *data,
 {
 	static gboolean found;
 
+	/*
+	 * --files: represent hits as regular files, with their content, rather
+	 * than as symlinks.  We need to hold onto the hits to do that.
+	 */
+	if (key == BEAGLEFS_OPT_KEY_FILES) {
+		beagle_file_set_content_mode (TRUE);
+		beagle_hit_set_retain (TRUE);
+		return 0;
+	}
+
 	/*
 	 * Grab the first non-option argument as the query text, but make sure
 	 * to leave the second argument (the mount point) alone.
@@ -30,6 +50,7 @@ static int opt_process (G_GNUC_UNUSED void *data,
 	if (!found && key == FUSE_OPT_KEY_NONOPT) {
 		found = TRUE;
 		beagle_hit_set_query (arg);
+		beagle_snapshot_set_query (arg);
 		return 0;
 	}
 
@@ -43,8 +64,8 @@ main (int argc, char *argv[])
 
 	g_log_set_always_fatal (G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_ERROR);
 
-	if (fuse_opt_parse (&args, NULL, NULL, opt_process) == -1)
-		g_critical ("usage: %s <query> <mount point>", argv[0]);
+	if (fuse_opt_parse (&args, NULL, beaglefs_opts, opt_process) == -1)
+		g_critical ("usage: %s [--files] <query> <mount point>", argv[0]);
 
 	return fuse_main (args.argc, args.argv, &beagle_file_ops);
 }
@@ -12,6 +12,7 @@
 
 #include "inode.h"
 #include "dir.h"
+#include "stats.h"
 
 /* the hash table of inodes in the beaglefs */
 static GHashTable *dir_hash;
@@ -19,6 +20,12 @@ static GHashTable *dir_hash;
 /* the read-write lock that protects said hash AND its contents */
 static GStaticRWLock dir_lock = G_STATIC_RW_LOCK_INIT;
 
+/* bumped on every change to the hash, protected by dir_lock */
+static unsigned int dir_generation;
+
+/* total size of the inodes in the hash, protected by dir_lock */
+static size_t dir_bytes;
+
 /*
  * beagle_dir_get_count - Return the number of entries (hits) in the directory.
  *
@@ -30,10 +37,37 @@ beagle_dir_get_count (void)
 	return g_hash_table_size (dir_hash);
 }
 
+/*
+ * beagle_dir_get_generation - Return the directory's generation count, which
+ * changes whenever an inode is added or removed.
+ *
+ * Caller must hold the directory read lock.
+ */
+unsigned int
+beagle_dir_get_generation (void)
+{
+	return dir_generation;
+}
+
+/*
+ * beagle_dir_get_bytes - Return the number of bytes allocated for the inodes
+ * in the directory, not counting the hash table itself.
+ *
+ * Caller must hold the directory read lock.
+ */
+size_t
+beagle_dir_get_bytes (void)
+{
+	return dir_bytes;
+}
+
 void
 beagle_dir_read_lock (void)
 {
+	guint64 start = beagle_stats_now ();
+
 	g_static_rw_lock_reader_lock (&dir_lock);
+	beagle_stats_lock_wait (BEAGLE_STATS_LOCK_READ, start);
 }
 
 void
@@ -45,7 +79,10 @@ beagle_dir_read_unlock (void)
 void
 beagle_dir_write_lock (void)
 {
+	guint64 start = beagle_stats_now ();
+
 	g_static_rw_lock_writer_lock (&dir_lock);
+	beagle_stats_lock_wait (BEAGLE_STATS_LOCK_WRITE, start);
 }
 
 void
@@ -95,8 +132,6 @@ beagle_dir_for_each_inode (GHFunc func,
 void
 beagle_dir_add_inode (beagle_inode_t *inode)
 {
-	char *key;
-
 	g_return_if_fail (inode);
 
 	/*
@@ -111,8 +146,16 @@ beagle_dir_add_inode (beagle_inode_t *inode)
 	 * hash table, keying off of URI.  I do not want to do that.
 	 */
 
-	key = g_strdup (beagle_inode_get_name (inode));
-	g_hash_table_replace (dir_hash, key, inode);
+	/*
+	 * The key is the inode's own name, which lives as long as the inode,
+	 * so we need not make a copy.  Note that we must replace and not
+	 * insert, so that the key is updated along with the value.
+	 */
+	g_hash_table_replace (dir_hash,
+			      (gpointer) beagle_inode_get_name (inode),
+			      inode);
+	dir_bytes += beagle_inode_get_size (inode);
+	dir_generation++;
 }
 
 /*
@@ -125,13 +168,42 @@ void
 beagle_dir_remove_inode_by_name (const char *name)
 {
 	g_return_if_fail (name);
-	g_hash_table_remove (dir_hash, name);
+	if (g_hash_table_remove (dir_hash, name))
+		dir_generation++;
+}
+
+static gboolean
+inode_is_stale (G_GNUC_UNUSED gpointer key,
+		gpointer value,
+		G_GNUC_UNUSED gpointer user)
+{
+	return beagle_inode_is_stale (value);
+}
+
+/*
+ * beagle_dir_remove_stale_inodes - Remove any inodes loaded from a snapshot
+ * that the daemon has not since confirmed.  Returns the number removed.
+ *
+ * Caller must hold the directory write lock.
+ */
+unsigned int
+beagle_dir_remove_stale_inodes (void)
+{
+	unsigned int removed;
+
+	removed = g_hash_table_foreach_remove (dir_hash, inode_is_stale, NULL);
+	if (removed)
+		dir_generation++;
+
+	return removed;
 }
 
 static void
 value_destroy_func (void *data)
 {
 	beagle_inode_t *inode = data;
+
+	dir_bytes -= beagle_inode_get_size (inode);
 	beagle_inode_free (inode);
 }
 
@@ -143,7 +215,7 @@ beagle_dir_init (void)
 {
 	dir_hash = g_hash_table_new_full (g_str_hash,
 					  g_str_equal,
-					  g_free,
+					  NULL,
 					  value_destroy_func);
 }
 
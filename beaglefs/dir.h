@@ -1,7 +1,12 @@
 #ifndef _BEAGLEFS_DIR_H
 #define _BEAGLEFS_DIR_H
 
+/* estimated per-inode overhead of the hash table, for statistics */
+#define BEAGLEFS_DIR_ENTRY_OVERHEAD	(4 * sizeof (void *))
+
 unsigned int beagle_dir_get_count (void);
+size_t beagle_dir_get_bytes (void);
+unsigned int beagle_dir_get_generation (void);
 
 void beagle_dir_init (void);
 void beagle_dir_destroy (void);
@@ -12,6 +17,8 @@ void beagle_dir_add_inode (beagle_inode_t *inode);
 
 void beagle_dir_remove_inode_by_name (const char *name);
 
+unsigned int beagle_dir_remove_stale_inodes (void);
+
 void beagle_dir_for_each_inode (GHFunc func, gpointer user);
 
 void beagle_dir_read_lock (void);
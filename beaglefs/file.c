@@ -13,6 +13,8 @@
 
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <unistd.h>
 
 #include <glib.h>
@@ -21,30 +23,135 @@
 #include "inode.h"
 #include "dir.h"
 #include "hit.h"
+#include "snapshot.h"
+#include "stats.h"
+
+#define BEAGLEFS_SNIPPET_SUFFIX		".snippet"
+#define BEAGLEFS_SNIPPET_SUFFIX_LEN	8
+
+/*
+ * In content mode, hits are regular files whose contents are the hit targets
+ * (or, lacking a local file, the text the daemon cached for the hit), and each
+ * hit has a sibling "<name>.snippet" file holding its snippet.  Otherwise,
+ * hits are symlinks to their targets.
+ */
+static gboolean content_mode;
+
+/*
+ * An open file in content mode.  Local targets are passed through to 'fd',
+ * everything else is served out of 'text'.
+ */
+typedef struct {
+	int fd;			/* descriptor of the target, or -1 */
+	char *text;		/* text fetched from the daemon, if fd is -1 */
+	size_t len;		/* length of 'text' */
+} beagle_open_file_t;
+
+/*
+ * beagle_file_set_content_mode - Serve hits as regular files with content
+ * rather than as symlinks.  Must be called before the filesystem is mounted.
+ */
+void
+beagle_file_set_content_mode (gboolean enable)
+{
+	content_mode = enable;
+}
 
 /*
- * stat_new_from_inode - populate a stat object from a beagle inode
+ * lookup_path - Return the inode backing 'path' or NULL if there is none.  In
+ * content mode, 'path' may also name the .snippet sibling of a hit, in which
+ * case '*snippet' is set to TRUE.
+ *
+ * The caller must hold the directory read lock.
+ */
+static beagle_inode_t *
+lookup_path (const char *path,
+	     gboolean *snippet)
+{
+	beagle_inode_t *inode;
+	size_t len;
+	char *name;
+
+	*snippet = FALSE;
+
+	inode = beagle_dir_get_inode (path);
+	if (inode || !content_mode)
+		return inode;
+
+	len = strlen (path);
+	if (len <= BEAGLEFS_SNIPPET_SUFFIX_LEN + 1)
+		return NULL;
+	len -= BEAGLEFS_SNIPPET_SUFFIX_LEN;
+	if (strcmp (path + len, BEAGLEFS_SNIPPET_SUFFIX))
+		return NULL;
+
+	name = g_strndup (path, len);
+	inode = beagle_dir_get_inode (name);
+	g_free (name);
+
+	if (inode)
+		*snippet = TRUE;
+
+	return inode;
+}
+
+/*
+ * target_is_local - Return TRUE if the inode's target is a file on the local
+ * filesystem that we can pass through to.
+ *
+ * The caller must hold the directory read lock.
+ */
+static gboolean
+target_is_local (beagle_inode_t *inode)
+{
+	return g_str_has_prefix (beagle_inode_get_uri (inode), "file://");
+}
+
+/*
+ * stat_new_from_inode - populate a stat object from a beagle inode.  In
+ * content mode, the size of a local target is not filled in; instead its path
+ * is copied into 'target' (of PATH_MAX bytes) so that the caller can stat it
+ * once the lock is dropped, and TRUE is returned.
  *
  * The caller needs to hold the directory read lock.
  */
-static void
+static gboolean
 stat_new_from_inode (struct stat **sp,
-		     beagle_inode_t *inode)
+		     beagle_inode_t *inode,
+		     gboolean snippet,
+		     char *target)
 {
 	struct stat *sb = *sp;
+	gboolean need_size = FALSE;
 
-	g_return_if_fail (sb);
-	g_return_if_fail (inode);
+	g_return_val_if_fail (sb, FALSE);
+	g_return_val_if_fail (inode, FALSE);
 
 	memset (sb, 0, sizeof (struct stat));
 
-	sb->st_mode = S_IFLNK | 0777;
+	if (content_mode) {
+		/*
+		 * Text from the daemon is of unknown size until the file is
+		 * opened, so we report zero and use direct I/O on open.
+		 */
+		sb->st_mode = S_IFREG | 0444;
+		if (!snippet && target_is_local (inode)) {
+			g_strlcpy (target, beagle_inode_get_target (inode),
+				   PATH_MAX);
+			need_size = TRUE;
+		}
+	} else {
+		sb->st_mode = S_IFLNK | 0777;
+		sb->st_size = strlen (beagle_inode_get_target (inode));
+	}
+
 	sb->st_nlink = 1;
-	sb->st_size = strlen (beagle_inode_get_target (inode));
 	sb->st_uid = fuse_get_context()->uid;
 	sb->st_gid = fuse_get_context()->gid;
 	sb->st_atime = sb->st_mtime = sb->st_ctime =
 		beagle_inode_get_time (inode);
+
+	return need_size;
 }
 
 static int
@@ -52,6 +159,8 @@ beagle_getattr (const char *path,
 		struct stat *sb)
 {
 	beagle_inode_t *inode;
+	char target[PATH_MAX];
+	gboolean snippet, need_size = FALSE;
 	int ret;
 
 	if (!strcmp (path, G_DIR_SEPARATOR_S)) {
@@ -64,15 +173,34 @@ beagle_getattr (const char *path,
 		return 0;
 	}
 
+	/* the statistics are generated on open, so their size is unknown */
+	if (!strcmp (path, BEAGLEFS_STATS_PATH)) {
+		memset (sb, 0, sizeof (struct stat));
+		sb->st_mode = S_IFREG | 0444;
+		sb->st_nlink = 1;
+		sb->st_uid = fuse_get_context()->uid;
+		sb->st_gid = fuse_get_context()->gid;
+		sb->st_atime = sb->st_mtime = sb->st_ctime = time (NULL);
+		return 0;
+	}
+
 	ret = -ENOENT;
 	beagle_dir_read_lock ();
-	inode = beagle_dir_get_inode (path);
+	inode = lookup_path (path, &snippet);
 	if (inode) {
-		stat_new_from_inode (&sb, inode);
+		need_size = stat_new_from_inode (&sb, inode, snippet, target);
 		ret = 0;
 	}
 	beagle_dir_read_unlock ();
 
+	/* the target may be on a slow disk, so stat it without the lock */
+	if (need_size) {
+		struct stat st;
+
+		if (!stat (target, &st))
+			sb->st_size = st.st_size;
+	}
+
 	return ret;
 }
 
@@ -107,6 +235,14 @@ do_fill_dir (gpointer key,
 	do_fill_dir_t *fill = user;
 
 	fill->filler (fill->buf, name, NULL, 0);
+
+	if (content_mode) {
+		char *snippet;
+
+		snippet = g_strconcat (name, BEAGLEFS_SNIPPET_SUFFIX, NULL);
+		fill->filler (fill->buf, snippet, NULL, 0);
+		g_free (snippet);
+	}
 }
 
 static int
@@ -123,6 +259,7 @@ beagle_readdir (const char *path,
 
 	filler (buf, ".", NULL, 0);
 	filler (buf, "..", NULL, 0);
+	filler (buf, BEAGLEFS_STATS_PATH + 1, NULL, 0);
 
 	beagle_dir_read_lock ();
 	beagle_dir_for_each_inode (do_fill_dir, &user);
@@ -139,7 +276,7 @@ beagle_readlink (const char *path,
 	beagle_inode_t *inode;
 	int ret;
 
-	if (len <= 0)
+	if (len <= 0 || content_mode || !strcmp (path, BEAGLEFS_STATS_PATH))
 		return -EINVAL;
 
 	ret = -ENOENT;
@@ -154,6 +291,108 @@ beagle_readlink (const char *path,
 	return ret;
 }
 
+static int
+beagle_open (const char *path,
+	     struct fuse_file_info *fi)
+{
+	beagle_open_file_t *file;
+	beagle_inode_t *inode;
+	char target[PATH_MAX];
+	gboolean snippet, local;
+	void *hit;
+
+	if ((fi->flags & O_ACCMODE) != O_RDONLY)
+		return -EROFS;
+
+	if (!strcmp (path, BEAGLEFS_STATS_PATH)) {
+		file = g_new0 (beagle_open_file_t, 1);
+		file->fd = -1;
+		file->text = beagle_stats_report ();
+		file->len = strlen (file->text);
+		fi->direct_io = 1;
+		fi->fh = GPOINTER_TO_SIZE (file);
+		return 0;
+	}
+
+	if (!content_mode)
+		return -ENOENT;
+
+	/*
+	 * Grab what we need from the inode and drop the lock before doing
+	 * any I/O, as talking to the daemon can take a while.
+	 */
+	beagle_dir_read_lock ();
+	inode = lookup_path (path, &snippet);
+	if (!inode) {
+		beagle_dir_read_unlock ();
+		return -ENOENT;
+	}
+	local = !snippet && target_is_local (inode);
+	g_strlcpy (target, beagle_inode_get_target (inode), sizeof (target));
+	hit = beagle_inode_get_hit (inode);
+	if (hit)
+		beagle_hit_retain (hit);
+	beagle_dir_read_unlock ();
+
+	file = g_new0 (beagle_open_file_t, 1);
+	file->fd = local ? open (target, O_RDONLY) : -1;
+
+	if (file->fd == -1) {
+		/* no local file, so fall back to the daemon's cached text */
+		if (hit)
+			file->text = beagle_hit_fetch_text (hit, !snippet);
+		if (!file->text)
+			file->text = g_strdup ("");
+		file->len = strlen (file->text);
+		fi->direct_io = 1;
+	}
+
+	if (hit)
+		beagle_hit_release (hit);
+
+	fi->fh = GPOINTER_TO_SIZE (file);
+
+	return 0;
+}
+
+static int
+beagle_read (G_GNUC_UNUSED const char *path,
+	     char *buf,
+	     size_t size,
+	     off_t offset,
+	     struct fuse_file_info *fi)
+{
+	beagle_open_file_t *file = GSIZE_TO_POINTER (fi->fh);
+	ssize_t ret;
+
+	if (file->fd != -1) {
+		ret = pread (file->fd, buf, size, offset);
+		return ret == -1 ? -errno : (int) ret;
+	}
+
+	if (offset < 0 || (size_t) offset >= file->len)
+		return 0;
+	if (size > file->len - offset)
+		size = file->len - offset;
+	memcpy (buf, file->text + offset, size);
+
+	return size;
+}
+
+static int
+beagle_release (G_GNUC_UNUSED const char *path,
+		struct fuse_file_info *fi)
+{
+	beagle_open_file_t *file = GSIZE_TO_POINTER (fi->fh);
+
+	if (file->fd != -1)
+		close (file->fd);
+	g_free (file->text);
+	g_free (file);
+
+	return 0;
+}
+
 /*
  * copy_xattr - copy a given xattr value into the buffer of the given len,
  * behaving per POSIX.
@@ -189,68 +428,159 @@ beagle_getxattr (const char *path,
 		 size_t len)
 {
 	beagle_inode_t *inode;
+	gboolean snippet;
 	int ret;
 
 	if (strlen (key) < BEAGLEFS_XATTR_PREFIX_LEN + 1)
 		return -ENODATA;
 	if (strncmp (key, BEAGLEFS_XATTR_PREFIX, BEAGLEFS_XATTR_PREFIX_LEN))
 		return -ENODATA;
+	if (!strcmp (path, BEAGLEFS_STATS_PATH))
+		return -ENODATA;
 	key += BEAGLEFS_XATTR_PREFIX_LEN;
 
 	ret = -ENOENT;
 	beagle_dir_read_lock ();
-	inode = beagle_dir_get_inode (path);
+	inode = lookup_path (path, &snippet);
 	if (inode) {
-		if (!strcmp (key, "mime_type"))
-			ret = copy_xattr (buf,
-					  beagle_inode_get_mime_type (inode),
-					  len);
-		else if (!strcmp (key, "type"))
-			ret = copy_xattr (buf,
-					  beagle_inode_get_type (inode),
-					  len);
-		else if (!strcmp (key, "uri"))
+		if (!strcmp (key, "uri"))
 			ret = copy_xattr (buf,
 					  beagle_inode_get_uri (inode),
 					  len);
-		else if (!strcmp (key, "source"))
+		else if (!strcmp (key, "score")) {
+			char score[G_ASCII_DTOSTR_BUF_SIZE];
+
+			g_snprintf (score, sizeof (score), "%.4lf",
+				    beagle_inode_get_score (inode));
+			ret = copy_xattr (buf, score, len);
+		} else if (!strcmp (key, "stale"))
 			ret = copy_xattr (buf,
-					  beagle_inode_get_source (inode),
+					  beagle_inode_is_stale (inode) ?
+					  "1" : NULL,
 					  len);
-		else if (!strcmp (key, "score"))
+		else
 			ret = copy_xattr (buf,
-					  beagle_inode_get_score (inode),
+					  beagle_inode_get_property (inode,
+								     key),
 					  len);
-		else
-			ret = -ENODATA;
 	}
 	beagle_dir_read_unlock ();
 
 	return ret;
 }
 
+static void
+do_list_xattr (const char *key,
+	       G_GNUC_UNUSED const char *value,
+	       void *user)
+{
+	GString *list = user;
+
+	g_string_append (list, BEAGLEFS_XATTR_PREFIX);
+	g_string_append_len (list, key, strlen (key) + 1);
+}
+
 static int
-beagle_listxattr (G_GNUC_UNUSED const char *path,
+beagle_listxattr (const char *path,
 		  char *buf,
 		  size_t len)
 {
-	const char list[] = BEAGLEFS_XATTR_PREFIX"mime_type\0"
-			    BEAGLEFS_XATTR_PREFIX"type\0"
-			    BEAGLEFS_XATTR_PREFIX"score\0"
-			    BEAGLEFS_XATTR_PREFIX"source\0"
-			    BEAGLEFS_XATTR_PREFIX"uri";
-	size_t size = sizeof (list);
+	beagle_inode_t *inode;
+	gboolean snippet;
+	GString *list;
+	size_t size;
+
+	if (!strcmp (path, BEAGLEFS_STATS_PATH))
+		return 0;
+
+	beagle_dir_read_lock ();
+	inode = lookup_path (path, &snippet);
+	if (!inode) {
+		beagle_dir_read_unlock ();
+		return -ENOENT;
+	}
 
+	/* build the list on demand, from the inode's packed properties */
+	list = g_string_new (NULL);
+	g_string_append_len (list, BEAGLEFS_XATTR_PREFIX"uri",
+			     BEAGLEFS_XATTR_PREFIX_LEN + 4);
+	g_string_append_len (list, BEAGLEFS_XATTR_PREFIX"score",
+			     BEAGLEFS_XATTR_PREFIX_LEN + 6);
+	if (beagle_inode_is_stale (inode))
+		g_string_append_len (list, BEAGLEFS_XATTR_PREFIX"stale",
+				     BEAGLEFS_XATTR_PREFIX_LEN + 6);
+	beagle_inode_for_each_property (inode, do_list_xattr, list);
+	beagle_dir_read_unlock ();
+
+	size = list->len;
 	if (len) {
 		if (len >= size)
-			memcpy (buf, list, size);
-		if (len < size)
+			memcpy (buf, list->str, size);
+		if (len < size) {
+			g_string_free (list, TRUE);
 			return -ERANGE;
+		}
 	}
+	g_string_free (list, TRUE);
 
 	return size;
 }
 
+/*
+ * Timed wrappers for the hot operations, feeding the per-operation call counts
+ * and latency histograms in the statistics file.
+ */
+
+static int
+timed_getattr (const char *path,
+	       struct stat *sb)
+{
+	guint64 start = beagle_stats_now ();
+	int ret = beagle_getattr (path, sb);
+
+	beagle_stats_op (BEAGLE_STATS_OP_GETATTR, start);
+	return ret;
+}
+
+static int
+timed_readdir (const char *path,
+	       void *buf,
+	       fuse_fill_dir_t filler,
+	       off_t offset,
+	       struct fuse_file_info *fi)
+{
+	guint64 start = beagle_stats_now ();
+	int ret = beagle_readdir (path, buf, filler, offset, fi);
+
+	beagle_stats_op (BEAGLE_STATS_OP_READDIR, start);
+	return ret;
+}
+
+static int
+timed_readlink (const char *path,
+		char *buf,
+		size_t len)
+{
+	guint64 start = beagle_stats_now ();
+	int ret = beagle_readlink (path, buf, len);
+
+	beagle_stats_op (BEAGLE_STATS_OP_READLINK, start);
+	return ret;
+}
+
+static int
+timed_getxattr (const char *path,
+		const char *key,
+		char *buf,
+		size_t len)
+{
+	guint64 start = beagle_stats_now ();
+	int ret = beagle_getxattr (path, key, buf, len);
+
+	beagle_stats_op (BEAGLE_STATS_OP_GETXATTR, start);
+	return ret;
+}
+
 static void *
 beagle_init (void)
 {
@@ -262,16 +592,21 @@ beagle_init (void)
 static void
 beagle_destroy (G_GNUC_UNUSED void *ignore)
 {
+	beagle_snapshot_save ();
 	beagle_hit_destroy ();
 	beagle_dir_destroy ();
+	beagle_snapshot_destroy ();
 }
 
 struct fuse_operations beagle_file_ops = {
-	.getattr = beagle_getattr,
+	.getattr = timed_getattr,
 	.statfs = beagle_statfs,
-	.readdir = beagle_readdir,
-	.readlink = beagle_readlink,
-	.getxattr = beagle_getxattr,
+	.readdir = timed_readdir,
+	.readlink = timed_readlink,
+	.open = beagle_open,
+	.read = beagle_read,
+	.release = beagle_release,
+	.getxattr = timed_getxattr,
 	.listxattr = beagle_listxattr,
 	.init = beagle_init,
 	.destroy = beagle_destroy
@@ -1,6 +1,10 @@
 #ifndef _BEAGLEFS_FILE_H
 #define _BEAGLEFS_FILE_H
 
+#include <glib.h>
+
 struct fuse_operations beagle_file_ops;
 
+void beagle_file_set_content_mode (gboolean enable);
+
 #endif	/* _BEAGLEFS_FILE_H */
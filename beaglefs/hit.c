@@ -16,9 +16,17 @@
 #include "hit.h"
 #include "inode.h"
 #include "dir.h"
+#include "snapshot.h"
+#include "stats.h"
+
+/* how often, in seconds, to save a snapshot of the directory */
+#define BEAGLEFS_SNAPSHOT_INTERVAL	300
 
 static char *query_text;
 static GMainLoop *hit_main_loop;
+static BeagleClient *hit_client;
+static BeagleQuery *hit_query;
+static gboolean retain_hits;
 
 /*
  * beagle_hit_set_query - Set the query used by the filesystem to 'query'.
@@ -31,9 +39,85 @@ beagle_hit_set_query (const char *query)
 	query_text = g_strdup (query);
 }
 
+/*
+ * beagle_hit_set_retain - If 'retain' is TRUE, each inode keeps a reference to
+ * the BeagleHit it was created from, so that its text and snippet can later be
+ * fetched from the daemon via beagle_hit_fetch_text().  Must be called before
+ * beagle_hit_init().
+ */
+void
+beagle_hit_set_retain (gboolean retain)
+{
+	retain_hits = retain;
+}
+
+/*
+ * beagle_hit_retain - Take a reference on the opaque hit 'hit', returning it.
+ */
+void *
+beagle_hit_retain (void *hit)
+{
+	g_return_val_if_fail (hit, NULL);
+	return beagle_hit_ref (hit);
+}
+
+/*
+ * beagle_hit_release - Drop a reference obtained via beagle_hit_retain().
+ */
+void
+beagle_hit_release (void *hit)
+{
+	g_return_if_fail (hit);
+	beagle_hit_unref (hit);
+}
+
+/*
+ * beagle_hit_fetch_text - Synchronously ask the daemon for the text of 'hit'.
+ * If 'full_text' is TRUE, the entire cached text of the hit is returned,
+ * otherwise just the snippet for our query.  This blocks on the daemon, so do
+ * not call it with the directory lock held.
+ *
+ * Returns a newly allocated string, which must be freed via g_free(), or NULL
+ * if the daemon has no text for the hit.
+ */
+char *
+beagle_hit_fetch_text (void *hit,
+		       gboolean full_text)
+{
+	BeagleSnippetRequest *request;
+	BeagleResponse *response;
+	char *text = NULL;
+
+	g_return_val_if_fail (hit, NULL);
+
+	if (!hit_client || !hit_query)
+		return NULL;
+
+	request = beagle_snippet_request_new ();
+	beagle_snippet_request_set_query (request, hit_query);
+	beagle_snippet_request_set_hit (request, hit);
+	beagle_snippet_request_set_full_text (request, full_text);
+
+	response = beagle_client_send_request (hit_client,
+					       BEAGLE_REQUEST (request),
+					       NULL);
+	if (response) {
+		if (BEAGLE_IS_SNIPPET_RESPONSE (response)) {
+			BeagleSnippetResponse *snippet;
+
+			snippet = BEAGLE_SNIPPET_RESPONSE (response);
+			text = g_strdup (beagle_snippet_response_get_snippet (snippet));
+		}
+		g_object_unref (response);
+	}
+	g_object_unref (request);
+
+	return text;
+}
+
 /*
  * hit_to_new_inode - create a new beaglefs inode object via beagle_inode_new()
- * and initialize its default values via a BeagleHit object.
+ * and initialize its default values and properties via a BeagleHit object.
  *
  * Returns the newly allocated inode object, which must be freed via a call to
  * beagle_inode_free().
@@ -43,6 +127,9 @@ hit_to_new_inode (BeagleHit *hit)
 {
 	BeagleTimestamp *hit_time;
 	beagle_inode_t *inode;
+	GSList *props, *elt;
+	const char **keys, **values;
+	unsigned int n;
 	time_t timestamp;
 
 	g_return_val_if_fail (hit, NULL);
@@ -51,12 +138,36 @@ hit_to_new_inode (BeagleHit *hit)
 	if (!beagle_timestamp_to_unix_time (hit_time, &timestamp))
 		time (&timestamp); /* current time is better than nothing */
 
+	/* libbeagle keeps the properties sorted by key, as the inode wants */
+	props = beagle_hit_get_all_properties (hit);
+
+	n = g_slist_length (props);
+	keys = g_new (const char *, n);
+	values = g_new (const char *, n);
+
+	n = 0;
+	for (elt = props; elt; elt = g_slist_next (elt)) {
+		BeagleProperty *prop = elt->data;
+
+		keys[n] = beagle_property_get_key (prop);
+		values[n] = beagle_property_get_value (prop);
+		n++;
+	}
+
 	inode = beagle_inode_new (beagle_hit_get_uri (hit),
 				  timestamp,
+				  beagle_hit_get_score (hit),
 				  beagle_hit_get_mime_type (hit),
 				  beagle_hit_get_type (hit),
 				  beagle_hit_get_source (hit),
-				  beagle_hit_get_score (hit));
+				  keys,
+				  values,
+				  n,
+				  retain_hits ? beagle_hit_retain (hit) : NULL);
+
+	g_free (values);
+	g_free (keys);
+	g_slist_free (props);
 
 	return inode;
 }
@@ -71,7 +182,10 @@ hits_added_cb (G_GNUC_UNUSED BeagleQuery *query,
 {
 	GSList *hits, *elt;
 
+	beagle_stats_query_hits ();
+
 	hits = beagle_hits_added_response_get_hits (response);
+	beagle_stats_hits_added (g_slist_length (hits));
 	for (elt = hits; elt; elt = g_slist_next (elt)) {
 		beagle_inode_t *inode;
 
@@ -94,6 +208,7 @@ hits_subtracted_cb (G_GNUC_UNUSED BeagleQuery *query,
 	GSList *hits, *elt;
 
 	hits = beagle_hits_subtracted_response_get_uris (response);
+	beagle_stats_hits_removed (g_slist_length (hits));
 	for (elt = hits; elt; elt = g_slist_next (elt)) {
 		const char *name;
 
@@ -105,46 +220,76 @@ hits_subtracted_cb (G_GNUC_UNUSED BeagleQuery *query,
 	}
 }
 
-static void *
-hit_thread_start (G_GNUC_UNUSED void *ignored)
+/*
+ * finished_cb - Our callback for the libbeagle "finished" signal.  By now the
+ * daemon has sent us every current hit, so anything left over from the
+ * snapshot is gone.
+ */
+static void
+finished_cb (G_GNUC_UNUSED BeagleQuery *query,
+	     G_GNUC_UNUSED BeagleFinishedResponse *response)
 {
-	BeagleClient *client;
-	BeagleQuery *query;
-	BeagleRequest *request;
+	unsigned int removed;
 
-	client = beagle_client_new (NULL);
-	if (!client)
-		g_critical ("Failed to instantiate a BeagleClient.");
+	beagle_stats_query_finished ();
 
-	hit_main_loop = g_main_loop_new (NULL, FALSE);
-	query = beagle_query_new ();
-	request = BEAGLE_REQUEST (query);
+	beagle_dir_write_lock ();
+	removed = beagle_dir_remove_stale_inodes ();
+	beagle_dir_write_unlock ();
+
+	beagle_stats_hits_removed (removed);
+}
+
+/*
+ * snapshot_timeout_cb - Periodically save a snapshot of the directory.
+ */
+static gboolean
+snapshot_timeout_cb (G_GNUC_UNUSED gpointer data)
+{
+	beagle_snapshot_save ();
+	return TRUE;
+}
 
-	beagle_query_add_text (query, query_text);
-	beagle_query_add_text (query, "type:File");
-	beagle_query_add_text (query, "type:IMLog");
+static void *
+hit_thread_start (G_GNUC_UNUSED void *ignored)
+{
+	BeagleRequest *request;
 
+	request = BEAGLE_REQUEST (hit_query);
 
-	g_signal_connect (query,
+	g_signal_connect (hit_query,
 			  "hits-added",
 			  G_CALLBACK (hits_added_cb),
-			  client);
+			  hit_client);
 
-	g_signal_connect (query,
+	g_signal_connect (hit_query,
 			  "hits-subtracted",
 			  G_CALLBACK (hits_subtracted_cb),
-			  client);
+			  hit_client);
 
-	if (!beagle_client_send_request_async (client, request, NULL))
+	g_signal_connect (hit_query,
+			  "finished",
+			  G_CALLBACK (finished_cb),
+			  hit_client);
+
+	g_timeout_add (BEAGLEFS_SNAPSHOT_INTERVAL * 1000,
+		       snapshot_timeout_cb,
+		       NULL);
+
+	beagle_stats_query_sent ();
+	if (!beagle_client_send_request_async (hit_client, request, NULL))
 		g_critical ("Failed to send BeagleQuery to Beagle.");
 
 	g_main_loop_run (hit_main_loop);
 
-	g_object_unref (query);
-	g_object_unref (client);
+	g_object_unref (hit_query);
+	g_object_unref (hit_client);
 	g_main_loop_unref (hit_main_loop);
 	g_free (query_text);
 
+	hit_query = NULL;
+	hit_client = NULL;
+
 	return NULL;
 }
 
@@ -157,6 +302,28 @@ beagle_hit_init (void)
 	g_thread_init (NULL);
 	g_type_init ();
 
+	/*
+	 * Serve the last snapshot of our results while the daemon re-runs the
+	 * query.  This must happen before the hit thread starts, lest a stale
+	 * inode from the snapshot replace a fresh one from the daemon.
+	 */
+	beagle_snapshot_load ();
+
+	/*
+	 * Create the client and query up front, so that they are available to
+	 * beagle_hit_fetch_text() from the filesystem threads, too.
+	 */
+	hit_client = beagle_client_new (NULL);
+	if (!hit_client)
+		g_critical ("Failed to instantiate a BeagleClient.");
+
+	hit_main_loop = g_main_loop_new (NULL, FALSE);
+	hit_query = beagle_query_new ();
+
+	beagle_query_add_text (hit_query, query_text);
+	beagle_query_add_text (hit_query, "type:File");
+	beagle_query_add_text (hit_query, "type:IMLog");
+
 	if (!g_thread_create (hit_thread_start, NULL, FALSE, NULL))
 		g_critical ("Failed to launch hit engine thread.");
 }
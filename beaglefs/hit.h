@@ -1,7 +1,14 @@
 #ifndef _BEAGLEFS_HIT_H
 #define _BEAGLEFS_HIT_H
 
+#include <glib.h>
+
 void beagle_hit_set_query (const char *query);
+void beagle_hit_set_retain (gboolean retain);
+
+void * beagle_hit_retain (void *hit);
+void beagle_hit_release (void *hit);
+char * beagle_hit_fetch_text (void *hit, gboolean full_text);
 
 void beagle_hit_init (void);
 void beagle_hit_destroy (void);
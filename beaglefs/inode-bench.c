@@ -0,0 +1,101 @@
+/*
+ * beaglefs/inode-bench.c - measure the memory cost of a beaglefs hit
+ *
+ * Builds a directory of synthetic inodes, shaped like a typical result set,
+ * and reports the heap consumed per hit, including the directory hash.
+ *
+ * Usage: ./inode-bench [number of hits]
+ *
+ * Licensed under the terms of the GNU GPL v2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#include <glib.h>
+
+#include "inode.h"
+#include "dir.h"
+
+#define DEFAULT_NR_HITS	250000
+
+/* the properties each synthetic hit carries, besides the built-in ones */
+#define NR_PROPERTIES	2
+
+static const char *mime_types[] = {
+	"text/plain", "application/pdf", "image/jpeg", "text/html",
+	"application/msword", "text/x-csrc", "audio/mpeg"
+};
+
+static const char *types[] = { "File", "IMLog" };
+
+static const char *sources[] = { "Files", "GaimLog" };
+
+/*
+ * heap_in_use - bytes of heap currently allocated, per mallinfo().
+ */
+static size_t
+heap_in_use (void)
+{
+	struct mallinfo mi = mallinfo ();
+
+	return (size_t) mi.uordblks + (size_t) mi.hblkhd;
+}
+
+int
+main (int argc, char *argv[])
+{
+	size_t before, after;
+	unsigned int i, nr_hits = DEFAULT_NR_HITS;
+
+	if (argc > 1)
+		nr_hits = strtoul (argv[1], NULL, 10);
+
+	/*
+	 * Route GSlice through malloc, so that mallinfo() sees every byte and
+	 * not just the magazines.
+	 */
+	g_setenv ("G_SLICE", "always-malloc", TRUE);
+
+	beagle_dir_init ();
+	before = heap_in_use ();
+
+	beagle_dir_write_lock ();
+	for (i = 0; i < nr_hits; i++) {
+		beagle_inode_t *inode;
+		const char *keys[NR_PROPERTIES], *values[NR_PROPERTIES];
+		char *uri, *title;
+
+		uri = g_strdup_printf ("file:///home/user/Documents/project-%u/"
+				       "notes%%20on%%20hit-%u.txt", i % 97, i);
+		title = g_strdup_printf ("Notes on hit %u", i);
+
+		keys[0] = "beagle:ExactFilename";
+		values[0] = strrchr (uri, '/') + 1;
+		keys[1] = "dc:title";
+		values[1] = title;
+
+		inode = beagle_inode_new (uri, 1150000000 + i,
+					  (double) i / nr_hits,
+					  mime_types[i % G_N_ELEMENTS (mime_types)],
+					  types[i % G_N_ELEMENTS (types)],
+					  sources[i % G_N_ELEMENTS (sources)],
+					  keys, values, NR_PROPERTIES, NULL);
+		beagle_dir_add_inode (inode);
+		g_free (title);
+		g_free (uri);
+	}
+	beagle_dir_write_unlock ();
+
+	after = heap_in_use ();
+
+	printf ("%u hits, %lu bytes, %.1f bytes per hit\n",
+		nr_hits, (unsigned long) (after - before),
+		nr_hits ? (double) (after - before) / nr_hits : 0.0);
+
+	beagle_dir_destroy ();
+
+	return 0;
+}
@@ -8,23 +8,179 @@
  * Licensed under the terms of the GNU GPL v2
  */
 
+#include <stdio.h>
 #include <string.h>
 
 #include <glib.h>
 
 #include "inode.h"
+#include "hit.h"
 
+/*
+ * Interning of the low-cardinality inode strings (MIME type, hit type, and
+ * source), which take only a handful of distinct values across all hits.
+ * Interned strings live for the life of the process and are never freed.
+ */
+#if GLIB_CHECK_VERSION(2,10,0)
+# define inode_intern(str)	g_intern_string (str)
+#else
+# define inode_intern(str)	g_quark_to_string (g_quark_from_string (str))
+#endif
+
+/*
+ * The properties every hit has, which are interned rather than packed, and
+ * are listed ahead of the hit's own properties.
+ */
+#define INODE_NR_BUILTINS	3
+
+static const char *builtin_keys[INODE_NR_BUILTINS] = {
+	"mime_type",
+	"type",
+	"source"
+};
+
+/*
+ * The inode object.  To keep the per-hit cost down, the target, the URI, and
+ * the hit's own properties are packed, in that order, into the 'target'
+ * storage at the end of the inode, which is thus a single allocation.  The
+ * name points into 'target'.
+ *
+ * The properties are a sequence of NUL-terminated key and value pairs, ended
+ * by an empty key.  A key with multiple values is stored once, with its values
+ * separated by newlines.  They are left packed until somebody asks for them.
+ */
 struct beagle_inode {
-	char *name;		/* filename */
-	char *target;		/* target of the symlink, absolute file path */
+	const char *name;	/* filename, the last component of 'target' */
+	const char *builtins[INODE_NR_BUILTINS]; /* interned, or NULL */
+	void *hit;		/* retained hit for content mode, or NULL */
+	double score;		/* xattr: Hit Score */
 	time_t time;		/* inode's m_time, c_time, and a_time */
-	char *mime_type;	/* xattr: MIME Type */
-	char *type;		/* xattr: Hit Type */
-	char *uri;		/* xattr: URI */
-	char *source;		/* xattr: Source */
-	char *score;		/* xattr: Hit Score */
+	unsigned int size;	/* size of the inode, including 'target' */
+	unsigned int stale;	/* from a snapshot, not yet seen by the daemon */
+	char target[];		/* target of the symlink, URI, properties */
 };
 
+/*
+ * The on-disk form of an inode, as stored in snapshots: this header, followed
+ * by the target, the URI, and the properties in the packed form above, with
+ * the built-in properties first, padded to a multiple of eight bytes so that
+ * each header is aligned within a mapped snapshot.
+ */
+typedef struct {
+	gint64 time;		/* the inode's time */
+	double score;		/* the inode's score */
+	guint32 len;		/* length of the storage that follows */
+	guint32 reserved;	/* zero */
+} inode_record_t;
+
+#define INODE_RECORD_ALIGN(len)	(((len) + 7) & ~((size_t) 7))
+
+/*
+ * pack_properties - pack the 'n' properties in 'keys' and 'values' into
+ * 'dest', in the format described above, and return the packed length.  If
+ * 'dest' is NULL, just return the length.
+ *
+ * Multiple values for the same key are merged only if they are adjacent, so
+ * the keys ought to be sorted.  Pairs with a NULL or empty key or a NULL value
+ * are skipped.
+ */
+static size_t
+pack_properties (char *dest,
+		 const char **keys,
+		 const char **values,
+		 unsigned int n)
+{
+	const char *last = NULL;
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		size_t klen, vlen;
+
+		if (!keys[i] || *keys[i] == '\0' || !values[i])
+			continue;
+
+		vlen = strlen (values[i]);
+
+		if (last && !strcmp (last, keys[i])) {
+			/* another value: turn the last NUL into a newline */
+			if (dest) {
+				dest[len - 1] = '\n';
+				memcpy (dest + len, values[i], vlen + 1);
+			}
+			len += vlen + 1;
+			continue;
+		}
+
+		klen = strlen (keys[i]);
+		if (dest) {
+			memcpy (dest + len, keys[i], klen + 1);
+			memcpy (dest + len + klen + 1, values[i], vlen + 1);
+		}
+		len += klen + 1 + vlen + 1;
+		last = keys[i];
+	}
+
+	if (dest)
+		dest[len] = '\0';
+
+	return len + 1;
+}
+
+/*
+ * inode_alloc - allocate an inode with the given target, URI, and built-in
+ * properties, packing 'target', 'uri', and the 'n' properties in 'keys' and
+ * 'values'.  The caller fills in the rest.
+ */
+static beagle_inode_t *
+inode_alloc (const char *target,
+	     const char *uri,
+	     const char **builtins,
+	     const char **keys,
+	     const char **values,
+	     unsigned int n)
+{
+	beagle_inode_t *inode;
+	size_t target_len, uri_len, size;
+	unsigned int i;
+
+	target_len = strlen (target);
+	uri_len = strlen (uri);
+	size = sizeof (beagle_inode_t) + target_len + 1 + uri_len + 1 +
+	       pack_properties (NULL, keys, values, n);
+
+#if GLIB_CHECK_VERSION(2,10,0)
+	inode = g_slice_alloc (size);
+# else
+	inode = g_malloc (size);
+#endif
+
+	memcpy (inode->target, target, target_len + 1);
+	memcpy (inode->target + target_len + 1, uri, uri_len + 1);
+	pack_properties (inode->target + target_len + 1 + uri_len + 1,
+			 keys, values, n);
+
+	for (i = 0; i < INODE_NR_BUILTINS; i++)
+		inode->builtins[i] = builtins[i] ?
+				     inode_intern (builtins[i]) : NULL;
+
+	inode->name = strrchr (inode->target, G_DIR_SEPARATOR);
+	inode->size = size;
+
+	return inode;
+}
+
+/*
+ * inode_get_properties - return the start of the inode's packed properties.
+ */
+static inline const char *
+inode_get_properties (beagle_inode_t *inode)
+{
+	const char *uri = beagle_inode_get_uri (inode);
+
+	return uri + strlen (uri) + 1;
+}
+
 const char *
 beagle_inode_get_name (beagle_inode_t *inode)
 {
@@ -47,43 +203,120 @@ beagle_inode_get_time (beagle_inode_t *inode)
 }
 
 const char *
-beagle_inode_get_mime_type (beagle_inode_t *inode)
+beagle_inode_get_uri (beagle_inode_t *inode)
 {
 	g_return_val_if_fail (inode, NULL);
-	return inode->mime_type;
+	return inode->target + strlen (inode->target) + 1;
 }
 
-const char *
-beagle_inode_get_type (beagle_inode_t *inode)
+double
+beagle_inode_get_score (beagle_inode_t *inode)
 {
-	g_return_val_if_fail (inode, NULL);
-	return inode->type;
+	g_return_val_if_fail (inode, 0.0);
+	return inode->score;
 }
 
-const char *
-beagle_inode_get_uri (beagle_inode_t *inode)
+/*
+ * beagle_inode_is_stale - Return TRUE if the inode was loaded from a snapshot
+ * and the daemon has not (yet) confirmed it.
+ */
+int
+beagle_inode_is_stale (beagle_inode_t *inode)
 {
-	g_return_val_if_fail (inode, NULL);
-	return inode->uri;
+	g_return_val_if_fail (inode, FALSE);
+	return inode->stale;
 }
 
+/*
+ * beagle_inode_get_size - Return the number of bytes allocated for the inode.
+ */
+size_t
+beagle_inode_get_size (beagle_inode_t *inode)
+{
+	g_return_val_if_fail (inode, 0);
+	return inode->size;
+}
+
+/*
+ * beagle_inode_get_property - Return the value of the hit property 'key', or
+ * NULL if the hit has no such property.  Multiple values are separated by
+ * newlines.
+ */
 const char *
-beagle_inode_get_source (beagle_inode_t *inode)
+beagle_inode_get_property (beagle_inode_t *inode,
+			   const char *key)
 {
+	const char *p;
+	unsigned int i;
+
 	g_return_val_if_fail (inode, NULL);
-	return inode->source;
+	g_return_val_if_fail (key, NULL);
+
+	for (i = 0; i < INODE_NR_BUILTINS; i++) {
+		if (!strcmp (builtin_keys[i], key))
+			return inode->builtins[i];
+	}
+
+	p = inode_get_properties (inode);
+	while (*p) {
+		const char *value = p + strlen (p) + 1;
+
+		if (!strcmp (p, key))
+			return value;
+		p = value + strlen (value) + 1;
+	}
+
+	return NULL;
 }
 
-const char *
-beagle_inode_get_score (beagle_inode_t *inode)
+/*
+ * beagle_inode_for_each_property - Invoke 'func' on each of the inode's hit
+ * properties, with the property's key and value, and 'user'.
+ */
+void
+beagle_inode_for_each_property (beagle_inode_t *inode,
+				beagle_inode_property_func_t func,
+				void *user)
+{
+	const char *p;
+	unsigned int i;
+
+	g_return_if_fail (inode);
+	g_return_if_fail (func);
+
+	for (i = 0; i < INODE_NR_BUILTINS; i++) {
+		if (inode->builtins[i])
+			func (builtin_keys[i], inode->builtins[i], user);
+	}
+
+	p = inode_get_properties (inode);
+	while (*p) {
+		const char *value = p + strlen (p) + 1;
+
+		func (p, value, user);
+		p = value + strlen (value) + 1;
+	}
+}
+
+/*
+ * beagle_inode_get_hit - Return the hit retained by this inode, or NULL if the
+ * filesystem is not retaining hits.  The caller must hold the directory read
+ * lock, and must beagle_hit_retain() the hit if it is to outlive the lock.
+ */
+void *
+beagle_inode_get_hit (beagle_inode_t *inode)
 {
 	g_return_val_if_fail (inode, NULL);
-	return inode->score;
+	return inode->hit;
 }
 
 /*
  * beagle_inode_new - Allocate and return a new inode object, initializing it
- * with the provided values, of which fresh copies are made.
+ * with the provided values, of which fresh copies are made (or, for the MIME
+ * type, type, and source, which may be NULL, interned copies), and with the
+ * 'n' properties in 'keys' and 'values'.  The keys should be sorted, so that
+ * multiple values for a key are adjacent.  The inode takes ownership of the
+ * reference to 'hit', which may be NULL.
  *
  * Returns the newly allocated inode object, which must be freed via a call to
  * beagle_inode_free().  The inode is not automatically added to the directory
@@ -92,38 +325,39 @@ beagle_inode_get_score (beagle_inode_t *inode)
 beagle_inode_t *
 beagle_inode_new (const char *uri,
 		  time_t timestamp,
+		  double score,
 		  const char *mime_type,
 		  const char *type,
 		  const char *source,
-		  double score)
+		  const char **keys,
+		  const char **values,
+		  unsigned int n,
+		  void *hit)
 {
+	const char *builtins[INODE_NR_BUILTINS];
 	beagle_inode_t *inode;
 	char *target;
 
 	g_return_val_if_fail (uri && *uri != '\0', NULL);	
 	g_return_val_if_fail (timestamp != (time_t)(-1), NULL);
-	g_return_val_if_fail (mime_type && *mime_type != '\0', NULL);
-	g_return_val_if_fail (type && *type != '\0', NULL);
-	g_return_val_if_fail (source && *source != '\0', NULL);
-
-#if GLIB_CHECK_VERSION(2,10,0)
-	inode = g_slice_new (beagle_inode_t);
-# else
-	inode = g_new (beagle_inode_t, 1);
-#endif
+	g_return_val_if_fail (keys || !n, NULL);
+	g_return_val_if_fail (values || !n, NULL);
 
 	target = g_filename_from_uri (uri, NULL, NULL);
 	if (!target)
 		target = g_strdup (uri + 7); /* try to convert it manually */
 
-	inode->name = g_strdup (strrchr (target, G_DIR_SEPARATOR));
-	inode->target = target;
+	builtins[0] = mime_type;
+	builtins[1] = type;
+	builtins[2] = source;
+
+	inode = inode_alloc (target, uri, builtins, keys, values, n);
+	g_free (target);
+
 	inode->time = timestamp;
-	inode->mime_type = g_strdup (mime_type);
-	inode->type = g_strdup (type);
-	inode->uri = g_strdup (uri);
-	inode->source = g_strdup (source);
-	inode->score = g_strdup_printf ("%.4lf", score);
+	inode->score = score;
+	inode->stale = FALSE;
+	inode->hit = hit;
 
 	return inode;
 }
@@ -136,17 +370,175 @@ beagle_inode_free (beagle_inode_t *inode)
 {
 	g_return_if_fail (inode);
 
-	g_free (inode->score);
-	g_free (inode->source);
-	g_free (inode->uri);
-	g_free (inode->type);
-	g_free (inode->mime_type);
-	g_free (inode->target);
-	g_free (inode->name);
+	if (inode->hit)
+		beagle_hit_release (inode->hit);
 
 #if GLIB_CHECK_VERSION(2,10,0)
-	g_slice_free (beagle_inode_t, inode);
+	g_slice_free1 (inode->size, inode);
 # else
 	g_free (inode);
 #endif
 }
+
+/*
+ * storage_is_valid - Return TRUE if the 'len' bytes at 'storage' are a target,
+ * a URI, and a properties list, all properly terminated.
+ */
+static gboolean
+storage_is_valid (const char *storage,
+		  size_t len)
+{
+	const char *p = storage, *end = storage + len;
+	unsigned int strings = 0;
+
+	/* the target, URI, and each key and value are NUL terminated... */
+	while (p < end) {
+		const char *nul = memchr (p, '\0', end - p);
+
+		if (!nul)
+			return FALSE;
+
+		/* ...and the properties end with an empty key */
+		if (nul == p && strings >= 2 && strings % 2 == 0)
+			return nul + 1 == end;
+
+		p = nul + 1;
+		strings++;
+	}
+
+	return FALSE;
+}
+
+/*
+ * beagle_inode_write - Write the inode to the stream 'f' in its on-disk form.
+ *
+ * Returns zero on success and -1 on failure.  The caller must hold the
+ * directory read lock.
+ */
+int
+beagle_inode_write (beagle_inode_t *inode,
+		    FILE *f)
+{
+	static const char zeros[8];
+	inode_record_t record;
+	const char *props;
+	size_t names_len, props_len, pad;
+	unsigned int i;
+
+	g_return_val_if_fail (inode, -1);
+	g_return_val_if_fail (f, -1);
+
+	props = inode_get_properties (inode);
+	names_len = props - inode->target;
+	props_len = inode->size - sizeof (beagle_inode_t) - names_len;
+
+	memset (&record, 0, sizeof (record));
+	record.time = inode->time;
+	record.score = inode->score;
+	record.len = names_len + props_len;
+	for (i = 0; i < INODE_NR_BUILTINS; i++) {
+		if (inode->builtins[i])
+			record.len += strlen (builtin_keys[i]) + 1 +
+				      strlen (inode->builtins[i]) + 1;
+	}
+
+	if (fwrite (&record, sizeof (record), 1, f) != 1)
+		return -1;
+	if (fwrite (inode->target, names_len, 1, f) != 1)
+		return -1;
+	for (i = 0; i < INODE_NR_BUILTINS; i++) {
+		if (!inode->builtins[i])
+			continue;
+		if (fwrite (builtin_keys[i], strlen (builtin_keys[i]) + 1,
+			    1, f) != 1)
+			return -1;
+		if (fwrite (inode->builtins[i],
+			    strlen (inode->builtins[i]) + 1, 1, f) != 1)
+			return -1;
+	}
+	if (fwrite (props, props_len, 1, f) != 1)
+		return -1;
+	pad = INODE_RECORD_ALIGN (record.len) - record.len;
+	if (pad && fwrite (zeros, pad, 1, f) != 1)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * beagle_inode_read - Read an inode, in the on-disk form written by
+ * beagle_inode_write(), from the '*pos' in a buffer that ends at 'end', and
+ * advance '*pos' past it.  The new inode is marked stale.
+ *
+ * Returns the newly allocated inode object, which must be freed via a call to
+ * beagle_inode_free(), or NULL if the buffer does not hold a valid inode.
+ */
+beagle_inode_t *
+beagle_inode_read (const char **pos,
+		   const char *end)
+{
+	const char *builtins[INODE_NR_BUILTINS] = { NULL, NULL, NULL };
+	const char **keys, **values;
+	const char *target, *uri, *p;
+	inode_record_t record;
+	beagle_inode_t *inode;
+	unsigned int i, n;
+
+	g_return_val_if_fail (pos && *pos, NULL);
+	g_return_val_if_fail (end, NULL);
+
+	if ((size_t) (end - *pos) < sizeof (record))
+		return NULL;
+	memcpy (&record, *pos, sizeof (record));
+	*pos += sizeof (record);
+
+	if ((size_t) (end - *pos) < record.len ||
+	    !storage_is_valid (*pos, record.len))
+		return NULL;
+
+	/* the name is the last component of the target, so it needs one */
+	target = *pos;
+	if (!strchr (target, G_DIR_SEPARATOR))
+		return NULL;
+	uri = target + strlen (target) + 1;
+
+	/* there are at most this many properties */
+	keys = g_new (const char *, record.len / 2);
+	values = g_new (const char *, record.len / 2);
+
+	/* split the built-in properties, to be interned, from the rest */
+	n = 0;
+	p = uri + strlen (uri) + 1;
+	while (*p) {
+		const char *value = p + strlen (p) + 1;
+
+		for (i = 0; i < INODE_NR_BUILTINS; i++) {
+			if (!strcmp (builtin_keys[i], p))
+				break;
+		}
+		if (i < INODE_NR_BUILTINS)
+			builtins[i] = value;
+		else {
+			keys[n] = p;
+			values[n] = value;
+			n++;
+		}
+		p = value + strlen (value) + 1;
+	}
+
+	inode = inode_alloc (target, uri, builtins, keys, values, n);
+	g_free (values);
+	g_free (keys);
+
+	inode->time = record.time;
+	inode->score = record.score;
+	inode->stale = TRUE;
+	inode->hit = NULL;
+
+	if ((size_t) (end - *pos) < INODE_RECORD_ALIGN (record.len))
+		*pos = end;
+	else
+		*pos += INODE_RECORD_ALIGN (record.len);
+
+	return inode;
+}
@@ -1,23 +1,38 @@
 #ifndef _BEAGLEFS_INODE_H
 #define _BEAGLEFS_INODE_H
 
+#include <stdio.h>
 #include <time.h>
 
 typedef struct beagle_inode beagle_inode_t;
 
+typedef void (*beagle_inode_property_func_t) (const char *key,
+					      const char *value,
+					      void *user);
+
 const char * beagle_inode_get_name (beagle_inode_t *inode);
 const char * beagle_inode_get_target (beagle_inode_t *inode);
 time_t beagle_inode_get_time (beagle_inode_t *inode);
-const char * beagle_inode_get_mime_type (beagle_inode_t *inode);
-const char * beagle_inode_get_type (beagle_inode_t *inode);
 const char * beagle_inode_get_uri (beagle_inode_t *inode);
-const char * beagle_inode_get_source (beagle_inode_t *inode);
-const char * beagle_inode_get_score (beagle_inode_t *inode);
+double beagle_inode_get_score (beagle_inode_t *inode);
+const char * beagle_inode_get_property (beagle_inode_t *inode,
+					const char *key);
+void beagle_inode_for_each_property (beagle_inode_t *inode,
+				     beagle_inode_property_func_t func,
+				     void *user);
+void * beagle_inode_get_hit (beagle_inode_t *inode);
+int beagle_inode_is_stale (beagle_inode_t *inode);
+size_t beagle_inode_get_size (beagle_inode_t *inode);
 
-beagle_inode_t * beagle_inode_new (const char *uri, time_t time,
+beagle_inode_t * beagle_inode_new (const char *uri, time_t time, double score,
 				   const char *mime_type, const char *type,
-				   const char *source, double score);
+				   const char *source, const char **keys,
+				   const char **values, unsigned int n,
+				   void *hit);
 
 void beagle_inode_free (beagle_inode_t *inode);
 
+int beagle_inode_write (beagle_inode_t *inode, FILE *f);
+beagle_inode_t * beagle_inode_read (const char **pos, const char *end);
+
 #endif	/* _BEAGLEFS_INODE_H */
@@ -0,0 +1,287 @@
+/*
+ * beaglefs/snapshot.c - persisted snapshots of the beaglefs directory
+ *
+ * When the filesystem is mounted, the daemon has to re-run the query and
+ * re-stream every hit before the directory is populated.  To paper over that,
+ * we save the directory to a snapshot file, periodically and on unmount, and
+ * load it on mount.  Inodes loaded from a snapshot are marked stale until the
+ * daemon sends us the hit again; any still stale when the query finishes are
+ * removed.
+ *
+ * Licensed under the terms of the GNU GPL v2
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "inode.h"
+#include "dir.h"
+#include "snapshot.h"
+
+#define BEAGLEFS_SNAPSHOT_MAGIC		"BGFSSNAP"
+#define BEAGLEFS_SNAPSHOT_VERSION	1
+
+/*
+ * The snapshot file header, followed by the query text (padded to a multiple
+ * of eight bytes) and then 'count' inodes as written by beagle_inode_write().
+ */
+typedef struct {
+	char magic[8];		/* BEAGLEFS_SNAPSHOT_MAGIC */
+	guint32 version;	/* BEAGLEFS_SNAPSHOT_VERSION */
+	guint32 count;		/* number of inodes */
+	guint32 query_len;	/* length of the query text */
+	guint32 reserved;	/* zero */
+} snapshot_header_t;
+
+#define SNAPSHOT_ALIGN(len)	(((len) + 7) & ~((size_t) 7))
+
+static char *snapshot_query;
+static char *snapshot_path;
+
+/* the directory generation at the time of the last load or save */
+static unsigned int saved_generation;
+
+/*
+ * Serializes saves, which come from both the hit thread's timer and the FUSE
+ * thread on unmount and share the temporary file, against each other and
+ * against beagle_snapshot_destroy().
+ */
+static GStaticMutex save_lock = G_STATIC_MUTEX_INIT;
+
+/*
+ * beagle_snapshot_set_query - Set the query whose results we snapshot, which
+ * also selects the snapshot file.  A copy of 'query' is made.
+ */
+void
+beagle_snapshot_set_query (const char *query)
+{
+	char *name;
+
+	g_return_if_fail (query);
+
+	g_free (snapshot_query);
+	g_free (snapshot_path);
+
+	snapshot_query = g_strdup (query);
+
+	/* the query is in the header, so a hash collision is harmless */
+	name = g_strdup_printf ("%08x.snapshot", g_str_hash (query));
+	snapshot_path = g_build_filename (g_get_user_cache_dir (), "beaglefs",
+					  name, NULL);
+	g_free (name);
+}
+
+/*
+ * load_inodes - Add the inodes in the mapped snapshot 'map' of 'len' bytes to
+ * the directory.  Returns the number of inodes loaded.
+ *
+ * The caller must hold the directory write lock.
+ */
+static unsigned int
+load_inodes (const char *map,
+	     size_t len)
+{
+	snapshot_header_t header;
+	const char *pos, *end = map + len;
+	unsigned int i;
+
+	if (len < sizeof (header))
+		return 0;
+	memcpy (&header, map, sizeof (header));
+
+	if (memcmp (header.magic, BEAGLEFS_SNAPSHOT_MAGIC, sizeof (header.magic))
+	    || header.version != BEAGLEFS_SNAPSHOT_VERSION)
+		return 0;
+
+	pos = map + sizeof (header);
+	if ((size_t) (end - pos) < SNAPSHOT_ALIGN (header.query_len))
+		return 0;
+	if (header.query_len != strlen (snapshot_query) ||
+	    memcmp (pos, snapshot_query, header.query_len))
+		return 0;
+	pos += SNAPSHOT_ALIGN (header.query_len);
+
+	for (i = 0; i < header.count; i++) {
+		beagle_inode_t *inode;
+
+		inode = beagle_inode_read (&pos, end);
+		if (!inode)
+			break;
+		beagle_dir_add_inode (inode);
+	}
+
+	return i;
+}
+
+/*
+ * beagle_snapshot_load - Populate the directory from the snapshot of our
+ * query, if there is one.  The loaded inodes are marked stale.
+ */
+void
+beagle_snapshot_load (void)
+{
+	struct stat sb;
+	void *map;
+	int fd;
+
+	g_return_if_fail (snapshot_path);
+
+	fd = open (snapshot_path, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	if (fstat (fd, &sb) || sb.st_size == 0) {
+		close (fd);
+		return;
+	}
+
+	map = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED)
+		return;
+
+	g_static_mutex_lock (&save_lock);
+	beagle_dir_write_lock ();
+	load_inodes (map, sb.st_size);
+	saved_generation = beagle_dir_get_generation ();
+	beagle_dir_write_unlock ();
+	g_static_mutex_unlock (&save_lock);
+
+	munmap (map, sb.st_size);
+}
+
+typedef struct {
+	FILE *f;
+	int error;
+} do_write_inode_t;
+
+static void
+do_write_inode (G_GNUC_UNUSED gpointer key,
+		gpointer value,
+		gpointer user)
+{
+	do_write_inode_t *snap = user;
+
+	if (!snap->error && beagle_inode_write (value, snap->f))
+		snap->error = errno ? errno : EIO;
+}
+
+/*
+ * write_header - Write the snapshot header and query text to 'f'.  Returns
+ * zero on success and -1 on failure.
+ *
+ * The caller must hold the directory read lock.
+ */
+static int
+write_header (FILE *f)
+{
+	static const char zeros[8];
+	snapshot_header_t header;
+	size_t query_len, pad;
+
+	query_len = strlen (snapshot_query);
+	pad = SNAPSHOT_ALIGN (query_len) - query_len;
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, BEAGLEFS_SNAPSHOT_MAGIC, sizeof (header.magic));
+	header.version = BEAGLEFS_SNAPSHOT_VERSION;
+	header.count = beagle_dir_get_count ();
+	header.query_len = query_len;
+
+	if (fwrite (&header, sizeof (header), 1, f) != 1)
+		return -1;
+	if (query_len && fwrite (snapshot_query, query_len, 1, f) != 1)
+		return -1;
+	if (pad && fwrite (zeros, pad, 1, f) != 1)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * beagle_snapshot_save - Save the directory to the snapshot of our query, if
+ * it changed since the last load or save.  The snapshot is written to a
+ * temporary file and renamed into place, so a crash never leaves a torn one.
+ * Does nothing once beagle_snapshot_destroy() has been called.
+ */
+void
+beagle_snapshot_save (void)
+{
+	do_write_inode_t snap;
+	unsigned int generation;
+	char *dir, *tmp;
+
+	g_static_mutex_lock (&save_lock);
+
+	if (!snapshot_path) {
+		g_static_mutex_unlock (&save_lock);
+		return;
+	}
+
+	beagle_dir_read_lock ();
+	generation = beagle_dir_get_generation ();
+	beagle_dir_read_unlock ();
+	if (generation == saved_generation) {
+		g_static_mutex_unlock (&save_lock);
+		return;
+	}
+
+	dir = g_path_get_dirname (snapshot_path);
+	g_mkdir_with_parents (dir, 0700);
+	g_free (dir);
+
+	tmp = g_strconcat (snapshot_path, ".tmp", NULL);
+	snap.f = fopen (tmp, "wb");
+	if (!snap.f) {
+		g_warning ("Cannot write snapshot %s: %s", tmp,
+			   g_strerror (errno));
+		g_free (tmp);
+		g_static_mutex_unlock (&save_lock);
+		return;
+	}
+	snap.error = 0;
+
+	beagle_dir_read_lock ();
+	generation = beagle_dir_get_generation ();
+	if (write_header (snap.f))
+		snap.error = errno ? errno : EIO;
+	beagle_dir_for_each_inode (do_write_inode, &snap);
+	beagle_dir_read_unlock ();
+
+	if (fclose (snap.f) && !snap.error)
+		snap.error = errno ? errno : EIO;
+	if (!snap.error && rename (tmp, snapshot_path))
+		snap.error = errno;
+
+	if (snap.error) {
+		g_warning ("Cannot write snapshot %s: %s", snapshot_path,
+			   g_strerror (snap.error));
+		unlink (tmp);
+	} else
+		saved_generation = generation;
+
+	g_free (tmp);
+
+	g_static_mutex_unlock (&save_lock);
+}
+
+/*
+ * beagle_snapshot_destroy - Free the snapshot state.
+ */
+void
+beagle_snapshot_destroy (void)
+{
+	g_static_mutex_lock (&save_lock);
+	g_free (snapshot_query);
+	g_free (snapshot_path);
+	snapshot_query = NULL;
+	snapshot_path = NULL;
+	g_static_mutex_unlock (&save_lock);
+}
@@ -0,0 +1,11 @@
+#ifndef _BEAGLEFS_SNAPSHOT_H
+#define _BEAGLEFS_SNAPSHOT_H
+
+void beagle_snapshot_set_query (const char *query);
+
+void beagle_snapshot_load (void);
+void beagle_snapshot_save (void);
+
+void beagle_snapshot_destroy (void);
+
+#endif	/* _BEAGLEFS_SNAPSHOT_H */
@@ -0,0 +1,356 @@
+/*
+ * beaglefs/stats.c - runtime statistics, reported in /.beaglefs-stats
+ *
+ * Counters are kept per thread, so that updating them takes neither a lock
+ * nor an atomic operation and does not perturb the hot path.  Each thread
+ * writes only to its own slot; reading the statistics walks every slot and
+ * sums them up.  A reader can thus see a slightly inconsistent picture, which
+ * is fine for statistics.  The slot of a thread that exits is handed, counts
+ * and all, to the next new thread, so FUSE's worker threads coming and going
+ * do not grow the list.
+ *
+ * Licensed under the terms of the GNU GPL v2
+ */
+
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <glib.h>
+
+#include "stats.h"
+#include "inode.h"
+#include "dir.h"
+
+/*
+ * Latency histograms have power-of-two buckets: bucket 'i' counts operations
+ * that took less than 2^i microseconds, and the last bucket counts the rest.
+ */
+#define NR_BUCKETS	21
+
+typedef struct stats_slot {
+	guint64 op_calls[BEAGLE_STATS_NR_OPS];
+	guint64 op_ns[BEAGLE_STATS_NR_OPS];
+	guint64 op_hist[BEAGLE_STATS_NR_OPS][NR_BUCKETS];
+	guint64 lock_waits[BEAGLE_STATS_NR_LOCKS];
+	guint64 lock_wait_ns[BEAGLE_STATS_NR_LOCKS];
+	guint64 lock_wait_max_ns[BEAGLE_STATS_NR_LOCKS];
+	guint64 hits_added;
+	guint64 hits_removed;
+	gboolean in_use;		/* owned by a live thread */
+	struct stats_slot *next;
+} stats_slot_t;
+
+static const char *op_names[BEAGLE_STATS_NR_OPS] = {
+	"getattr", "readdir", "readlink", "getxattr"
+};
+
+static const char *lock_names[BEAGLE_STATS_NR_LOCKS] = {
+	"read", "write"
+};
+
+/* this thread's slot */
+static __thread stats_slot_t *thread_slot;
+
+/* every slot; only ever prepended to, and 'in_use' changed, under slots */
+static stats_slot_t *slots;
+G_LOCK_DEFINE_STATIC (slots);
+
+/* lets a thread give its slot back as it exits */
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Query timings, written by the hit thread and read by whoever reads the
+ * statistics, hence accessed atomically.
+ */
+static guint64 query_sent_ns, query_hits_ns, query_finished_ns;
+
+/*
+ * release_slot - Mark an exiting thread's slot as free for another thread.
+ */
+static void
+release_slot (void *data)
+{
+	stats_slot_t *slot = data;
+
+	G_LOCK (slots);
+	slot->in_use = FALSE;
+	G_UNLOCK (slots);
+}
+
+static void
+make_slot_key (void)
+{
+	pthread_key_create (&slot_key, release_slot);
+}
+
+/*
+ * new_slot - Find this thread a slot, reusing that of an exited thread if
+ * there is one, or else allocating and publishing a new one.
+ */
+static stats_slot_t *
+new_slot (void)
+{
+	stats_slot_t *slot;
+
+	pthread_once (&slot_key_once, make_slot_key);
+
+	G_LOCK (slots);
+	for (slot = slots; slot; slot = slot->next) {
+		if (!slot->in_use)
+			break;
+	}
+	if (!slot) {
+		slot = g_new0 (stats_slot_t, 1);
+		slot->next = slots;
+		g_atomic_pointer_set (&slots, slot);
+	}
+	slot->in_use = TRUE;
+	G_UNLOCK (slots);
+
+	pthread_setspecific (slot_key, slot);
+	thread_slot = slot;
+
+	return slot;
+}
+
+/*
+ * get_slot - Return this thread's slot, finding it one on first use.
+ */
+static inline stats_slot_t *
+get_slot (void)
+{
+	stats_slot_t *slot = thread_slot;
+
+	if (G_LIKELY (slot))
+		return slot;
+
+	return new_slot ();
+}
+
+/*
+ * beagle_stats_now - Return the current monotonic time, in nanoseconds.
+ */
+guint64
+beagle_stats_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return (guint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline unsigned int
+bucket_of (guint64 ns)
+{
+	guint64 us = ns / 1000;
+	unsigned int i = 0;
+
+	while (us && i < NR_BUCKETS - 1) {
+		us >>= 1;
+		i++;
+	}
+
+	return i;
+}
+
+/*
+ * beagle_stats_op - Record a call of the operation 'op', which started at
+ * 'start', as returned by beagle_stats_now().
+ */
+void
+beagle_stats_op (beagle_stats_op_t op,
+		 guint64 start)
+{
+	stats_slot_t *slot = get_slot ();
+	guint64 ns = beagle_stats_now () - start;
+
+	slot->op_calls[op]++;
+	slot->op_ns[op] += ns;
+	slot->op_hist[op][bucket_of (ns)]++;
+}
+
+/*
+ * beagle_stats_lock_wait - Record an acquisition of the directory lock, which
+ * we started waiting on at 'start'.
+ */
+void
+beagle_stats_lock_wait (beagle_stats_lock_t lock,
+			guint64 start)
+{
+	stats_slot_t *slot = get_slot ();
+	guint64 ns = beagle_stats_now () - start;
+
+	slot->lock_waits[lock]++;
+	slot->lock_wait_ns[lock] += ns;
+	if (ns > slot->lock_wait_max_ns[lock])
+		slot->lock_wait_max_ns[lock] = ns;
+}
+
+void
+beagle_stats_hits_added (unsigned int n)
+{
+	get_slot ()->hits_added += n;
+}
+
+void
+beagle_stats_hits_removed (unsigned int n)
+{
+	get_slot ()->hits_removed += n;
+}
+
+/*
+ * beagle_stats_query_sent - Note that the query was just sent to the daemon.
+ */
+void
+beagle_stats_query_sent (void)
+{
+	__atomic_store_n (&query_sent_ns, beagle_stats_now (),
+			  __ATOMIC_RELAXED);
+}
+
+/*
+ * set_once - Set '*ns' to the current time, unless it is already set.
+ */
+static void
+set_once (guint64 *ns)
+{
+	guint64 unset = 0;
+
+	if (!__atomic_load_n (ns, __ATOMIC_RELAXED))
+		__atomic_compare_exchange_n (ns, &unset, beagle_stats_now (),
+					     FALSE, __ATOMIC_RELAXED,
+					     __ATOMIC_RELAXED);
+}
+
+/*
+ * beagle_stats_query_hits - Note that hits just arrived for the query.  Only
+ * the first arrival is recorded.
+ */
+void
+beagle_stats_query_hits (void)
+{
+	set_once (&query_hits_ns);
+}
+
+/*
+ * beagle_stats_query_finished - Note that the daemon just finished the query.
+ */
+void
+beagle_stats_query_finished (void)
+{
+	set_once (&query_finished_ns);
+}
+
+static void
+append_query_time (GString *report,
+		   const char *what,
+		   guint64 *ns_p)
+{
+	guint64 sent = __atomic_load_n (&query_sent_ns, __ATOMIC_RELAXED);
+	guint64 ns = __atomic_load_n (ns_p, __ATOMIC_RELAXED);
+
+	if (sent && ns)
+		g_string_append_printf (report, "query %s ms\t%.3f\n", what,
+					(ns - sent) / 1e6);
+	else
+		g_string_append_printf (report, "query %s ms\t-\n", what);
+}
+
+/*
+ * beagle_stats_report - Sum up the statistics of all threads and format them.
+ *
+ * Returns a newly allocated string, which must be freed via g_free().
+ */
+char *
+beagle_stats_report (void)
+{
+	stats_slot_t sum, *slot;
+	unsigned int op, lock, i, count;
+	size_t bytes;
+	GString *report;
+
+	memset (&sum, 0, sizeof (sum));
+	for (slot = g_atomic_pointer_get (&slots); slot; slot = slot->next) {
+		for (op = 0; op < BEAGLE_STATS_NR_OPS; op++) {
+			sum.op_calls[op] += slot->op_calls[op];
+			sum.op_ns[op] += slot->op_ns[op];
+			for (i = 0; i < NR_BUCKETS; i++)
+				sum.op_hist[op][i] += slot->op_hist[op][i];
+		}
+		for (lock = 0; lock < BEAGLE_STATS_NR_LOCKS; lock++) {
+			sum.lock_waits[lock] += slot->lock_waits[lock];
+			sum.lock_wait_ns[lock] += slot->lock_wait_ns[lock];
+			sum.lock_wait_max_ns[lock] =
+				MAX (sum.lock_wait_max_ns[lock],
+				     slot->lock_wait_max_ns[lock]);
+		}
+		sum.hits_added += slot->hits_added;
+		sum.hits_removed += slot->hits_removed;
+	}
+
+	beagle_dir_read_lock ();
+	count = beagle_dir_get_count ();
+	bytes = beagle_dir_get_bytes ();
+	beagle_dir_read_unlock ();
+
+	report = g_string_new (NULL);
+
+	for (op = 0; op < BEAGLE_STATS_NR_OPS; op++) {
+		guint64 calls = sum.op_calls[op];
+
+		g_string_append_printf (report,
+					"%s calls\t%" G_GUINT64_FORMAT "\n"
+					"%s mean us\t%.1f\n"
+					"%s histogram us\t",
+					op_names[op], calls,
+					op_names[op],
+					calls ? sum.op_ns[op] / 1e3 / calls : 0.0,
+					op_names[op]);
+		for (i = 0; i < NR_BUCKETS; i++) {
+			if (!sum.op_hist[op][i])
+				continue;
+			if (i < NR_BUCKETS - 1)
+				g_string_append_printf (report, " <%u:", 1u << i);
+			else
+				g_string_append (report, " more:");
+			g_string_append_printf (report, "%" G_GUINT64_FORMAT,
+						sum.op_hist[op][i]);
+		}
+		g_string_append_c (report, '\n');
+	}
+
+	for (lock = 0; lock < BEAGLE_STATS_NR_LOCKS; lock++) {
+		guint64 waits = sum.lock_waits[lock];
+
+		g_string_append_printf (report,
+					"dir_lock %s waits\t%" G_GUINT64_FORMAT "\n"
+					"dir_lock %s mean wait us\t%.1f\n"
+					"dir_lock %s max wait us\t%.1f\n",
+					lock_names[lock], waits,
+					lock_names[lock],
+					waits ? sum.lock_wait_ns[lock] / 1e3 / waits : 0.0,
+					lock_names[lock],
+					sum.lock_wait_max_ns[lock] / 1e3);
+	}
+
+	g_string_append_printf (report,
+				"hits added\t%" G_GUINT64_FORMAT "\n"
+				"hits removed\t%" G_GUINT64_FORMAT "\n"
+				"inodes\t%u\n"
+				"inode bytes\t%lu\n"
+				"memory estimate bytes\t%lu\n",
+				sum.hits_added,
+				sum.hits_removed,
+				count,
+				(unsigned long) bytes,
+				(unsigned long) (bytes + count *
+						 BEAGLEFS_DIR_ENTRY_OVERHEAD));
+
+	append_query_time (report, "first hit", &query_hits_ns);
+	append_query_time (report, "finished", &query_finished_ns);
+
+	return g_string_free (report, FALSE);
+}
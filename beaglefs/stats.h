@@ -0,0 +1,36 @@
+#ifndef _BEAGLEFS_STATS_H
+#define _BEAGLEFS_STATS_H
+
+#include <glib.h>
+
+#define BEAGLEFS_STATS_PATH	"/.beaglefs-stats"
+
+typedef enum {
+	BEAGLE_STATS_OP_GETATTR,
+	BEAGLE_STATS_OP_READDIR,
+	BEAGLE_STATS_OP_READLINK,
+	BEAGLE_STATS_OP_GETXATTR,
+	BEAGLE_STATS_NR_OPS
+} beagle_stats_op_t;
+
+typedef enum {
+	BEAGLE_STATS_LOCK_READ,
+	BEAGLE_STATS_LOCK_WRITE,
+	BEAGLE_STATS_NR_LOCKS
+} beagle_stats_lock_t;
+
+guint64 beagle_stats_now (void);
+
+void beagle_stats_op (beagle_stats_op_t op, guint64 start);
+void beagle_stats_lock_wait (beagle_stats_lock_t lock, guint64 start);
+
+void beagle_stats_hits_added (unsigned int n);
+void beagle_stats_hits_removed (unsigned int n);
+
+void beagle_stats_query_sent (void);
+void beagle_stats_query_hits (void);
+void beagle_stats_query_finished (void);
+
+char * beagle_stats_report (void);
+
+#endif	/* _BEAGLEFS_STATS_H */